@@ -109,7 +109,7 @@ void picoquic_demo_client_set_alpn_from_tickets(picoquic_cnx_t* cnx, picoquic_de
                 uint8_t* ticket;
                 uint16_t ticket_length;
 
-                if (picoquic_get_ticket(cnx->quic->p_first_ticket, current_time, sni, sni_len,
+                if (picoquic_get_ticket(&cnx->quic->ticket_store, current_time, sni, sni_len,
                     alpn_list[i].alpn_val, (uint16_t) strlen(alpn_list[i].alpn_val), &ticket, &ticket_length) == 0) {
                     ctx->alpn = alpn_list[i].alpn_code;
                     cnx->alpn = picoquic_string_duplicate(alpn_list[i].alpn_val);
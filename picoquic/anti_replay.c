@@ -0,0 +1,127 @@
+/*
+ * Anti-replay filter for 0-RTT.
+ *
+ * Each use of a session ticket is recorded in a Bloom filter. Time is divided
+ * in windows, with one filter per window, and the oldest filter is cleared
+ * when a new window starts. The filters thus remember the uses of the last
+ * PICOQUIC_ANTI_REPLAY_FILTERS - 1 windows at least. Early data is only
+ * accepted for tickets issued during that period, so that any earlier use
+ * of the same ticket is still remembered, and only once per ticket.
+ * False positives only cause a fallback to a 1-RTT handshake.
+ */
+
+#include "picoquic_internal.h"
+#include "siphash.h"
+#include <stdlib.h>
+#include <string.h>
+
+picoquic_anti_replay_t* picoquic_anti_replay_create(uint64_t window_ms, size_t nb_entries,
+    const uint8_t key[PICOQUIC_ANTI_REPLAY_KEY_SIZE])
+{
+    picoquic_anti_replay_t* anti_replay = NULL;
+    size_t nb_bits = 64;
+
+    /* About 10 bits per entry give a 1% false positive rate with 7 hashes */
+    while (nb_bits < 10 * nb_entries && nb_bits < ((size_t)1 << 40)) {
+        nb_bits <<= 1;
+    }
+
+    if (window_ms > 0 && nb_entries > 0) {
+        anti_replay = (picoquic_anti_replay_t*)malloc(sizeof(picoquic_anti_replay_t));
+    }
+
+    if (anti_replay != NULL) {
+        memset(anti_replay, 0, sizeof(picoquic_anti_replay_t));
+        anti_replay->window_ms = window_ms;
+        anti_replay->nb_bits = nb_bits;
+        memcpy(anti_replay->key, key, PICOQUIC_ANTI_REPLAY_KEY_SIZE);
+        anti_replay->filters = (uint8_t*)calloc(PICOQUIC_ANTI_REPLAY_FILTERS, nb_bits / 8);
+
+        if (anti_replay->filters == NULL) {
+            free(anti_replay);
+            anti_replay = NULL;
+        }
+    }
+
+    return anti_replay;
+}
+
+void picoquic_anti_replay_delete(picoquic_anti_replay_t* anti_replay)
+{
+    if (anti_replay != NULL) {
+        if (anti_replay->filters != NULL) {
+            free(anti_replay->filters);
+        }
+        free(anti_replay);
+    }
+}
+
+static void picoquic_anti_replay_advance(picoquic_anti_replay_t* anti_replay, uint64_t current_ms)
+{
+    uint64_t window = current_ms / anti_replay->window_ms;
+
+    if (window > anti_replay->current_window) {
+        uint64_t nb_cleared = window - anti_replay->current_window;
+
+        if (nb_cleared > PICOQUIC_ANTI_REPLAY_FILTERS) {
+            nb_cleared = PICOQUIC_ANTI_REPLAY_FILTERS;
+        }
+
+        for (uint64_t i = 0; i < nb_cleared; i++) {
+            uint64_t cleared = (window - i) % PICOQUIC_ANTI_REPLAY_FILTERS;
+            memset(anti_replay->filters + cleared * (anti_replay->nb_bits / 8), 0, anti_replay->nb_bits / 8);
+        }
+
+        anti_replay->current_window = window;
+    }
+}
+
+int picoquic_anti_replay_check(picoquic_anti_replay_t* anti_replay, const uint8_t* bytes, size_t length,
+    uint64_t issued_ms, uint64_t current_ms)
+{
+    int ret = 0;
+    uint64_t max_age = (PICOQUIC_ANTI_REPLAY_FILTERS - 1) * anti_replay->window_ms;
+
+    picoquic_anti_replay_advance(anti_replay, current_ms);
+
+    if (issued_ms > current_ms || current_ms - issued_ms >= max_age) {
+        /* Earlier uses of the ticket may have been forgotten */
+        ret = -1;
+    } else {
+        uint8_t h[16];
+        uint64_t h1;
+        uint64_t h2;
+        uint64_t bit[PICOQUIC_ANTI_REPLAY_HASHES];
+        size_t filter_length = anti_replay->nb_bits / 8;
+        uint8_t* current = anti_replay->filters +
+            (anti_replay->current_window % PICOQUIC_ANTI_REPLAY_FILTERS) * filter_length;
+
+        siphash_128(anti_replay->key, bytes, length, h);
+        h1 = PICOPARSE_64(h);
+        h2 = PICOPARSE_64(h + 8) | 1;
+
+        for (int i = 0; i < PICOQUIC_ANTI_REPLAY_HASHES; i++) {
+            bit[i] = (h1 + i * h2) & (anti_replay->nb_bits - 1);
+        }
+
+        for (int f = 0; ret == 0 && f < PICOQUIC_ANTI_REPLAY_FILTERS; f++) {
+            uint8_t* filter = anti_replay->filters + f * filter_length;
+            int nb_set = 0;
+
+            for (int i = 0; i < PICOQUIC_ANTI_REPLAY_HASHES; i++) {
+                nb_set += (filter[bit[i] >> 3] >> (bit[i] & 7)) & 1;
+            }
+
+            if (nb_set == PICOQUIC_ANTI_REPLAY_HASHES) {
+                ret = -1;
+            }
+        }
+
+        /* Record the use, even if it was a replay */
+        for (int i = 0; i < PICOQUIC_ANTI_REPLAY_HASHES; i++) {
+            current[bit[i] >> 3] |= (uint8_t)(1 << (bit[i] & 7));
+        }
+    }
+
+    return ret;
+}
@@ -0,0 +1,741 @@
+#include "picoquic_internal.h"
+#include <stdlib.h>
+#include <string.h>
+#include "cc_common.h"
+#include "tls_api.h"
+#include "picoquic.h"
+
+/*
+Implementation of a BBRv2 style congestion control algorithm, tuned for Picoquic.
+
+The original BBR algorithm, in bbr.c, only uses loss as a trigger for packet
+conservation. When the bottleneck buffer is shallow, probing at 1.25 times the
+bandwidth estimate and keeping a congestion window of twice the BDP causes
+sustained losses, and the flows using BBR starve competing loss based flows.
+BBRv2 keeps the BBR model of the path, based on the maximum delivery rate and
+the minimum RTT, and adds bounds on the amount of data in flight derived from
+loss and ECN signals:
+
+* inflight_hi is a long term upper bound. It is set when losses or ECN marks
+  exceed a threshold while probing for bandwidth, and then raised slowly
+  during the next bandwidth probes.
+
+* bw_lo and inflight_lo are short term lower bounds. They are reduced
+  multiplicatively once per round trip in which losses or ECN marks were
+  observed, and reset at the start of each bandwidth probe.
+
+The probe bandwidth state is split in four phases. During "down", the
+sender paces below the estimated bandwidth to drain the queue created by the
+previous probe. During "cruise", it sends at the estimated rate, leaving
+some headroom below inflight_hi for competing flows. After a randomized wait
+of 2 to 3 seconds, or of a number of rounds comparable to the time a Reno
+flow needs to grow its window by the same amount, "refill" sends at the
+estimated rate for one round, and then "up" probes at 1.25 times the
+estimated rate, growing inflight_hi exponentially per round until the path
+shows signs of congestion or the queue is deemed full.
+
+The startup phase is the same as in BBR, except that it also exits when the
+loss rate exceeds the threshold, in which case inflight_hi is set from the
+data in flight when the losses were detected.
+
+The stack notifies losses once per packet retransmission event, without the
+size of the packet, so a loss event is accounted as one full size packet.
+ECN marks are accounted per notification.
+
+The maximum bandwidth filter spans two probe bandwidth cycles, and the
+minimum RTT filter spans 10 seconds. Both use the windowed filter defined
+in cc_common.c. Probe RTT is entered if the RTT did not reach a new minimum
+in 5 seconds, and reduces the congestion window to half the BDP, instead of
+the 4 packets used in bbr.c.
+*/
+
+typedef enum {
+    picoquic_bbr2_alg_startup = 0,
+    picoquic_bbr2_alg_drain,
+    picoquic_bbr2_alg_probe_bw_down,
+    picoquic_bbr2_alg_probe_bw_cruise,
+    picoquic_bbr2_alg_probe_bw_refill,
+    picoquic_bbr2_alg_probe_bw_up,
+    picoquic_bbr2_alg_probe_rtt
+} picoquic_bbr2_alg_state_t;
+
+#define BBR2_STARTUP_PACING_GAIN 2.77 /* 4*ln(2) */
+#define BBR2_STARTUP_CWND_GAIN 2.0
+#define BBR2_DRAIN_PACING_GAIN (1.0 / BBR2_STARTUP_PACING_GAIN)
+#define BBR2_DEFAULT_CWND_GAIN 2.0
+#define BBR2_PROBE_DOWN_PACING_GAIN 0.9
+#define BBR2_PROBE_UP_PACING_GAIN 1.25
+#define BBR2_PROBE_UP_CWND_GAIN 2.25
+#define BBR2_PROBE_RTT_CWND_GAIN 0.5
+#define BBR2_LOSS_THRESH 0.02 /* Max loss rate per round while probing */
+#define BBR2_ECN_THRESH 0.5 /* Max ECN mark rate per round while probing */
+#define BBR2_BETA 0.7 /* Multiplicative decrease of the bounds */
+#define BBR2_HEADROOM 0.15 /* Fraction of inflight_hi left to other flows when cruising */
+#define BBR2_FULL_LOSS_COUNT 6 /* Loss events in a round to exit startup */
+#define BBR2_MAX_BW_FILTER_LENGTH 2 /* in probe bw cycles */
+#define BBR2_MIN_RTT_FILTER_LENGTH 10000000 /* 10 sec, 10000000 microsecs */
+#define BBR2_PROBE_RTT_INTERVAL 5000000 /* 5 sec, 5000000 microsecs */
+#define BBR2_PROBE_RTT_DURATION 200000 /* 200msec, 200000 microsecs */
+#define BBR2_PROBE_WAIT_BASE 2000000 /* 2 sec, 2000000 microsecs */
+#define BBR2_PROBE_WAIT_RANDOM 1000000 /* up to 1 more sec */
+#define BBR2_PROBE_WAIT_ROUNDS_MAX 63
+#define BBR2_PROBE_UP_ROUNDS_MAX 30
+#define BBR2_MIN_PIPE_CWND(mss) (4*mss)
+#define BBR2_PACING_RATE_LOW 150000.0 /* 150000 B/s = 1.2 Mbps */
+#define BBR2_PACING_RATE_MEDIUM 3000000.0 /* 3000000 B/s = 24 Mbps */
+#define BBR2_UNSET UINT64_MAX
+
+typedef struct st_picoquic_bbr2_state_t {
+    picoquic_bbr2_alg_state_t state;
+    picoquic_windowed_filter_t max_bw_filter;
+    picoquic_windowed_filter_t min_rtt_filter;
+    uint64_t max_bw;
+    uint64_t min_rtt;
+    uint64_t bw_lo;
+    uint64_t bw_latest;
+    uint64_t inflight_hi;
+    uint64_t inflight_lo;
+    uint64_t inflight_latest;
+    uint64_t probe_rtt_min_delay;
+    uint64_t probe_rtt_min_stamp;
+    uint64_t probe_rtt_done_stamp;
+    uint64_t next_round_delivered;
+    uint64_t round_count;
+    uint64_t cycle_count;
+    uint64_t cycle_stamp;
+    uint64_t probe_wait;
+    uint64_t rounds_since_probe;
+    uint64_t probe_up_rounds;
+    uint64_t full_bw;
+    uint64_t prior_cwnd;
+    uint64_t recovery_delivered;
+    uint64_t bytes_delivered;
+    uint64_t round_bytes_delivered;
+    uint64_t round_bytes_lost;
+    uint64_t round_nb_losses;
+    uint64_t round_nb_ecn_marks;
+    uint64_t send_quantum;
+    double pacing_gain;
+    double cwnd_gain;
+    double pacing_rate;
+    int full_bw_count;
+    unsigned int filled_pipe : 1;
+    unsigned int round_start : 1;
+    unsigned int probe_rtt_round_done : 1;
+    unsigned int probe_rtt_expired : 1;
+    unsigned int in_recovery : 1;
+} picoquic_bbr2_state_t;
+
+static uint64_t BBR2Bw(picoquic_bbr2_state_t* bbr2_state)
+{
+    return (bbr2_state->max_bw < bbr2_state->bw_lo) ? bbr2_state->max_bw : bbr2_state->bw_lo;
+}
+
+static uint64_t BBR2BDP(picoquic_bbr2_state_t* bbr2_state, double gain)
+{
+    uint64_t bdp = PICOQUIC_CWIN_INITIAL;
+
+    if (bbr2_state->min_rtt != BBR2_UNSET && bbr2_state->max_bw > 0) {
+        /* Bandwidth is estimated in bytes per second, rtt in microseconds */
+        bdp = (uint64_t)(gain * (((double)BBR2Bw(bbr2_state) * (double)bbr2_state->min_rtt) / 1000000.0));
+    }
+
+    return bdp;
+}
+
+static uint64_t BBR2Inflight(picoquic_bbr2_state_t* bbr2_state, double gain)
+{
+    return BBR2BDP(bbr2_state, gain) + 3 * bbr2_state->send_quantum;
+}
+
+/* Largest amount in flight allowed when not probing, leaving room for other flows */
+static uint64_t BBR2InflightWithHeadroom(picoquic_bbr2_state_t* bbr2_state, picoquic_path_t* path_x)
+{
+    uint64_t inflight = BBR2_UNSET;
+
+    if (bbr2_state->inflight_hi != BBR2_UNSET) {
+        inflight = (uint64_t)((1.0 - BBR2_HEADROOM) * (double)bbr2_state->inflight_hi);
+        if (inflight < BBR2_MIN_PIPE_CWND(path_x->send_mtu)) {
+            inflight = BBR2_MIN_PIPE_CWND(path_x->send_mtu);
+        }
+    }
+
+    return inflight;
+}
+
+static void BBR2SetSendQuantum(picoquic_bbr2_state_t* bbr2_state, picoquic_path_t* path_x)
+{
+    if (bbr2_state->pacing_rate < BBR2_PACING_RATE_LOW) {
+        bbr2_state->send_quantum = 1ull * path_x->send_mtu;
+    }
+    else if (bbr2_state->pacing_rate < BBR2_PACING_RATE_MEDIUM) {
+        bbr2_state->send_quantum = 2ull * path_x->send_mtu;
+    }
+    else {
+        bbr2_state->send_quantum = (uint64_t)(bbr2_state->pacing_rate * 0.001);
+        if (bbr2_state->send_quantum > 64000) {
+            bbr2_state->send_quantum = 64000;
+        }
+    }
+}
+
+static void BBR2EnterStartup(picoquic_bbr2_state_t* bbr2_state)
+{
+    bbr2_state->state = picoquic_bbr2_alg_startup;
+    bbr2_state->pacing_gain = BBR2_STARTUP_PACING_GAIN;
+    bbr2_state->cwnd_gain = BBR2_STARTUP_CWND_GAIN;
+}
+
+static void BBR2ResetLowerBounds(picoquic_bbr2_state_t* bbr2_state)
+{
+    bbr2_state->bw_lo = BBR2_UNSET;
+    bbr2_state->inflight_lo = BBR2_UNSET;
+}
+
+static void picoquic_bbr2_init(picoquic_cnx_t* cnx, picoquic_path_t* path_x)
+{
+    /* Initialize the state of the congestion control algorithm */
+    picoquic_bbr2_state_t* bbr2_state = (picoquic_bbr2_state_t*)malloc(sizeof(picoquic_bbr2_state_t));
+    path_x->congestion_alg_state = (void*)bbr2_state;
+    if (bbr2_state != NULL) {
+        uint64_t current_time = picoquic_get_quic_time(cnx->quic);
+
+        memset(bbr2_state, 0, sizeof(picoquic_bbr2_state_t));
+        path_x->cwin = PICOQUIC_CWIN_INITIAL;
+        bbr2_state->min_rtt = BBR2_UNSET;
+        bbr2_state->probe_rtt_min_delay = BBR2_UNSET;
+        bbr2_state->probe_rtt_min_stamp = current_time;
+        bbr2_state->cycle_stamp = current_time;
+        bbr2_state->inflight_hi = BBR2_UNSET;
+        BBR2ResetLowerBounds(bbr2_state);
+
+        BBR2EnterStartup(bbr2_state);
+        BBR2SetSendQuantum(bbr2_state, path_x);
+    }
+}
+
+/* Release the state of the congestion control algorithm */
+static void picoquic_bbr2_delete(picoquic_cnx_t* cnx, picoquic_path_t* path_x)
+{
+    if (path_x->congestion_alg_state != NULL) {
+        free(path_x->congestion_alg_state);
+        path_x->congestion_alg_state = NULL;
+    }
+}
+
+/* Loss and ECN signals of the current round */
+static int BBR2IsInflightTooHigh(picoquic_bbr2_state_t* bbr2_state, picoquic_path_t* path_x)
+{
+    int too_high = 0;
+    uint64_t round_bytes = bbr2_state->round_bytes_delivered + bbr2_state->round_bytes_lost;
+
+    if (bbr2_state->round_nb_losses > 1 &&
+        (double)bbr2_state->round_bytes_lost > BBR2_LOSS_THRESH * (double)round_bytes) {
+        too_high = 1;
+    }
+    else if (bbr2_state->round_nb_ecn_marks > 1) {
+        uint64_t round_packets = bbr2_state->round_bytes_delivered / path_x->send_mtu;
+
+        if ((double)bbr2_state->round_nb_ecn_marks > BBR2_ECN_THRESH * (double)round_packets) {
+            too_high = 1;
+        }
+    }
+
+    return too_high;
+}
+
+static void BBR2ResetRoundSignals(picoquic_bbr2_state_t* bbr2_state)
+{
+    bbr2_state->round_bytes_delivered = 0;
+    bbr2_state->round_bytes_lost = 0;
+    bbr2_state->round_nb_losses = 0;
+    bbr2_state->round_nb_ecn_marks = 0;
+}
+
+static void BBR2PickProbeWait(picoquic_bbr2_state_t* bbr2_state)
+{
+    /* Randomize the probes, so that competing flows do not probe in sync */
+    bbr2_state->probe_wait = BBR2_PROBE_WAIT_BASE + picoquic_public_uniform_random(BBR2_PROBE_WAIT_RANDOM);
+    bbr2_state->rounds_since_probe = 0;
+}
+
+static void BBR2StartProbeBwDown(picoquic_bbr2_state_t* bbr2_state, uint64_t current_time)
+{
+    bbr2_state->state = picoquic_bbr2_alg_probe_bw_down;
+    bbr2_state->pacing_gain = BBR2_PROBE_DOWN_PACING_GAIN;
+    bbr2_state->cwnd_gain = BBR2_DEFAULT_CWND_GAIN;
+    bbr2_state->cycle_count++;
+    bbr2_state->cycle_stamp = current_time;
+    BBR2PickProbeWait(bbr2_state);
+}
+
+static void BBR2StartProbeBwCruise(picoquic_bbr2_state_t* bbr2_state)
+{
+    bbr2_state->state = picoquic_bbr2_alg_probe_bw_cruise;
+    bbr2_state->pacing_gain = 1.0;
+    bbr2_state->cwnd_gain = BBR2_DEFAULT_CWND_GAIN;
+}
+
+static void BBR2StartProbeBwRefill(picoquic_bbr2_state_t* bbr2_state, picoquic_path_t* path_x)
+{
+    BBR2ResetLowerBounds(bbr2_state);
+    bbr2_state->probe_up_rounds = 0;
+    bbr2_state->state = picoquic_bbr2_alg_probe_bw_refill;
+    bbr2_state->pacing_gain = 1.0;
+    bbr2_state->cwnd_gain = BBR2_DEFAULT_CWND_GAIN;
+    /* Refill lasts one round */
+    bbr2_state->next_round_delivered = path_x->delivered;
+}
+
+static void BBR2StartProbeBwUp(picoquic_bbr2_state_t* bbr2_state, uint64_t current_time)
+{
+    bbr2_state->state = picoquic_bbr2_alg_probe_bw_up;
+    bbr2_state->pacing_gain = BBR2_PROBE_UP_PACING_GAIN;
+    bbr2_state->cwnd_gain = BBR2_PROBE_UP_CWND_GAIN;
+    bbr2_state->cycle_stamp = current_time;
+}
+
+/* Time to probe if the randomized wait elapsed, or if a Reno flow would
+ * have grown its window by the BDP in the same number of rounds. */
+static int BBR2IsTimeToProbeBw(picoquic_bbr2_state_t* bbr2_state, picoquic_path_t* path_x, uint64_t current_time)
+{
+    uint64_t reno_rounds = BBR2BDP(bbr2_state, 1.0) / path_x->send_mtu;
+
+    if (reno_rounds > BBR2_PROBE_WAIT_ROUNDS_MAX) {
+        reno_rounds = BBR2_PROBE_WAIT_ROUNDS_MAX;
+    }
+
+    return (current_time - bbr2_state->cycle_stamp > bbr2_state->probe_wait ||
+        bbr2_state->rounds_since_probe >= reno_rounds);
+}
+
+/* Losses or ECN marks while probing: the path cannot sustain that much data in flight */
+static void BBR2HandleInflightTooHigh(picoquic_bbr2_state_t* bbr2_state, picoquic_path_t* path_x, uint64_t current_time)
+{
+    uint64_t target = (uint64_t)(BBR2_BETA * (double)BBR2Inflight(bbr2_state, 1.0));
+
+    bbr2_state->inflight_hi = (path_x->bytes_in_transit > target) ? path_x->bytes_in_transit : target;
+    if (bbr2_state->inflight_hi < BBR2_MIN_PIPE_CWND(path_x->send_mtu)) {
+        bbr2_state->inflight_hi = BBR2_MIN_PIPE_CWND(path_x->send_mtu);
+    }
+
+    if (bbr2_state->state == picoquic_bbr2_alg_probe_bw_up) {
+        BBR2StartProbeBwDown(bbr2_state, current_time);
+    }
+    else if (bbr2_state->state == picoquic_bbr2_alg_startup) {
+        bbr2_state->filled_pipe = 1;
+    }
+}
+
+/* Check the loss and ECN signals as soon as they arrive when probing */
+static void BBR2CheckInflightTooHigh(picoquic_bbr2_state_t* bbr2_state, picoquic_path_t* path_x, uint64_t current_time)
+{
+    if ((bbr2_state->state == picoquic_bbr2_alg_probe_bw_up ||
+        (bbr2_state->state == picoquic_bbr2_alg_startup && bbr2_state->round_nb_losses >= BBR2_FULL_LOSS_COUNT)) &&
+        BBR2IsInflightTooHigh(bbr2_state, path_x)) {
+        BBR2HandleInflightTooHigh(bbr2_state, path_x, current_time);
+    }
+}
+
+/* Once per round with congestion signals, outside of bandwidth probes,
+ * reduce the short term bounds */
+static void BBR2AdaptLowerBounds(picoquic_bbr2_state_t* bbr2_state, picoquic_path_t* path_x)
+{
+    if (bbr2_state->state == picoquic_bbr2_alg_startup || bbr2_state->state == picoquic_bbr2_alg_probe_bw_up ||
+        bbr2_state->state == picoquic_bbr2_alg_probe_bw_refill) {
+        return;
+    }
+
+    if (bbr2_state->round_nb_losses > 0 || bbr2_state->round_nb_ecn_marks > 0) {
+        uint64_t bw_lo = (bbr2_state->bw_lo == BBR2_UNSET) ? bbr2_state->max_bw : bbr2_state->bw_lo;
+        uint64_t inflight_lo = (bbr2_state->inflight_lo == BBR2_UNSET) ? path_x->cwin : bbr2_state->inflight_lo;
+
+        bw_lo = (uint64_t)(BBR2_BETA * (double)bw_lo);
+        if (bw_lo < bbr2_state->bw_latest) {
+            bw_lo = bbr2_state->bw_latest;
+        }
+        inflight_lo = (uint64_t)(BBR2_BETA * (double)inflight_lo);
+        if (inflight_lo < bbr2_state->inflight_latest) {
+            inflight_lo = bbr2_state->inflight_latest;
+        }
+        if (inflight_lo < BBR2_MIN_PIPE_CWND(path_x->send_mtu)) {
+            inflight_lo = BBR2_MIN_PIPE_CWND(path_x->send_mtu);
+        }
+        bbr2_state->bw_lo = bw_lo;
+        bbr2_state->inflight_lo = inflight_lo;
+    }
+}
+
+/* During "up", raise inflight_hi by 1, 2, 4... packets per round, if the window is fully used */
+static void BBR2ProbeInflightHiUpward(picoquic_bbr2_state_t* bbr2_state, picoquic_path_t* path_x)
+{
+    if (bbr2_state->inflight_hi != BBR2_UNSET && path_x->bytes_in_transit + path_x->send_mtu >= path_x->cwin) {
+        bbr2_state->inflight_hi += ((uint64_t)path_x->send_mtu) << bbr2_state->probe_up_rounds;
+        if (bbr2_state->probe_up_rounds < BBR2_PROBE_UP_ROUNDS_MAX) {
+            bbr2_state->probe_up_rounds++;
+        }
+    }
+}
+
+/* Track the round count using the "delivered" counter, as in bbr.c,
+ * and process the per round signals when a new round starts */
+static void BBR2UpdateRound(picoquic_bbr2_state_t* bbr2_state, picoquic_path_t* path_x)
+{
+    if (path_x->delivered_last_packet >= bbr2_state->next_round_delivered) {
+        bbr2_state->next_round_delivered = path_x->delivered;
+        bbr2_state->round_count++;
+        bbr2_state->rounds_since_probe++;
+        bbr2_state->round_start = 1;
+    }
+    else {
+        bbr2_state->round_start = 0;
+    }
+
+    if (bbr2_state->round_start) {
+        bbr2_state->inflight_latest = bbr2_state->round_bytes_delivered;
+        BBR2AdaptLowerBounds(bbr2_state, path_x);
+        if (bbr2_state->state == picoquic_bbr2_alg_probe_bw_up) {
+            BBR2ProbeInflightHiUpward(bbr2_state, path_x);
+        }
+        BBR2ResetRoundSignals(bbr2_state);
+        bbr2_state->bw_latest = 0;
+    }
+}
+
+static void BBR2UpdateMaxBw(picoquic_bbr2_state_t* bbr2_state, picoquic_path_t* path_x)
+{
+    uint64_t bw_sample = path_x->bandwidth_estimate;
+
+    if (bw_sample > bbr2_state->bw_latest) {
+        bbr2_state->bw_latest = bw_sample;
+    }
+
+    /* App limited samples are only used if they increase the estimate */
+    if (!path_x->last_bw_estimate_path_limited || bw_sample >= bbr2_state->max_bw) {
+        bbr2_state->max_bw = picoquic_windowed_max_update(&bbr2_state->max_bw_filter,
+            BBR2_MAX_BW_FILTER_LENGTH, bbr2_state->cycle_count, bw_sample);
+    }
+}
+
+static void BBR2UpdateMinRtt(picoquic_bbr2_state_t* bbr2_state, uint64_t rtt_sample, uint64_t current_time)
+{
+    if (rtt_sample == 0) {
+        return;
+    }
+
+    bbr2_state->probe_rtt_expired = current_time > bbr2_state->probe_rtt_min_stamp + BBR2_PROBE_RTT_INTERVAL;
+    if (rtt_sample <= bbr2_state->probe_rtt_min_delay || bbr2_state->probe_rtt_expired) {
+        bbr2_state->probe_rtt_min_delay = rtt_sample;
+        bbr2_state->probe_rtt_min_stamp = current_time;
+    }
+
+    if (bbr2_state->min_rtt == BBR2_UNSET) {
+        bbr2_state->min_rtt = picoquic_windowed_filter_reset(&bbr2_state->min_rtt_filter, current_time, rtt_sample);
+    }
+    else {
+        bbr2_state->min_rtt = picoquic_windowed_min_update(&bbr2_state->min_rtt_filter,
+            BBR2_MIN_RTT_FILTER_LENGTH, current_time, rtt_sample);
+    }
+}
+
+static void BBR2CheckStartupDone(picoquic_bbr2_state_t* bbr2_state, picoquic_path_t* path_x, uint64_t current_time)
+{
+    if (!bbr2_state->filled_pipe && bbr2_state->round_start && !path_x->last_bw_estimate_path_limited) {
+        if (bbr2_state->max_bw >= bbr2_state->full_bw * 1.25) {
+            /* Bandwidth still growing */
+            bbr2_state->full_bw = bbr2_state->max_bw;
+            bbr2_state->full_bw_count = 0;
+        }
+        else {
+            bbr2_state->full_bw_count++;
+            if (bbr2_state->full_bw_count >= 3) {
+                bbr2_state->filled_pipe = 1;
+            }
+        }
+    }
+
+    if (bbr2_state->state == picoquic_bbr2_alg_startup && bbr2_state->filled_pipe) {
+        bbr2_state->state = picoquic_bbr2_alg_drain;
+        bbr2_state->pacing_gain = BBR2_DRAIN_PACING_GAIN;
+        bbr2_state->cwnd_gain = BBR2_STARTUP_CWND_GAIN;
+    }
+
+    if (bbr2_state->state == picoquic_bbr2_alg_drain && path_x->bytes_in_transit <= BBR2Inflight(bbr2_state, 1.0)) {
+        /* The queue built during startup is deemed drained */
+        BBR2StartProbeBwDown(bbr2_state, current_time);
+    }
+}
+
+static void BBR2UpdateProbeBwCyclePhase(picoquic_bbr2_state_t* bbr2_state, picoquic_path_t* path_x, uint64_t current_time)
+{
+    switch (bbr2_state->state) {
+    case picoquic_bbr2_alg_probe_bw_down:
+        if (BBR2IsTimeToProbeBw(bbr2_state, path_x, current_time)) {
+            BBR2StartProbeBwRefill(bbr2_state, path_x);
+        }
+        else if (path_x->bytes_in_transit <= BBR2InflightWithHeadroom(bbr2_state, path_x) &&
+            path_x->bytes_in_transit <= BBR2Inflight(bbr2_state, 1.0)) {
+            BBR2StartProbeBwCruise(bbr2_state);
+        }
+        break;
+    case picoquic_bbr2_alg_probe_bw_cruise:
+        if (BBR2IsTimeToProbeBw(bbr2_state, path_x, current_time)) {
+            BBR2StartProbeBwRefill(bbr2_state, path_x);
+        }
+        break;
+    case picoquic_bbr2_alg_probe_bw_refill:
+        if (bbr2_state->round_start) {
+            BBR2StartProbeBwUp(bbr2_state, current_time);
+        }
+        break;
+    case picoquic_bbr2_alg_probe_bw_up:
+        if (current_time - bbr2_state->cycle_stamp > bbr2_state->min_rtt &&
+            path_x->bytes_in_transit > BBR2Inflight(bbr2_state, BBR2_PROBE_UP_PACING_GAIN)) {
+            /* The probe filled the pipe, drain the queue it created */
+            BBR2StartProbeBwDown(bbr2_state, current_time);
+        }
+        break;
+    default:
+        break;
+    }
+}
+
+static uint64_t BBR2ProbeRttCwnd(picoquic_bbr2_state_t* bbr2_state, picoquic_path_t* path_x)
+{
+    uint64_t cwnd = BBR2BDP(bbr2_state, BBR2_PROBE_RTT_CWND_GAIN);
+
+    if (cwnd < BBR2_MIN_PIPE_CWND(path_x->send_mtu)) {
+        cwnd = BBR2_MIN_PIPE_CWND(path_x->send_mtu);
+    }
+
+    return cwnd;
+}
+
+static void BBR2CheckProbeRtt(picoquic_bbr2_state_t* bbr2_state, picoquic_path_t* path_x, uint64_t current_time)
+{
+    if (bbr2_state->state != picoquic_bbr2_alg_probe_rtt && bbr2_state->probe_rtt_expired &&
+        bbr2_state->state != picoquic_bbr2_alg_startup) {
+        bbr2_state->state = picoquic_bbr2_alg_probe_rtt;
+        bbr2_state->pacing_gain = 1.0;
+        bbr2_state->cwnd_gain = BBR2_PROBE_RTT_CWND_GAIN;
+        if (path_x->cwin > bbr2_state->prior_cwnd) {
+            bbr2_state->prior_cwnd = path_x->cwin;
+        }
+        bbr2_state->probe_rtt_done_stamp = 0;
+    }
+
+    if (bbr2_state->state == picoquic_bbr2_alg_probe_rtt) {
+        if (bbr2_state->probe_rtt_done_stamp == 0 &&
+            path_x->bytes_in_transit <= BBR2ProbeRttCwnd(bbr2_state, path_x)) {
+            bbr2_state->probe_rtt_done_stamp = current_time + BBR2_PROBE_RTT_DURATION;
+            bbr2_state->probe_rtt_round_done = 0;
+            bbr2_state->next_round_delivered = path_x->delivered;
+        }
+        else if (bbr2_state->probe_rtt_done_stamp != 0) {
+            if (bbr2_state->round_start) {
+                bbr2_state->probe_rtt_round_done = 1;
+            }
+            if (bbr2_state->probe_rtt_round_done && current_time > bbr2_state->probe_rtt_done_stamp) {
+                bbr2_state->probe_rtt_min_stamp = current_time;
+                bbr2_state->probe_rtt_expired = 0;
+                if (path_x->cwin < bbr2_state->prior_cwnd) {
+                    path_x->cwin = bbr2_state->prior_cwnd;
+                }
+                bbr2_state->prior_cwnd = 0;
+                if (bbr2_state->filled_pipe) {
+                    BBR2StartProbeBwDown(bbr2_state, current_time);
+                    BBR2StartProbeBwCruise(bbr2_state);
+                }
+                else {
+                    BBR2EnterStartup(bbr2_state);
+                }
+            }
+        }
+    }
+}
+
+/* The recovery from a timeout ends when a packet sent after it is acked.
+ * The window saved at the timeout is then restored, before the bounds apply. */
+static void BBR2CheckRecoveryDone(picoquic_bbr2_state_t* bbr2_state, picoquic_path_t* path_x)
+{
+    if (bbr2_state->in_recovery && path_x->delivered_last_packet >= bbr2_state->recovery_delivered) {
+        bbr2_state->in_recovery = 0;
+        if (path_x->cwin < bbr2_state->prior_cwnd) {
+            path_x->cwin = bbr2_state->prior_cwnd;
+        }
+        if (bbr2_state->state != picoquic_bbr2_alg_probe_rtt) {
+            /* ProbeRTT still needs the saved window when it exits */
+            bbr2_state->prior_cwnd = 0;
+        }
+    }
+}
+
+static void BBR2SetPacingRate(picoquic_bbr2_state_t* bbr2_state, picoquic_path_t* path_x)
+{
+    double rate;
+
+    if (bbr2_state->max_bw > 0) {
+        rate = bbr2_state->pacing_gain * (double)BBR2Bw(bbr2_state);
+    }
+    else {
+        /* No bandwidth sample yet, pace the initial window over the RTT */
+        rate = bbr2_state->pacing_gain * (double)path_x->cwin * 1000000.0 / (double)path_x->smoothed_rtt;
+    }
+
+    if (bbr2_state->filled_pipe || rate > bbr2_state->pacing_rate) {
+        bbr2_state->pacing_rate = rate;
+    }
+}
+
+/* Apply the loss and ECN based bounds to the model based window */
+static uint64_t BBR2BoundCwnd(picoquic_bbr2_state_t* bbr2_state, picoquic_path_t* path_x, uint64_t cwnd)
+{
+    uint64_t cap = BBR2_UNSET;
+
+    if (bbr2_state->state == picoquic_bbr2_alg_probe_bw_up ||
+        bbr2_state->state == picoquic_bbr2_alg_probe_bw_refill ||
+        bbr2_state->state == picoquic_bbr2_alg_startup) {
+        cap = bbr2_state->inflight_hi;
+    }
+    else if (bbr2_state->state != picoquic_bbr2_alg_probe_rtt) {
+        cap = BBR2InflightWithHeadroom(bbr2_state, path_x);
+    }
+
+    if (bbr2_state->inflight_lo < cap) {
+        cap = bbr2_state->inflight_lo;
+    }
+    if (cwnd > cap) {
+        cwnd = cap;
+    }
+    if (bbr2_state->state == picoquic_bbr2_alg_probe_rtt && cwnd > BBR2ProbeRttCwnd(bbr2_state, path_x)) {
+        cwnd = BBR2ProbeRttCwnd(bbr2_state, path_x);
+    }
+    if (cwnd < BBR2_MIN_PIPE_CWND(path_x->send_mtu)) {
+        cwnd = BBR2_MIN_PIPE_CWND(path_x->send_mtu);
+    }
+
+    return cwnd;
+}
+
+static void BBR2SetCwnd(picoquic_bbr2_state_t* bbr2_state, picoquic_path_t* path_x)
+{
+    uint64_t target_cwnd = BBR2Inflight(bbr2_state, bbr2_state->cwnd_gain);
+
+    if (bbr2_state->filled_pipe) {
+        path_x->cwin += bbr2_state->bytes_delivered;
+        if (path_x->cwin > target_cwnd) {
+            path_x->cwin = target_cwnd;
+        }
+    }
+    else if (path_x->cwin < target_cwnd || path_x->delivered < PICOQUIC_CWIN_INITIAL) {
+        path_x->cwin += bbr2_state->bytes_delivered;
+    }
+
+    path_x->cwin = BBR2BoundCwnd(bbr2_state, path_x, path_x->cwin);
+}
+
+/* This is the per ACK processing, activated when a bandwidth sample is
+ * available, after the RTT and the delivered counters were updated. */
+static void BBR2UpdateOnACK(picoquic_bbr2_state_t* bbr2_state, picoquic_path_t* path_x,
+    uint64_t rtt_sample, uint64_t current_time)
+{
+    BBR2UpdateRound(bbr2_state, path_x);
+    BBR2UpdateMaxBw(bbr2_state, path_x);
+    BBR2UpdateMinRtt(bbr2_state, rtt_sample, current_time);
+    BBR2CheckStartupDone(bbr2_state, path_x, current_time);
+    BBR2UpdateProbeBwCyclePhase(bbr2_state, path_x, current_time);
+    BBR2CheckProbeRtt(bbr2_state, path_x, current_time);
+    BBR2CheckRecoveryDone(bbr2_state, path_x);
+
+    BBR2SetPacingRate(bbr2_state, path_x);
+    BBR2SetSendQuantum(bbr2_state, path_x);
+    BBR2SetCwnd(bbr2_state, path_x);
+}
+
+/*
+ * In order to implement BBRv2, we map generic congestion notification
+ * signals to the corresponding BBRv2 actions.
+ */
+static void picoquic_bbr2_notify(
+    picoquic_path_t* path_x,
+    picoquic_congestion_notification_t notification,
+    uint64_t rtt_measurement,
+    uint64_t nb_bytes_acknowledged,
+    uint64_t lost_packet_number,
+    uint64_t current_time)
+{
+#ifdef _WINDOWS
+    UNREFERENCED_PARAMETER(lost_packet_number);
+#endif
+    picoquic_bbr2_state_t* bbr2_state = (picoquic_bbr2_state_t*)path_x->congestion_alg_state;
+
+    if (bbr2_state != NULL) {
+        switch (notification) {
+        case picoquic_congestion_notification_acknowledgement:
+            /* sum the amount of data acked per packet */
+            bbr2_state->bytes_delivered += nb_bytes_acknowledged;
+            bbr2_state->round_bytes_delivered += nb_bytes_acknowledged;
+            break;
+        case picoquic_congestion_notification_repeat:
+            bbr2_state->round_bytes_lost += path_x->send_mtu;
+            bbr2_state->round_nb_losses++;
+            BBR2CheckInflightTooHigh(bbr2_state, path_x, current_time);
+            break;
+        case picoquic_congestion_notification_congestion_experienced:
+            bbr2_state->round_nb_ecn_marks++;
+            BBR2CheckInflightTooHigh(bbr2_state, path_x, current_time);
+            break;
+        case picoquic_congestion_notification_timeout:
+            /* Restart from a minimal window until the recovery is done, the model is kept */
+            bbr2_state->round_bytes_lost += path_x->send_mtu;
+            bbr2_state->round_nb_losses++;
+            if (path_x->cwin > bbr2_state->prior_cwnd) {
+                bbr2_state->prior_cwnd = path_x->cwin;
+            }
+            bbr2_state->recovery_delivered = path_x->delivered;
+            bbr2_state->in_recovery = 1;
+            path_x->cwin = BBR2_MIN_PIPE_CWND(path_x->send_mtu);
+            break;
+        case picoquic_congestion_notification_spurious_repeat:
+            break;
+        case picoquic_congestion_notification_rtt_measurement:
+            BBR2UpdateMinRtt(bbr2_state, rtt_measurement, current_time);
+            break;
+        case picoquic_congestion_notification_bw_measurement:
+            BBR2UpdateOnACK(bbr2_state, path_x, rtt_measurement, current_time);
+            bbr2_state->bytes_delivered = 0;
+
+            if (bbr2_state->pacing_rate > 0) {
+                /* Set the pacing rate in picoquic sender */
+                picoquic_update_pacing_rate(path_x, bbr2_state->pacing_rate, bbr2_state->send_quantum);
+            }
+            break;
+        case picoquic_congestion_notification_cwin_blocked:
+        default:
+            /* ignore */
+            break;
+        }
+    }
+}
+
+uint64_t picoquic_bbr2_get_inflight_hi(picoquic_cnx_t* cnx, picoquic_path_t* path_x)
+{
+    uint64_t inflight_hi = BBR2_UNSET;
+
+    if (path_x->congestion_alg_state != NULL && cnx->congestion_alg == picoquic_bbr2_algorithm) {
+        inflight_hi = ((picoquic_bbr2_state_t*)path_x->congestion_alg_state)->inflight_hi;
+    }
+
+    return inflight_hi;
+}
+
+#define picoquic_bbr2_ID 0x42425232 /* BBR2 */
+
+picoquic_congestion_algorithm_t picoquic_bbr2_algorithm_struct = {
+    picoquic_bbr2_ID,
+    picoquic_bbr2_init,
+    picoquic_bbr2_notify,
+    picoquic_bbr2_delete
+};
+
+picoquic_congestion_algorithm_t* picoquic_bbr2_algorithm = &picoquic_bbr2_algorithm_struct;
@@ -140,4 +140,98 @@ uint64_t picoquic_cc_increased_window(picoquic_path_t* path, uint64_t previous_w
         new_window = (uint64_t)w;
     }
     return new_window;
-}
\ No newline at end of file
+}
+
+/*
+ * Windowed min or max filter.
+ * s[0] holds the best sample, s[1] the best sample after s[0], and s[2] the
+ * best sample after s[1]. When s[0] ages out of the window, the next best
+ * samples take over. Sub-window checks ensure that the second and third
+ * samples are refreshed at 1/4 and 1/2 of the window, so a decrease of the
+ * max (or increase of the min) is tracked within one window.
+ */
+uint64_t picoquic_windowed_filter_reset(picoquic_windowed_filter_t* filter, uint64_t t, uint64_t v)
+{
+    for (int i = 0; i < PICOQUIC_WINDOWED_FILTER_NB_SAMPLES; i++) {
+        filter->s[i].t = t;
+        filter->s[i].v = v;
+    }
+
+    return v;
+}
+
+uint64_t picoquic_windowed_filter_get(const picoquic_windowed_filter_t* filter)
+{
+    return filter->s[0].v;
+}
+
+static uint64_t picoquic_windowed_filter_subwin_update(picoquic_windowed_filter_t* filter, uint64_t window,
+    const picoquic_windowed_sample_t* sample)
+{
+    uint64_t dt = sample->t - filter->s[0].t;
+
+    if (dt > window) {
+        /* The best sample expired, promote the second and third best */
+        filter->s[0] = filter->s[1];
+        filter->s[1] = filter->s[2];
+        filter->s[2] = *sample;
+        if (sample->t - filter->s[0].t > window) {
+            filter->s[0] = filter->s[1];
+            filter->s[1] = filter->s[2];
+            filter->s[2] = *sample;
+        }
+    } else if (filter->s[1].t == filter->s[0].t && dt > window / 4) {
+        /* A quarter of the window passed without a second choice */
+        filter->s[1] = *sample;
+        filter->s[2] = *sample;
+    } else if (filter->s[2].t == filter->s[1].t && dt > window / 2) {
+        /* Half of the window passed without a third choice */
+        filter->s[2] = *sample;
+    }
+
+    return filter->s[0].v;
+}
+
+uint64_t picoquic_windowed_max_update(picoquic_windowed_filter_t* filter, uint64_t window, uint64_t t, uint64_t v)
+{
+    picoquic_windowed_sample_t sample;
+
+    sample.t = t;
+    sample.v = v;
+
+    if (v >= filter->s[0].v || t - filter->s[2].t > window) {
+        /* New max, or nothing left in the window */
+        return picoquic_windowed_filter_reset(filter, t, v);
+    }
+
+    if (v >= filter->s[1].v) {
+        filter->s[1] = sample;
+        filter->s[2] = sample;
+    } else if (v >= filter->s[2].v) {
+        filter->s[2] = sample;
+    }
+
+    return picoquic_windowed_filter_subwin_update(filter, window, &sample);
+}
+
+uint64_t picoquic_windowed_min_update(picoquic_windowed_filter_t* filter, uint64_t window, uint64_t t, uint64_t v)
+{
+    picoquic_windowed_sample_t sample;
+
+    sample.t = t;
+    sample.v = v;
+
+    if (v <= filter->s[0].v || t - filter->s[2].t > window) {
+        /* New min, or nothing left in the window */
+        return picoquic_windowed_filter_reset(filter, t, v);
+    }
+
+    if (v <= filter->s[1].v) {
+        filter->s[1] = sample;
+        filter->s[2] = sample;
+    } else if (v <= filter->s[2].v) {
+        filter->s[2] = sample;
+    }
+
+    return picoquic_windowed_filter_subwin_update(filter, window, &sample);
+}
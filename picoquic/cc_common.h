@@ -16,6 +16,21 @@ typedef struct st_picoquic_min_max_rtt_t {
     uint64_t samples[PICOQUIC_MIN_MAX_RTT_SCOPE];
 } picoquic_min_max_rtt_t;
 
+/* Windowed min or max filter, after Kathleen Nichols' algorithm as used in BBR.
+ * The filter keeps the best, second best and third best samples in the window,
+ * so that the estimate can be updated in constant time. The time base is up to
+ * the caller, e.g. microseconds or round trip counts. */
+#define PICOQUIC_WINDOWED_FILTER_NB_SAMPLES 3
+
+typedef struct st_picoquic_windowed_sample_t {
+    uint64_t t;
+    uint64_t v;
+} picoquic_windowed_sample_t;
+
+typedef struct st_picoquic_windowed_filter_t {
+    picoquic_windowed_sample_t s[PICOQUIC_WINDOWED_FILTER_NB_SAMPLES];
+} picoquic_windowed_filter_t;
+
 
 uint64_t picoquic_cc_get_sequence_number(picoquic_path_t *path);
 
@@ -29,4 +44,12 @@ void picoquic_hystart_increase(picoquic_path_t* path_x, picoquic_min_max_rtt_t*
 
 int picoquic_cc_was_cwin_blocked(picoquic_path_t *path, uint64_t last_sequence_blocked);
 
+uint64_t picoquic_windowed_filter_reset(picoquic_windowed_filter_t* filter, uint64_t t, uint64_t v);
+
+uint64_t picoquic_windowed_filter_get(const picoquic_windowed_filter_t* filter);
+
+uint64_t picoquic_windowed_max_update(picoquic_windowed_filter_t* filter, uint64_t window, uint64_t t, uint64_t v);
+
+uint64_t picoquic_windowed_min_update(picoquic_windowed_filter_t* filter, uint64_t window, uint64_t t, uint64_t v);
+
 #endif //CC_COMMON_H
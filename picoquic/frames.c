@@ -144,6 +144,8 @@ picoquic_stream_head* picoquic_create_stream(picoquic_cnx_t* cnx, uint64_t strea
 
         memset(stream, 0, sizeof(picoquic_stream_head));
         stream->stream_id = stream_id;
+        /* Nothing acknowledged yet */
+        stream->first_sack_item.start_of_sack_range = (uint64_t)((int64_t)-1);
 
         if (IS_LOCAL_STREAM_ID(stream_id, cnx->client_mode)) {
             if (IS_BIDIR_STREAM_ID(stream_id)) {
@@ -406,12 +408,10 @@ int picoquic_prepare_stream_reset_frame(picoquic_cnx_t *cnx, picoquic_stream_hea
             /* Free the queued data */
             while (stream->send_queue != NULL) {
                 picoquic_stream_data* next = stream->send_queue->next_stream_data;
-                if (stream->send_queue->bytes != NULL) {
-                    free(stream->send_queue->bytes);
-                }
-                free(stream->send_queue);
+                picoquic_free_stream_data(stream->send_queue);
                 stream->send_queue = next;
             }
+            picoquic_clear_sent_stream_data(stream);
         }
     }
 
@@ -503,7 +503,7 @@ protoop_arg_t parse_new_connection_id_frame(picoquic_cnx_t* cnx)
 
     if (cnx->active_connection_id_count >= cnx->local_parameters.active_connection_id_limit) {
         picoquic_connection_error(cnx, PICOQUIC_TRANSPORT_CONNECTION_ID_LIMIT_ERROR, picoquic_frame_type_new_connection_id);
-        picoquic_reinsert_by_wake_time(cnx->quic, cnx, picoquic_current_time());
+        picoquic_reinsert_by_wake_time(cnx->quic, cnx, picoquic_get_quic_time(cnx->quic));
         return (protoop_arg_t) NULL;
     } else if ((bytes = picoquic_frames_varint_decode(bytes + picoquic_varint_skip(bytes), bytes_max, &frame->sequence)) == NULL ||
         (bytes = picoquic_frames_varint_decode(bytes, bytes_max, &frame->retire_prior_to)) == NULL ||
@@ -761,32 +761,33 @@ int picoquic_parse_stream_header(const uint8_t* bytes, size_t bytes_max,
     return ret;
 }
 
-void picoquic_stream_data_callback(picoquic_cnx_t* cnx, picoquic_stream_head* stream)
+/* Deliver the next in order bytes of the stream to the application */
+static void picoquic_stream_deliver_data(picoquic_cnx_t* cnx, picoquic_stream_head* stream, uint8_t* bytes, size_t data_length)
 {
-    picoquic_stream_data* data = stream->stream_data;
+    picoquic_call_back_event_t fin_now = picoquic_callback_no_event;
 
-    while (data != NULL && data->offset <= stream->consumed_offset) {
-        size_t start = (size_t)(stream->consumed_offset - data->offset);
-        size_t data_length = data->length - start;
-        picoquic_call_back_event_t fin_now = picoquic_callback_no_event;
+    stream->consumed_offset += data_length;
 
-        stream->consumed_offset += data_length;
+    if (stream->consumed_offset >= stream->fin_offset && stream->fin_received && !stream->fin_signalled){
+        fin_now = picoquic_callback_stream_fin;
+        stream->fin_signalled = 1;
+    }
 
-        if (stream->consumed_offset >= stream->fin_offset && stream->fin_received && !stream->fin_signalled){
-            fin_now = picoquic_callback_stream_fin;
-            stream->fin_signalled = 1;
-        }
+    LOG_EVENT(cnx, "application", "callback", picoquic_log_fin_or_event_name(fin_now), "{\"stream_id\": %" PRIu64 ", \"data_length\": %" PRIu64 "}", stream->stream_id, data_length);
+    if (cnx->callback_fn(cnx, stream->stream_id, bytes, data_length, fin_now,
+        cnx->callback_ctx, stream->app_stream_ctx) != 0) {
+        picoquic_connection_error(cnx, PICOQUIC_TRANSPORT_INTERNAL_ERROR, 0);
+    }
+}
 
-        LOG_EVENT(cnx, "application", "callback", picoquic_log_fin_or_event_name(fin_now), "{\"stream_id\": %" PRIu64 ", \"data_length\": %" PRIu64 "}", stream->stream_id, data_length);
-        if (cnx->callback_fn(cnx, stream->stream_id, data->bytes + start, data_length, fin_now,
-            cnx->callback_ctx, stream->app_stream_ctx) != 0) {
-            picoquic_connection_error(cnx, PICOQUIC_TRANSPORT_INTERNAL_ERROR, 0);
-        }
+void picoquic_stream_data_callback(picoquic_cnx_t* cnx, picoquic_stream_head* stream)
+{
+    uint8_t* bytes;
+    size_t data_length;
 
-        free(data->bytes);
-        stream->stream_data = data->next_stream_data;
-        free(data);
-        data = stream->stream_data;
+    /* Each call delivers the largest contiguous run available */
+    while ((data_length = picoquic_stream_reassembly_peek(&stream->reassembly, stream->consumed_offset, &bytes)) > 0) {
+        picoquic_stream_deliver_data(cnx, stream, bytes, data_length);
     }
 
     /* handle the case where the fin frame does not carry any data */
@@ -801,63 +802,474 @@ void picoquic_stream_data_callback(picoquic_cnx_t* cnx, picoquic_stream_head* st
     }
 }
 
-/* Common code to data stream and crypto hs stream */
-static int picoquic_queue_network_input(picoquic_cnx_t* cnx, picoquic_stream_head* stream, size_t offset, uint8_t* bytes, size_t length, int * new_data_available)
+/*
+ * Reassembly of received data.
+ *
+ * The received bytes are written at their offset in a single buffer that
+ * starts at "base_offset", and the received ranges are kept in a sorted
+ * array of disjoint, non adjacent ranges. Looking up the position of a new
+ * segment is a binary search, and the buffer only grows by doubling, so
+ * there is no allocation per segment. Delivered bytes are reclaimed by
+ * moving the remaining data to the start of the buffer when it needs room.
+ */
+
+/* Index of the first range that ends at or after the offset */
+static size_t picoquic_stream_reassembly_search(picoquic_stream_reassembly_t* reassembly, uint64_t offset)
+{
+    size_t low = 0;
+    size_t high = reassembly->nb_ranges;
+
+    while (low < high) {
+        size_t middle = (low + high) / 2;
+
+        if (reassembly->ranges[middle].end < offset) {
+            low = middle + 1;
+        } else {
+            high = middle;
+        }
+    }
+
+    return low;
+}
+
+/* Forget the ranges that were delivered */
+static void picoquic_stream_reassembly_trim(picoquic_stream_reassembly_t* reassembly, uint64_t consumed_offset)
+{
+    size_t nb_delivered = 0;
+
+    while (nb_delivered < reassembly->nb_ranges && reassembly->ranges[nb_delivered].end <= consumed_offset) {
+        nb_delivered++;
+    }
+
+    if (nb_delivered > 0) {
+        reassembly->nb_ranges -= nb_delivered;
+        memmove(reassembly->ranges, reassembly->ranges + nb_delivered, reassembly->nb_ranges * sizeof(picoquic_stream_range_t));
+    }
+
+    if (reassembly->nb_ranges == 0) {
+        /* Nothing buffered, the next data can go at the start of the buffer */
+        reassembly->base_offset = consumed_offset;
+    }
+}
+
+/* Make sure that the buffer can hold the bytes up to end_offset */
+static int picoquic_stream_reassembly_reserve(picoquic_stream_reassembly_t* reassembly, uint64_t consumed_offset, uint64_t end_offset)
 {
     int ret = 0;
-    picoquic_stream_data** pprevious = &stream->stream_data;
-    picoquic_stream_data* next = stream->stream_data;
-    size_t start = 0;
-
-    if (offset <= stream->consumed_offset) {
-        if (offset + length <= stream->consumed_offset) {
-            /* already received */
-            start = length;
+
+    if (end_offset - reassembly->base_offset > reassembly->bytes_size && consumed_offset > reassembly->base_offset) {
+        /* Reclaim the space used by delivered data */
+        size_t delivered = (size_t)(consumed_offset - reassembly->base_offset);
+        size_t kept = (reassembly->nb_ranges == 0) ? 0 :
+            (size_t)(reassembly->ranges[reassembly->nb_ranges - 1].end - consumed_offset);
+
+        if (kept > 0) {
+            memmove(reassembly->bytes, reassembly->bytes + delivered, kept);
         }
-        else {
-            start = (size_t)(stream->consumed_offset - offset);
+        reassembly->base_offset = consumed_offset;
+    }
+
+    if (end_offset - reassembly->base_offset > reassembly->bytes_size) {
+        uint64_t needed = end_offset - reassembly->base_offset;
+        size_t new_size = (reassembly->bytes_size == 0) ? PICOQUIC_REASSEMBLY_MIN_SIZE : reassembly->bytes_size;
+        uint8_t* new_bytes;
+
+        while (new_size < needed && new_size <= SIZE_MAX / 2) {
+            new_size *= 2;
+        }
+
+        if (new_size < needed || (new_bytes = (uint8_t*)realloc(reassembly->bytes, new_size)) == NULL) {
+            ret = PICOQUIC_ERROR_MEMORY;
+        } else {
+            reassembly->bytes = new_bytes;
+            reassembly->bytes_size = new_size;
+        }
+    }
+
+    return ret;
+}
+
+int picoquic_stream_reassembly_insert(picoquic_stream_reassembly_t* reassembly, uint64_t consumed_offset,
+    uint64_t offset, const uint8_t* bytes, size_t length, int* new_data_available)
+{
+    int ret = 0;
+    uint64_t end_offset = offset + length;
+    uint64_t copy_offset;
+    size_t first;
+    size_t last;
+
+    if (end_offset <= consumed_offset) {
+        /* already received */
+        return 0;
+    }
+
+    if (offset < consumed_offset) {
+        bytes += consumed_offset - offset;
+        offset = consumed_offset;
+    }
+
+    picoquic_stream_reassembly_trim(reassembly, consumed_offset);
+
+    /* Ranges overlapping or adjacent to the new data are first..last-1 */
+    first = picoquic_stream_reassembly_search(reassembly, offset);
+    last = first;
+    while (last < reassembly->nb_ranges && reassembly->ranges[last].start <= end_offset) {
+        last++;
+    }
+
+    if (last == first + 1 && reassembly->ranges[first].start <= offset && reassembly->ranges[first].end >= end_offset) {
+        /* Duplicate */
+        return 0;
+    }
+
+    if (last == first && reassembly->nb_ranges >= reassembly->ranges_size) {
+        size_t new_size = (reassembly->ranges_size == 0) ? 8 : 2 * reassembly->ranges_size;
+        picoquic_stream_range_t* new_ranges = (picoquic_stream_range_t*)realloc(reassembly->ranges,
+            new_size * sizeof(picoquic_stream_range_t));
+
+        if (new_ranges == NULL) {
+            return PICOQUIC_ERROR_MEMORY;
+        }
+        reassembly->ranges = new_ranges;
+        reassembly->ranges_size = new_size;
+    }
+
+    if ((ret = picoquic_stream_reassembly_reserve(reassembly, consumed_offset, end_offset)) != 0) {
+        return ret;
+    }
+
+    /* Only fill the holes, data already received is kept as is */
+    copy_offset = offset;
+    for (size_t i = first; i <= last; i++) {
+        uint64_t hole_end = (i < last && reassembly->ranges[i].start < end_offset) ? reassembly->ranges[i].start : end_offset;
+
+        if (hole_end > copy_offset) {
+            memcpy(reassembly->bytes + (copy_offset - reassembly->base_offset), bytes + (copy_offset - offset),
+                (size_t)(hole_end - copy_offset));
+            *new_data_available = 1;
+        }
+        if (i < last && reassembly->ranges[i].end > copy_offset) {
+            copy_offset = reassembly->ranges[i].end;
+        }
+    }
+
+    /* Merge the ranges */
+    if (last == first) {
+        memmove(reassembly->ranges + first + 1, reassembly->ranges + first,
+            (reassembly->nb_ranges - first) * sizeof(picoquic_stream_range_t));
+        reassembly->ranges[first].start = offset;
+        reassembly->ranges[first].end = end_offset;
+        reassembly->nb_ranges++;
+    } else {
+        if (reassembly->ranges[first].start > offset) {
+            reassembly->ranges[first].start = offset;
+        }
+        reassembly->ranges[first].end = (reassembly->ranges[last - 1].end > end_offset) ? reassembly->ranges[last - 1].end : end_offset;
+        if (last > first + 1) {
+            memmove(reassembly->ranges + first + 1, reassembly->ranges + last,
+                (reassembly->nb_ranges - last) * sizeof(picoquic_stream_range_t));
+            reassembly->nb_ranges -= last - first - 1;
+        }
+    }
+
+    return ret;
+}
+
+size_t picoquic_stream_reassembly_peek(picoquic_stream_reassembly_t* reassembly, uint64_t consumed_offset, uint8_t** bytes)
+{
+    size_t length = 0;
+
+    picoquic_stream_reassembly_trim(reassembly, consumed_offset);
+
+    if (reassembly->nb_ranges > 0 && reassembly->ranges[0].start <= consumed_offset) {
+        *bytes = reassembly->bytes + (consumed_offset - reassembly->base_offset);
+        length = (size_t)(reassembly->ranges[0].end - consumed_offset);
+    }
+
+    return length;
+}
+
+void picoquic_stream_reassembly_clear(picoquic_stream_reassembly_t* reassembly)
+{
+    if (reassembly->bytes != NULL) {
+        free(reassembly->bytes);
+    }
+    if (reassembly->ranges != NULL) {
+        free(reassembly->ranges);
+    }
+    memset(reassembly, 0, sizeof(picoquic_stream_reassembly_t));
+}
+
+/*
+ * Retransmission of sent stream data.
+ *
+ * Queued data is not released once sent: it moves to the sent queue of the
+ * stream and stays there until the peer acknowledges it. When a packet is
+ * lost, the stream ranges that it carried are added to the lost ranges of
+ * the stream, and prepare_stream_frame sends them again from the sent queue
+ * before any new data, coalescing adjacent ranges into full size frames.
+ * Data written directly in the packet by active streams is not retained,
+ * the frames that carried it are still repeated by copy.
+ */
+
+void picoquic_retain_sent_stream_data(picoquic_stream_head* stream, picoquic_stream_data* stream_data)
+{
+    stream_data->next_stream_data = NULL;
+    if (stream->sent_queue_last == NULL) {
+        stream->sent_queue = stream_data;
+    } else {
+        stream->sent_queue_last->next_stream_data = stream_data;
+    }
+    stream->sent_queue_last = stream_data;
+}
+
+/*
+ * Record the acknowledgement of stream data, and release the sent data below
+ * the acked offset. The acked offset only moves when the range reaches it,
+ * and then the SACK list is walked down to the range containing it.
+ */
+void picoquic_record_acked_stream_data(picoquic_cnx_t* cnx, picoquic_stream_head* stream, uint64_t offset, uint64_t length)
+{
+    if (length == 0) {
+        return;
+    }
+
+    (void)picoquic_update_sack_list(cnx, &stream->first_sack_item, offset, offset + length - 1);
+
+    if (offset <= stream->acked_offset && offset + length > stream->acked_offset) {
+        picoquic_sack_item_t* sack = &stream->first_sack_item;
+
+        /* Ranges are sorted by decreasing offsets, stop at the one the data was merged in */
+        while (sack != NULL && sack->start_of_sack_range > offset) {
+            sack = sack->next_sack;
+        }
+        if (sack != NULL && sack->end_of_sack_range + 1 > stream->acked_offset) {
+            stream->acked_offset = sack->end_of_sack_range + 1;
         }
     }
 
-    /* Queue of a block in the stream */
+    while (stream->sent_queue != NULL &&
+        stream->sent_queue->stream_offset + stream->sent_queue->length <= stream->acked_offset) {
+        picoquic_stream_data* next = stream->sent_queue->next_stream_data;
+        picoquic_free_stream_data(stream->sent_queue);
+        stream->sent_queue = next;
+    }
+
+    if (stream->sent_queue == NULL) {
+        stream->sent_queue_last = NULL;
+    }
+}
+
+void picoquic_clear_sent_stream_data(picoquic_stream_head* stream)
+{
+    while (stream->sent_queue != NULL) {
+        picoquic_stream_data* next = stream->sent_queue->next_stream_data;
+        picoquic_free_stream_data(stream->sent_queue);
+        stream->sent_queue = next;
+    }
+    stream->sent_queue_last = NULL;
+
+    if (stream->lost_ranges != NULL) {
+        free(stream->lost_ranges);
+        stream->lost_ranges = NULL;
+    }
+    stream->nb_lost_ranges = 0;
+    stream->lost_ranges_size = 0;
+}
+
+/* Copy sent stream data from the sent queue, or from the part of the first queued
+ * buffer that was already sent. Returns -1 if some of the bytes are not retained.
+ * If bytes is NULL, only check that they are. */
+static int picoquic_copy_sent_stream_data(picoquic_stream_head* stream, uint64_t offset, uint8_t* bytes, size_t length)
+{
+    for (int i = 0; i < 2 && length > 0; i++) {
+        picoquic_stream_data* data = (i == 0) ? stream->sent_queue : stream->send_queue;
 
-    while (next != NULL && start < length && next->offset <= offset + start) {
-        if (offset + length <= next->offset + next->length) {
-            start = length;
-        } else if (offset < next->offset + next->length) {
-            start = (size_t)(next->offset + next->length - offset);
+        while (data != NULL && length > 0) {
+            size_t sent_length = (i == 0) ? data->length : (size_t)data->offset;
+
+            if (offset >= data->stream_offset && offset < data->stream_offset + sent_length) {
+                size_t data_offset = (size_t)(offset - data->stream_offset);
+                size_t copied = sent_length - data_offset;
+
+                if (copied > length) {
+                    copied = length;
+                }
+                if (bytes != NULL) {
+                    memcpy(bytes, data->bytes + data_offset, copied);
+                    bytes += copied;
+                }
+                offset += copied;
+                length -= copied;
+            }
+
+            data = (i == 0) ? data->next_stream_data : NULL;
         }
-        pprevious = &next->next_stream_data;
-        next = next->next_stream_data;
     }
 
-    if (start < length) {
-        size_t data_length = length - start;
+    return (length == 0) ? 0 : -1;
+}
+
+static int picoquic_add_lost_stream_range(picoquic_stream_head* stream, uint64_t start, uint64_t end)
+{
+    size_t first = 0;
+    size_t last;
 
-        if (next != NULL && next->offset < offset + length) {
-            data_length -= (size_t)(offset + length - next->offset);
+    while (first < stream->nb_lost_ranges && stream->lost_ranges[first].end < start) {
+        first++;
+    }
+    last = first;
+    while (last < stream->nb_lost_ranges && stream->lost_ranges[last].start <= end) {
+        last++;
+    }
+
+    if (last == first) {
+        if (stream->nb_lost_ranges >= stream->lost_ranges_size) {
+            size_t new_size = (stream->lost_ranges_size == 0) ? 8 : 2 * stream->lost_ranges_size;
+            picoquic_stream_range_t* new_ranges = (picoquic_stream_range_t*)realloc(stream->lost_ranges,
+                new_size * sizeof(picoquic_stream_range_t));
+
+            if (new_ranges == NULL) {
+                return PICOQUIC_ERROR_MEMORY;
+            }
+            stream->lost_ranges = new_ranges;
+            stream->lost_ranges_size = new_size;
+        }
+        memmove(stream->lost_ranges + first + 1, stream->lost_ranges + first,
+            (stream->nb_lost_ranges - first) * sizeof(picoquic_stream_range_t));
+        stream->lost_ranges[first].start = start;
+        stream->lost_ranges[first].end = end;
+        stream->nb_lost_ranges++;
+    } else {
+        if (stream->lost_ranges[first].start > start) {
+            stream->lost_ranges[first].start = start;
         }
+        stream->lost_ranges[first].end = (stream->lost_ranges[last - 1].end > end) ? stream->lost_ranges[last - 1].end : end;
+        if (last > first + 1) {
+            memmove(stream->lost_ranges + first + 1, stream->lost_ranges + last,
+                (stream->nb_lost_ranges - last) * sizeof(picoquic_stream_range_t));
+            stream->nb_lost_ranges -= last - first - 1;
+        }
+    }
+
+    return 0;
+}
 
-        if (data_length > 0) {
-            picoquic_stream_data* data = (picoquic_stream_data*)malloc(sizeof(picoquic_stream_data));
+static void picoquic_remove_first_lost_stream_range(picoquic_stream_head* stream)
+{
+    stream->nb_lost_ranges--;
+    memmove(stream->lost_ranges, stream->lost_ranges + 1, stream->nb_lost_ranges * sizeof(picoquic_stream_range_t));
+}
+
+/*
+ * Schedule the retransmission of a lost stream frame from the sent data.
+ * Returns 1 if the frame does not need to be copied, 0 otherwise.
+ */
+int picoquic_reschedule_lost_stream_frame(picoquic_cnx_t* cnx, uint8_t* bytes, size_t bytes_max)
+{
+    int rescheduled = 0;
+    int fin;
+    size_t data_length;
+    size_t consumed;
+    uint64_t stream_id;
+    uint64_t offset;
+    picoquic_stream_head* stream;
 
-            if (data == NULL) {
-                ret = picoquic_connection_error(cnx, PICOQUIC_ERROR_MEMORY, 0);
+    if (picoquic_parse_stream_header(bytes, bytes_max, &stream_id, &offset, &data_length, &fin, &consumed) == 0 &&
+        (stream = picoquic_find_stream(cnx, stream_id, 0)) != NULL && !stream->reset_requested &&
+        picoquic_copy_sent_stream_data(stream, offset, NULL, data_length) == 0 &&
+        picoquic_add_lost_stream_range(stream, offset, offset + data_length) == 0) {
+        rescheduled = 1;
+    }
+
+    return rescheduled;
+}
+
+/* Repeat the first lost range of the stream, or as much of it as fits */
+static int picoquic_prepare_stream_retransmit_frame(picoquic_cnx_t* cnx, picoquic_stream_head* stream,
+    uint8_t* bytes, size_t bytes_max, size_t* consumed)
+{
+    int ret = 0;
+    uint64_t acked_offset = stream->acked_offset;
+    picoquic_stream_range_t* range = NULL;
+
+    *consumed = 0;
+
+    /* Forget what was acknowledged since the loss */
+    while (stream->nb_lost_ranges > 0) {
+        range = &stream->lost_ranges[0];
+        if (range->start < acked_offset) {
+            range->start = (range->end < acked_offset) ? range->end : acked_offset;
+            if (range->start == range->end) {
+                picoquic_remove_first_lost_stream_range(stream);
+                continue;
             }
-            else {
-                data->length = data_length;
-                data->bytes = (uint8_t*)malloc(data_length);
-                if (data->bytes == NULL) {
-                    ret = picoquic_connection_error(cnx, PICOQUIC_ERROR_MEMORY, 0);
-                    free(data);
+        }
+        if (range->end > range->start &&
+            picoquic_check_sack_list(&stream->first_sack_item, range->start, range->end - 1) != 0) {
+            picoquic_remove_first_lost_stream_range(stream);
+            continue;
+        }
+        break;
+    }
+
+    if (stream->nb_lost_ranges > 0) {
+        size_t byte_index = 0;
+        size_t l_stream = 0;
+        size_t l_off = 0;
+
+        bytes[byte_index++] = picoquic_frame_type_stream_range_min;
+
+        if (bytes_max > byte_index) {
+            l_stream = picoquic_varint_encode(bytes + byte_index, bytes_max - byte_index, stream->stream_id);
+            byte_index += l_stream;
+        }
+
+        if (range->start > 0 && bytes_max > byte_index) {
+            bytes[0] |= 4; /* Indicates presence of offset */
+            l_off = picoquic_varint_encode(bytes + byte_index, bytes_max - byte_index, range->start);
+            byte_index += l_off;
+        }
+
+        if (byte_index + 3 > bytes_max || l_stream == 0 || (range->start > 0 && l_off == 0)) {
+            ret = PICOQUIC_ERROR_FRAME_BUFFER_TOO_SMALL;
+        } else {
+            size_t byte_space = bytes_max - byte_index;
+            size_t length;
+
+            if (range->end - range->start >= byte_space) {
+                /* The frame fills the buffer, the length is implicit */
+                length = byte_space;
+            } else {
+                size_t l_len;
+
+                length = (size_t)(range->end - range->start);
+                l_len = picoquic_varint_encode(bytes + byte_index, byte_space, (uint64_t)length);
+                if (l_len + length > byte_space) {
+                    length = byte_space - l_len;
+                    l_len = picoquic_varint_encode(bytes + byte_index, byte_space, (uint64_t)length);
                 }
-                else {
-                    data->offset = offset + start;
-                    memcpy(data->bytes, bytes + start, data_length);
-                    data->next_stream_data = next;
-                    *pprevious = data;
-                    *new_data_available = 1;
+                byte_index += l_len;
+                bytes[0] |= 2; /* Indicates presence of length */
+            }
+
+            if (picoquic_copy_sent_stream_data(stream, range->start, bytes + byte_index, length) != 0) {
+                /* Cannot happen, the data is kept until acknowledged */
+                picoquic_remove_first_lost_stream_range(stream);
+            } else {
+                byte_index += length;
+                range->start += length;
+                cnx->nb_stream_bytes_repeated += length;
+
+                if (range->start == range->end) {
+                    if (stream->fin_sent && range->end == stream->sent_offset) {
+                        bytes[0] |= 1;
+                    }
+                    picoquic_remove_first_lost_stream_range(stream);
                 }
+
+                *consumed = byte_index;
+                cnx->last_visited_stream_id = stream->stream_id;
             }
         }
     }
@@ -865,6 +1277,23 @@ static int picoquic_queue_network_input(picoquic_cnx_t* cnx, picoquic_stream_hea
     return ret;
 }
 
+/* Common code to data stream and crypto hs stream */
+static int picoquic_queue_network_input(picoquic_cnx_t* cnx, picoquic_stream_head* stream, size_t offset, uint8_t* bytes, size_t length, int * new_data_available)
+{
+    int ret = 0;
+
+    if (stream->maxdata_local == (uint64_t)((int64_t)-1) &&
+        offset + length > stream->consumed_offset + PICOQUIC_MAX_CRYPTO_BUFFER_GAP) {
+        /* Crypto streams are not flow controlled, bound the amount of buffered data */
+        ret = picoquic_connection_error(cnx, PICOQUIC_TRANSPORT_CRYPTO_BUFFER_EXCEEDED, 0);
+    } else if (picoquic_stream_reassembly_insert(&stream->reassembly, stream->consumed_offset,
+        offset, bytes, length, new_data_available) != 0) {
+        ret = picoquic_connection_error(cnx, PICOQUIC_ERROR_MEMORY, 0);
+    }
+
+    return ret;
+}
+
 static int picoquic_stream_network_input(picoquic_cnx_t* cnx, uint64_t stream_id,
     uint64_t offset, int fin, uint8_t* bytes, size_t length, uint64_t current_time)
 {
@@ -896,7 +1325,16 @@ static int picoquic_stream_network_input(picoquic_cnx_t* cnx, uint64_t stream_id
         }
     }
 
-    if (ret == 0) {
+    if (ret == 0 && cnx->callback_fn != NULL &&
+        offset <= stream->consumed_offset && offset + length > stream->consumed_offset) {
+        /* In order data is handed to the application straight from the packet,
+         * the queue only holds the segments received out of order. */
+        size_t start = (size_t)(stream->consumed_offset - offset);
+
+        cnx->latest_progress_time = current_time;
+        picoquic_stream_deliver_data(cnx, stream, bytes + start, length - start);
+        should_notify = 1;
+    } else if (ret == 0) {
         int new_data_available = 0;
 
         ret = picoquic_queue_network_input(cnx, stream, (size_t)offset, bytes, length, &new_data_available);
@@ -975,7 +1413,8 @@ protoop_arg_t find_ready_stream(picoquic_cnx_t *cnx) {
             }
         }
         while (stream) {
-            if ((cnx->maxdata_remote > cnx->data_sent && stream->sent_offset < stream->maxdata_remote &&
+            if (stream->nb_lost_ranges > 0 ||
+                (cnx->maxdata_remote > cnx->data_sent && stream->sent_offset < stream->maxdata_remote &&
                 (stream->is_active ||
                 (stream->send_queue != NULL && stream->send_queue->length > stream->send_queue->offset) ||
                 (stream->fin_requested && !stream->fin_sent))) ||
@@ -1179,6 +1618,15 @@ protoop_arg_t prepare_stream_frame(picoquic_cnx_t* cnx)
         return ret;
     }
 
+    if (stream->nb_lost_ranges > 0) {
+        /* Lost data goes before new data */
+        ret = picoquic_prepare_stream_retransmit_frame(cnx, stream, bytes, bytes_max, &consumed);
+        if (ret != 0 || consumed > 0) {
+            protoop_save_outputs(cnx, consumed);
+            return ret;
+        }
+    }
+
     if (!stream->is_active &&
         (stream->send_queue == NULL || stream->send_queue->length <= stream->send_queue->offset) &&
         (!STREAM_FIN_REQUESTED(stream) || STREAM_FIN_SENT(stream))) {
@@ -1299,14 +1747,17 @@ protoop_arg_t prepare_stream_frame(picoquic_cnx_t* cnx)
                 }
 
                 if (ret == 0 && length > 0 && stream->send_queue != NULL && stream->send_queue->bytes != NULL) {
+                    if (stream->send_queue->offset == 0) {
+                        stream->send_queue->stream_offset = stream->sent_offset;
+                    }
                     memcpy(&bytes[byte_index], stream->send_queue->bytes + stream->send_queue->offset, length);
                     byte_index += length;
 
                     stream->send_queue->offset += length;
                     if (stream->send_queue->offset >= stream->send_queue->length) {
+                        /* Keep the data until it is acknowledged */
                         picoquic_stream_data* next = stream->send_queue->next_stream_data;
-                        free(stream->send_queue->bytes);
-                        free(stream->send_queue);
+                        picoquic_retain_sent_stream_data(stream, stream->send_queue);
                         stream->send_queue = next;
                     }
 
@@ -1446,8 +1897,7 @@ protoop_arg_t prepare_plugin_frame(picoquic_cnx_t* cnx)
                 plugin_stream->send_queue->offset += length;
                 if (plugin_stream->send_queue->offset >= plugin_stream->send_queue->length) {
                     picoquic_stream_data* next = plugin_stream->send_queue->next_stream_data;
-                    free(plugin_stream->send_queue->bytes);
-                    free(plugin_stream->send_queue);
+                    picoquic_free_stream_data(plugin_stream->send_queue);
                     plugin_stream->send_queue = next;
                 }
 
@@ -1615,7 +2065,7 @@ protoop_arg_t parse_handshake_done_frame(picoquic_cnx_t* cnx) {
  */
 protoop_arg_t process_handshake_done_frame(picoquic_cnx_t* cnx)
 {
-    uint64_t current_time = picoquic_current_time();
+    uint64_t current_time = picoquic_get_quic_time(cnx->quic);
     if (cnx->client_mode) {
         cnx->handshake_done = 1;
         for (int i = 0; i < cnx->nb_paths; i++) {
@@ -1738,8 +2188,7 @@ protoop_arg_t prepare_crypto_hs_frame(picoquic_cnx_t *cnx)
                 stream->send_queue->offset += length;
                 if (stream->send_queue->offset >= stream->send_queue->length) {
                     picoquic_stream_data* next = stream->send_queue->next_stream_data;
-                    free(stream->send_queue->bytes);
-                    free(stream->send_queue);
+                    picoquic_free_stream_data(stream->send_queue);
                     stream->send_queue = next;
                 }
 
@@ -1843,10 +2292,10 @@ protoop_arg_t check_spurious_retransmission(picoquic_cnx_t *cnx)
     picoquic_path_t* path_x = (picoquic_path_t*) cnx->protoop_inputv[4];
 
     picoquic_packet_context_t * pkt_ctx = (picoquic_packet_context_t *) &path_x->pkt_ctx[pc];
-    picoquic_packet_t* p = pkt_ctx->retransmitted_newest;
+    picoquic_packet_summary_t* p = pkt_ctx->retransmitted_newest;
 
     while (p != NULL) {
-        picoquic_packet_t* should_delete = NULL;
+        picoquic_packet_summary_t* should_delete = NULL;
 
         if (p->sequence_number >= start_of_range && p->sequence_number <= end_of_range) {
 
@@ -1882,6 +2331,14 @@ protoop_arg_t check_spurious_retransmission(picoquic_cnx_t *cnx)
                 }
             }
 
+            /* The stream data was received after all, do not repeat it again */
+            for (size_t i = 0; i < p->nb_stream_ranges; i++) {
+                picoquic_stream_head* stream = picoquic_find_stream(cnx, p->stream_ranges[i].stream_id, 0);
+                if (stream != NULL) {
+                    picoquic_record_acked_stream_data(cnx, stream, p->stream_ranges[i].offset, p->stream_ranges[i].length);
+                }
+            }
+
             cnx->nb_spurious++;
             should_delete = p;
         } else if (p->send_time + PICOQUIC_SPURIOUS_RETRANSMIT_DELAY_MAX < pkt_ctx->latest_time_acknowledged) {
@@ -1989,6 +2446,14 @@ void picoquic_estimate_path_bandwidth(picoquic_cnx_t* cnx, picoquic_path_t* path
     protoop_prepare_and_run_noparam(cnx, &PROTOOP_NOPARAM_ESTIMATE_PATH_BANDWIDTH, NULL, path_x, send_time, delivered_prior, delivered_time_prior, delivered_sent_prior, delivery_time, current_time, rs_is_path_limited);
 }
 
+/* The cached loss times of every packet context depend on the RTT estimate of the path */
+static void picoquic_invalidate_loss_detection_time(picoquic_path_t* path_x)
+{
+    for (picoquic_packet_context_enum pc = 0; pc < picoquic_nb_packet_context; pc++) {
+        path_x->pkt_ctx[pc].loss_detection_time = 0;
+    }
+}
+
 /**
  * See PROTOOP_NOPARAM_UPDATE_RTT
  */
@@ -2009,15 +2474,13 @@ protoop_arg_t update_rtt(picoquic_cnx_t *cnx)
     if (largest > pkt_ctx->highest_acknowledged || pkt_ctx->first_sack_item.start_of_sack_range == (uint64_t)((int64_t)-1) ||
         pkt_ctx->highest_acknowledged == (uint64_t)((int64_t)-1)) { /* This last condition is for Multipath ! */
         pkt_ctx->highest_acknowledged = largest;
+        pkt_ctx->loss_detection_time = 0;
         is_new_ack = 1;
 
         if (ack_delay < PICOQUIC_ACK_DELAY_MAX) {
             /* if the ACK is reasonably recent, use it to update the RTT */
             /* find the stored copy of the largest acknowledged packet */
-
-            while (packet != NULL && packet->sequence_number > largest) {
-                packet = packet->next_packet;
-            }
+            packet = picoquic_retransmit_packet_at_or_below(pkt_ctx, largest);
 
             if (packet == NULL || packet->sequence_number < largest) {
                 /* There is no copy of this packet in store. It may have
@@ -2034,6 +2497,8 @@ protoop_arg_t update_rtt(picoquic_cnx_t *cnx)
 
                 if (rtt_estimate > 0) {
                     picoquic_path_t * old_path = packet->send_path;
+                    uint64_t old_smoothed_rtt = old_path->smoothed_rtt;
+                    uint64_t old_rtt_min = old_path->rtt_min;
 
                     if (ack_delay > old_path->max_ack_delay) {
                         old_path->max_ack_delay = ack_delay;
@@ -2071,6 +2536,10 @@ protoop_arg_t update_rtt(picoquic_cnx_t *cnx)
                     }
                     old_path->rtt_sample = rtt_estimate;
 
+                    if (old_path->smoothed_rtt != old_smoothed_rtt || old_path->rtt_min != old_rtt_min) {
+                        picoquic_invalidate_loss_detection_time(old_path);
+                    }
+
                     if (PICOQUIC_MIN_RETRANSMIT_TIMER > old_path->retransmit_timer) {
                         old_path->retransmit_timer = PICOQUIC_MIN_RETRANSMIT_TIMER;
                     }
@@ -2145,6 +2614,38 @@ static void picoquic_process_ack_of_ack_range(picoquic_cnx_t * cnx, picoquic_sac
         first_sack, start_of_range, end_of_range);
 }
 
+/*
+ * Once the peer received an ACK frame announcing all numbers up to the watermark,
+ * the ranges at or below it do not need to be repeated. The first range keeps at
+ * least its largest number, and ranges straddling the watermark are kept as they
+ * were extended after the ACK was sent.
+ */
+void picoquic_process_ack_of_ack_watermark(picoquic_sack_item_t* first_sack, uint64_t watermark)
+{
+    picoquic_sack_item_t* previous = first_sack;
+    picoquic_sack_item_t* next;
+
+    if (first_sack->start_of_sack_range == (uint64_t)((int64_t)-1)) {
+        return;
+    }
+
+    if (watermark >= first_sack->end_of_sack_range) {
+        first_sack->start_of_sack_range = first_sack->end_of_sack_range;
+    } else if (watermark >= first_sack->start_of_sack_range) {
+        first_sack->start_of_sack_range = watermark + 1;
+    }
+
+    /* Ranges are sorted by decreasing numbers, so everything after the first one below the watermark goes */
+    while ((next = previous->next_sack) != NULL && next->end_of_sack_range > watermark) {
+        previous = next;
+    }
+
+    while ((next = previous->next_sack) != NULL) {
+        previous->next_sack = next->next_sack;
+        free(next);
+    }
+}
+
 int picoquic_process_ack_of_ack_frame(
     picoquic_cnx_t* cnx,
     picoquic_sack_item_t* first_sack,
@@ -2303,15 +2804,10 @@ int picoquic_check_stream_frame_already_acked(picoquic_cnx_t* cnx, uint8_t* byte
     return ret;
 }
 
-/**
- * See PROTOOP_NOPARAM_PROCESS_ACK_OF_STREAM_FRAME
- */
-protoop_arg_t process_ack_of_stream_frame(picoquic_cnx_t* cnx)
+/* Record the acknowledged range of a stream frame, and return its length in consumed */
+static int picoquic_record_ack_of_stream_frame(picoquic_cnx_t* cnx, uint8_t* bytes,
+    size_t bytes_max, size_t* consumed)
 {
-    uint8_t* bytes = (uint8_t*) cnx->protoop_inputv[0];
-    size_t bytes_max = (size_t) cnx->protoop_inputv[1];
-    size_t consumed = (size_t) cnx->protoop_inputv[2];
-
     int ret;
     int fin;
     size_t data_length;
@@ -2321,19 +2817,32 @@ protoop_arg_t process_ack_of_stream_frame(picoquic_cnx_t* cnx)
 
     /* skip stream frame */
     ret = picoquic_parse_stream_header(bytes, bytes_max,
-        &stream_id, &offset, &data_length, &fin, &consumed);
+        &stream_id, &offset, &data_length, &fin, consumed);
 
     if (ret == 0) {
-        consumed += data_length;
+        *consumed += data_length;
 
         /* record the ack range for the stream */
         stream = picoquic_find_stream(cnx, stream_id, 0);
         if (stream != NULL) {
-            (void)picoquic_update_sack_list(cnx, &stream->first_sack_item,
-                offset, offset + data_length - 1);
+            picoquic_record_acked_stream_data(cnx, stream, offset, data_length);
         }
     }
 
+    return ret;
+}
+
+/**
+ * See PROTOOP_NOPARAM_PROCESS_ACK_OF_STREAM_FRAME
+ */
+protoop_arg_t process_ack_of_stream_frame(picoquic_cnx_t* cnx)
+{
+    uint8_t* bytes = (uint8_t*) cnx->protoop_inputv[0];
+    size_t bytes_max = (size_t) cnx->protoop_inputv[1];
+    size_t consumed = (size_t) cnx->protoop_inputv[2];
+
+    int ret = picoquic_record_ack_of_stream_frame(cnx, bytes, bytes_max, &consumed);
+
     protoop_save_outputs(cnx, consumed);
 
     return (protoop_arg_t) ret;
@@ -2349,35 +2858,37 @@ static int picoquic_process_ack_of_stream_frame(picoquic_cnx_t* cnx, uint8_t* by
     return ret;
 }
 
-/**
- * See PROTOOP_NOPARAM_PROCESS_POSSIBLE_ACK_OF_ACK_FRAME
+/*
+ * Process the acknowledgement of a sent packet. The ACK frames that it carried
+ * are not parsed again, the SACK list is pruned using the watermark recorded
+ * at send time. Packets that are not pure ACKs are parsed to record the
+ * acknowledged stream ranges. If direct is set, the stream frames are processed
+ * without going through the protocol operation.
  */
-protoop_arg_t process_possible_ack_of_ack_frame(picoquic_cnx_t* cnx)
+static void picoquic_process_ack_of_packet(picoquic_cnx_t* cnx, picoquic_packet_t* p, int direct)
 {
-    picoquic_packet_t* p = (picoquic_packet_t*) cnx->protoop_inputv[0];
-
     int ret = 0;
     size_t byte_index;
     int frame_is_pure_ack = 0;
     size_t frame_length = 0;
 
-    if (ret == 0 && p->ptype == picoquic_packet_0rtt_protected) {
+    if (p->ptype == picoquic_packet_0rtt_protected) {
         cnx->nb_zero_rtt_acked++;
     }
 
-    byte_index = p->offset;
+    if (p->has_ack_frame) {
+        picoquic_process_ack_of_ack_watermark(&p->send_path->pkt_ctx[p->pc].first_sack_item, p->ack_frame_largest);
+    }
+
+    byte_index = (p->is_pure_ack) ? p->length : p->offset;
 
     while (ret == 0 && byte_index < p->length) {
-        if (p->bytes[byte_index] == picoquic_frame_type_ack) {
-            ret = picoquic_process_ack_of_ack_frame(cnx, &p->send_path->pkt_ctx[p->pc].first_sack_item,
-                &p->bytes[byte_index], p->length - byte_index, &frame_length, 0);
-            byte_index += frame_length;
-        } else if (p->bytes[byte_index] == picoquic_frame_type_ack_ecn) {
-            ret = picoquic_process_ack_of_ack_frame(cnx, &p->send_path->pkt_ctx[p->pc].first_sack_item,
-                &p->bytes[byte_index], p->length - byte_index, &frame_length, 1);
-            byte_index += frame_length;
-        } else if (PICOQUIC_IN_RANGE(p->bytes[byte_index], picoquic_frame_type_stream_range_min, picoquic_frame_type_stream_range_max)) {
-            ret = picoquic_process_ack_of_stream_frame(cnx, &p->bytes[byte_index], p->length - byte_index, &frame_length);
+        if (PICOQUIC_IN_RANGE(p->bytes[byte_index], picoquic_frame_type_stream_range_min, picoquic_frame_type_stream_range_max)) {
+            if (direct) {
+                ret = picoquic_record_ack_of_stream_frame(cnx, &p->bytes[byte_index], p->length - byte_index, &frame_length);
+            } else {
+                ret = picoquic_process_ack_of_stream_frame(cnx, &p->bytes[byte_index], p->length - byte_index, &frame_length);
+            }
             byte_index += frame_length;
         } else {
             ret = picoquic_skip_frame(cnx, &p->bytes[byte_index],
@@ -2385,6 +2896,16 @@ protoop_arg_t process_possible_ack_of_ack_frame(picoquic_cnx_t* cnx)
             byte_index += frame_length;
         }
     }
+}
+
+/**
+ * See PROTOOP_NOPARAM_PROCESS_POSSIBLE_ACK_OF_ACK_FRAME
+ */
+protoop_arg_t process_possible_ack_of_ack_frame(picoquic_cnx_t* cnx)
+{
+    picoquic_packet_t* p = (picoquic_packet_t*) cnx->protoop_inputv[0];
+
+    picoquic_process_ack_of_packet(cnx, p, 0);
 
     return 0;
 }
@@ -2395,6 +2916,77 @@ void picoquic_process_possible_ack_of_ack_frame(picoquic_cnx_t* cnx, picoquic_pa
         p);
 }
 
+/**
+ * See PROTOOP_NOPARAM_PROCESS_ACK_BATCH
+ */
+protoop_arg_t process_ack_batch(picoquic_cnx_t *cnx)
+{
+    picoquic_path_t* path_x = (picoquic_path_t*) cnx->protoop_inputv[0];
+    picoquic_packet_context_enum pc = (picoquic_packet_context_enum) cnx->protoop_inputv[1];
+    uint64_t nb_bytes = (uint64_t) cnx->protoop_inputv[3];
+    uint64_t current_time = (uint64_t) cnx->protoop_inputv[5];
+
+    if (cnx->congestion_alg != NULL) {
+        picoquic_congestion_algorithm_notify_func(cnx, path_x,
+            picoquic_congestion_notification_acknowledgement,
+            0, nb_bytes, 0, current_time);
+    }
+
+    /* Any acknowledgement shows progress */
+    path_x->pkt_ctx[pc].nb_retransmit = 0;
+    path_x->pkt_ctx[pc].latest_progress_time = current_time;
+    path_x->pkt_ctx[pc].loss_detection_time = 0;
+
+    return 0;
+}
+
+void picoquic_ack_batch_flush(picoquic_cnx_t* cnx)
+{
+    picoquic_ack_batch_t batch = cnx->ack_batch;
+
+    if (batch.nb_packets > 0) {
+        memset(&cnx->ack_batch, 0, sizeof(picoquic_ack_batch_t));
+        protoop_prepare_and_run_noparam(cnx, &PROTOOP_NOPARAM_PROCESS_ACK_BATCH, NULL,
+            batch.path, batch.pc, batch.nb_packets, batch.nb_bytes, batch.largest_acked, batch.current_time);
+    }
+}
+
+static void picoquic_ack_batch_add(picoquic_cnx_t* cnx, picoquic_packet_t* p,
+    picoquic_packet_context_enum pc, uint64_t current_time)
+{
+    picoquic_ack_batch_t* batch = &cnx->ack_batch;
+
+    if (batch->nb_packets > 0 && (batch->path != p->send_path || batch->pc != pc)) {
+        picoquic_ack_batch_flush(cnx);
+    }
+
+    if (batch->nb_packets == 0 || p->sequence_number > batch->largest_acked) {
+        batch->largest_acked = p->sequence_number;
+    }
+    batch->path = p->send_path;
+    batch->pc = pc;
+    batch->nb_packets++;
+    batch->nb_bytes += p->length;
+    batch->current_time = current_time;
+}
+
+/*
+ * Whether the operations run for each acknowledged packet only have their core
+ * behaviour, so that process_ack_range can call it directly. The answer is kept
+ * until pluglets are plugged or unplugged.
+ */
+static int picoquic_ack_is_core_only(picoquic_cnx_t* cnx)
+{
+    if (!cnx->ack_core_only_checked) {
+        cnx->ack_core_only = plugin_protoop_is_core_only(cnx, &PROTOOP_NOPARAM_PROCESS_POSSIBLE_ACK_OF_ACK_FRAME, NO_PARAM) &&
+            plugin_protoop_is_core_only(cnx, &PROTOOP_NOPARAM_PROCESS_ACK_OF_STREAM_FRAME, NO_PARAM) &&
+            plugin_protoop_is_core_only(cnx, &PROTOOP_NOPARAM_DEQUEUE_RETRANSMIT_PACKET, NO_PARAM);
+        cnx->ack_core_only_checked = 1;
+    }
+
+    return cnx->ack_core_only;
+}
+
 /**
  * See PROTOOP_NOPARAM_PROCESS_ACK_RANGE
  */
@@ -2408,43 +3000,59 @@ protoop_arg_t process_ack_range(picoquic_cnx_t *cnx)
 
     picoquic_packet_t* p = ppacket;
     int ret = 0;
+    /* Without pluglets on the per packet operations, run them directly */
+    int direct = picoquic_ack_is_core_only(cnx);
+
+    if (p != NULL && p->sequence_number > highest) {
+        /* Jump to the top of the range instead of walking the list */
+        p = picoquic_retransmit_packet_at_or_below(&p->send_path->pkt_ctx[pc], highest);
+    }
+
     /* Compare the range to the retransmit queue */
     while (p != NULL && range > 0) {
         if (p->sequence_number > highest) {
             p = p->next_packet;
+        } else if (p->sequence_number < highest) {
+            /* Skip the numbers that have no packet in the queue */
+            uint64_t skipped = highest - p->sequence_number;
+
+            if (skipped >= range) {
+                range = 0;
+            } else {
+                range -= skipped;
+                highest = p->sequence_number;
+            }
         } else {
-            if (p->sequence_number == highest) {
-                /* TODO: RTT Estimate */
-                picoquic_packet_t* next = p->next_packet;
-                picoquic_path_t * old_path = p->send_path;
-
-                old_path->delivered += p->length;
-                if (cnx->congestion_alg != NULL) {
-                    picoquic_congestion_algorithm_notify_func(cnx, old_path,
-                        picoquic_congestion_notification_acknowledgement,
-                        0, p->length, 0, current_time);
-                }
+            picoquic_packet_t* next = p->next_packet;
+            picoquic_path_t * old_path = p->send_path;
 
-                /* If the packet contained an ACK frame, perform the ACK of ACK pruning logic */
-                picoquic_process_possible_ack_of_ack_frame(cnx, p);
+            /* The congestion control is notified once for the whole ACK frame, after the dequeues */
+            old_path->delivered += p->length;
+            picoquic_ack_batch_add(cnx, p, pc, current_time);
 
-                /* If packet is larger than the current MTU, update the MTU */
-                if ((p->length + p->checksum_overhead) > old_path->send_mtu) {
-                    old_path->send_mtu = (uint32_t)(p->length + p->checksum_overhead);
-                    old_path->mtu_probe_sent = 0;
-                }
+            /* If the packet contained an ACK frame, perform the ACK of ACK pruning logic */
+            if (direct) {
+                picoquic_process_ack_of_packet(cnx, p, 1);
+            } else {
+                picoquic_process_possible_ack_of_ack_frame(cnx, p);
+            }
 
-                /* Any acknowledgement shows progress */
-                p->send_path->pkt_ctx[pc].nb_retransmit = 0;
-                p->send_path->pkt_ctx[pc].latest_progress_time = current_time;
+            /* If packet is larger than the current MTU, update the MTU */
+            if ((p->length + p->checksum_overhead) > old_path->send_mtu) {
+                old_path->send_mtu = (uint32_t)(p->length + p->checksum_overhead);
+                old_path->mtu_probe_sent = 0;
+            }
 
-                if (p->has_handshake_done) {
-                    cnx->handshake_done_acked = 1;
-                }
+            if (p->has_handshake_done) {
+                cnx->handshake_done_acked = 1;
+            }
 
+            if (direct) {
+                picoquic_dequeue_retransmit_packet_core(cnx, p, 1);
+            } else {
                 picoquic_dequeue_retransmit_packet(cnx, p, 1);
-                p = next;
             }
+            p = next;
 
             range--;
             highest--;
@@ -2584,7 +3192,8 @@ protoop_arg_t process_ack_frame_maybe_ecn(picoquic_cnx_t* cnx)
 
         /* Attempt to update the RTT */
         int is_new_ack = 0;
-        picoquic_packet_t* top_packet = picoquic_update_rtt(cnx, frame->largest_acknowledged, current_time, frame->ack_delay, pc, path_x, &is_new_ack);
+        picoquic_packet_t* top_packet = picoquic_update_rtt(cnx, frame->largest_acknowledged,
+            picoquic_get_arrival_time(cnx->quic, current_time), frame->ack_delay, pc, path_x, &is_new_ack);
         uint64_t largest_sent_time = 0;
         uint64_t delivered_prior = 0;
         uint64_t delivered_time_prior = 0;
@@ -2654,6 +3263,8 @@ protoop_arg_t process_ack_frame_maybe_ecn(picoquic_cnx_t* cnx)
             }
         }
 
+        picoquic_ack_batch_flush(cnx);
+
         if (old_path != NULL && is_new_ack) {
             picoquic_estimate_path_bandwidth(cnx, old_path, largest_sent_time,
                                              delivered_prior, delivered_time_prior, delivered_sent_prior,
@@ -3884,12 +4495,11 @@ protoop_arg_t parse_plugin_frame(picoquic_cnx_t* cnx)
 
 void picoquic_plugin_data_callback(picoquic_cnx_t* cnx, picoquic_stream_head* plugin_stream)
 {
-    picoquic_stream_data* data = plugin_stream->stream_data;
+    uint8_t* bytes;
+    size_t data_length;
     plugin_req_pid_t *preq = NULL;
 
-    while (data != NULL && data->offset <= plugin_stream->consumed_offset) {
-        size_t start = (size_t)(plugin_stream->consumed_offset - data->offset);
-        size_t data_length = data->length - start;
+    while ((data_length = picoquic_stream_reassembly_peek(&plugin_stream->reassembly, plugin_stream->consumed_offset, &bytes)) > 0) {
         picoquic_call_back_event_t fin_now = picoquic_callback_no_event;
 
         plugin_stream->consumed_offset += data_length;
@@ -3904,16 +4514,11 @@ void picoquic_plugin_data_callback(picoquic_cnx_t* cnx, picoquic_stream_head* pl
         for (int i = 0; i < cnx->pids_to_request.size; i++) {
             preq = &cnx->pids_to_request.elems[i];
             if (preq->pid_id == plugin_stream->stream_id) {
-                memcpy(preq->data + preq->received_length, data->bytes, data_length);
+                memcpy(preq->data + preq->received_length, bytes, data_length);
                 preq->received_length += data_length;
                 break;
             }
         }
-
-        free(data->bytes);
-        plugin_stream->stream_data = data->next_stream_data;
-        free(data);
-        data = plugin_stream->stream_data;
     }
 
     /* Once all data have been received, process it! */
@@ -4170,6 +4775,9 @@ int picoquic_decode_frames(picoquic_cnx_t* cnx, uint8_t* bytes,
         free(fq);
     }
 
+    /* Acknowledgements processed by plugin frames are reported here */
+    picoquic_ack_batch_flush(cnx);
+
     if (bytes != NULL && ack_needed != 0) {
         cnx->latest_progress_time = current_time;
         pkt_ctx->ack_needed = 1;
@@ -4182,7 +4790,7 @@ int picoquic_decode_frames_without_current_time(picoquic_cnx_t* cnx, uint8_t* by
                                                 size_t bytes_max_size, int epoch, picoquic_path_t* path_x) {
     const uint8_t *bytes_max = bytes + bytes_max_size;
     int ack_needed = 0;
-    uint64_t current_time = picoquic_current_time();
+    uint64_t current_time = picoquic_get_quic_time(cnx->quic);
 
     while (bytes != NULL && bytes < bytes_max) {
         uint64_t frame_type;
@@ -4386,6 +4994,7 @@ void frames_register_noparam_protoops(picoquic_cnx_t *cnx)
     register_noparam_protoop(cnx, &PROTOOP_NOPARAM_UPDATE_ACK_DELAY, &update_ack_delay);
     register_noparam_protoop(cnx, &PROTOOP_NOPARAM_ESTIMATE_PATH_BANDWIDTH, &estimate_path_bandwidth);
     register_noparam_protoop(cnx, &PROTOOP_NOPARAM_PROCESS_ACK_RANGE, &process_ack_range);
+    register_noparam_protoop(cnx, &PROTOOP_NOPARAM_PROCESS_ACK_BATCH, &process_ack_batch);
     register_noparam_protoop(cnx, &PROTOOP_NOPARAM_CHECK_SPURIOUS_RETRANSMISSION, &check_spurious_retransmission);
     register_noparam_protoop(cnx, &PROTOOP_NOPARAM_PROCESS_POSSIBLE_ACK_OF_ACK_FRAME, &process_possible_ack_of_ack_frame);
     register_noparam_protoop(cnx, &PROTOOP_NOPARAM_PROCESS_ACK_OF_STREAM_FRAME, &process_ack_of_stream_frame);
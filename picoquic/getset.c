@@ -767,6 +767,7 @@ void set_pkt_ctx(picoquic_packet_context_t *pkt_ctx, access_key_t ak, protoop_ar
         break;
     case AK_PKTCTX_NB_RETRANSMIT:
         pkt_ctx->nb_retransmit = val;
+        pkt_ctx->loss_detection_time = 0;
         break;
     case AK_PKTCTX_LATEST_RETRANSMIT_TIME:
         pkt_ctx->latest_retransmit_time = val;
@@ -776,6 +777,7 @@ void set_pkt_ctx(picoquic_packet_context_t *pkt_ctx, access_key_t ak, protoop_ar
         break;
     case AK_PKTCTX_HIGHEST_ACKNOWLEDGED:
         pkt_ctx->highest_acknowledged = val;
+        pkt_ctx->loss_detection_time = 0;
         break;
     case AK_PKTCTX_LATEST_TIME_ACKNOWLEDGED:
         pkt_ctx->latest_time_acknowledged = val;
@@ -1042,6 +1044,8 @@ protoop_arg_t get_stream_head(picoquic_stream_head *stream_head, access_key_t ak
         return stream_head->stop_sending_signalled;
     case AK_STREAMHEAD_FLAGS_MAX_STREAM_UPDATED:
         return stream_head->max_stream_updated;
+    case AK_STREAMHEAD_NB_LOST_RANGES:
+        return stream_head->nb_lost_ranges;
     default:
         printf("ERROR: unknown stream head access key %u\n", ak);
         return 0;
@@ -1096,6 +1100,9 @@ void set_stream_head(picoquic_stream_head *stream_head, access_key_t ak, protoop
     case AK_STREAMHEAD_FLAGS_MAX_STREAM_UPDATED:
         stream_head->max_stream_updated = val;
         break;
+    case AK_STREAMHEAD_NB_LOST_RANGES:
+        printf("ERROR: setting the number of lost ranges is not implemented!\n");
+        break;
     default:
         printf("ERROR: unknown stream head access key %u\n", ak);
         break;
@@ -574,9 +574,9 @@ void set_preq(plugin_req_pid_t *preq, access_key_t ak, protoop_arg_t val);
 #define AK_PKTCTX_RETRANSMIT_NEWEST 0x0a
 /** The pointer to the oldest retransmit packet */
 #define AK_PKTCTX_RETRANSMIT_OLDEST 0x0b
-/** The pointer to the newest retransmitted packet */
+/** The pointer to the summary of the newest retransmitted packet */
 #define AK_PKTCTX_RETRANSMITTED_NEWEST 0x0c
-/** The pointer to the oldest retransmitted packet */
+/** The pointer to the summary of the oldest retransmitted packet */
 #define AK_PKTCTX_RETRANSMITTED_OLDEST 0x0d
 /** Indicate if a ack is needed */
 #define AK_PKTCTX_ACK_NEEDED 0x0e
@@ -703,6 +703,8 @@ void set_preq(plugin_req_pid_t *preq, access_key_t ak, protoop_arg_t val);
 #define AK_STREAMHEAD_FLAGS_STOP_SENDING_RECEIVED 0x13
 #define AK_STREAMHEAD_FLAGS_STOP_SENDING_SIGNALLED 0x14
 #define AK_STREAMHEAD_FLAGS_MAX_STREAM_UPDATED 0x15
+/** The number of lost ranges waiting to be sent again */
+#define AK_STREAMHEAD_NB_LOST_RANGES 0x16
 
 /**
  * @}
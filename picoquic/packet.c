@@ -728,7 +728,7 @@ void picoquic_queue_stateless_retry(picoquic_cnx_t* cnx,
 
         byte_index = header_length = picoquic_create_packet_header(cnx, picoquic_packet_retry,
             cnx->path[0],
-            0, bytes, &pn_offset, &pn_length);
+            0, bytes, &pn_offset, &pn_length, NULL);
 
 
         /* use same encoding as packet header */
@@ -1415,9 +1415,17 @@ int picoquic_incoming_segment(
             /* Mark the sequence number as received */
             /* FIXME */
             picoquic_path_t* path_x = picoquic_get_incoming_path(cnx, &ph);
-            ret = picoquic_record_pn_received(cnx, path_x, ph.pc, ph.pn64, current_time);
+            ret = picoquic_record_pn_received(cnx, path_x, ph.pc, ph.pn64,
+                picoquic_get_arrival_time(quic, current_time));
         }
         if (cnx != NULL) {
+            picoquic_receive_batch_t* batch = quic->receive_batch;
+
+            if (batch != NULL && !cnx->wake_time_deferred && batch->nb_cnx < PICOQUIC_RECEIVE_BATCH_MAX) {
+                /* Recompute the wake time once, at the end of the batch */
+                batch->cnx[batch->nb_cnx++] = cnx;
+                cnx->wake_time_deferred = 1;
+            }
             picoquic_cnx_set_next_wake_time(cnx, current_time);
         }
     } else if (ret == PICOQUIC_ERROR_DUPLICATE) {
@@ -1495,6 +1503,49 @@ int picoquic_incoming_packet(
         }
     }
 
+    /* The kernel arrival time only applies to this datagram */
+    quic->rcv_time = 0;
+
+    return ret;
+}
+
+int picoquic_incoming_packets(
+    picoquic_quic_t* quic,
+    picoquic_received_datagram_t* datagrams,
+    size_t nb_datagrams,
+    uint64_t current_time,
+    int* new_context_created)
+{
+    int ret = 0;
+    picoquic_receive_batch_t batch;
+
+    memset(&batch, 0, sizeof(batch));
+    quic->receive_batch = &batch;
+    *new_context_created = 0;
+
+    for (size_t i = 0; ret == 0 && i < nb_datagrams; i++) {
+        int new_context = 0;
+
+        quic->rcv_time = datagrams[i].arrival_time;
+        ret = picoquic_incoming_packet(quic, datagrams[i].bytes, datagrams[i].length,
+            datagrams[i].addr_from, datagrams[i].addr_to, datagrams[i].if_index_to,
+            current_time, &new_context);
+        *new_context_created |= new_context;
+    }
+
+    quic->receive_batch = NULL;
+
+    for (size_t i = 0; i < batch.nb_cnx; i++) {
+        picoquic_cnx_t* cnx = batch.cnx[i];
+        int pending = cnx->wake_time_pending;
+
+        cnx->wake_time_deferred = 0;
+        cnx->wake_time_pending = 0;
+        if (pending) {
+            picoquic_cnx_set_next_wake_time(cnx, current_time);
+        }
+    }
+
     return ret;
 }
 
@@ -20,26 +20,104 @@
 */
 
 /*
- * Basic hash implementation, like we have seen tons off already.
+ * Open addressing hash table with Robin Hood probing and backward shift deletion.
+ * Each bin keeps the full hash of its key, so the compare function is only called
+ * when the hashes match, and the table can be resized without rehashing the keys.
  */
 #include "picohash.h"
 #include <stdlib.h>
 #include <string.h>
 
+#define PICOHASH_MIN_BINS 16
+
+static size_t picohash_probe_distance(picohash_table* hash_table, uint64_t hash, size_t bin)
+{
+    return (bin - (size_t)hash) & (hash_table->nb_bin - 1);
+}
+
+static picohash_item* picohash_alloc_bins(size_t nb_bin)
+{
+    picohash_item* bins = (picohash_item*)malloc(sizeof(picohash_item) * nb_bin);
+
+    if (bins != NULL) {
+        (void)memset(bins, 0, sizeof(picohash_item) * nb_bin);
+    }
+
+    return bins;
+}
+
+/* Place an item known to be absent from the table, displacing richer items along the way */
+static void picohash_place(picohash_table* hash_table, uint64_t hash, void* key)
+{
+    size_t mask = hash_table->nb_bin - 1;
+    size_t bin = (size_t)hash & mask;
+    size_t distance = 0;
+
+    while (hash_table->hash_bin[bin].key != NULL) {
+        size_t resident_distance = picohash_probe_distance(hash_table, hash_table->hash_bin[bin].hash, bin);
+
+        if (resident_distance < distance) {
+            picohash_item displaced = hash_table->hash_bin[bin];
+
+            hash_table->hash_bin[bin].hash = hash;
+            hash_table->hash_bin[bin].key = key;
+            hash = displaced.hash;
+            key = displaced.key;
+            distance = resident_distance;
+        }
+
+        bin = (bin + 1) & mask;
+        distance++;
+    }
+
+    hash_table->hash_bin[bin].hash = hash;
+    hash_table->hash_bin[bin].key = key;
+}
+
+static int picohash_resize(picohash_table* hash_table, size_t nb_bin)
+{
+    int ret = 0;
+    picohash_item* old_bins = hash_table->hash_bin;
+    size_t old_nb_bin = hash_table->nb_bin;
+    picohash_item* new_bins = picohash_alloc_bins(nb_bin);
+
+    if (new_bins == NULL) {
+        ret = -1;
+    } else {
+        hash_table->hash_bin = new_bins;
+        hash_table->nb_bin = nb_bin;
+
+        for (size_t i = 0; i < old_nb_bin; i++) {
+            if (old_bins[i].key != NULL) {
+                picohash_place(hash_table, old_bins[i].hash, old_bins[i].key);
+            }
+        }
+
+        free(old_bins);
+    }
+
+    return ret;
+}
+
 picohash_table* picohash_create(size_t nb_bin,
     uint64_t (*picohash_hash)(void*),
     int (*picohash_compare)(void*, void*))
 {
     picohash_table* t = (picohash_table*)malloc(sizeof(picohash_table));
+    size_t nb_bin_pow2 = PICOHASH_MIN_BINS;
+
+    while (nb_bin_pow2 < nb_bin) {
+        nb_bin_pow2 <<= 1;
+    }
+
     if (t != NULL) {
-        t->hash_bin = (picohash_item**)malloc(sizeof(picohash_item*) * nb_bin);
+        t->hash_bin = picohash_alloc_bins(nb_bin_pow2);
 
         if (t->hash_bin == NULL) {
             free(t);
             t = NULL;
         } else {
-            (void)memset(t->hash_bin, 0, sizeof(picohash_item*) * nb_bin);
-            t->nb_bin = nb_bin;
+            t->nb_bin = nb_bin_pow2;
             t->count = 0;
             t->picohash_hash = picohash_hash;
             t->picohash_compare = picohash_compare;
@@ -52,15 +130,20 @@ picohash_table* picohash_create(size_t nb_bin,
 picohash_item* picohash_retrieve(picohash_table* hash_table, void* key)
 {
     uint64_t hash = hash_table->picohash_hash(key);
-    uint32_t bin = (uint32_t)(hash % hash_table->nb_bin);
-    picohash_item* item = hash_table->hash_bin[bin];
-
-    while (item != NULL) {
-        if (hash_table->picohash_compare(key, item->key) == 0) {
+    size_t mask = hash_table->nb_bin - 1;
+    size_t bin = (size_t)hash & mask;
+    size_t distance = 0;
+    picohash_item* item = NULL;
+
+    while (hash_table->hash_bin[bin].key != NULL &&
+        picohash_probe_distance(hash_table, hash_table->hash_bin[bin].hash, bin) >= distance) {
+        if (hash_table->hash_bin[bin].hash == hash &&
+            hash_table->picohash_compare(key, hash_table->hash_bin[bin].key) == 0) {
+            item = &hash_table->hash_bin[bin];
             break;
-        } else {
-            item = item->next_in_bin;
         }
+        bin = (bin + 1) & mask;
+        distance++;
     }
 
     return item;
@@ -68,18 +151,14 @@ picohash_item* picohash_retrieve(picohash_table* hash_table, void* key)
 
 int picohash_insert(picohash_table* hash_table, void* key)
 {
-    uint64_t hash = hash_table->picohash_hash(key);
-    uint32_t bin = (uint32_t)(hash % hash_table->nb_bin);
     int ret = 0;
-    picohash_item* item = (picohash_item*)malloc(sizeof(picohash_item));
 
-    if (item == NULL) {
-        ret = -1;
-    } else {
-        item->hash = hash;
-        item->key = key;
-        item->next_in_bin = hash_table->hash_bin[bin];
-        hash_table->hash_bin[bin] = item;
+    if (4 * (hash_table->count + 1) > 3 * hash_table->nb_bin) {
+        ret = picohash_resize(hash_table, 2 * hash_table->nb_bin);
+    }
+
+    if (ret == 0) {
+        picohash_place(hash_table, hash_table->picohash_hash(key), key);
         hash_table->count++;
     }
 
@@ -88,34 +167,34 @@ int picohash_insert(picohash_table* hash_table, void* key)
 
 void picohash_item_delete(picohash_table* hash_table, picohash_item* item, int delete_key_too)
 {
-    uint32_t bin = (uint32_t)(item->hash % hash_table->nb_bin);
-    picohash_item* previous = hash_table->hash_bin[bin];
-
-    if (previous == item) {
-        hash_table->hash_bin[bin] = item->next_in_bin;
-    } else
-        while (previous != NULL) {
-            if (previous->next_in_bin == item) {
-                previous->next_in_bin = item->next_in_bin;
-                break;
-            } else {
-                previous = previous->next_in_bin;
-            }
-        }
+    size_t mask = hash_table->nb_bin - 1;
+    size_t bin = (size_t)(item - hash_table->hash_bin);
+    size_t next = (bin + 1) & mask;
 
     if (delete_key_too) {
         free(item->key);
     }
 
-    free(item);
+    /* Shift the following items of the probe sequence back by one bin */
+    while (hash_table->hash_bin[next].key != NULL &&
+        picohash_probe_distance(hash_table, hash_table->hash_bin[next].hash, next) > 0) {
+        hash_table->hash_bin[bin] = hash_table->hash_bin[next];
+        bin = next;
+        next = (next + 1) & mask;
+    }
+
+    hash_table->hash_bin[bin].hash = 0;
+    hash_table->hash_bin[bin].key = NULL;
+    hash_table->count--;
 }
 
 void picohash_delete(picohash_table* hash_table, int delete_key_too)
 {
-    for (uint32_t i = 0; i < hash_table->nb_bin; i++) {
-        while (hash_table->hash_bin[i] != NULL) {
-            /* TODO: could be faster */
-            picohash_item_delete(hash_table, hash_table->hash_bin[i], delete_key_too);
+    if (delete_key_too) {
+        for (size_t i = 0; i < hash_table->nb_bin; i++) {
+            if (hash_table->hash_bin[i].key != NULL) {
+                free(hash_table->hash_bin[i].key);
+            }
         }
     }
 
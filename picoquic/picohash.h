@@ -23,6 +23,11 @@
  * Context hash.
  * Retrieve an object based on a hash of a context ID, or alternatively based on
  * source address and port number.
+ *
+ * The table uses open addressing with Robin Hood probing: items are stored inline
+ * in a power of two array of bins, which doubles when the load factor exceeds 3/4.
+ * Pointers returned by picohash_retrieve are only valid until the next insertion
+ * or deletion.
  */
 #ifndef PICOHASH_H
 #define PICOHASH_H
@@ -35,14 +40,13 @@ extern "C" {
 
 typedef struct _picohash_item {
     uint64_t hash;
-    struct _picohash_item* next_in_bin;
-    void* key;
+    void* key; /* NULL if the bin is empty */
 } picohash_item;
 
 typedef struct picohash_table {
     /* TODO: lock ! */
-    picohash_item** hash_bin;
-    size_t nb_bin;
+    picohash_item* hash_bin;
+    size_t nb_bin; /* Always a power of 2 */
     size_t count;
     uint64_t (*picohash_hash)(void*);
     int (*picohash_compare)(void*, void*);
@@ -62,6 +66,17 @@ void picohash_delete(picohash_table* hash_table, int delete_key_too);
 
 uint64_t picohash_bytes(uint8_t* key, uint32_t length);
 
+/* Final mix of a 64 bit value, so that all input bits affect the low order bits used to pick a bin */
+static inline uint64_t picohash_mix64(uint64_t x)
+{
+    x ^= x >> 33;
+    x *= 0xff51afd7ed558ccdull;
+    x ^= x >> 33;
+    x *= 0xc4ceb9fe1a85ec53ull;
+    x ^= x >> 33;
+    return x;
+}
+
 #ifdef __cplusplus
 }
 #endif
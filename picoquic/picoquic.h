@@ -103,6 +103,7 @@ extern "C" {
 #define PICOQUIC_TRANSPORT_CONNECTION_ID_LIMIT_ERROR (0x9)
 #define PICOQUIC_TRANSPORT_PROTOCOL_VIOLATION (0xA)
 #define PICOQUIC_TRANSPORT_INVALID_TOKEN (0xB)
+#define PICOQUIC_TRANSPORT_CRYPTO_BUFFER_EXCEEDED (0xD)
 #define PICOQUIC_TRANSPORT_CRYPTO_ERROR(Alert) (((uint64_t)0x100) | ((uint64_t)((Alert)&0xFF)))
 #define PICOQUIC_TLS_HANDSHAKE_FAILED (0x201)
 #define PICOQUIC_TLS_FATAL_ALERT_GENERATED (0x202)
@@ -307,6 +308,8 @@ typedef struct st_picoquic_packet_t {
     unsigned int is_mtu_probe : 1;
     unsigned int delivered_app_limited : 1;
     unsigned int has_handshake_done : 1;
+    unsigned int has_ack_frame : 1;
+    uint64_t ack_frame_largest; /* Largest number announced by the ACK frame of the packet, if any */
 
     picoquic_packet_plugin_frame_t *plugin_frames; /* Track plugin bytes */
 
@@ -545,17 +548,24 @@ typedef struct plugin_stat {
 * If the argument is set, the default time function of picotls will be overridden by a function that
 * reads the value of *p_simulated_time.
 *
-* The function "picoquic_current_time()" reads the wall time in microseconds, using the same system calls
-* as picotls. The default socket code in "picosock.[ch]" uses that time function, and returns the time
-* at which messages arrived.
+* The function "picoquic_current_time()" reads the time in microseconds from a monotonic clock,
+* anchored to the wall time when first called. The same clock is used for picotls when the time
+* is not simulated. The default socket code in "picosock.[ch]" uses that time function, and returns
+* the time at which messages arrived.
 *
 * The function "picoquic_get_quic_time()" returns the "virtual time" used by the specified quic
 * context, which can be either the current wall time or the simulated time, depending on how the
 * quic context was initialized.
+*
+* The function "picoquic_stamp_time()" reads the clock once per iteration of the event loop. After
+* it was called, "picoquic_get_quic_time()" returns the stamped time instead of reading the clock,
+* so the application shall stamp the time at each iteration. "picoquic_select()" does it.
 */
 
 uint64_t picoquic_current_time(); /* wall time */
 uint64_t picoquic_get_quic_time(picoquic_quic_t* quic); /* connection time, compatible with simulations */
+uint64_t picoquic_stamp_time(picoquic_quic_t* quic); /* Set the time of the current loop iteration */
+uint64_t picoquic_get_quic_time_for_cnx(picoquic_cnx_t* cnx); /* Same as picoquic_get_quic_time, for plugins */
 
 
 /* Callback function for providing stream data to the application.
@@ -566,6 +576,10 @@ typedef int (*picoquic_stream_data_cb_fn)(picoquic_cnx_t* cnx,
     uint64_t stream_id, uint8_t* bytes, size_t length,
     picoquic_call_back_event_t fin_or_event, void* callback_ctx, void* stream_ctx);
 
+/* Callback used to hand back application owned buffers queued with
+ * "picoquic_add_buffer_to_stream". */
+typedef void (*picoquic_stream_data_release_fn)(void* release_ctx, const uint8_t* data, size_t length);
+
 typedef void (*cnx_id_cb_fn)(picoquic_connection_id_t cnx_id_local,
     picoquic_connection_id_t cnx_id_remote, void* cnx_id_cb_data, picoquic_connection_id_t * cnx_id_returned);
 
@@ -652,6 +666,30 @@ int picoquic_handle_plugin_negotiation(picoquic_cnx_t* cnx);
 /* Set cookie mode on QUIC context when under stress */
 void picoquic_set_cookie_mode(picoquic_quic_t* quic, int cookie_mode);
 
+/* Pre-generate local connection IDs and their reset secrets, e.g. when the event loop is idle.
+ * Returns the number of IDs ready in the pool. */
+size_t picoquic_refill_cnxid_pool(picoquic_quic_t* quic);
+
+/* Start encrypting session tickets with a new key, derived from the secret or random if secret is NULL.
+ * Tickets encrypted with the previous keys remain valid until PICOQUIC_TICKET_KEY_RING_SIZE rotations. */
+int picoquic_rotate_ticket_key(picoquic_quic_t* quic, const uint8_t* secret, size_t secret_length);
+
+/* Size the server anti-replay filter for 0-RTT. Early data is accepted at most once per ticket,
+ * and only for tickets issued less than 3 windows ago. Setting window_ms or nb_entries to 0
+ * removes the filter, and then replays of early data are not detected.
+ * nb_entries is the number of resumptions expected per window. The filter takes 4 * 10 *
+ * nb_entries bits, rounded up to a power of 2, e.g. 8 MB for the default of 10^6 resumptions
+ * per hour. Past that load, most resumptions are deemed replays and fall back to 1-RTT. */
+int picoquic_set_anti_replay(picoquic_quic_t* quic, uint64_t window_ms, size_t nb_entries);
+
+/* Pace new connections by earliest departure time (EDT) instead of waking up for each packet.
+ * Packets are prepared up to horizon microseconds before their departure time, which is returned
+ * with each datagram, and the application hands them to the kernel with that time, e.g. with
+ * picoquic_sendmsg_at on a socket configured with picoquic_socket_set_txtime. A horizon of 0
+ * restores the default pacing. The kernel only holds packets on Linux: elsewhere, including Windows,
+ * picoquic_socket_set_txtime fails and this mode must not be enabled. */
+void picoquic_set_edt_pacing(picoquic_quic_t* quic, uint64_t horizon);
+
 /* Set the TLS certificate chain(DER format) for the QUIC context. The context will take ownership over the certs pointer. */
 void picoquic_set_tls_certificate_chain(picoquic_quic_t* quic, ptls_iovec_t* certs, size_t count);
 
@@ -762,6 +800,28 @@ int picoquic_incoming_packet(
     uint64_t current_time,
     int* new_context_created);
 
+/* Datagram received from the network, e.g., one of the messages returned by recvmmsg */
+typedef struct st_picoquic_received_datagram_t {
+    uint8_t* bytes;
+    uint32_t length;
+    struct sockaddr* addr_from;
+    struct sockaddr* addr_to;
+    int if_index_to;
+    uint64_t arrival_time; /* Kernel arrival time, as returned by picoquic_recvmsg, or 0 if unknown */
+} picoquic_received_datagram_t;
+
+/* Process a batch of received datagrams, as picoquic_incoming_packet would one by one.
+ * Consecutive packets for the same connection share the connection lookup, and the
+ * next wake time of each connection is only computed once, at the end of the batch.
+ * new_context_created is set if any datagram created a new connection.
+ */
+int picoquic_incoming_packets(
+    picoquic_quic_t* quic,
+    picoquic_received_datagram_t* datagrams,
+    size_t nb_datagrams,
+    uint64_t current_time,
+    int* new_context_created);
+
 picoquic_packet_t* picoquic_create_packet(picoquic_cnx_t *cnx);
 
 void picoquic_destroy_packet(picoquic_packet_t *p);
@@ -769,6 +829,27 @@ void picoquic_destroy_packet(picoquic_packet_t *p);
 int picoquic_prepare_packet(picoquic_cnx_t* cnx,
     uint64_t current_time, uint8_t* send_buffer, size_t send_buffer_max, size_t* send_length, picoquic_path_t** path);
 
+/* Datagram prepared by picoquic_prepare_packets. The caller provides the buffer. */
+typedef struct st_picoquic_prepared_datagram_t {
+    uint8_t* send_buffer;
+    size_t send_buffer_max;
+    size_t send_length; /* 0 if nothing was prepared in this datagram */
+    picoquic_path_t* path; /* Path on which the datagram must be sent */
+    uint64_t departure_time; /* Earliest departure time in nanoseconds with EDT pacing, 0 to send now */
+} picoquic_prepared_datagram_t;
+
+/* Prepare a burst of datagrams, up to nb_datagrams_max or until the total length
+ * reaches bytes_max (0 means no byte limit). The burst stops earlier when the
+ * connection has nothing more to send, e.g., because it is limited by the
+ * congestion window or by pacing. The next wake time of the connection is
+ * only computed once, at the end of the burst, even if an error occurs. In
+ * that case, nb_datagrams still counts the datagrams prepared before the
+ * error, and they should be sent, e.g. the last ones before
+ * PICOQUIC_ERROR_DISCONNECTED.
+ */
+int picoquic_prepare_packets(picoquic_cnx_t* cnx, uint64_t current_time,
+    picoquic_prepared_datagram_t* datagrams, size_t nb_datagrams_max, size_t bytes_max, size_t* nb_datagrams);
+
 /* Associate stream with app context */
 int picoquic_set_app_stream_ctx(picoquic_cnx_t* cnx,
                                 uint64_t stream_id, void* app_stream_ctx);
@@ -812,6 +893,17 @@ int picoquic_add_to_stream(picoquic_cnx_t* cnx,
  */
 int picoquic_add_to_stream_with_ctx(picoquic_cnx_t * cnx, uint64_t stream_id, const uint8_t * data, size_t length, int set_fin, void * app_stream_ctx);
 
+/* Same as "picoquic_add_to_stream_with_ctx", but the data is not copied.
+ * The transport keeps a reference to the application buffer and reads the
+ * stream frames directly from it. The buffer must not be modified or freed
+ * until "release_fn" is called with "release_ctx", which happens once the
+ * peer acknowledged all the bytes, since lost data is sent again from the
+ * buffer, or when the stream is reset or the connection deleted. If the call fails, "release_fn" is not called.
+ * A buffer of length 0, e.g. to only set the FIN, is not queued: "release_fn" is called before returning.
+ */
+int picoquic_add_buffer_to_stream(picoquic_cnx_t* cnx, uint64_t stream_id, const uint8_t* data, size_t length, int set_fin,
+    void* app_stream_ctx, picoquic_stream_data_release_fn release_fn, void* release_ctx);
+
 /* Reset a stream, indicating that no more data will be sent on 
  * that stream and that any data currently queued can be abandoned. */
 int picoquic_reset_stream(picoquic_cnx_t* cnx,
@@ -857,6 +949,7 @@ typedef struct st_picoquic_congestion_algorithm_t {
 extern picoquic_congestion_algorithm_t* picoquic_newreno_algorithm;
 extern picoquic_congestion_algorithm_t* picoquic_cubic_algorithm;
 extern picoquic_congestion_algorithm_t* picoquic_bbr_algorithm;
+extern picoquic_congestion_algorithm_t* picoquic_bbr2_algorithm;
 
 #define PICOQUIC_DEFAULT_CONGESTION_ALGORITHM picoquic_cubic_algorithm;
 
@@ -918,6 +1011,10 @@ int picoquic_is_sending_authorized_by_pacing(picoquic_path_t * path_x, uint64_t
 void picoquic_update_pacing_data(picoquic_path_t * path_x);
 void picoquic_update_pacing_rate(picoquic_path_t* path_x, double pacing_rate, uint64_t quantum);
 
+/* Departure time in nanoseconds of the last datagram prepared on the path. Returns 0 unless EDT pacing
+ * is used and the datagram carries a paced packet. Datagrams without one, e.g. pure ACKs, can leave now. */
+uint64_t picoquic_get_departure_time(picoquic_path_t* path_x);
+
 void picoquic_estimate_path_bandwidth(picoquic_cnx_t *cnx, picoquic_path_t* path_x, uint64_t send_time, uint64_t delivered_prior, uint64_t delivered_time_prior, uint64_t delivered_sent_prior,
                                       uint64_t delivery_time, uint64_t current_time, int rs_is_path_limited);
 
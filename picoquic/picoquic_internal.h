@@ -61,11 +61,13 @@ extern "C" {
 
 #define PICOQUIC_MAX_PACKET_SIZE 1536
 #define PICOQUIC_MIN_SEGMENT_SIZE 256
+#define PICOQUIC_MIN_PADDING_PAYLOAD 4
 #define PICOQUIC_INITIAL_MTU_IPV4 1252
 #define PICOQUIC_INITIAL_MTU_IPV6 1232
 #define PICOQUIC_ENFORCED_INITIAL_MTU 1200
 #define PICOQUIC_PRACTICAL_MAX_MTU 1440
 #define PICOQUIC_RETRY_SECRET_SIZE 64
+#define PICOQUIC_CNX_ID_HASH_KEY_SIZE 16 /* SipHash key of the connection ID table */
 #define PICOQUIC_DEFAULT_0RTT_WINDOW 4096
 
 #define PICOQUIC_NUMBER_OF_EPOCHS 4
@@ -77,11 +79,14 @@ extern "C" {
 #define PICOQUIC_MIN_RETRANSMIT_TIMER 50000 /* 50 ms */
 #define PICOQUIC_ACK_DELAY_MAX 25000 /* 25 ms */
 #define PICOQUIC_RACK_DELAY 10000 /* 10 ms */
+#define PICOQUIC_LOSS_PACKET_THRESHOLD 3 /* Reordering threshold in packets, as kPacketThreshold in RFC 9002 */
+#define PICOQUIC_LOSS_TIMER_GRANULARITY 1000 /* 1 ms, as kGranularity in RFC 9002 */
 
 #define PICOQUIC_BANDWIDTH_ESTIMATE_MAX 10000000000ull /* 10 GB per second */
 #define PICOQUIC_BANDWIDTH_TIME_INTERVAL_MIN 1000
 
 #define PICOQUIC_SPURIOUS_RETRANSMIT_DELAY_MAX 1000000 /* one second */
+#define PICOQUIC_RETRANSMIT_INDEX_MIN_SIZE 64
 
 #define PICOQUIC_MICROSEC_SILENCE_MAX 120000000 /* 120 seconds for now */
 #define PICOQUIC_MICROSEC_HANDSHAKE_MAX 15000000 /* 15 seconds for now */
@@ -136,6 +141,7 @@ int picoquic_get_version_index(uint32_t proposed_version);
      */
 typedef struct st_picoquic_stored_ticket_t {
     struct st_picoquic_stored_ticket_t* next_ticket;
+    struct st_picoquic_stored_ticket_t* previous_ticket;
     char* sni;
     char* alpn;
     uint8_t* ticket;
@@ -145,20 +151,63 @@ typedef struct st_picoquic_stored_ticket_t {
     uint16_t ticket_length;
 } picoquic_stored_ticket_t;
 
-int picoquic_store_ticket(picoquic_stored_ticket_t** pp_first_ticket,
+/*
+ * The store keeps at most one ticket per SNI and ALPN, indexed by a hash table
+ * and chained in order of expiry. An all zero store is a valid empty store.
+ * If file_name is set, new tickets are appended to that file.
+ */
+typedef struct st_picoquic_ticket_store_t {
+    picoquic_stored_ticket_t* p_first_ticket; /* Expires first */
+    picoquic_stored_ticket_t* p_last_ticket;
+    picohash_table* table_by_name; /* Created with the first ticket */
+    size_t nb_tickets;
+    char const* file_name;
+    size_t file_length; /* Bytes in the ticket file, including superseded records */
+    size_t live_length; /* Bytes needed to save the current tickets */
+} picoquic_ticket_store_t;
+
+int picoquic_store_ticket(picoquic_ticket_store_t* store,
     uint64_t current_time,
     char const* sni, uint16_t sni_length, char const* alpn, uint16_t alpn_length,
     uint8_t* ticket, uint16_t ticket_length);
-int picoquic_get_ticket(picoquic_stored_ticket_t* p_first_ticket,
+int picoquic_get_ticket(picoquic_ticket_store_t* store,
     uint64_t current_time,
     char const* sni, uint16_t sni_length, char const* alpn, uint16_t alpn_length,
     uint8_t** ticket, uint16_t* ticket_length);
 
-int picoquic_save_tickets(const picoquic_stored_ticket_t* first_ticket,
+int picoquic_save_tickets(const picoquic_ticket_store_t* store,
     uint64_t current_time, char const* ticket_file_name);
-int picoquic_load_tickets(picoquic_stored_ticket_t** pp_first_ticket,
+int picoquic_load_tickets(picoquic_ticket_store_t* store,
     uint64_t current_time, char const* ticket_file_name);
-void picoquic_free_tickets(picoquic_stored_ticket_t** pp_first_ticket);
+void picoquic_free_tickets(picoquic_ticket_store_t* store);
+
+/*
+ * Anti-replay filter for 0-RTT, keeping the session tickets used during the last
+ * windows in a set of Bloom filters, one per time window.
+ */
+#define PICOQUIC_ANTI_REPLAY_FILTERS 4
+#define PICOQUIC_ANTI_REPLAY_HASHES 7
+#define PICOQUIC_ANTI_REPLAY_KEY_SIZE 16
+#define PICOQUIC_ANTI_REPLAY_DEFAULT_WINDOW_MS 3600000ull /* Early data accepted for tickets less than 3 hours old */
+#define PICOQUIC_ANTI_REPLAY_DEFAULT_ENTRIES 1000000 /* Expected resumptions per window, the filters take 8 MB */
+
+typedef struct st_picoquic_anti_replay_t {
+    uint64_t window_ms;
+    uint64_t current_window; /* Current time divided by window_ms */
+    size_t nb_bits; /* Bits per filter, a power of 2 */
+    uint8_t* filters; /* PICOQUIC_ANTI_REPLAY_FILTERS consecutive filters */
+    uint8_t key[PICOQUIC_ANTI_REPLAY_KEY_SIZE];
+} picoquic_anti_replay_t;
+
+picoquic_anti_replay_t* picoquic_anti_replay_create(uint64_t window_ms, size_t nb_entries,
+    const uint8_t key[PICOQUIC_ANTI_REPLAY_KEY_SIZE]);
+void picoquic_anti_replay_delete(picoquic_anti_replay_t* anti_replay);
+/* Record the use of a ticket. Returns 0 if early data can be accepted, -1 if the ticket is too old or was already used */
+int picoquic_anti_replay_check(picoquic_anti_replay_t* anti_replay, const uint8_t* bytes, size_t length,
+    uint64_t issued_ms, uint64_t current_ms);
+
+/* Session ticket keys: the current key encrypts, and the last keys can still decrypt */
+#define PICOQUIC_TICKET_KEY_RING_SIZE 4
 
 
 #define MAX_PLUGIN 64
@@ -195,6 +244,39 @@ typedef struct st_plugin_request_t {
     plugin_req_pid_t elems[MAX_PLUGIN];
 } plugin_request_t;
 
+/*
+ * State of a batch of datagrams processed by picoquic_incoming_packets.
+ * Consecutive packets for the same connection ID reuse the last lookup, and
+ * the wake time of the connections is only recomputed at the end of the batch.
+ */
+#define PICOQUIC_RECEIVE_BATCH_MAX 64
+
+typedef struct st_picoquic_receive_batch_t {
+    picoquic_connection_id_t last_cnx_id;
+    struct st_picoquic_cnx_t* last_cnx; /* NULL if there is no cached lookup */
+    size_t nb_cnx;
+    struct st_picoquic_cnx_t* cnx[PICOQUIC_RECEIVE_BATCH_MAX]; /* Connections with a deferred wake time */
+} picoquic_receive_batch_t;
+
+/*
+ * Pool of pre-generated local connection IDs. The random bytes of a whole
+ * batch are drawn in one call, and the stateless reset secret of each ID is
+ * computed at the same time, so that creating a path or issuing a
+ * NEW_CONNECTION_ID frame does not hit the random generator or the PRF.
+ * The pool is refilled when empty, or ahead of time by calling
+ * picoquic_refill_cnxid_pool when the event loop is idle.
+ */
+#define PICOQUIC_CNXID_POOL_SIZE 32
+
+typedef struct st_picoquic_cnxid_pool_t {
+    uint8_t id_length; /* Length of the pooled IDs, the local_ctx_length at refill time */
+    size_t nb_ready; /* IDs left in the pool, taken from the end */
+    picoquic_connection_id_t cnx_id[PICOQUIC_CNXID_POOL_SIZE];
+    uint8_t reset_secret[PICOQUIC_CNXID_POOL_SIZE][PICOQUIC_RESET_SECRET_SIZE];
+    picoquic_connection_id_t last_cnx_id; /* Last ID handed out, and its reset secret */
+    uint8_t last_reset_secret[PICOQUIC_RESET_SECRET_SIZE];
+} picoquic_cnxid_pool_t;
+
 /*
 	 * QUIC context, defining the tables of connections,
 	 * open sockets, etc.
@@ -209,9 +291,10 @@ typedef struct st_picoquic_quic_t {
     picoquic_alpn_select_fn alpn_select_fn;
     uint8_t reset_seed[PICOQUIC_RESET_SECRET_SIZE];
     uint8_t retry_seed[PICOQUIC_RETRY_SECRET_SIZE];
+    uint8_t cnx_id_hash_key[PICOQUIC_CNX_ID_HASH_KEY_SIZE];
     uint64_t* p_simulated_time;
     char const* ticket_file_name;
-    picoquic_stored_ticket_t* p_first_ticket;
+    picoquic_ticket_store_t ticket_store;
     uint32_t mtu_max;
 
     uint32_t flags;
@@ -229,11 +312,20 @@ typedef struct st_picoquic_quic_t {
     picohash_table* table_cnx_by_id;
     picohash_table* table_cnx_by_net;
 
+    picoquic_receive_batch_t* receive_batch; /* Non NULL while processing a batch of datagrams */
+
+    uint64_t stamped_time; /* Time of the current event loop iteration, 0 if never stamped */
+
+    picoquic_cnxid_pool_t cnxid_pool;
+
     cnx_id_cb_fn cnx_id_callback_fn;
     void* cnx_id_callback_ctx;
 
     void* aead_encrypt_ticket_ctx;
-    void* aead_decrypt_ticket_ctx;
+    void* aead_decrypt_ticket_ctx[PICOQUIC_TICKET_KEY_RING_SIZE]; /* Indexed by key id modulo the ring size */
+    uint8_t ticket_key_id; /* Id of the key used for encryption */
+    picoquic_anti_replay_t* anti_replay; /* NULL if 0-RTT replays are not filtered */
+    uint64_t edt_horizon; /* Earliest departure time pacing of new paths if not 0, see picoquic_set_edt_pacing */
 
     picoquic_verify_certificate_cb_fn verify_certificate_callback_fn;
     picoquic_free_verify_certificate_ctx free_verify_certificate_callback_fn;
@@ -244,6 +336,8 @@ typedef struct st_picoquic_quic_t {
     SOCKET_TYPE rcv_socket;
     /* Last received TOS */
     int rcv_tos;
+    /* Kernel arrival time of the next packet to process, 0 if unknown */
+    uint64_t rcv_time;
 
     picoquic_tp_t * default_tp;
 
@@ -342,8 +436,34 @@ typedef struct _picoquic_stream_data {
     uint64_t offset;  /* Stream offset of the first octet in "bytes" */
     size_t length;    /* Number of octets in "bytes" */
     uint8_t* bytes;
+    uint64_t stream_offset; /* On the send side, stream offset of bytes[0], set when sending starts */
+    /* If set, "bytes" is owned by the application and handed back through
+     * this callback instead of being freed by the stack. */
+    picoquic_stream_data_release_fn release_fn;
+    void* release_ctx;
 } picoquic_stream_data;
 
+/*
+ * Received data waiting for reassembly. The bytes are stored at their offset
+ * in one buffer, the array of received ranges is sorted by offset.
+ */
+#define PICOQUIC_REASSEMBLY_MIN_SIZE 4096
+#define PICOQUIC_MAX_CRYPTO_BUFFER_GAP 0x10000
+
+typedef struct st_picoquic_stream_range_t {
+    uint64_t start;
+    uint64_t end;
+} picoquic_stream_range_t;
+
+typedef struct st_picoquic_stream_reassembly_t {
+    uint8_t* bytes; /* Holds the stream bytes from base_offset to base_offset + bytes_size */
+    size_t bytes_size;
+    uint64_t base_offset;
+    picoquic_stream_range_t* ranges; /* Disjoint ranges received above the consumed offset */
+    size_t nb_ranges;
+    size_t ranges_size;
+} picoquic_stream_reassembly_t;
+
 typedef struct _picoquic_stream_head {
     struct _picoquic_stream_head* next_stream;
     uint64_t stream_id;
@@ -355,10 +475,17 @@ typedef struct _picoquic_stream_head {
     uint64_t remote_error;
     uint64_t local_stop_error;
     uint64_t remote_stop_error;
-    picoquic_stream_data* stream_data;
+    picoquic_stream_reassembly_t reassembly;
     uint64_t sent_offset;
     uint64_t sending_offset;
     picoquic_stream_data* send_queue;
+    /* Sent data is kept until acknowledged, lost ranges are retransmitted from it */
+    picoquic_stream_data* sent_queue;
+    picoquic_stream_data* sent_queue_last;
+    uint64_t acked_offset; /* All the data below was acknowledged */
+    picoquic_stream_range_t* lost_ranges; /* Sorted by offset, disjoint */
+    size_t nb_lost_ranges;
+    size_t lost_ranges_size;
     void *app_stream_ctx;
     picoquic_sack_item_t first_sack_item;
     /* Flags describing the state of the stream */
@@ -403,6 +530,40 @@ typedef struct st_picoquic_crypto_context_t {
  * 2: Initial
  */
 
+/*
+ * Summary of a packet that was declared lost, kept after its retransmission
+ * in order to detect spurious retransmissions. The payload is released, only
+ * the ranges of stream data that the packet carried are kept.
+ */
+typedef struct st_picoquic_stream_data_range_t {
+    uint64_t stream_id;
+    uint64_t offset;
+    uint64_t length;
+} picoquic_stream_data_range_t;
+
+typedef struct st_picoquic_packet_summary_t {
+    struct st_picoquic_packet_summary_t* previous_packet;
+    struct st_picoquic_packet_summary_t* next_packet;
+    struct st_picoquic_path_t* send_path;
+    uint64_t sequence_number;
+    uint64_t send_time;
+    uint32_t length;
+    uint32_t checksum_overhead;
+    picoquic_packet_context_enum pc;
+    size_t nb_stream_ranges;
+    picoquic_stream_data_range_t* stream_ranges; /* Allocated with the summary */
+} picoquic_packet_summary_t;
+
+/*
+ * Slot of the retransmit index. A number without a packet in the queue keeps in
+ * "below" a lower number, such that no packet is queued between the two.
+ */
+typedef struct st_picoquic_retransmit_slot_t {
+    uint64_t sequence_number;
+    uint64_t below;
+    picoquic_packet_t* packet;
+} picoquic_retransmit_slot_t;
+
 typedef struct st_picoquic_packet_context_t {
     uint64_t send_sequence;
 
@@ -418,10 +579,13 @@ typedef struct st_picoquic_packet_context_t {
     uint64_t latest_retransmit_cc_notification_time;
     uint64_t highest_acknowledged;
     uint64_t latest_time_acknowledged; /* time at which the highest acknowledged was sent */
+    uint64_t loss_detection_time; /* Time at which the oldest packet is lost or probed, 0 if not known */
     picoquic_packet_t* retransmit_newest;
     picoquic_packet_t* retransmit_oldest;
-    picoquic_packet_t* retransmitted_newest;
-    picoquic_packet_t* retransmitted_oldest;
+    struct st_picoquic_packet_summary_t* retransmitted_newest;
+    struct st_picoquic_packet_summary_t* retransmitted_oldest;
+    picoquic_retransmit_slot_t* retransmit_index; /* Packets of the retransmit list, by sequence number */
+    size_t retransmit_index_size;
 
     unsigned int ack_needed : 1;
 
@@ -480,12 +644,19 @@ typedef struct st_picoquic_path_t {
      * - pacing_bucket_max: maximum value (capacity) of the leaky bucket.
      * - pacing_packet_time_nanosec: number of nanoseconds required to send a full size packet.
      * - pacing_packet_time_microsec: max of (packet_time_nano_sec/1024, 1) microsec.
+     * In earliest departure time (EDT) mode, the leaky bucket is replaced by:
+     * - pacing_edt_horizon: how far ahead of their departure packets can be prepared, in microsec.
+     * - pacing_next_departure_nanosec: earliest departure time of the next packet.
+     * - pacing_departure_nanosec: departure time of the paced packet in the last datagram, 0 if none.
      */
     uint64_t pacing_evaluation_time;
     uint64_t pacing_bucket_nanosec;
     uint64_t pacing_bucket_max;
     uint64_t pacing_packet_time_nanosec;
     uint64_t pacing_packet_time_microsec;
+    uint64_t pacing_edt_horizon;
+    uint64_t pacing_next_departure_nanosec;
+    uint64_t pacing_departure_nanosec;
 
     /* Statistics */
     uint64_t nb_pkt_sent;
@@ -566,6 +737,9 @@ typedef struct protoop_plugin {
     uint64_t bytes_in_flight; /* Number of bytes in flight due to generated frames */
     uint64_t bytes_total; /* Number of total bytes by generated frames, for monitoring */
     uint64_t frames_total; /* Number of total generated frames, for monitoring */
+    uint64_t drr_deficit; /* Bytes the plugin may still schedule in the current DRR round */
+    struct protoop_plugin *drr_next; /* Next plugin with pending reservations, NULL if none are pending */
+    struct protoop_plugin *drr_prev; /* Previous plugin with pending reservations */
     uint64_t hash;         /* Hash of the plugin name */
     plugin_parameters_t params;
     /* With uBPF, we don't want the VM it corrupts the memory of another context.
@@ -625,6 +799,7 @@ int register_noparam_protoop(picoquic_cnx_t* cnx, protoop_id_t *pid, protocol_op
 int register_param_protoop(picoquic_cnx_t* cnx, protoop_id_t *pid, param_id_t param, protocol_operation op);
 int register_param_protoop_default(picoquic_cnx_t* cnx, protoop_id_t *pid, protocol_operation op);
 void register_protocol_operations(picoquic_cnx_t *cnx);
+void picoquic_free_protoops_and_plugins(picoquic_cnx_t* cnx);
 
 void packet_register_noparam_protoops(picoquic_cnx_t *cnx);
 void frames_register_noparam_protoops(picoquic_cnx_t *cnx);
@@ -635,6 +810,20 @@ void quicctx_register_noparam_protoops(picoquic_cnx_t *cnx);
 
 #define MAX_PLUGIN_DATA_LEN (1024 * 1000) /* In bytes */
 
+/*
+ * Acknowledgements collected while processing ACK frames.
+ * Newly acknowledged packets are summed up and reported once per frame,
+ * see PROTOOP_NOPARAM_PROCESS_ACK_BATCH.
+ */
+typedef struct st_picoquic_ack_batch_t {
+    picoquic_path_t* path;
+    picoquic_packet_context_enum pc;
+    uint64_t nb_packets;
+    uint64_t nb_bytes;
+    uint64_t largest_acked;
+    uint64_t current_time;
+} picoquic_ack_batch_t;
+
 /*
  * Per connection context.
  * This is the structure that will be passed to pluglets.
@@ -700,6 +889,8 @@ typedef struct st_picoquic_cnx_t {
 
     /* Next time sending data is expected */
     uint64_t next_wake_time;
+    unsigned int wake_time_deferred : 1; /* Set while preparing a burst, the wake time is computed once at its end */
+    unsigned int wake_time_pending : 1; /* The wake time was invalidated during the burst */
     struct st_picoquic_cnx_t* next_by_wake_time;
     struct st_picoquic_cnx_t* previous_by_wake_time;
 
@@ -722,9 +913,14 @@ typedef struct st_picoquic_cnx_t {
     uint32_t nb_zero_rtt_acked;
     uint64_t nb_retransmission_total;
     uint64_t nb_spurious;
+    uint64_t nb_stream_bytes_repeated; /* Lost stream data sent again from the sent queues */
 
     /* Congestion algorithm */
     picoquic_congestion_algorithm_t const* congestion_alg;
+    picoquic_ack_batch_t ack_batch; /* Acknowledgements not yet notified to the congestion algorithm */
+    unsigned int ack_core_only_checked : 1; /* ack_core_only is valid, cleared when pluglets change */
+    unsigned int ack_core_only : 1; /* No pluglet on the operations run for each acknowledged packet */
+    picoquic_packet_t* retired_packets; /* Lost packets, released at the end of picoquic_prepare_packet */
 
     /* Flow control information */
     uint64_t data_sent;
@@ -757,8 +953,11 @@ typedef struct st_picoquic_cnx_t {
     queue_t *retry_frames;
     /* Queues of frames to be retransmitted */
     queue_t *rtx_frames[picoquic_nb_packet_context];
-    /* Keep a pointer to the next plugin to look at first */
+    /* Circular list of plugins having pending reservations, starting by the next one to look at */
     protoop_plugin_t *first_drr;
+    int nb_drr_plugins;
+    /* Sum of the bytes in flight of all plugins */
+    uint64_t plugins_bytes_in_flight;
     /* Core guaranteed rate (fraction over 1000) */
     uint16_t core_rate;
 
@@ -920,8 +1119,18 @@ int picoquic_register_cnx_id(picoquic_quic_t* quic, picoquic_cnx_t* cnx, const p
 int picoquic_register_cnx_id_for_cnx(picoquic_cnx_t* cnx, const picoquic_connection_id_t* cnx_id);
 
 /* handling of retransmission queue */
+void picoquic_queue_for_retransmit(picoquic_cnx_t* cnx, picoquic_path_t* path_x, picoquic_packet_t* packet,
+    size_t length, uint64_t current_time);
 void picoquic_dequeue_retransmit_packet(picoquic_cnx_t* cnx, picoquic_packet_t* p, int should_free);
-void picoquic_dequeue_retransmitted_packet(picoquic_cnx_t* cnx, picoquic_packet_t* p);
+void picoquic_dequeue_retransmit_packet_core(picoquic_cnx_t* cnx, picoquic_packet_t* p, int should_free);
+void picoquic_dequeue_retransmitted_packet(picoquic_cnx_t* cnx, picoquic_packet_summary_t* p);
+void picoquic_free_retired_packets(picoquic_cnx_t* cnx);
+
+void picoquic_plugin_drr_activate(picoquic_cnx_t* cnx, protoop_plugin_t* p);
+void picoquic_plugin_drr_deactivate(picoquic_cnx_t* cnx, protoop_plugin_t* p);
+picoquic_packet_t* picoquic_retransmit_packet_by_number(picoquic_packet_context_t* pkt_ctx, uint64_t sequence_number);
+picoquic_packet_t* picoquic_retransmit_packet_at_or_below(picoquic_packet_context_t* pkt_ctx, uint64_t sequence_number);
+void picoquic_retransmit_index_clear(picoquic_packet_context_t* pkt_ctx);
 void picoquic_implicit_handshake_ack(picoquic_cnx_t* cnx, picoquic_path_t *path, picoquic_packet_context_enum pc, uint64_t current_time);
 
 /* Reset connection after receiving version negotiation */
@@ -952,6 +1161,11 @@ void picoquic_cnx_set_next_wake_time(picoquic_cnx_t* cnx, uint64_t current_time)
 
 void picoquic_create_random_cnx_id(picoquic_quic_t* quic, picoquic_connection_id_t * cnx_id, uint8_t id_length);
 void picoquic_create_random_cnx_id_for_cnx(picoquic_cnx_t* cnx, picoquic_connection_id_t *cnx_id, uint8_t id_length);
+int picoquic_get_pooled_reset_secret(picoquic_quic_t* quic, picoquic_connection_id_t* cnx_id,
+    uint8_t reset_secret[PICOQUIC_RESET_SECRET_SIZE]);
+
+/* Kernel arrival time of the packet being processed if known, else current_time */
+uint64_t picoquic_get_arrival_time(picoquic_quic_t* quic, uint64_t current_time);
 
 /* Integer parsing macros */
 #define PICOPARSE_16(b) ((((uint16_t)(b)[0]) << 8) | (b)[1])
@@ -1015,7 +1229,8 @@ uint32_t picoquic_create_packet_header(
     uint64_t sequence_number,
     uint8_t* bytes,
     uint32_t * pn_offset,
-    uint32_t * pn_length);
+    uint32_t * pn_length,
+    picoquic_packet_header* ph);
 
 uint32_t  picoquic_predict_packet_header_length(
     picoquic_cnx_t* cnx,
@@ -1076,6 +1291,10 @@ int picoquic_parse_header_and_decrypt(
     uint32_t * consumed,
     int * new_context_created);
 
+/* Long term inflight bound of BBRv2 on the path, UINT64_MAX if not set or if
+ * the path does not use BBRv2. Used by the tests. */
+uint64_t picoquic_bbr2_get_inflight_hi(picoquic_cnx_t* cnx, picoquic_path_t* path_x);
+
 /* Handling of packet logging */
 void picoquic_log_decrypted_segment(void* F_log, int log_cnxid, picoquic_cnx_t* cnx,
     int receiving, picoquic_packet_header * ph, uint8_t* bytes, size_t length, int ret);
@@ -1132,6 +1351,10 @@ int picoquic_process_ack_of_ack_frame(
     picoquic_cnx_t* cnx,
     picoquic_sack_item_t* first_sack,
     uint8_t* bytes, size_t bytes_max, size_t* consumed, int is_ecn);
+void picoquic_process_ack_of_ack_watermark(picoquic_sack_item_t* first_sack, uint64_t watermark);
+
+/* Report the acknowledgements collected in cnx->ack_batch, if any */
+void picoquic_ack_batch_flush(picoquic_cnx_t* cnx);
 
 /* stream management */
 picoquic_stream_head* picoquic_create_stream(picoquic_cnx_t* cnx, uint64_t stream_id);
@@ -1164,6 +1387,17 @@ void picoquic_update_max_stream_ID_local(picoquic_cnx_t* cnx, picoquic_stream_he
 int picoquic_prepare_max_stream_ID_frame_if_needed(picoquic_cnx_t* cnx,
     uint8_t* bytes, size_t bytes_max, size_t* consumed);
 void picoquic_clear_stream(picoquic_stream_head* stream);
+void picoquic_free_stream_data(picoquic_stream_data* stream_data);
+void picoquic_retain_sent_stream_data(picoquic_stream_head* stream, picoquic_stream_data* stream_data);
+void picoquic_record_acked_stream_data(picoquic_cnx_t* cnx, picoquic_stream_head* stream, uint64_t offset, uint64_t length);
+void picoquic_clear_sent_stream_data(picoquic_stream_head* stream);
+int picoquic_reschedule_lost_stream_frame(picoquic_cnx_t* cnx, uint8_t* bytes, size_t bytes_max);
+
+int picoquic_stream_reassembly_insert(picoquic_stream_reassembly_t* reassembly, uint64_t consumed_offset,
+    uint64_t offset, const uint8_t* bytes, size_t length, int* new_data_available);
+/* Returns the length of the contiguous data available at the consumed offset, and a pointer to it */
+size_t picoquic_stream_reassembly_peek(picoquic_stream_reassembly_t* reassembly, uint64_t consumed_offset, uint8_t** bytes);
+void picoquic_stream_reassembly_clear(picoquic_stream_reassembly_t* reassembly);
 int picoquic_prepare_path_challenge_frame(picoquic_cnx_t* cnx, uint8_t* bytes,
     size_t bytes_max, size_t* consumed, picoquic_path_t * path);
 
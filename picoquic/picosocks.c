@@ -19,9 +19,18 @@
 * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 */
 
+#ifdef __linux__
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE /* sendmmsg */
+#endif
+#endif
 #include <sys/stat.h>
 #include "picosocks.h"
 #include "util.h"
+#ifdef __linux__
+#include <time.h>
+#include <linux/net_tstamp.h>
+#endif
 
 static int bind_to_port(SOCKET_TYPE fd, int af, int port)
 {
@@ -50,6 +59,43 @@ static int bind_to_port(SOCKET_TYPE fd, int af, int port)
     return bind(fd, (struct sockaddr*)&sa, addr_length);
 }
 
+/*
+ * Ask the kernel to time stamp incoming packets. The stamps are returned as
+ * control messages by picoquic_recvmsg. This is a no-op on platforms that do
+ * not support SO_TIMESTAMPNS; the packets are then stamped by picoquic_select.
+ */
+int picoquic_socket_set_timestamping(SOCKET_TYPE fd)
+{
+    int ret = 0;
+#ifdef SO_TIMESTAMPNS
+    int val = 1;
+    ret = setsockopt(fd, SOL_SOCKET, SO_TIMESTAMPNS, (char*)&val, sizeof(int));
+#else
+    (void)fd;
+#endif
+    return ret;
+}
+
+/*
+ * Let the kernel hold each packet until the departure time passed to
+ * picoquic_sendmsg_at. The fq qdisc must be installed on the interface.
+ * Returns an error on platforms that do not support SO_TXTIME.
+ */
+int picoquic_socket_set_txtime(SOCKET_TYPE fd)
+{
+    int ret = -1;
+#if defined(__linux__) && defined(SO_TXTIME)
+    struct sock_txtime txtime_config;
+
+    memset(&txtime_config, 0, sizeof(txtime_config));
+    txtime_config.clockid = CLOCK_MONOTONIC;
+    ret = setsockopt(fd, SOL_SOCKET, SO_TXTIME, (char*)&txtime_config, sizeof(txtime_config));
+#else
+    (void)fd;
+#endif
+    return ret;
+}
+
 int picoquic_open_server_sockets(picoquic_server_sockets_t* sockets, int port)
 {
     int ret = 0;
@@ -103,6 +149,8 @@ int picoquic_open_server_sockets(picoquic_server_sockets_t* sockets, int port)
             }
 #endif
             if (ret == 0) {
+                /* Not fatal: packets are then time stamped in user space */
+                (void)picoquic_socket_set_timestamping(sockets->s_socket[i]);
                 ret = bind_to_port(sockets->s_socket[i], sock_af[i], port);
             }
         }
@@ -121,14 +169,57 @@ void picoquic_close_server_sockets(picoquic_server_sockets_t* sockets)
     }
 }
 
-int picoquic_recvmsg(SOCKET_TYPE fd,
+/* Real time and picoquic time read together, to convert the kernel time stamps */
+typedef struct st_picoquic_rcv_clock_t {
+    uint64_t wall_now;
+    uint64_t now;
+} picoquic_rcv_clock_t;
+
+#if !defined(_WINDOWS) && defined(SO_TIMESTAMPNS)
+static void picoquic_rcv_clock_read(picoquic_rcv_clock_t* rcv_clock, uint64_t now)
+{
+    struct timeval tv;
+
+    (void)gettimeofday(&tv, NULL);
+    rcv_clock->wall_now = (tv.tv_sec * 1000000ull) + tv.tv_usec;
+    rcv_clock->now = now;
+}
+
+/*
+ * The kernel stamps packets with the real time clock, while picoquic uses a
+ * monotonic clock. Convert by measuring how long the packet waited in the
+ * socket queue, and subtracting that delay from the current time. Returns 0
+ * if the stamp cannot be trusted, e.g. if the wall clock was just changed.
+ */
+static uint64_t picoquic_kernel_time_to_current(const struct timespec* ts, const picoquic_rcv_clock_t* rcv_clock)
+{
+    uint64_t kernel_time = (ts->tv_sec * 1000000ull) + (ts->tv_nsec / 1000);
+    uint64_t arrival_time = 0;
+
+    if (kernel_time != 0 && kernel_time <= rcv_clock->wall_now &&
+        rcv_clock->wall_now - kernel_time < PICOQUIC_MAX_RCV_QUEUE_DELAY) {
+        uint64_t queue_delay = rcv_clock->wall_now - kernel_time;
+
+        if (queue_delay < rcv_clock->now) {
+            arrival_time = rcv_clock->now - queue_delay;
+        }
+    }
+
+    return arrival_time;
+}
+#endif
+
+/* Same as picoquic_recvmsg, with the clocks read once by the caller, or NULL to read them here */
+static int picoquic_recvmsg_clock(SOCKET_TYPE fd,
     struct sockaddr_storage* addr_from,
     socklen_t* from_length,
     struct sockaddr_storage* addr_dest,
     socklen_t* dest_length,
     unsigned long* dest_if,
     uint8_t* buffer, int buffer_max,
-    int *tos)
+    int *tos,
+    uint64_t* arrival_time,
+    const picoquic_rcv_clock_t* rcv_clock)
 #ifdef _WINDOWS
 {
     GUID WSARecvMsg_GUID = WSAID_WSARECVMSG;
@@ -150,6 +241,12 @@ int picoquic_recvmsg(SOCKET_TYPE fd,
         *dest_if = 0;
     }
 
+    UNREFERENCED_PARAMETER(rcv_clock);
+
+    if (arrival_time != NULL) {
+        *arrival_time = 0;
+    }
+
     nResult = WSAIoctl(fd, SIO_GET_EXTENSION_FUNCTION_POINTER,
         &WSARecvMsg_GUID, sizeof WSARecvMsg_GUID,
         &WSARecvMsg, sizeof WSARecvMsg,
@@ -235,6 +332,10 @@ int picoquic_recvmsg(SOCKET_TYPE fd,
         *dest_if = 0;
     }
 
+    if (arrival_time != NULL) {
+        *arrival_time = 0;
+    }
+
     dataBuf.iov_base = (char*)buffer;
     dataBuf.iov_len = buffer_max;
 
@@ -305,6 +406,18 @@ int picoquic_recvmsg(SOCKET_TYPE fd,
                 } else if (cmsg->cmsg_type == IPV6_TCLASS && tos) {
                         *tos = *(int *) CMSG_DATA(cmsg);
                 }
+            } else if (cmsg->cmsg_level == SOL_SOCKET && arrival_time != NULL) {
+#ifdef SO_TIMESTAMPNS
+                if (cmsg->cmsg_type == SCM_TIMESTAMPNS) {
+                    picoquic_rcv_clock_t local_clock;
+
+                    if (rcv_clock == NULL) {
+                        picoquic_rcv_clock_read(&local_clock, picoquic_current_time());
+                        rcv_clock = &local_clock;
+                    }
+                    *arrival_time = picoquic_kernel_time_to_current((struct timespec*)CMSG_DATA(cmsg), rcv_clock);
+                }
+#endif
             }
         }
     }
@@ -313,13 +426,195 @@ int picoquic_recvmsg(SOCKET_TYPE fd,
 }
 #endif
 
-int picoquic_sendmsg(SOCKET_TYPE fd,
+int picoquic_recvmsg(SOCKET_TYPE fd,
+    struct sockaddr_storage* addr_from,
+    socklen_t* from_length,
+    struct sockaddr_storage* addr_dest,
+    socklen_t* dest_length,
+    unsigned long* dest_if,
+    uint8_t* buffer, int buffer_max,
+    int *tos,
+    uint64_t* arrival_time)
+{
+    return picoquic_recvmsg_clock(fd, addr_from, from_length, addr_dest, dest_length, dest_if,
+        buffer, buffer_max, tos, arrival_time, NULL);
+}
+
+#if defined(__linux__) && defined(SO_TXTIME)
+/*
+ * Departure times are expressed with picoquic_current_time(), while SO_TXTIME
+ * sockets use the raw monotonic clock. Both advance at the same rate.
+ */
+static uint64_t picoquic_departure_time_to_txtime(uint64_t departure_time)
+{
+    struct timespec ts;
+    uint64_t now = picoquic_current_time() * 1000;
+    uint64_t txtime;
+
+    (void)clock_gettime(CLOCK_MONOTONIC, &ts);
+    txtime = (ts.tv_sec * 1000000000ull) + ts.tv_nsec;
+    if (departure_time > now) {
+        txtime += departure_time - now;
+    }
+
+    return txtime;
+}
+#endif
+
+#ifndef _WINDOWS
+/* Format the message header and the control messages of one datagram */
+static void picoquic_sendmsg_format(struct msghdr* msg, struct iovec* dataBuf,
+    char* cmsg_buffer, size_t cmsg_buffer_size,
     struct sockaddr* addr_dest,
     socklen_t dest_length,
     struct sockaddr* addr_from,
     socklen_t from_length,
     unsigned long dest_if,
-    const char* bytes, int length)
+    const char* bytes, int length,
+    uint64_t departure_time)
+{
+    int control_length = 0;
+    struct cmsghdr* cmsg;
+
+    /* Format the message header */
+
+    dataBuf->iov_base = (char*)bytes;
+    dataBuf->iov_len = length;
+
+    memset(msg, 0, sizeof(struct msghdr));
+    msg->msg_name = addr_dest;
+    msg->msg_namelen = dest_length;
+    msg->msg_iov = dataBuf;
+    msg->msg_iovlen = 1;
+    msg->msg_control = (void*)cmsg_buffer;
+    msg->msg_controllen = cmsg_buffer_size;
+
+    /* Format the control message */
+    cmsg = CMSG_FIRSTHDR(msg);
+
+    if (addr_from != NULL && from_length != 0) {
+        if (addr_from->sa_family == AF_INET) {
+#ifdef IP_PKTINFO
+            memset(cmsg, 0, CMSG_SPACE(sizeof(struct in_pktinfo)));
+            cmsg->cmsg_level = IPPROTO_IP;
+            cmsg->cmsg_type = IP_PKTINFO;
+            cmsg->cmsg_len = CMSG_LEN(sizeof(struct in_pktinfo));
+            struct in_pktinfo* pktinfo = (struct in_pktinfo*)CMSG_DATA(cmsg);
+            pktinfo->ipi_spec_dst.s_addr = ((struct sockaddr_in*)addr_from)->sin_addr.s_addr;
+            pktinfo->ipi_ifindex = dest_if;
+            control_length += CMSG_SPACE(sizeof(struct in_pktinfo));
+#else
+            /* The IP_PKTINFO structure is not defined on BSD */
+            memset(cmsg, 0, CMSG_SPACE(sizeof(struct in_addr)));
+            cmsg->cmsg_level = IPPROTO_IP;
+            cmsg->cmsg_type = IP_SENDSRCADDR;
+            cmsg->cmsg_len = CMSG_LEN(sizeof(struct in_addr));
+            struct in_addr* pktinfo = (struct in_addr*)CMSG_DATA(cmsg);
+            pktinfo->s_addr = ((struct sockaddr_in*)addr_from)->sin_addr.s_addr;
+            control_length += CMSG_SPACE(sizeof(struct in_addr));
+#endif
+        } else if (addr_from->sa_family == AF_INET6) {
+            memset(cmsg, 0, CMSG_SPACE(sizeof(struct in6_pktinfo)));
+            cmsg->cmsg_level = IPPROTO_IPV6;
+            cmsg->cmsg_type = IPV6_PKTINFO;
+            cmsg->cmsg_len = CMSG_LEN(sizeof(struct in6_pktinfo));
+            struct in6_pktinfo* pktinfo6 = (struct in6_pktinfo*)CMSG_DATA(cmsg);
+            memcpy(&pktinfo6->ipi6_addr, &((struct sockaddr_in6*)addr_from)->sin6_addr, sizeof(struct in6_addr));
+            pktinfo6->ipi6_ifindex = dest_if;
+
+            control_length += CMSG_SPACE(sizeof(struct in6_pktinfo));
+        } else {
+            DBG_PRINTF("Unexpected address family: %d\n", addr_from->sa_family);
+        }
+
+#if 0
+#if defined(IP_PMTUDISC_DO) || defined(IP_DONTFRAG)
+        if (addr_from->sa_family == AF_INET && length > PICOQUIC_INITIAL_MTU_IPV4) {
+#ifdef CMSG_ALIGN
+            struct cmsghdr * cmsg_2 = (struct cmsghdr *)((unsigned char *)cmsg + CMSG_ALIGN(cmsg->cmsg_len));
+            {
+#else
+            struct cmsghdr * cmsg_2 = CMSG_NXTHDR(msg, cmsg);
+            if (cmsg_2 == NULL) {
+                DBG_PRINTF("Cannot obtain second CMSG (control_length: %d)\n", control_length);
+            }
+            else {
+#endif
+#ifdef IP_PMTUDISC_DO
+                /* This sets the don't fragment bit on Linux */
+                int val = IP_PMTUDISC_DO;
+                cmsg_2->cmsg_level = IPPROTO_IP;
+                cmsg_2->cmsg_type = IP_MTU_DISCOVER;
+#else
+                /* On BSD systems, just use IP_DONTFRAG */
+                int val = 1;
+                cmsg_2->cmsg_level = IPPROTO_IP;
+                cmsg_2->cmsg_type = IP_DONTFRAG;
+#endif
+                cmsg_2->cmsg_len = CMSG_LEN(sizeof(int));
+                memcpy(CMSG_DATA(cmsg_2), &val, sizeof(int));
+                control_length += CMSG_SPACE(sizeof(int));
+            }
+        }
+#endif
+#else
+#if defined(IP_DONTFRAG)
+        if (addr_from->sa_family == AF_INET && length > PICOQUIC_INITIAL_MTU_IP$
+#ifdef CMSG_ALIGN
+            struct cmsghdr * cmsg_2 = (struct cmsghdr *)((unsigned char *)cmsg $
+            {
+#else
+            struct cmsghdr * cmsg_2 = CMSG_NXTHDR(msg, cmsg);
+            if (cmsg_2 == NULL) {
+                DBG_PRINTF("Cannot obtain second CMSG (control_length: %d)\n", $
+            }
+            else {
+#endif
+                /* On BSD systems, just use IP_DONTFRAG */
+                int val = 1;
+                cmsg_2->cmsg_level = IPPROTO_IP;
+                cmsg_2->cmsg_type = IP_DONTFRAG;
+                cmsg_2->cmsg_len = CMSG_LEN(sizeof(int));
+                memcpy(CMSG_DATA(cmsg_2), &val, sizeof(int));
+                control_length += CMSG_SPACE(sizeof(int));
+            }
+        }
+#endif
+
+
+#endif
+
+    }
+
+#if defined(__linux__) && defined(SO_TXTIME)
+    if (departure_time != 0) {
+        uint64_t txtime = picoquic_departure_time_to_txtime(departure_time);
+
+        cmsg = (struct cmsghdr*)(cmsg_buffer + control_length);
+        memset(cmsg, 0, CMSG_SPACE(sizeof(uint64_t)));
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type = SCM_TXTIME;
+        cmsg->cmsg_len = CMSG_LEN(sizeof(uint64_t));
+        memcpy(CMSG_DATA(cmsg), &txtime, sizeof(uint64_t));
+        control_length += CMSG_SPACE(sizeof(uint64_t));
+    }
+#endif
+
+    msg->msg_controllen = control_length;
+    if (control_length == 0) {
+        msg->msg_control = NULL;
+    }
+}
+#endif
+
+int picoquic_sendmsg_at(SOCKET_TYPE fd,
+    struct sockaddr* addr_dest,
+    socklen_t dest_length,
+    struct sockaddr* addr_from,
+    socklen_t from_length,
+    unsigned long dest_if,
+    const char* bytes, int length,
+    uint64_t departure_time)
 #ifdef _WINDOWS
 {
     GUID WSASendMsg_GUID = WSAID_WSASENDMSG;
@@ -335,6 +630,9 @@ int picoquic_sendmsg(SOCKET_TYPE fd,
     int last_error;
     WSACMSGHDR* cmsg;
 
+    /* No SO_TXTIME on Windows, picoquic_socket_set_txtime fails and EDT pacing is not used */
+    UNREFERENCED_PARAMETER(departure_time);
+
     ret = WSAIoctl(fd, SIO_GET_EXTENSION_FUNCTION_POINTER,
         &WSASendMsg_GUID, sizeof WSASendMsg_GUID,
         &WSASendMsg, sizeof WSASendMsg,
@@ -424,128 +722,80 @@ int picoquic_sendmsg(SOCKET_TYPE fd,
     struct msghdr msg;
     struct iovec dataBuf;
     char cmsg_buffer[1024];
-    int control_length = 0;
-    int bytes_sent;
-    struct cmsghdr* cmsg;
-
-    /* Format the message header */
-
-    dataBuf.iov_base = (char*)bytes;
-    dataBuf.iov_len = length;
-
-    memset(&msg, 0, sizeof(msg));
-    msg.msg_name = addr_dest;
-    msg.msg_namelen = dest_length;
-    msg.msg_iov = &dataBuf;
-    msg.msg_iovlen = 1;
-    msg.msg_control = (void*)cmsg_buffer;
-    msg.msg_controllen = sizeof(cmsg_buffer);
 
-    /* Format the control message */
-    cmsg = CMSG_FIRSTHDR(&msg);
+    picoquic_sendmsg_format(&msg, &dataBuf, cmsg_buffer, sizeof(cmsg_buffer),
+        addr_dest, dest_length, addr_from, from_length, dest_if, bytes, length, departure_time);
 
-    if (addr_from != NULL && from_length != 0) {
-        if (addr_from->sa_family == AF_INET) {
-#ifdef IP_PKTINFO
-            memset(cmsg, 0, CMSG_SPACE(sizeof(struct in_pktinfo)));
-            cmsg->cmsg_level = IPPROTO_IP;
-            cmsg->cmsg_type = IP_PKTINFO;
-            cmsg->cmsg_len = CMSG_LEN(sizeof(struct in_pktinfo));
-            struct in_pktinfo* pktinfo = (struct in_pktinfo*)CMSG_DATA(cmsg);
-            pktinfo->ipi_spec_dst.s_addr = ((struct sockaddr_in*)addr_from)->sin_addr.s_addr;
-            pktinfo->ipi_ifindex = dest_if;
-            control_length += CMSG_SPACE(sizeof(struct in_pktinfo));
-#else
-            /* The IP_PKTINFO structure is not defined on BSD */
-            memset(cmsg, 0, CMSG_SPACE(sizeof(struct in_addr)));
-            cmsg->cmsg_level = IPPROTO_IP;
-            cmsg->cmsg_type = IP_SENDSRCADDR;
-            cmsg->cmsg_len = CMSG_LEN(sizeof(struct in_addr));
-            struct in_addr* pktinfo = (struct in_addr*)CMSG_DATA(cmsg);
-            pktinfo->s_addr = ((struct sockaddr_in*)addr_from)->sin_addr.s_addr;
-            control_length += CMSG_SPACE(sizeof(struct in_addr));
+    return (int)sendmsg(fd, &msg, 0);
+}
 #endif
-        } else if (addr_from->sa_family == AF_INET6) {
-            memset(cmsg, 0, CMSG_SPACE(sizeof(struct in6_pktinfo)));
-            cmsg->cmsg_level = IPPROTO_IPV6;
-            cmsg->cmsg_type = IPV6_PKTINFO;
-            cmsg->cmsg_len = CMSG_LEN(sizeof(struct in6_pktinfo));
-            struct in6_pktinfo* pktinfo6 = (struct in6_pktinfo*)CMSG_DATA(cmsg);
-            memcpy(&pktinfo6->ipi6_addr, &((struct sockaddr_in6*)addr_from)->sin6_addr, sizeof(struct in6_addr));
-            pktinfo6->ipi6_ifindex = dest_if;
 
-            control_length += CMSG_SPACE(sizeof(struct in6_pktinfo));
-        } else {
-            DBG_PRINTF("Unexpected address family: %d\n", addr_from->sa_family);
-        }
+int picoquic_sendmsg(SOCKET_TYPE fd,
+    struct sockaddr* addr_dest,
+    socklen_t dest_length,
+    struct sockaddr* addr_from,
+    socklen_t from_length,
+    unsigned long dest_if,
+    const char* bytes, int length)
+{
+    return picoquic_sendmsg_at(fd, addr_dest, dest_length, addr_from, from_length, dest_if, bytes, length, 0);
+}
 
-#if 0
-#if defined(IP_PMTUDISC_DO) || defined(IP_DONTFRAG)
-        if (addr_from->sa_family == AF_INET && length > PICOQUIC_INITIAL_MTU_IPV4) {
-#ifdef CMSG_ALIGN
-            struct cmsghdr * cmsg_2 = (struct cmsghdr *)((unsigned char *)cmsg + CMSG_ALIGN(cmsg->cmsg_len));
-            {
-#else
-            struct cmsghdr * cmsg_2 = CMSG_NXTHDR((&msg), cmsg);
-            if (cmsg_2 == NULL) {
-                DBG_PRINTF("Cannot obtain second CMSG (control_length: %d)\n", control_length);
-            }
-            else {
-#endif
-#ifdef IP_PMTUDISC_DO
-                /* This sets the don't fragment bit on Linux */
-                int val = IP_PMTUDISC_DO;
-                cmsg_2->cmsg_level = IPPROTO_IP;
-                cmsg_2->cmsg_type = IP_MTU_DISCOVER;
-#else
-                /* On BSD systems, just use IP_DONTFRAG */
-                int val = 1;
-                cmsg_2->cmsg_level = IPPROTO_IP;
-                cmsg_2->cmsg_type = IP_DONTFRAG;
-#endif
-                cmsg_2->cmsg_len = CMSG_LEN(sizeof(int));
-                memcpy(CMSG_DATA(cmsg_2), &val, sizeof(int));
-                control_length += CMSG_SPACE(sizeof(int));
-            }
-        }
-#endif
-#else
-#if defined(IP_DONTFRAG)
-        if (addr_from->sa_family == AF_INET && length > PICOQUIC_INITIAL_MTU_IP$
-#ifdef CMSG_ALIGN
-            struct cmsghdr * cmsg_2 = (struct cmsghdr *)((unsigned char *)cmsg $
-            {
-#else
-            struct cmsghdr * cmsg_2 = CMSG_NXTHDR((&msg), cmsg);
-            if (cmsg_2 == NULL) {
-                DBG_PRINTF("Cannot obtain second CMSG (control_length: %d)\n", $
-            }
-            else {
+#ifdef __linux__
+#define PICOQUIC_SENDMSG_BATCH_MAX 16
 #endif
-                /* On BSD systems, just use IP_DONTFRAG */
-                int val = 1;
-                cmsg_2->cmsg_level = IPPROTO_IP;
-                cmsg_2->cmsg_type = IP_DONTFRAG;
-                cmsg_2->cmsg_len = CMSG_LEN(sizeof(int));
-                memcpy(CMSG_DATA(cmsg_2), &val, sizeof(int));
-                control_length += CMSG_SPACE(sizeof(int));
-            }
+
+int picoquic_sendmsg_batch(SOCKET_TYPE fd, picoquic_sendmsg_desc_t* desc, int nb_desc)
+#ifdef __linux__
+{
+    struct mmsghdr msgs[PICOQUIC_SENDMSG_BATCH_MAX];
+    struct iovec dataBufs[PICOQUIC_SENDMSG_BATCH_MAX];
+    char cmsg_buffers[PICOQUIC_SENDMSG_BATCH_MAX][256];
+    int nb_done = 0;
+    int nb_sent = 0;
+
+    while (nb_done < nb_desc) {
+        int nb_msgs = nb_desc - nb_done;
+        int ret;
+
+        if (nb_msgs > PICOQUIC_SENDMSG_BATCH_MAX) {
+            nb_msgs = PICOQUIC_SENDMSG_BATCH_MAX;
         }
-#endif
 
+        for (int i = 0; i < nb_msgs; i++) {
+            picoquic_sendmsg_desc_t* d = &desc[nb_done + i];
 
-#endif
+            picoquic_sendmsg_format(&msgs[i].msg_hdr, &dataBufs[i], cmsg_buffers[i], sizeof(cmsg_buffers[i]),
+                d->addr_dest, d->dest_length, d->addr_from, d->from_length, d->dest_if,
+                d->bytes, d->length, d->departure_time);
+            msgs[i].msg_len = 0;
+        }
 
+        ret = sendmmsg(fd, msgs, nb_msgs, 0);
+        if (ret > 0) {
+            nb_done += ret;
+            nb_sent += ret;
+        } else {
+            /* The first datagram failed, skip it and send the next ones */
+            DBG_PRINTF("Could not send datagram on UDP socket %d= %d!\n", (int)fd, errno);
+            nb_done++;
+        }
     }
 
-    msg.msg_controllen = control_length;
-    if (control_length == 0) {
-        msg.msg_control = NULL;
-    }
+    return nb_sent;
+}
+#else
+{
+    int nb_sent = 0;
 
-    bytes_sent = sendmsg(fd, &msg, 0);
+    for (int i = 0; i < nb_desc; i++) {
+        if (picoquic_sendmsg_at(fd, desc[i].addr_dest, desc[i].dest_length, desc[i].addr_from, desc[i].from_length,
+            desc[i].dest_if, desc[i].bytes, desc[i].length, desc[i].departure_time) > 0) {
+            nb_sent++;
+        }
+    }
 
-    return bytes_sent;
+    return nb_sent;
 }
 #endif
 
@@ -566,7 +816,12 @@ int picoquic_select(SOCKET_TYPE* sockets,
     int ret_select = 0;
     int bytes_recv = 0;
     int sockmax = 0;
+    int rcv_tos = 0;
+    uint64_t arrival_time = 0;
+    int is_time_stamped = 0;
+    picoquic_rcv_clock_t rcv_clock;
 
+    memset(&rcv_clock, 0, sizeof(rcv_clock));
     FD_ZERO(&readfds);
 
     for (int i = 0; i < nb_sockets; i++) {
@@ -602,14 +857,21 @@ select_retry:
             }
         }
     } else if (ret_select > 0) {
+        /* Stamp the loop time once, and read the real time clock with it for the kernel stamps */
+        *current_time = (quic != NULL) ? picoquic_stamp_time(quic) : picoquic_current_time();
+        is_time_stamped = 1;
+#if !defined(_WINDOWS) && defined(SO_TIMESTAMPNS)
+        picoquic_rcv_clock_read(&rcv_clock, *current_time);
+#endif
+
         for (int i = 0; i < nb_sockets; i++) {
             if (FD_ISSET(sockets[i], &readfds)) {
                 struct stat statbuf;
                 fstat(sockets[i], &statbuf);
                 if (S_ISSOCK(statbuf.st_mode)) {
-                    bytes_recv = picoquic_recvmsg(sockets[i], addr_from, from_length,
+                    bytes_recv = picoquic_recvmsg_clock(sockets[i], addr_from, from_length,
                                                   addr_dest, dest_length, dest_if,
-                                                  buffer, buffer_max, &quic->rcv_tos);
+                                                  buffer, buffer_max, &rcv_tos, &arrival_time, &rcv_clock);
                 } else {
                     bytes_recv = (int) read(sockets[i], buffer, (size_t) buffer_max);
                 }
@@ -630,6 +892,7 @@ select_retry:
                 } else {
                     if (quic) {
                         quic->rcv_socket = sockets[i];
+                        quic->rcv_tos = rcv_tos;
                     }
                     break;
                 }
@@ -638,7 +901,12 @@ select_retry:
     }
 
 exit:
-    *current_time = picoquic_current_time();
+    if (!is_time_stamped) {
+        *current_time = (quic != NULL) ? picoquic_stamp_time(quic) : picoquic_current_time();
+    }
+    if (quic != NULL) {
+        quic->rcv_time = (bytes_recv > 0 && arrival_time <= *current_time) ? arrival_time : 0;
+    }
 
     return bytes_recv;
 }
@@ -648,6 +916,17 @@ int picoquic_send_through_server_sockets(
     struct sockaddr* addr_dest, socklen_t dest_length,
     struct sockaddr* addr_from, socklen_t from_length, unsigned long from_if,
     const char* bytes, int length)
+{
+    return picoquic_send_through_server_sockets_at(sockets, addr_dest, dest_length,
+        addr_from, from_length, from_if, bytes, length, 0);
+}
+
+int picoquic_send_through_server_sockets_at(
+    picoquic_server_sockets_t* sockets,
+    struct sockaddr* addr_dest, socklen_t dest_length,
+    struct sockaddr* addr_from, socklen_t from_length, unsigned long from_if,
+    const char* bytes, int length,
+    uint64_t departure_time)
 {
     /* Both Linux and Windows use separate sockets for V4 and V6 */
 #ifndef NS3
@@ -656,8 +935,8 @@ int picoquic_send_through_server_sockets(
     int socket_index = 0;
 #endif
 
-    int sent = picoquic_sendmsg(sockets->s_socket[socket_index], addr_dest, dest_length,
-        addr_from, from_length, from_if, bytes, length);
+    int sent = picoquic_sendmsg_at(sockets->s_socket[socket_index], addr_dest, dest_length,
+        addr_from, from_length, from_if, bytes, length, departure_time);
 
 #ifndef DISABLE_DEBUG_PRINTF
     if (sent <= 0) {
@@ -676,6 +955,35 @@ int picoquic_send_through_server_sockets(
     return sent;
 }
 
+int picoquic_send_batch_through_server_sockets(
+    picoquic_server_sockets_t* sockets, picoquic_sendmsg_desc_t* desc, int nb_desc)
+{
+    int nb_sent = 0;
+    int first = 0;
+
+    /* Send each run of datagrams of the same family with one batch */
+    while (first < nb_desc) {
+#ifndef NS3
+        int socket_index = (desc[first].addr_dest->sa_family == AF_INET) ? 1 : 0;
+#else
+        int socket_index = 0;
+#endif
+        int last = first + 1;
+
+#ifndef NS3
+        while (last < nb_desc && ((desc[last].addr_dest->sa_family == AF_INET) ? 1 : 0) == socket_index) {
+            last++;
+        }
+#else
+        last = nb_desc;
+#endif
+        nb_sent += picoquic_sendmsg_batch(sockets->s_socket[socket_index], &desc[first], last - first);
+        first = last;
+    }
+
+    return nb_sent;
+}
+
 int picoquic_get_server_address(const char* ip_address_text, int server_port,
     struct sockaddr_storage* server_address,
     int* server_addr_length,
@@ -120,6 +120,9 @@
 #define DEFAULT_SOCK_AF AF_INET
 #endif
 
+/* Kernel time stamps older than this are deemed unreliable, in microseconds */
+#define PICOQUIC_MAX_RCV_QUEUE_DELAY 1000000ull
+
 typedef struct st_picoquic_server_sockets_t {
     SOCKET_TYPE s_socket[PICOQUIC_NB_SERVER_SOCKETS];
 } picoquic_server_sockets_t;
@@ -128,6 +131,22 @@ int picoquic_open_server_sockets(picoquic_server_sockets_t* sockets, int port);
 
 void picoquic_close_server_sockets(picoquic_server_sockets_t* sockets);
 
+int picoquic_socket_set_timestamping(SOCKET_TYPE fd);
+
+/* Configure SO_TXTIME for picoquic_sendmsg_at. Fails on Windows and on other platforms without
+ * SO_TXTIME, where the departure time is ignored: do not enable EDT pacing there. */
+int picoquic_socket_set_txtime(SOCKET_TYPE fd);
+
+int picoquic_recvmsg(SOCKET_TYPE fd,
+    struct sockaddr_storage* addr_from,
+    socklen_t* from_length,
+    struct sockaddr_storage* addr_dest,
+    socklen_t* dest_length,
+    unsigned long* dest_if,
+    uint8_t* buffer, int buffer_max,
+    int* tos,
+    uint64_t* arrival_time);
+
 int picoquic_select(SOCKET_TYPE* sockets, int nb_sockets,
     struct sockaddr_storage* addr_from,
     socklen_t* from_length,
@@ -145,6 +164,13 @@ int picoquic_send_through_server_sockets(
     struct sockaddr* addr_from, socklen_t from_length, unsigned long from_if,
     const char* bytes, int length);
 
+int picoquic_send_through_server_sockets_at(
+    picoquic_server_sockets_t* sockets,
+    struct sockaddr* addr_dest, socklen_t addr_length,
+    struct sockaddr* addr_from, socklen_t from_length, unsigned long from_if,
+    const char* bytes, int length,
+    uint64_t departure_time);
+
 int picoquic_sendmsg(SOCKET_TYPE fd,
     struct sockaddr* addr_dest,
     socklen_t dest_length,
@@ -153,6 +179,37 @@ int picoquic_sendmsg(SOCKET_TYPE fd,
     unsigned long dest_if,
     const char* bytes, int length);
 
+/* Same as picoquic_sendmsg, passing the departure time in nanoseconds, 0 if none, to a SO_TXTIME socket */
+int picoquic_sendmsg_at(SOCKET_TYPE fd,
+    struct sockaddr* addr_dest,
+    socklen_t dest_length,
+    struct sockaddr* addr_from,
+    socklen_t from_length,
+    unsigned long dest_if,
+    const char* bytes, int length,
+    uint64_t departure_time);
+
+/* One datagram of a batch sent with picoquic_sendmsg_batch */
+typedef struct st_picoquic_sendmsg_desc_t {
+    struct sockaddr* addr_dest;
+    socklen_t dest_length;
+    struct sockaddr* addr_from;
+    socklen_t from_length;
+    unsigned long dest_if;
+    const char* bytes;
+    int length;
+    uint64_t departure_time; /* In nanoseconds, 0 if none, as for picoquic_sendmsg_at */
+} picoquic_sendmsg_desc_t;
+
+/* Send a batch of datagrams, with sendmmsg on Linux and one picoquic_sendmsg_at per
+ * datagram elsewhere. A datagram that fails is skipped. Returns the number of
+ * datagrams sent. */
+int picoquic_sendmsg_batch(SOCKET_TYPE fd, picoquic_sendmsg_desc_t* desc, int nb_desc);
+
+/* Same as picoquic_sendmsg_batch, using the server socket of each destination family */
+int picoquic_send_batch_through_server_sockets(
+    picoquic_server_sockets_t* sockets, picoquic_sendmsg_desc_t* desc, int nb_desc);
+
 int picoquic_get_server_address(const char* ip_address_text, int server_port,
     struct sockaddr_storage* server_address,
     int* server_addr_length,
@@ -159,6 +159,7 @@ int plugin_plug_elf(picoquic_cnx_t *cnx, protoop_plugin_t *p, protoop_str_id_t p
     /* And compute its hash */
     pid.hash = hash_value_str(pid.id);
     HASH_FIND_PID(cnx->ops, &(pid.hash), post);
+    cnx->ack_core_only_checked = 0;
 
     /* Two cases: either it exists, or not */
     if (!post) {
@@ -184,6 +185,7 @@ int plugin_plug_elf(picoquic_cnx_t *cnx, protoop_plugin_t *p, protoop_str_id_t p
 int plugin_unplug(picoquic_cnx_t *cnx, protoop_str_id_t pid, param_id_t param, pluglet_type_enum pte) {
     protocol_operation_struct_t *post;
     HASH_FIND_STR(cnx->ops, pid, post);
+    cnx->ack_core_only_checked = 0;
 
     if (!post) {
         printf("Trying to unplug pluglet for non-existing proto op id %s...\n", pid);
@@ -947,6 +949,7 @@ bool plugin_insert_plugins_from_cache(picoquic_cnx_t *cnx, uint8_t nb_plugins, p
                     /* curr is the one we were looking for! Insert it! */
                     cnx->ops = curr->ops;
                     cnx->plugins = curr->plugins;
+                    cnx->ack_core_only_checked = 0;
                     free(curr);
                     DBG_PRINTF("%s", "Plugin found in cache: inserted!\n");
                     return true;
@@ -1498,6 +1501,27 @@ bool plugin_pluglet_exists(picoquic_cnx_t *cnx, protoop_id_t *pid, param_id_t pa
     }
 }
 
+bool plugin_protoop_is_core_only(picoquic_cnx_t *cnx, protoop_id_t *pid, param_id_t param) {
+    protocol_operation_struct_t *post;
+    if (pid->hash == 0) {
+        pid->hash = hash_value_str(pid->id);
+    }
+    HASH_FIND_PID(cnx->ops, &pid->hash, post);
+    if (!post)
+        return false;
+
+    protocol_operation_param_struct_t *popst;
+    if (post->is_parametrable) {
+        HASH_FIND(hh, post->params, &param, sizeof(param_id_t), popst);
+        if (!popst)
+            return false;
+    } else {
+        popst = post->params;
+    }
+
+    return popst->core && !popst->replace && !popst->pre && !popst->post;
+}
+
 
 int set_plugin_metadata(protoop_plugin_t *plugin, plugin_struct_metadata_t **metadata, int idx, uint64_t val) {
     if (!plugin) {
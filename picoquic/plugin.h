@@ -108,6 +108,12 @@ protoop_arg_t plugin_run_protoop(picoquic_cnx_t *cnx, protoop_params_t *pp, char
 
 bool plugin_pluglet_exists(picoquic_cnx_t *cnx, protoop_id_t *pid, param_id_t param, pluglet_type_enum anchor);
 
+/**
+ * Returns true if the protocol operation only runs its default behaviour, i.e., no pluglet
+ * replaces or observes it. Core code can then call the default behaviour directly.
+ */
+bool plugin_protoop_is_core_only(picoquic_cnx_t *cnx, protoop_id_t *pid, param_id_t param);
+
 /**
  * This function sets metadata at `idx` to `val` from a plugin structure metadata hashmap stored at `metadata`
  * If the metadata are not present in the hashmap, it will be allocated and the values at indexes different thant `idx`
@@ -10,6 +10,7 @@ protoop_id_t PROTOOP_NOPARAM_UPDATE_RTT = { .id = PROTOOPID_NOPARAM_UPDATE_RTT }
 protoop_id_t PROTOOP_NOPARAM_SCHEDULE_FRAMES_ON_PATH = { .id = PROTOOPID_NOPARAM_SCHEDULE_FRAMES_ON_PATH };
 protoop_id_t PROTOOP_NOPARAM_SCHEDULER_WRITE_NEW_FRAMES = { .id = PROTOOPID_NOPARAM_SCHEDULER_WRITE_NEW_FRAMES };
 protoop_id_t PROTOOP_NOPARAM_PROCESS_ACK_RANGE = { .id = PROTOOPID_NOPARAM_PROCESS_ACK_RANGE };
+protoop_id_t PROTOOP_NOPARAM_PROCESS_ACK_BATCH = { .id = PROTOOPID_NOPARAM_PROCESS_ACK_BATCH };
 protoop_id_t PROTOOP_NOPARAM_CHECK_SPURIOUS_RETRANSMISSION = { .id = PROTOOPID_NOPARAM_CHECK_SPURIOUS_RETRANSMISSION };
 protoop_id_t PROTOOP_NOPARAM_PROCESS_POSSIBLE_ACK_OF_ACK_FRAME = { .id = PROTOOPID_NOPARAM_PROCESS_POSSIBLE_ACK_OF_ACK_FRAME };
 protoop_id_t PROTOOP_NOPARAM_PROCESS_ACK_OF_ACK_RANGE = { .id = PROTOOPID_NOPARAM_PROCESS_ACK_OF_ACK_RANGE };
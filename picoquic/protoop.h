@@ -193,6 +193,21 @@ extern protoop_id_t PROTOOP_NOPARAM_SCHEDULER_WRITE_NEW_FRAMES;
  */
 #define PROTOOPID_NOPARAM_PROCESS_ACK_RANGE "process_ack_range"
 extern protoop_id_t PROTOOP_NOPARAM_PROCESS_ACK_RANGE;
+
+/**
+ * Report the packets newly acknowledged by an ACK frame, once all its ranges are processed.
+ * The default behaviour notifies the congestion control algorithm with the total. As the packets
+ * were already dequeued, their bytes are no longer counted in the bytes in transit of the path.
+ * Plugins can observe the whole batch with a single post pluglet.
+ * \param[in] path_x \b picoquic_path_t* The path on which the acknowledged packets were sent
+ * \param[in] pc \b picoquic_packet_context_enum The packet context of the acknowledged packets
+ * \param[in] nb_packets \b uint64_t The number of packets newly acknowledged
+ * \param[in] nb_bytes \b uint64_t The number of bytes newly acknowledged
+ * \param[in] largest_acked \b uint64_t The largest packet number newly acknowledged
+ * \param[in] current_time \b uint64_t Time of reception of the ACK frame
+ */
+#define PROTOOPID_NOPARAM_PROCESS_ACK_BATCH "process_ack_batch"
+extern protoop_id_t PROTOOP_NOPARAM_PROCESS_ACK_BATCH;
 /**
  * Check if packet that were retransmitted (in the retransmitted queue) were spurious, and release them if needed.
  * \param[in] start_of_range \b uint64_t The lowest packet number included in the range
@@ -206,6 +221,8 @@ extern protoop_id_t PROTOOP_NOPARAM_CHECK_SPURIOUS_RETRANSMISSION;
 
 /**
  * Update the sent packets and the ack status with the reception of the ACK frame.
+ * The default behaviour prunes the SACK list up to the ack_frame_largest watermark recorded
+ * when the packet was sent, instead of parsing its ACK frames again.
  * \param[in] p \b picoquic_packet_t* The largest packet acknowledged by the ACK frame
  */
 #define PROTOOPID_NOPARAM_PROCESS_POSSIBLE_ACK_OF_ACK_FRAME "process_possible_ack_of_ack_frame"
@@ -454,8 +471,8 @@ extern protoop_id_t PROTOOP_NOPARAM_GET_CHECKSUM_LENGTH;
 #define PROTOOPID_NOPARAM_DEQUEUE_RETRANSMIT_PACKET "dequeue_retransmit_packet"
 extern protoop_id_t PROTOOP_NOPARAM_DEQUEUE_RETRANSMIT_PACKET;
 /**
- * Dequeue the packet from the retransmitted queue and release its memory.
- * \param[in] p \b picoquic_packet_t* The packet to be dequeued and freed
+ * Dequeue the summary of a lost packet from the retransmitted queue and release its memory.
+ * \param[in] p \b picoquic_packet_summary_t* The packet summary to be dequeued and freed
  */
 #define PROTOOPID_NOPARAM_DEQUEUE_RETRANSMITTED_PACKET "dequeue_retransmitted_packet"
 extern protoop_id_t PROTOOP_NOPARAM_DEQUEUE_RETRANSMITTED_PACKET;
@@ -1,4 +1,5 @@
 #include <stdlib.h>
+#include <string.h>
 #include "queue.h"
 
 queue_t *queue_init()
@@ -7,71 +8,78 @@ queue_t *queue_init()
     if (!q) {
         return NULL;
     }
-    q->head = NULL;
-    q->tail = NULL;
+    q->items = (void **) malloc(QUEUE_INITIAL_CAPACITY * sizeof(void *));
+    if (!q->items) {
+        free(q);
+        return NULL;
+    }
+    q->capacity = QUEUE_INITIAL_CAPACITY;
+    q->head = 0;
     q->size = 0;
     return q;
 }
 
 void queue_free(queue_t *q)
 {
-    /* First remove all elements */
-    while (q->head) {
-        queue_dequeue(q);
-    }
+    free(q->items);
     free(q);
 }
 
-int queue_enqueue(queue_t *q, void *d)
+/* Doubles the capacity, moving the elements at the start of the new array */
+static int queue_grow(queue_t *q)
 {
-    queue_node_t *n = (queue_node_t *) malloc(sizeof(queue_node_t));
-    if (!n) {
+    size_t new_capacity = 2 * q->capacity;
+    void **new_items = (void **) malloc(new_capacity * sizeof(void *));
+    if (!new_items) {
         return 1;
     }
-    n->data = d;
-    /* This element is the last one to be removed, so the next one is NULL */
-    n->next = NULL;
+    /* Elements from head to the end of the array, then the wrapped ones */
+    size_t first_part = q->capacity - q->head;
+    if (first_part > q->size) {
+        first_part = q->size;
+    }
+    memcpy(new_items, &q->items[q->head], first_part * sizeof(void *));
+    memcpy(&new_items[first_part], q->items, (q->size - first_part) * sizeof(void *));
+    free(q->items);
+    q->items = new_items;
+    q->capacity = new_capacity;
+    q->head = 0;
+    return 0;
+}
 
-    /* Is it the first element to be inserted? */
-    if (!q->head) {
-        q->head = n;
-        q->tail = n;
-    } else {
-        /* Then n is the next of the previously last one */
-        q->tail->next = n;
-        /* And n is the new tail */
-        q->tail = n;
+int queue_enqueue(queue_t *q, void *d)
+{
+    if (q->size == q->capacity && queue_grow(q) != 0) {
+        return 1;
     }
+    /* This element is the last one to be removed */
+    size_t tail = q->head + q->size;
+    if (tail >= q->capacity) {
+        tail -= q->capacity;
+    }
+    q->items[tail] = d;
     q->size++;
     return 0;
 }
 
 void *queue_dequeue(queue_t *q)
 {
-    /* Case 1: the list is empty */
-    if (!q->head) {
+    /* The list is empty */
+    if (q->size == 0) {
         return NULL;
     }
-    queue_node_t *to_remove = q->head;
-    void *to_return = to_remove->data;
-    /* Case 2: only one element is left */
-    if (q->head == q->tail) {
-        q->head = NULL;
-        q->tail = NULL;
-    } else {
-        /* Case 3: at least two elements left */
-        q->head = q->head->next;
+    void *to_return = q->items[q->head];
+    q->head++;
+    if (q->head == q->capacity) {
+        q->head = 0;
     }
-
     q->size--;
-    /* Don't forget to free the node memory */
-    free(to_remove);
     return to_return;
 }
 
 void *queue_peek(const queue_t *q)
 {
-    return q->head ? q->head->data : NULL;
+    return q->size > 0 ? q->items[q->head] : NULL;
 }
 
 void *queue_peek_any(const queue_t **q, int nq) {
@@ -85,4 +93,16 @@ void *queue_peek_any(const queue_t **q, int nq) {
 size_t queue_size(const queue_t *q)
 {
     return q->size;
-}
\ No newline at end of file
+}
+
+void *queue_get(const queue_t *q, size_t i)
+{
+    if (i >= q->size) {
+        return NULL;
+    }
+    i += q->head;
+    if (i >= q->capacity) {
+        i -= q->capacity;
+    }
+    return q->items[i];
+}
@@ -1,31 +1,29 @@
 /**
  * \file queue.h
  * \author Quentin De Coninck
- * \brief A simple implementation of a queue using linked-list.
+ * \brief A simple implementation of a queue using a ring buffer.
  * 
- * Queue using two pointers, head and tail, and a simple linked list
- * to the next element being removed. Node memory is managed by this
- * simple library.
+ * Queue storing its elements in a circular array that doubles its capacity
+ * when full. Enqueueing and dequeueing do not allocate memory once the queue
+ * has reached its working size.
  * 
  * \warning Insertion of NULL element is discouraged, as it would not be possible to distinguish at peeking and dequeueing
  * if the element is NULL or if the queue is empty.
  */
 
 /**
- * A node of the queue.
+ * Number of elements a queue can hold before its first growth.
  */
-typedef struct queue_node {
-    void *data;
-    struct queue_node *next;
-} queue_node_t;
+#define QUEUE_INITIAL_CAPACITY 8
 
 /**
- * The queue containing references to the first (for removal) and the
- * last (fast insertion) elements.
+ * The queue containing the circular array of elements, the position of
+ * the first element (for removal) and the number of elements.
  */
 typedef struct queue {
-    queue_node_t *head;
-    queue_node_t *tail;
+    void **items;
+    size_t capacity;
+    size_t head;
     size_t size;
 } queue_t;
 
@@ -38,7 +36,7 @@ queue_t *queue_init();
 
 /**
  * Free all resources of the queue. The queue is then unusable.
- * If the queue is not empty, its elements are removed and free'd.
+ * If the queue is not empty, its elements are removed but not free'd.
  * \param[in] q The queue to free memory.
  */
 void queue_free(queue_t *q);
@@ -52,7 +50,7 @@ void queue_free(queue_t *q);
 int queue_enqueue(queue_t *q, void *d);
 
 /**
- * Dequeue the first element in the queue \p q and free internal structure used to maintain this element in \p q.
+ * Dequeue the first element in the queue \p q.
  * \param[in] q The queue to dequeue the first element.
  * 
  * \return The data contained in the first element of the queue, or NULL if there is no such element.
@@ -82,4 +80,13 @@ void *queue_peek_any(const queue_t **q, int nq);
  *
  * \return The number of elements in the queue.
  */
-size_t queue_size(const queue_t *q);
\ No newline at end of file
+size_t queue_size(const queue_t *q);
+
+/**
+ * Get the element at position \p i in the queue, the first element being at position 0. \p q is not modified.
+ * \param[in] q The queue to look into.
+ * \param[in] i The position of the element.
+ *
+ * \return The data contained at this position, or NULL if \p i is beyond the last element.
+ */
+void *queue_get(const queue_t *q, size_t i);
\ No newline at end of file
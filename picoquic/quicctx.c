@@ -26,10 +26,12 @@
 #include <string.h>
 #include "plugin.h"
 #include "memory.h"
+#include "siphash.h"
 #include <ifaddrs.h>
 #include <net/if.h>
 #ifndef _WINDOWS
 #include <sys/time.h>
+#include <time.h>
 #include <netinet/in.h>
 
 #include <dirent.h>
@@ -42,6 +44,7 @@
 */
 typedef struct st_picoquic_cnx_id_t {
     picoquic_connection_id_t cnx_id;
+    picoquic_quic_t* quic; /* Provides the hash key */
     picoquic_cnx_t* cnx;
     struct st_picoquic_cnx_id_t* next_cnx_id;
 } picoquic_cnx_id;
@@ -52,13 +55,13 @@ typedef struct st_picoquic_net_id_t {
     struct st_picoquic_net_id_t* next_net_id;
 } picoquic_net_id;
 
-/* Hash and compare for CNX hash tables */
+/* Hash and compare for CNX hash tables. The IDs are chosen by the peers, so
+ * the hash is keyed per context to prevent them from building long probe runs. */
 static uint64_t picoquic_cnx_id_hash(void* key)
 {
     picoquic_cnx_id* cid = (picoquic_cnx_id*)key;
 
-    /* TODO: should scramble the value for security and DOS protection */
-    return picoquic_val64_connection_id(cid->cnx_id);
+    return siphash_64(cid->quic->cnx_id_hash_key, cid->cnx_id.id, cid->cnx_id.id_len);
 }
 
 static int picoquic_cnx_id_compare(void* key1, void* key2)
@@ -73,7 +76,7 @@ static uint64_t picoquic_net_id_hash(void* key)
 {
     picoquic_net_id* net = (picoquic_net_id*)key;
 
-    return picohash_bytes((uint8_t*)&net->saddr, sizeof(net->saddr));
+    return picohash_mix64(picohash_bytes((uint8_t*)&net->saddr, sizeof(net->saddr)));
 }
 
 static int picoquic_net_id_compare(void* key1, void* key2)
@@ -600,13 +603,20 @@ picoquic_quic_t* picoquic_create(uint32_t nb_connections,
 
         if (ticket_file_name != NULL) {
             quic->ticket_file_name = ticket_file_name;
-            ret = picoquic_load_tickets(&quic->p_first_ticket, current_time, ticket_file_name);
+            ret = picoquic_load_tickets(&quic->ticket_store, current_time, ticket_file_name);
 
             if (ret == PICOQUIC_ERROR_NO_SUCH_FILE) {
                 DBG_PRINTF("Ticket file <%s> not created yet.\n", ticket_file_name);
                 ret = 0;
-            } else if (ret != 0) {
+            }
+
+            if (ret == 0) {
+                /* New tickets are appended to the file as they arrive */
+                quic->ticket_store.file_name = ticket_file_name;
+            } else if (ret != PICOQUIC_ERROR_MEMORY) {
+                /* The file is only a cache, run without it */
                 DBG_PRINTF("Cannot load tickets from <%s>\n", ticket_file_name);
+                ret = 0;
             }
         }
     }
@@ -634,6 +644,7 @@ picoquic_quic_t* picoquic_create(uint32_t nb_connections,
                 picoquic_crypto_random(quic, quic->reset_seed, sizeof(quic->reset_seed));
             else
                 memcpy(quic->reset_seed, reset_seed, sizeof(quic->reset_seed));
+            picoquic_crypto_random(quic, quic->cnx_id_hash_key, sizeof(quic->cnx_id_hash_key));
 
             quic->cached_plugins_queue = queue_init();
             if (!quic->cached_plugins_queue) {
@@ -692,9 +703,16 @@ void picoquic_free(picoquic_quic_t* quic)
             quic->aead_encrypt_ticket_ctx = NULL;
         }
 
-        if (quic->aead_decrypt_ticket_ctx != NULL) {
-            picoquic_aead_free(quic->aead_decrypt_ticket_ctx);
-            quic->aead_decrypt_ticket_ctx = NULL;
+        for (int i = 0; i < PICOQUIC_TICKET_KEY_RING_SIZE; i++) {
+            if (quic->aead_decrypt_ticket_ctx[i] != NULL) {
+                picoquic_aead_free(quic->aead_decrypt_ticket_ctx[i]);
+                quic->aead_decrypt_ticket_ctx[i] = NULL;
+            }
+        }
+
+        if (quic->anti_replay != NULL) {
+            picoquic_anti_replay_delete(quic->anti_replay);
+            quic->anti_replay = NULL;
         }
 
         if (quic->default_alpn != NULL) {
@@ -703,7 +721,7 @@ void picoquic_free(picoquic_quic_t* quic)
         }
 
         /* delete the stored tickets */
-        picoquic_free_tickets(&quic->p_first_ticket);
+        picoquic_free_tickets(&quic->ticket_store);
 
         /* delete all pending packets */
         while (quic->pending_stateless_packet != NULL) {
@@ -783,6 +801,11 @@ void picoquic_set_null_verifier(picoquic_quic_t* quic) {
     picoquic_dispose_verify_certificate_callback(quic, 1);
 }
 
+void picoquic_set_edt_pacing(picoquic_quic_t* quic, uint64_t horizon)
+{
+    quic->edt_horizon = horizon;
+}
+
 void picoquic_set_cookie_mode(picoquic_quic_t* quic, int cookie_mode)
 {
     if (cookie_mode) {
@@ -841,6 +864,7 @@ int picoquic_register_cnx_id(picoquic_quic_t* quic, picoquic_cnx_t* cnx, const p
     } else {
         picohash_item* item;
         key->cnx_id = *cnx_id;
+        key->quic = quic;
         key->cnx = cnx;
         key->next_cnx_id = NULL;
 
@@ -1164,6 +1188,7 @@ int picoquic_create_path(picoquic_cnx_t* cnx, uint64_t start_time, struct sockad
             path_x->pacing_bucket_max = 16;
             path_x->pacing_packet_time_nanosec = 1;
             path_x->pacing_packet_time_microsec = 1;
+            path_x->pacing_edt_horizon = cnx->quic->edt_horizon;
 
             /* Initialize the MTU */
             path_x->send_mtu = addr->sa_family == AF_INET ? PICOQUIC_INITIAL_MTU_IPV4 : PICOQUIC_INITIAL_MTU_IPV6;
@@ -1197,8 +1222,11 @@ int picoquic_create_path(picoquic_cnx_t* cnx, uint64_t start_time, struct sockad
                 path_x->pkt_ctx[pc].latest_retransmit_cc_notification_time = 0;
                 path_x->pkt_ctx[pc].retransmit_newest = NULL;
                 path_x->pkt_ctx[pc].retransmit_oldest = NULL;
+                path_x->pkt_ctx[pc].retransmit_index = NULL;
+                path_x->pkt_ctx[pc].retransmit_index_size = 0;
                 path_x->pkt_ctx[pc].highest_acknowledged = path_x->pkt_ctx[pc].send_sequence - 1;
                 path_x->pkt_ctx[pc].latest_time_acknowledged = start_time;
+                path_x->pkt_ctx[pc].loss_detection_time = 0;
                 path_x->pkt_ctx[pc].latest_progress_time = start_time;
                 path_x->pkt_ctx[pc].ack_needed = 0;
                 path_x->pkt_ctx[pc].ack_delay_local = 10000;
@@ -1227,15 +1255,73 @@ int picoquic_create_path(picoquic_cnx_t* cnx, uint64_t start_time, struct sockad
     return ret;
 }
 
-void picoquic_create_random_cnx_id(picoquic_quic_t* quic, picoquic_connection_id_t * cnx_id, uint8_t id_length)
+size_t picoquic_refill_cnxid_pool(picoquic_quic_t* quic)
 {
-    if (id_length > 0) {
-        picoquic_crypto_random(quic, cnx_id->id, id_length);
+    picoquic_cnxid_pool_t* pool = &quic->cnxid_pool;
+    uint8_t id_length = quic->local_ctx_length;
+    uint8_t random_bytes[PICOQUIC_CNXID_POOL_SIZE * PICOQUIC_CONNECTION_ID_MAX_SIZE];
+
+    if (pool->id_length != id_length) {
+        /* The local ID length changed, the pooled IDs cannot be used anymore */
+        pool->nb_ready = 0;
+        pool->id_length = id_length;
     }
-    if (id_length < sizeof(cnx_id->id)) {
-        memset(cnx_id->id + 8, 0, sizeof(cnx_id->id) - id_length);
+
+    if (id_length > 0 && id_length <= PICOQUIC_CONNECTION_ID_MAX_SIZE && pool->nb_ready < PICOQUIC_CNXID_POOL_SIZE) {
+        size_t nb_new = PICOQUIC_CNXID_POOL_SIZE - pool->nb_ready;
+
+        /* Keep the IDs already in the pool at the end, where they are taken first */
+        memmove(&pool->cnx_id[nb_new], &pool->cnx_id[0], pool->nb_ready * sizeof(picoquic_connection_id_t));
+        memmove(pool->reset_secret[nb_new], pool->reset_secret[0], pool->nb_ready * PICOQUIC_RESET_SECRET_SIZE);
+
+        picoquic_crypto_random(quic, random_bytes, nb_new * id_length);
+
+        for (size_t i = 0; i < nb_new; i++) {
+            memset(&pool->cnx_id[i], 0, sizeof(picoquic_connection_id_t));
+            memcpy(pool->cnx_id[i].id, random_bytes + i * id_length, id_length);
+            pool->cnx_id[i].id_len = id_length;
+            (void)picoquic_create_cnxid_reset_secret(quic, &pool->cnx_id[i], pool->reset_secret[i]);
+        }
+
+        pool->nb_ready = PICOQUIC_CNXID_POOL_SIZE;
+    }
+
+    return pool->nb_ready;
+}
+
+int picoquic_get_pooled_reset_secret(picoquic_quic_t* quic, picoquic_connection_id_t* cnx_id,
+    uint8_t reset_secret[PICOQUIC_RESET_SECRET_SIZE])
+{
+    picoquic_cnxid_pool_t* pool = &quic->cnxid_pool;
+    int ret = -1;
+
+    if (cnx_id->id_len > 0 && picoquic_compare_connection_id(cnx_id, &pool->last_cnx_id) == 0) {
+        memcpy(reset_secret, pool->last_reset_secret, PICOQUIC_RESET_SECRET_SIZE);
+        ret = 0;
+    }
+
+    return ret;
+}
+
+void picoquic_create_random_cnx_id(picoquic_quic_t* quic, picoquic_connection_id_t * cnx_id, uint8_t id_length)
+{
+    picoquic_cnxid_pool_t* pool = &quic->cnxid_pool;
+
+    if (id_length > 0 && id_length == quic->local_ctx_length &&
+        ((pool->id_length == id_length && pool->nb_ready > 0) || picoquic_refill_cnxid_pool(quic) > 0)) {
+        pool->nb_ready--;
+        *cnx_id = pool->cnx_id[pool->nb_ready];
+        pool->last_cnx_id = *cnx_id;
+        memcpy(pool->last_reset_secret, pool->reset_secret[pool->nb_ready], PICOQUIC_RESET_SECRET_SIZE);
+    } else {
+        if (id_length > 0) {
+            picoquic_crypto_random(quic, cnx_id->id, id_length);
+        }
+        if (id_length < sizeof(cnx_id->id)) {
+            memset(cnx_id->id + id_length, 0, sizeof(cnx_id->id) - id_length);
+        }
+        cnx_id->id_len = id_length;
     }
-    cnx_id->id_len = id_length;
 }
 
 void picoquic_create_random_cnx_id_for_cnx(picoquic_cnx_t* cnx, picoquic_connection_id_t *cnx_id, uint8_t id_length)
@@ -1382,7 +1468,7 @@ picoquic_cnx_t* picoquic_create_cnx(picoquic_quic_t* quic,
                 cnx->tls_stream[epoch].consumed_offset = 0;
                 cnx->tls_stream[epoch].fin_offset = 0;
                 cnx->tls_stream[epoch].next_stream = NULL;
-                cnx->tls_stream[epoch].stream_data = NULL;
+                memset(&cnx->tls_stream[epoch].reassembly, 0, sizeof(picoquic_stream_reassembly_t));
                 cnx->tls_stream[epoch].sent_offset = 0;
                 cnx->tls_stream[epoch].local_error = 0;
                 cnx->tls_stream[epoch].remote_error = 0;
@@ -1747,9 +1833,13 @@ int picoquic_handle_plugin_negotiation(picoquic_cnx_t* cnx)
 }
 
 /*
- * Provide clock time
+ * Provide clock time.
+ * The time is read from a monotonic clock, so that RTT samples and timers are
+ * not affected by changes of the wall clock. The monotonic clock is anchored to
+ * the wall time on the first call, so the values remain usable as wall time,
+ * e.g. for checking the validity of session tickets.
  */
-uint64_t picoquic_current_time()
+static uint64_t picoquic_wall_time()
 {
     uint64_t now;
 #ifdef _WINDOWS
@@ -1784,6 +1874,49 @@ uint64_t picoquic_current_time()
     return now;
 }
 
+static uint64_t picoquic_monotonic_time()
+{
+    uint64_t now;
+#ifdef _WINDOWS
+    static LARGE_INTEGER frequency;
+    LARGE_INTEGER counter;
+
+    if (frequency.QuadPart == 0) {
+        (void)QueryPerformanceFrequency(&frequency);
+    }
+    (void)QueryPerformanceCounter(&counter);
+    /* Split the conversion to avoid overflows */
+    now = (uint64_t)(counter.QuadPart / frequency.QuadPart) * 1000000ull +
+        ((uint64_t)(counter.QuadPart % frequency.QuadPart) * 1000000ull) / (uint64_t)frequency.QuadPart;
+#else
+    struct timespec ts;
+    (void)clock_gettime(CLOCK_MONOTONIC, &ts);
+    now = (ts.tv_sec * 1000000ull) + (ts.tv_nsec / 1000);
+#endif
+    return now;
+}
+
+uint64_t picoquic_current_time()
+{
+    static uint64_t clock_offset = 0;
+    static int clock_anchored = 0;
+    uint64_t now = picoquic_monotonic_time();
+
+    if (!clock_anchored) {
+        clock_offset = picoquic_wall_time() - now;
+        clock_anchored = 1;
+    }
+
+    return now + clock_offset;
+}
+
+uint64_t picoquic_stamp_time(picoquic_quic_t* quic)
+{
+    quic->stamped_time = picoquic_current_time();
+
+    return quic->stamped_time;
+}
+
 /*
 * Get the same time simulation as used for TLS
 */
@@ -1791,16 +1924,41 @@ uint64_t picoquic_current_time()
 uint64_t picoquic_get_quic_time(picoquic_quic_t* quic)
 {
     uint64_t now;
-    if (quic->p_simulated_time == NULL) {
-        now = picoquic_current_time();
+    if (quic->p_simulated_time != NULL) {
+        now = *quic->p_simulated_time;
+    }
+    else if (quic->stamped_time != 0) {
+        now = quic->stamped_time;
     }
     else {
-        now = *quic->p_simulated_time;
+        now = picoquic_current_time();
     }
 
     return now;
 }
 
+uint64_t picoquic_get_quic_time_for_cnx(picoquic_cnx_t* cnx)
+{
+    return picoquic_get_quic_time(cnx->quic);
+}
+
+/*
+* Time at which the packet being processed reached the host. When the socket
+* layer provides a kernel time stamp, using it rather than the processing time
+* keeps the socket queueing delay out of the RTT samples and ACK delays.
+*/
+
+uint64_t picoquic_get_arrival_time(picoquic_quic_t* quic, uint64_t current_time)
+{
+    uint64_t arrival_time = current_time;
+
+    if (quic->p_simulated_time == NULL && quic->rcv_time != 0 && quic->rcv_time <= current_time) {
+        arrival_time = quic->rcv_time;
+    }
+
+    return arrival_time;
+}
+
 void picoquic_set_fuzz(picoquic_quic_t * quic, picoquic_fuzz_fn fuzz_fn, void * fuzz_ctx)
 {
     quic->fuzz_fn = fuzz_fn;
@@ -1842,22 +2000,27 @@ int picoquic_write_ecn_block(picoquic_cnx_t* cnx, uint8_t *bytes, size_t bytes_m
 
 void picoquic_clear_stream(picoquic_stream_head* stream)
 {
-    picoquic_stream_data** pdata[2];
-    pdata[0] = &stream->stream_data;
-    pdata[1] = &stream->send_queue;
+    picoquic_stream_data* next;
 
-    for (int i = 0; i < 2; i++) {
-        picoquic_stream_data* next;
+    picoquic_stream_reassembly_clear(&stream->reassembly);
 
-        while ((next = *pdata[i]) != NULL) {
-            *pdata[i] = next->next_stream_data;
+    while ((next = stream->send_queue) != NULL) {
+        stream->send_queue = next->next_stream_data;
+        picoquic_free_stream_data(next);
+    }
 
-            if (next->bytes != NULL) {
-                free(next->bytes);
-            }
-            free(next);
-        }
+    picoquic_clear_sent_stream_data(stream);
+}
+
+void picoquic_free_stream_data(picoquic_stream_data* stream_data)
+{
+    if (stream_data->release_fn != NULL) {
+        /* Application owned buffer */
+        stream_data->release_fn(stream_data->release_ctx, stream_data->bytes, stream_data->length);
+    } else if (stream_data->bytes != NULL) {
+        free(stream_data->bytes);
     }
+    free(stream_data);
 }
 
 void picoquic_reset_packet_context(picoquic_cnx_t* cnx,
@@ -1874,6 +2037,8 @@ void picoquic_reset_packet_context(picoquic_cnx_t* cnx,
         picoquic_dequeue_retransmitted_packet(cnx, pkt_ctx->retransmitted_newest);
     }
 
+    picoquic_retransmit_index_clear(pkt_ctx);
+
     pkt_ctx->retransmitted_oldest = NULL;
 
     while (pkt_ctx->first_sack_item.next_sack != NULL) {
@@ -2052,6 +2217,21 @@ void picoquic_delete_cnx(picoquic_cnx_t* cnx)
             cnx->sni = NULL;
         }
 
+        if (cnx->quic->receive_batch != NULL) {
+            /* Forget the connection in the batch being received */
+            picoquic_receive_batch_t* batch = cnx->quic->receive_batch;
+
+            if (batch->last_cnx == cnx) {
+                batch->last_cnx = NULL;
+            }
+            for (size_t i = 0; i < batch->nb_cnx; i++) {
+                if (batch->cnx[i] == cnx) {
+                    batch->cnx[i] = batch->cnx[--batch->nb_cnx];
+                    break;
+                }
+            }
+        }
+
         while (cnx->first_cnx_id != NULL) {
             picohash_item* item;
             picoquic_cnx_id* cnx_id_key = cnx->first_cnx_id;
@@ -2090,6 +2270,8 @@ void picoquic_delete_cnx(picoquic_cnx_t* cnx)
             }
         }
 
+        picoquic_free_retired_packets(cnx);
+
         for (int epoch = 0; epoch < PICOQUIC_NUMBER_OF_EPOCHS; epoch++) {
             picoquic_clear_stream(&cnx->tls_stream[epoch]);
         }
@@ -2151,6 +2333,7 @@ void picoquic_delete_cnx(picoquic_cnx_t* cnx)
                     /* This remains safe to do this, as the memory of the frame context will be freed when cnx will */
                     while(queue_peek(current_p->block_queue_cc) != NULL) {queue_dequeue(current_p->block_queue_cc);}
                     while(queue_peek(current_p->block_queue_non_cc) != NULL) {queue_dequeue(current_p->block_queue_non_cc);}
+                    picoquic_plugin_drr_deactivate(cnx, current_p);
                     /* First destroy the memory */
                     destroy_memory_management(current_p);
                     /* And reinit the memory */
@@ -2232,14 +2415,25 @@ picoquic_cnx_t* picoquic_cnx_by_id(picoquic_quic_t* quic, picoquic_connection_id
     picoquic_cnx_t* ret = NULL;
     picohash_item* item;
     picoquic_cnx_id key;
+    picoquic_receive_batch_t* batch = quic->receive_batch;
+
+    if (batch != NULL && batch->last_cnx != NULL &&
+        picoquic_compare_connection_id(&batch->last_cnx_id, &cnx_id) == 0) {
+        return batch->last_cnx;
+    }
 
     memset(&key, 0, sizeof(key));
     key.cnx_id = cnx_id;
+    key.quic = quic;
 
     item = picohash_retrieve(quic->table_cnx_by_id, &key);
 
     if (item != NULL) {
         ret = ((picoquic_cnx_id*)item->key)->cnx;
+        if (batch != NULL) {
+            batch->last_cnx_id = cnx_id;
+            batch->last_cnx = ret;
+        }
     }
     return ret;
 }
@@ -2724,6 +2918,7 @@ size_t reserve_frames(picoquic_cnx_t* cnx, uint8_t nb_frames, reserve_frame_slot
         POP_LOG_CTX(cnx);
         return 0;
     }
+    picoquic_plugin_drr_activate(cnx, cnx->current_plugin);
     LOG {
         char ftypes_str[250];
         size_t ftypes_ofs = 0;
@@ -2753,6 +2948,9 @@ reserve_frame_slot_t* cancel_head_reservation(picoquic_cnx_t* cnx, uint8_t *nb_f
     }
     *nb_frames = block->nb_frames;
     reserve_frame_slot_t *slots = block->frames;
+    if (queue_peek(cnx->current_plugin->block_queue_cc) == NULL && queue_peek(cnx->current_plugin->block_queue_non_cc) == NULL) {
+        picoquic_plugin_drr_deactivate(cnx, cnx->current_plugin);
+    }
     LOG {
         char ftypes_str[250];
         size_t ftypes_ofs = 0;
@@ -2770,19 +2968,14 @@ reserve_frame_slot_t* cancel_head_reservation(picoquic_cnx_t* cnx, uint8_t *nb_f
 /* Indicates whether there exist non-low priority frames booked. */
 bool picoquic_has_booked_plugin_frames(picoquic_cnx_t *cnx)
 {
-    queue_node_t *n = cnx->reserved_frames->head;
-    while(n) {
-        reserve_frame_slot_t *s = n->data;
+    reserve_frame_slot_t *s;
+    for (size_t i = 0; (s = queue_get(cnx->reserved_frames, i)) != NULL; i++) {
         if (!s->low_priority)
             return true;
-        n = n->next;
     }
-    n = cnx->retry_frames->head;
-    while(n) {
-        reserve_frame_slot_t *s = n->data;
+    for (size_t i = 0; (s = queue_get(cnx->retry_frames, i)) != NULL; i++) {
         if (!s->low_priority)
             return true;
-        n = n->next;
     }
     return false;
 }
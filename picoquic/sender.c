@@ -119,8 +119,11 @@ int picoquic_mark_active_stream(picoquic_cnx_t* cnx,
     return ret;
 }
 
-int picoquic_add_to_stream_with_ctx(picoquic_cnx_t* cnx, uint64_t stream_id,
-    const uint8_t* data, size_t length, int set_fin, void *app_stream_ctx)
+/* Queue data at the end of the stream send queue. If release_fn is NULL the
+ * data is copied, otherwise the queue references the application buffer. */
+static int picoquic_queue_stream_data(picoquic_cnx_t* cnx, uint64_t stream_id,
+    const uint8_t* data, size_t length, int set_fin, void *app_stream_ctx,
+    picoquic_stream_data_release_fn release_fn, void* release_ctx)
 {
     int ret = 0;
     picoquic_stream_head* stream = picoquic_find_stream_for_writing(cnx, stream_id, &ret);
@@ -147,7 +150,11 @@ int picoquic_add_to_stream_with_ctx(picoquic_cnx_t* cnx, uint64_t stream_id,
         if (stream_data == 0) {
             ret = -1;
         } else {
-            stream_data->bytes = (uint8_t*)malloc(length);
+            if (release_fn != NULL) {
+                stream_data->bytes = (uint8_t*)data;
+            } else {
+                stream_data->bytes = (uint8_t*)malloc(length);
+            }
 
             if (stream_data->bytes == NULL) {
                 free(stream_data);
@@ -157,10 +164,15 @@ int picoquic_add_to_stream_with_ctx(picoquic_cnx_t* cnx, uint64_t stream_id,
                 picoquic_stream_data** pprevious = &stream->send_queue;
                 picoquic_stream_data* next = stream->send_queue;
 
-                memcpy(stream_data->bytes, data, length);
+                if (release_fn == NULL) {
+                    memcpy(stream_data->bytes, data, length);
+                }
                 stream_data->length = length;
                 stream_data->offset = 0;
+                stream_data->stream_offset = 0;
                 stream_data->next_stream_data = NULL;
+                stream_data->release_fn = release_fn;
+                stream_data->release_ctx = release_ctx;
 
                 while (next != NULL) {
                     pprevious = &next->next_stream_data;
@@ -186,6 +198,28 @@ int picoquic_add_to_stream_with_ctx(picoquic_cnx_t* cnx, uint64_t stream_id,
     return ret;
 }
 
+int picoquic_add_to_stream_with_ctx(picoquic_cnx_t* cnx, uint64_t stream_id,
+    const uint8_t* data, size_t length, int set_fin, void *app_stream_ctx)
+{
+    return picoquic_queue_stream_data(cnx, stream_id, data, length, set_fin, app_stream_ctx, NULL, NULL);
+}
+
+int picoquic_add_buffer_to_stream(picoquic_cnx_t* cnx, uint64_t stream_id, const uint8_t* data, size_t length, int set_fin,
+    void* app_stream_ctx, picoquic_stream_data_release_fn release_fn, void* release_ctx)
+{
+    int ret;
+
+    if (release_fn == NULL) {
+        return -1;
+    }
+    ret = picoquic_queue_stream_data(cnx, stream_id, data, length, set_fin, app_stream_ctx, release_fn, release_ctx);
+    if (ret == 0 && length == 0) {
+        /* Nothing was queued, the buffer is handed back at once */
+        release_fn(release_ctx, data, 0);
+    }
+    return ret;
+}
+
 int picoquic_add_to_stream(picoquic_cnx_t* cnx, uint64_t stream_id,
                                     const uint8_t* data, size_t length, int set_fin) {
     return picoquic_add_to_stream_with_ctx(cnx, stream_id, data, length, set_fin, NULL);
@@ -307,7 +341,10 @@ int picoquic_add_to_plugin_stream(picoquic_cnx_t* cnx, uint64_t pid_id,
                 memcpy(stream_data->bytes, data, length);
                 stream_data->length = length;
                 stream_data->offset = 0;
+                stream_data->stream_offset = 0;
                 stream_data->next_stream_data = NULL;
+                stream_data->release_fn = NULL;
+                stream_data->release_ctx = NULL;
 
                 while (next != NULL) {
                     pprevious = &next->next_stream_data;
@@ -418,6 +455,11 @@ picoquic_connection_id_t *picoquic_get_destination_connection_id(
         packet_type, path_x);
 }
 
+/*
+ * Format the packet header. If ph is not NULL, it is filled with the values that
+ * parsing the header would produce, so that the send path does not parse it again.
+ * The payload length is only known after encryption, and is left for the caller.
+ */
 uint32_t picoquic_create_packet_header(
     picoquic_cnx_t* cnx,
     picoquic_packet_type_enum packet_type,
@@ -425,10 +467,22 @@ uint32_t picoquic_create_packet_header(
     uint64_t sequence_number,
     uint8_t* bytes,
     uint32_t * pn_offset,
-    uint32_t * pn_length)
+    uint32_t * pn_length,
+    picoquic_packet_header* ph)
 {
     uint32_t length = 0;
     picoquic_connection_id_t dest_cnx_id = * (picoquic_get_destination_connection_id(cnx, packet_type, path_x));
+    picoquic_packet_header ph_local;
+
+    if (ph == NULL) {
+        ph = &ph_local;
+    }
+    memset(ph, 0, sizeof(picoquic_packet_header));
+    ph->ptype = packet_type;
+    ph->dest_cnx_id = dest_cnx_id;
+    ph->version_index = cnx->version_index;
+    ph->pn = (uint32_t)sequence_number;
+    ph->pn64 = sequence_number;
 
     /* Prepare the packet header */
     if (packet_type == picoquic_packet_1rtt_protected_phi0 || packet_type == picoquic_packet_1rtt_protected_phi1) {
@@ -444,6 +498,11 @@ uint32_t picoquic_create_packet_header(
         *pn_length = 4;
         picoformat_32(bytes + length, sequence_number);
         length += 4;
+
+        ph->pc = picoquic_packet_context_application;
+        ph->epoch = 3;
+        ph->has_spin_bit = 1;
+        ph->spin = cnx->current_spin;
     }
     else {
         /* Create a long packet */
@@ -452,15 +511,23 @@ uint32_t picoquic_create_packet_header(
         switch (packet_type) {
         case picoquic_packet_initial:
             type = picoquic_long_packet_type_initial;
+            ph->pc = picoquic_packet_context_initial;
+            ph->epoch = 0;
             break;
         case picoquic_packet_retry:
             type = picoquic_long_packet_type_retry;
+            ph->pc = picoquic_packet_context_initial;
+            ph->epoch = 0;
             break;
         case picoquic_packet_handshake:
             type = picoquic_long_packet_type_handshake;
+            ph->pc = picoquic_packet_context_handshake;
+            ph->epoch = 2;
             break;
         case picoquic_packet_0rtt_protected:
             type = picoquic_long_packet_type_0rtt;
+            ph->pc = picoquic_packet_context_application;
+            ph->epoch = 1;
             break;
         default:
             type = picoquic_long_packet_type_initial;
@@ -470,13 +537,14 @@ uint32_t picoquic_create_packet_header(
 
         length = 1;
         if ((cnx->cnx_state == picoquic_state_client_init || cnx->cnx_state == picoquic_state_client_init_sent) && packet_type == picoquic_packet_initial) {
-            picoformat_32(&bytes[length], cnx->proposed_version);
+            ph->vn = cnx->proposed_version;
         }
         else {
-            picoformat_32(&bytes[length],
-                picoquic_supported_versions[cnx->version_index].version);
+            ph->vn = picoquic_supported_versions[cnx->version_index].version;
         }
+        picoformat_32(&bytes[length], ph->vn);
         length += 4;
+        ph->srce_cnx_id = path_x->local_cnxid;
 
         bytes[length++] = dest_cnx_id.id_len;
         length += picoquic_format_connection_id(&bytes[length], PICOQUIC_MAX_PACKET_SIZE - length, dest_cnx_id);
@@ -486,6 +554,8 @@ uint32_t picoquic_create_packet_header(
         /* Special case of packet initial -- encode token as part of header */
         if (packet_type == picoquic_packet_initial) {
             length += (uint32_t)picoquic_varint_encode(&bytes[length], PICOQUIC_MAX_PACKET_SIZE - length, cnx->retry_token_length);
+            ph->token_length = cnx->retry_token_length;
+            ph->token_offset = length;
             if (cnx->retry_token_length > 0) {
                 memcpy(&bytes[length], cnx->retry_token, cnx->retry_token_length);
                 length += cnx->retry_token_length;
@@ -496,6 +566,7 @@ uint32_t picoquic_create_packet_header(
             /* No payload length and no sequence number for Retry */
             *pn_offset = 0;
             *pn_length = 0;
+            ph->pn_offset = length;
         } else {
             /* Reserve two bytes for payload length */
             bytes[length++] = 0;
@@ -508,6 +579,12 @@ uint32_t picoquic_create_packet_header(
         }
     }
 
+    if (*pn_length != 0) {
+        ph->pn_offset = *pn_offset;
+        ph->pnmask = 0xFFFFFFFF00000000ull;
+    }
+    ph->offset = ph->pn_offset;
+
     return length;
 }
 
@@ -620,14 +697,13 @@ uint32_t picoquic_protect_packet(picoquic_cnx_t* cnx,
 
     /* Create the packet header just before encrypting the content */
     h_length = picoquic_create_packet_header(cnx, ptype, path_x,
-        sequence_number, send_buffer, &pn_offset, &pn_length);
+        sequence_number, send_buffer, &pn_offset, &pn_length, ph);
     /* Make sure that the payload length is encoded in the header */
     /* Using encryption, the "payload" length also includes the encrypted packet length */
     picoquic_update_payload_length(send_buffer, pn_offset, h_length - pn_length, length + aead_checksum_length);
 
-    picoquic_cnx_t *pcnx = cnx;
     if (ph != NULL) {
-        picoquic_parse_packet_header(cnx->quic, send_buffer, length + aead_checksum_length, (struct sockaddr *) &path_x->local_addr, ph, &pcnx, false);
+        ph->payload_length = (uint16_t)(length + aead_checksum_length - ph->offset);
     }
 
     /* If fuzzing is required, apply it*/
@@ -704,6 +780,21 @@ int picoquic_is_sending_authorized_by_pacing(picoquic_path_t * path_x, uint64_t
 {
     int ret = 1;
 
+    if (path_x->pacing_edt_horizon != 0) {
+        /* EDT: the packet can be prepared if it will leave within the horizon */
+        uint64_t horizon_nanosec = (current_time + path_x->pacing_edt_horizon) * 1000;
+
+        if (path_x->pacing_next_departure_nanosec > horizon_nanosec) {
+            uint64_t next_pacing_time = path_x->pacing_next_departure_nanosec / 1000 - path_x->pacing_edt_horizon;
+            if (next_pacing_time < *next_time) {
+                *next_time = next_pacing_time;
+            }
+            ret = 0;
+        }
+
+        return ret;
+    }
+
     picoquic_update_pacing_bucket(path_x, current_time);
 
     if (path_x->pacing_bucket_nanosec <= 0) {
@@ -786,6 +877,16 @@ void picoquic_update_pacing_data(picoquic_path_t * path_x)
  */
 void picoquic_update_pacing_after_send(picoquic_path_t * path_x, uint64_t current_time)
 {
+    if (path_x->pacing_edt_horizon != 0) {
+        /* EDT: stamp the packet, and space the next one by a packet time */
+        if (path_x->pacing_next_departure_nanosec < current_time * 1000) {
+            path_x->pacing_next_departure_nanosec = current_time * 1000;
+        }
+        path_x->pacing_departure_nanosec = path_x->pacing_next_departure_nanosec;
+        path_x->pacing_next_departure_nanosec += path_x->pacing_packet_time_nanosec;
+        return;
+    }
+
     picoquic_update_pacing_bucket(path_x, current_time);
 
     if (path_x->pacing_bucket_nanosec < path_x->pacing_packet_time_nanosec) {
@@ -796,6 +897,222 @@ void picoquic_update_pacing_after_send(picoquic_path_t * path_x, uint64_t curren
 }
 
 
+uint64_t picoquic_get_departure_time(picoquic_path_t* path_x)
+{
+    return (path_x->pacing_edt_horizon != 0) ? path_x->pacing_departure_nanosec : 0;
+}
+
+/*
+ * Index of the packets waiting for acknowledgement, by sequence number.
+ * The packets stay in the double linked list, which gives the send order
+ * seen by plugins. The index is a power of two array in which the slot of a
+ * number is at that number modulo the size. The size is always larger than
+ * the span of sequence numbers in the list, so there are no collisions.
+ *
+ * Every number in the span has its slot. The slot of a number that has no
+ * packet in the queue, because it was never queued or was removed, points
+ * to a lower number with no packet queued in between. Finding the packet at
+ * or below a number follows these links, and shortens them on the way, so
+ * the cost does not grow with the number of packets already removed.
+ *
+ * The index grows when the span outgrows it and shrinks when the span falls
+ * under an eighth of its size. If the index cannot be allocated, lookups
+ * fall back to the list.
+ */
+static void picoquic_retransmit_index_set(picoquic_retransmit_slot_t* index, size_t size,
+    uint64_t sequence_number, uint64_t below, picoquic_packet_t* packet)
+{
+    picoquic_retransmit_slot_t* slot = &index[sequence_number & (size - 1)];
+
+    slot->sequence_number = sequence_number;
+    slot->below = below;
+    slot->packet = packet;
+}
+
+static void picoquic_retransmit_index_rebuild(picoquic_packet_context_t* pkt_ctx)
+{
+    uint64_t oldest = pkt_ctx->retransmit_oldest->sequence_number;
+    uint64_t span = pkt_ctx->retransmit_newest->sequence_number - oldest + 1;
+    size_t new_size = PICOQUIC_RETRANSMIT_INDEX_MIN_SIZE;
+    picoquic_retransmit_slot_t* new_index;
+
+    /* Leave room for the span to double before the next rebuild */
+    while (new_size < 2 * span && new_size <= SIZE_MAX / (4 * sizeof(picoquic_retransmit_slot_t))) {
+        new_size *= 2;
+    }
+
+    if (pkt_ctx->retransmit_index != NULL) {
+        free(pkt_ctx->retransmit_index);
+    }
+    pkt_ctx->retransmit_index = NULL;
+    pkt_ctx->retransmit_index_size = 0;
+
+    if (new_size >= span && (new_index = (picoquic_retransmit_slot_t*)calloc(new_size, sizeof(picoquic_retransmit_slot_t))) != NULL) {
+        uint64_t below = oldest;
+
+        pkt_ctx->retransmit_index = new_index;
+        pkt_ctx->retransmit_index_size = new_size;
+
+        /* From the oldest to the newest packet, filling the numbers in between */
+        for (picoquic_packet_t* p = pkt_ctx->retransmit_oldest; p != NULL; p = p->previous_packet) {
+            for (uint64_t s = below + 1; s < p->sequence_number; s++) {
+                picoquic_retransmit_index_set(new_index, new_size, s, below, NULL);
+            }
+            picoquic_retransmit_index_set(new_index, new_size, p->sequence_number, p->sequence_number, p);
+            below = p->sequence_number;
+        }
+    }
+}
+
+/* Called after the packet is added at the head of the list */
+static void picoquic_retransmit_index_insert(picoquic_packet_context_t* pkt_ctx, picoquic_packet_t* packet)
+{
+    if (pkt_ctx->retransmit_index_size > 0 &&
+        packet->sequence_number - pkt_ctx->retransmit_oldest->sequence_number < pkt_ctx->retransmit_index_size) {
+        picoquic_packet_t* previous = packet->next_packet;
+
+        if (previous != NULL) {
+            /* Numbers skipped since the previous packet */
+            for (uint64_t s = previous->sequence_number + 1; s < packet->sequence_number; s++) {
+                picoquic_retransmit_index_set(pkt_ctx->retransmit_index, pkt_ctx->retransmit_index_size,
+                    s, previous->sequence_number, NULL);
+            }
+        }
+        picoquic_retransmit_index_set(pkt_ctx->retransmit_index, pkt_ctx->retransmit_index_size,
+            packet->sequence_number, packet->sequence_number, packet);
+    } else {
+        picoquic_retransmit_index_rebuild(pkt_ctx);
+    }
+}
+
+/* Called before the packet is removed from the list */
+static void picoquic_retransmit_index_remove(picoquic_packet_context_t* pkt_ctx, picoquic_packet_t* packet)
+{
+    if (pkt_ctx->retransmit_index_size > 0) {
+        picoquic_retransmit_slot_t* slot = &pkt_ctx->retransmit_index[packet->sequence_number & (pkt_ctx->retransmit_index_size - 1)];
+
+        if (slot->packet == packet) {
+            slot->packet = NULL;
+            /* The next older packet, if any, is the first candidate below */
+            slot->below = (packet->next_packet == NULL) ? packet->sequence_number : packet->next_packet->sequence_number;
+        }
+    }
+}
+
+/* Called after a packet is removed from the list, shrinks the index if it became much larger than needed */
+static void picoquic_retransmit_index_compact(picoquic_packet_context_t* pkt_ctx)
+{
+    if (pkt_ctx->retransmit_index_size > PICOQUIC_RETRANSMIT_INDEX_MIN_SIZE) {
+        if (pkt_ctx->retransmit_oldest == NULL) {
+            picoquic_retransmit_index_clear(pkt_ctx);
+        } else if (8 * (pkt_ctx->retransmit_newest->sequence_number - pkt_ctx->retransmit_oldest->sequence_number + 1) <
+            pkt_ctx->retransmit_index_size) {
+            picoquic_retransmit_index_rebuild(pkt_ctx);
+        }
+    }
+}
+
+void picoquic_retransmit_index_clear(picoquic_packet_context_t* pkt_ctx)
+{
+    if (pkt_ctx->retransmit_index != NULL) {
+        free(pkt_ctx->retransmit_index);
+        pkt_ctx->retransmit_index = NULL;
+    }
+    pkt_ctx->retransmit_index_size = 0;
+}
+
+/* Follow the slots from a number in the span of the list down to a queued packet */
+static picoquic_packet_t* picoquic_retransmit_index_find(picoquic_packet_context_t* pkt_ctx, uint64_t sequence_number)
+{
+    picoquic_retransmit_slot_t* index = pkt_ctx->retransmit_index;
+    uint64_t mask = pkt_ctx->retransmit_index_size - 1;
+    uint64_t oldest = pkt_ctx->retransmit_oldest->sequence_number;
+    uint64_t s = sequence_number;
+    picoquic_packet_t* p = NULL;
+
+    for (;;) {
+        picoquic_retransmit_slot_t* slot = &index[s & mask];
+
+        if (slot->sequence_number != s) {
+            break;
+        } else if (slot->packet != NULL) {
+            p = slot->packet;
+            break;
+        } else if (slot->below >= s || slot->below < oldest) {
+            /* Nothing queued below */
+            break;
+        }
+        s = slot->below;
+    }
+
+    if (p != NULL) {
+        /* Point the slots on the way directly to the packet */
+        s = sequence_number;
+        while (s != p->sequence_number) {
+            picoquic_retransmit_slot_t* slot = &index[s & mask];
+
+            s = slot->below;
+            slot->below = p->sequence_number;
+        }
+    }
+
+    return p;
+}
+
+/* Returns the packet waiting for acknowledgement with that sequence number, or NULL */
+picoquic_packet_t* picoquic_retransmit_packet_by_number(picoquic_packet_context_t* pkt_ctx, uint64_t sequence_number)
+{
+    picoquic_packet_t* p;
+
+    if (pkt_ctx->retransmit_index_size > 0) {
+        picoquic_retransmit_slot_t* slot = &pkt_ctx->retransmit_index[sequence_number & (pkt_ctx->retransmit_index_size - 1)];
+
+        p = (slot->sequence_number == sequence_number) ? slot->packet : NULL;
+    } else {
+        p = pkt_ctx->retransmit_newest;
+        while (p != NULL && p->sequence_number > sequence_number) {
+            p = p->next_packet;
+        }
+        if (p != NULL && p->sequence_number != sequence_number) {
+            p = NULL;
+        }
+    }
+
+    return p;
+}
+
+/* Returns the newest packet in the retransmit list whose sequence number is at or below the argument */
+picoquic_packet_t* picoquic_retransmit_packet_at_or_below(picoquic_packet_context_t* pkt_ctx, uint64_t sequence_number)
+{
+    picoquic_packet_t* p = NULL;
+
+    if (pkt_ctx->retransmit_oldest == NULL || pkt_ctx->retransmit_oldest->sequence_number > sequence_number) {
+        p = NULL;
+    } else if (pkt_ctx->retransmit_newest->sequence_number <= sequence_number) {
+        p = pkt_ctx->retransmit_newest;
+    } else if (pkt_ctx->retransmit_index_size > 0) {
+        p = picoquic_retransmit_index_find(pkt_ctx, sequence_number);
+    } else {
+        p = pkt_ctx->retransmit_newest;
+        while (p != NULL && p->sequence_number > sequence_number) {
+            p = p->next_packet;
+        }
+    }
+
+    return p;
+}
+
+/* Remember the largest number announced by the ACK frame just written in the packet,
+ * so that the SACK list can be pruned without parsing the packet when it is acknowledged */
+static void picoquic_record_ack_frame_sent(picoquic_cnx_t* cnx, picoquic_packet_t* packet,
+    picoquic_packet_context_enum pc, size_t ack_length)
+{
+    if (ack_length > 0) {
+        packet->has_ack_frame = 1;
+        packet->ack_frame_largest = cnx->path[0]->pkt_ctx[pc].first_sack_item.end_of_sack_range;
+    }
+}
+
 /*
  * Final steps in packet transmission: queue for retransmission, etc
  */
@@ -821,9 +1138,12 @@ void picoquic_queue_for_retransmit(picoquic_cnx_t* cnx, picoquic_path_t * path_x
         packet->next_packet->previous_packet = packet;
     }
     path_x->pkt_ctx[pc].retransmit_newest = packet;
+    picoquic_retransmit_index_insert(&path_x->pkt_ctx[pc], packet);
 
-    /* Update the pacing data */
-    picoquic_update_pacing_after_send(path_x, current_time);
+    /* Update the pacing data. With EDT, only the packets that wait for pacing get a departure time */
+    if (path_x->pacing_edt_horizon == 0 || packet->is_congestion_controlled) {
+        picoquic_update_pacing_after_send(path_x, current_time);
+    }
 }
 
 void remove_registered_plugin_frames(picoquic_cnx_t *cnx, int received, picoquic_packet_t *p) {
@@ -834,6 +1154,7 @@ void remove_registered_plugin_frames(picoquic_cnx_t *cnx, int received, picoquic
     while (pppf) {
         tmp = pppf;
         tmp->plugin->bytes_in_flight -= tmp->bytes;
+        cnx->plugins_bytes_in_flight -= tmp->bytes;
         pppf = tmp->next;
         LOG_EVENT(cnx, "plugins", "metrics_updated", "dequeue_retransmit_packet", "{\"plugin\": \"%s\", \"bytes_in_flight\": %" PRIu64 "}", tmp->plugin->name, tmp->plugin->bytes_in_flight);
         protoop_prepare_and_run_param(cnx, &PROTOOP_PARAM_NOTIFY_FRAME, tmp->rfs->frame_type, NULL, tmp->rfs, received);
@@ -842,18 +1163,86 @@ void remove_registered_plugin_frames(picoquic_cnx_t *cnx, int received, picoquic
     p->plugin_frames = NULL;
 }
 
-/**
- * See PROTOOP_NOPARAM_DEQUEUE_RETRANSMIT_PACKET
- */
-protoop_arg_t dequeue_retransmit_packet(picoquic_cnx_t *cnx)
+/* Summarize a lost packet before it is moved to the retransmitted list. The stream data
+ * ranges are stored in the same allocation, right after the summary. */
+static picoquic_packet_summary_t* picoquic_create_packet_summary(picoquic_cnx_t* cnx, picoquic_packet_t* p)
 {
-    picoquic_packet_t *p = (picoquic_packet_t *) cnx->protoop_inputv[0];
-    int should_free = (int) cnx->protoop_inputv[1];
+    picoquic_packet_summary_t* summary;
+    size_t nb_stream_ranges = 0;
+    int pass;
+
+    for (pass = 0; pass < 2; pass++) {
+        size_t byte_index = p->offset;
+        size_t nb_ranges = 0;
+
+        if (pass == 1) {
+            summary = (picoquic_packet_summary_t*)malloc(sizeof(picoquic_packet_summary_t) +
+                nb_stream_ranges * sizeof(picoquic_stream_data_range_t));
+            if (summary == NULL) {
+                return NULL;
+            }
+            memset(summary, 0, sizeof(picoquic_packet_summary_t));
+            summary->stream_ranges = (picoquic_stream_data_range_t*)(summary + 1);
+        }
+
+        while (!p->is_pure_ack && byte_index < p->length) {
+            size_t consumed = 0;
+            int pure_ack = 0;
+
+            if (PICOQUIC_IN_RANGE(p->bytes[byte_index], picoquic_frame_type_stream_range_min, picoquic_frame_type_stream_range_max)) {
+                uint64_t stream_id;
+                uint64_t offset;
+                size_t data_length;
+                int fin;
+
+                if (picoquic_parse_stream_header(p->bytes + byte_index, p->length - byte_index,
+                    &stream_id, &offset, &data_length, &fin, &consumed) != 0) {
+                    break;
+                }
+                consumed += data_length;
+
+                if (data_length > 0) {
+                    if (pass == 1 && nb_ranges < nb_stream_ranges) {
+                        summary->stream_ranges[nb_ranges].stream_id = stream_id;
+                        summary->stream_ranges[nb_ranges].offset = offset;
+                        summary->stream_ranges[nb_ranges].length = data_length;
+                    }
+                    nb_ranges++;
+                }
+            }
+            else if (picoquic_skip_frame(cnx, p->bytes + byte_index, p->length - byte_index, &consumed, &pure_ack) != 0) {
+                break;
+            }
+            byte_index += consumed;
+        }
+
+        if (pass == 0) {
+            nb_stream_ranges = nb_ranges;
+        }
+    }
+
+    summary->nb_stream_ranges = nb_stream_ranges;
+    summary->send_path = p->send_path;
+    summary->sequence_number = p->sequence_number;
+    summary->send_time = p->send_time;
+    summary->length = p->length;
+    summary->checksum_overhead = p->checksum_overhead;
+    summary->pc = p->pc;
+
+    return summary;
+}
 
+/* Default behaviour of PROTOOP_NOPARAM_DEQUEUE_RETRANSMIT_PACKET, callable without a protocol operation
+ * when no pluglet is attached to it */
+void picoquic_dequeue_retransmit_packet_core(picoquic_cnx_t* cnx, picoquic_packet_t* p, int should_free)
+{
     size_t dequeued_length = p->send_length;
     picoquic_packet_context_enum pc = p->pc;
     picoquic_path_t* send_path = p->send_path;
 
+    picoquic_retransmit_index_remove(&send_path->pkt_ctx[pc], p);
+    send_path->pkt_ctx[pc].loss_detection_time = 0;
+
     if (p->previous_packet == NULL) {
         send_path->pkt_ctx[pc].retransmit_newest = p->next_packet;
     }
@@ -876,6 +1265,7 @@ protoop_arg_t dequeue_retransmit_packet(picoquic_cnx_t *cnx)
 #endif
         p->next_packet->previous_packet = p->previous_packet;
     }
+    picoquic_retransmit_index_compact(&send_path->pkt_ctx[pc]);
 
     /* Account for bytes in transit, for congestion control, only if the packet is marked as contributing to congestion */
     if (p->is_congestion_controlled) {
@@ -892,22 +1282,49 @@ protoop_arg_t dequeue_retransmit_packet(picoquic_cnx_t *cnx)
         picoquic_destroy_packet(p);
     }
     else {
-        protoop_prepare_and_run_noparam(cnx, &PROTOOP_NOPARAM_PACKET_WAS_LOST, NULL, p, send_path);
+        picoquic_packet_summary_t* summary;
 
-        p->next_packet = NULL;
+        protoop_prepare_and_run_noparam(cnx, &PROTOOP_NOPARAM_PACKET_WAS_LOST, NULL, p, send_path);
 
-        /* add this packet to the retransmitted list */
-        if (send_path->pkt_ctx[pc].retransmitted_oldest == NULL) {
-            send_path->pkt_ctx[pc].retransmitted_newest = p;
-            send_path->pkt_ctx[pc].retransmitted_oldest = p;
-            p->previous_packet = NULL;
-        }
-        else {
-            send_path->pkt_ctx[pc].retransmitted_oldest->next_packet = p;
-            p->previous_packet = send_path->pkt_ctx[pc].retransmitted_oldest;
-            send_path->pkt_ctx[pc].retransmitted_oldest = p;
+        /* Only a summary of the packet is kept in the retransmitted list. The packet itself
+         * is still used by the caller, and is released at the end of picoquic_prepare_packet */
+        summary = picoquic_create_packet_summary(cnx, p);
+        if (summary != NULL) {
+            if (send_path->pkt_ctx[pc].retransmitted_oldest == NULL) {
+                send_path->pkt_ctx[pc].retransmitted_newest = summary;
+                send_path->pkt_ctx[pc].retransmitted_oldest = summary;
+            }
+            else {
+                send_path->pkt_ctx[pc].retransmitted_oldest->next_packet = summary;
+                summary->previous_packet = send_path->pkt_ctx[pc].retransmitted_oldest;
+                send_path->pkt_ctx[pc].retransmitted_oldest = summary;
+            }
         }
+
+        p->previous_packet = NULL;
+        p->next_packet = cnx->retired_packets;
+        cnx->retired_packets = p;
     }
+}
+
+void picoquic_free_retired_packets(picoquic_cnx_t* cnx)
+{
+    while (cnx->retired_packets != NULL) {
+        picoquic_packet_t* p = cnx->retired_packets;
+        cnx->retired_packets = p->next_packet;
+        picoquic_destroy_packet(p);
+    }
+}
+
+/**
+ * See PROTOOP_NOPARAM_DEQUEUE_RETRANSMIT_PACKET
+ */
+protoop_arg_t dequeue_retransmit_packet(picoquic_cnx_t *cnx)
+{
+    picoquic_packet_t *p = (picoquic_packet_t *) cnx->protoop_inputv[0];
+    int should_free = (int) cnx->protoop_inputv[1];
+
+    picoquic_dequeue_retransmit_packet_core(cnx, p, should_free);
 
     return 0;
 }
@@ -923,7 +1340,7 @@ void picoquic_dequeue_retransmit_packet(picoquic_cnx_t* cnx, picoquic_packet_t*
  */
 protoop_arg_t dequeue_retransmitted_packet(picoquic_cnx_t *cnx)
 {
-    picoquic_packet_t *p = (picoquic_packet_t *)cnx->protoop_inputv[0];
+    picoquic_packet_summary_t *p = (picoquic_packet_summary_t *)cnx->protoop_inputv[0];
 
     picoquic_packet_context_enum pc = p->pc;
     picoquic_path_t* send_path = p->send_path;
@@ -951,12 +1368,12 @@ protoop_arg_t dequeue_retransmitted_packet(picoquic_cnx_t *cnx)
         p->next_packet->previous_packet = p->previous_packet;
     }
 
-    picoquic_destroy_packet(p);
+    free(p);
 
     return 0;
 }
 
-void picoquic_dequeue_retransmitted_packet(picoquic_cnx_t* cnx, picoquic_packet_t* p)
+void picoquic_dequeue_retransmitted_packet(picoquic_cnx_t* cnx, picoquic_packet_summary_t* p)
 {
     protoop_prepare_and_run_noparam(cnx, &PROTOOP_NOPARAM_DEQUEUE_RETRANSMITTED_PACKET, NULL,
         p);
@@ -1102,6 +1519,28 @@ void picoquic_finalize_and_protect_packet(picoquic_cnx_t *cnx, picoquic_packet_t
     *send_length  = (size_t) plugin_run_protoop_internal(cnx, &pp);
 }
 
+/*
+ * Loss detection follows RFC 9002. A packet is lost if a packet sent at least
+ * PICOQUIC_LOSS_PACKET_THRESHOLD packets later was acknowledged, or if a later
+ * packet was acknowledged and the packet was sent more than the loss delay
+ * ago. If no later packet was acknowledged, the packet is repeated when the
+ * probe timeout of its path and packet context expires.
+ */
+static uint64_t picoquic_loss_delay(picoquic_path_t* path_x)
+{
+    uint64_t rtt = (path_x->rtt_sample > path_x->smoothed_rtt) ? path_x->rtt_sample : path_x->smoothed_rtt;
+    uint64_t loss_delay = rtt + (rtt >> 3);
+
+    return (loss_delay < PICOQUIC_LOSS_TIMER_GRANULARITY) ? PICOQUIC_LOSS_TIMER_GRANULARITY : loss_delay;
+}
+
+static uint64_t picoquic_probe_timeout(picoquic_path_t* path_x, picoquic_packet_context_enum pc)
+{
+    uint64_t nb_retransmit = path_x->pkt_ctx[pc].nb_retransmit;
+
+    return (nb_retransmit == 0) ? path_x->retransmit_timer : (1000000ull << (nb_retransmit - 1));
+}
+
 /**
  * See PROTOOP_NOPARAM_RETRANSMIT_NEEDED_BY_PACKET
  */
@@ -1119,25 +1558,15 @@ protoop_arg_t retransmit_needed_by_packet(picoquic_cnx_t *cnx)
     uint64_t retransmit_time;
     int is_timer_based = 0;
 
-    if (delta_seq > 0) {
-        /* By default, we use timer based RACK logic to absorb out of order deliveries */
-        retransmit_time = p->send_time + send_path->smoothed_rtt + (send_path->smoothed_rtt >> 3);
-        is_timer_based = 0;
-
-        /* RACK logic fails when the smoothed RTT is too small, in which case we
-         * rely on dupack logic possible, or on a safe estimate of the RACK delay if it
-         * is not */
-        if (delta_seq < 3) {
-            uint64_t rack_timer_min = send_path->pkt_ctx[pc].latest_time_acknowledged + PICOQUIC_RACK_DELAY;
-            if (retransmit_time < rack_timer_min) {
-                retransmit_time = rack_timer_min;
-            }
-        }
+    if (delta_seq >= PICOQUIC_LOSS_PACKET_THRESHOLD) {
+        /* Packet threshold */
+        retransmit_time = p->send_time;
+    } else if (delta_seq > 0) {
+        /* Time threshold, absorbs out of order deliveries */
+        retransmit_time = p->send_time + picoquic_loss_delay(send_path);
     } else {
         /* There has not been any higher packet acknowledged, thus we fall back on timer logic. */
-        uint64_t rto = (send_path->pkt_ctx[pc].nb_retransmit == 0) ?
-            send_path->retransmit_timer : (1000000ull << (send_path->pkt_ctx[pc].nb_retransmit - 1));
-        retransmit_time = p->send_time + rto;
+        retransmit_time = p->send_time + picoquic_probe_timeout(send_path, pc);
         is_timer_based = 1;
     }
     if (p->ptype == picoquic_packet_0rtt_protected) {
@@ -1271,6 +1700,7 @@ protoop_arg_t scheduler_write_new_frames(picoquic_cnx_t *cnx) {
             length += (uint32_t) data_bytes;
             /* Keep track of the bytes sent by the plugin */
             p->bytes_in_flight += (uint64_t) data_bytes;
+            cnx->plugins_bytes_in_flight += (uint64_t) data_bytes;
             p->bytes_total += (uint64_t) data_bytes;
             p->frames_total += 1;
             /* Keep track if the packet should be retransmitted or not */
@@ -1322,6 +1752,7 @@ protoop_arg_t scheduler_write_new_frames(picoquic_cnx_t *cnx) {
             length += (uint32_t) data_bytes;
             /* Keep track of the bytes sent by the plugin */
             p->bytes_in_flight += (uint64_t) data_bytes;
+            cnx->plugins_bytes_in_flight += (uint64_t) data_bytes;
             p->bytes_total += (uint64_t) data_bytes;
             p->frames_total += 1;
             /* Keep track if the packet should be retransmitted or not */
@@ -1389,6 +1820,10 @@ protoop_arg_t retransmit_needed(picoquic_cnx_t *cnx)
         picoquic_path_t* orig_path = cnx->path[i];
         picoquic_packet_t* p = orig_path->pkt_ctx[pc].retransmit_oldest;
         queue_t *rtx_frames = cnx->rtx_frames[pc];
+        if (orig_path->pkt_ctx[pc].loss_detection_time > current_time) {
+            /* Nothing can be lost or probed yet in this context, avoid the scan */
+            continue;
+        }
         /* TODO: while packets are pure ACK, drop them from retransmit queue */
         while (p != NULL) {
             int should_retransmit = 0;
@@ -1467,6 +1902,7 @@ protoop_arg_t retransmit_needed(picoquic_cnx_t *cnx)
                     int packet_is_pure_ack = p->is_pure_ack;
                     int written_non_pure_ack_frames = 0;
                     int has_handshake_done = 0;
+                    int rescheduled_stream_data = 0;
 
                     if (p->is_mtu_probe && p->length > old_path->send_mtu) {
                         /* MTU probe was lost, presumably because of packet too big */
@@ -1500,6 +1936,13 @@ protoop_arg_t retransmit_needed(picoquic_cnx_t *cnx)
                                 if (ret == 0 && frame_is_pure_ack == 0) {
                                     ret = picoquic_check_stream_frame_already_acked(cnx, &p->bytes[byte_index], frame_length, &frame_is_pure_ack);
                                 }
+                                /* Stream data is sent again from the stream, in new frames, see prepare_stream_frame */
+                                if (ret == 0 && !frame_is_pure_ack && pc == picoquic_packet_context_application &&
+                                    PICOQUIC_IN_RANGE(p->bytes[byte_index], picoquic_frame_type_stream_range_min, picoquic_frame_type_stream_range_max) &&
+                                    picoquic_reschedule_lost_stream_frame(cnx, &p->bytes[byte_index], frame_length)) {
+                                    rescheduled_stream_data = 1;
+                                    frame_is_pure_ack = 1;
+                                }
                                 /* Prepare retransmission if needed */
                                 if (ret == 0 && !frame_is_pure_ack) {
                                     if (length + checksum_length + frame_length <= send_buffer_max) {
@@ -1592,8 +2035,9 @@ protoop_arg_t retransmit_needed(picoquic_cnx_t *cnx)
 
                     picoquic_dequeue_retransmit_packet(cnx, p, p->is_pure_ack & do_not_detect_spurious);
 
-                    /* If we have a good packet, return it */
-                    if (packet_is_pure_ack || length <= header_length) {
+                    /* If we have a good packet, return it. Rescheduled stream data counts as a
+                     * retransmission even if it did not fit in this packet. */
+                    if (packet_is_pure_ack || (length <= header_length && !rescheduled_stream_data)) {
                         length = 0;
                     } else {
                         /* We should also consider if some action was recently observed to consider that it is actually a RTO... */
@@ -1626,6 +2070,7 @@ protoop_arg_t retransmit_needed(picoquic_cnx_t *cnx)
                                 orig_path->pkt_ctx[pc].latest_retransmit_time = current_time;
                                 if (current_time >= retrans_cc_notification_timer) {
                                     orig_path->pkt_ctx[pc].nb_retransmit++;
+                                    orig_path->pkt_ctx[pc].loss_detection_time = 0;
                                 }
                             }
                         }
@@ -1637,6 +2082,11 @@ protoop_arg_t retransmit_needed(picoquic_cnx_t *cnx)
                                     p->sequence_number, cnx->client_mode);
                             }
 
+                            if (length <= header_length) {
+                                /* The rescheduled data will be sent in the next packets */
+                                length = 0;
+                            }
+
                             /* special case for the client initial */
                             if (p->ptype == picoquic_packet_initial && cnx->client_mode != 0) {
                                 while (length < (send_buffer_max - checksum_length)) {
@@ -1720,6 +2170,13 @@ int picoquic_is_cnx_backlog_empty(picoquic_cnx_t* cnx)
         }
     }
 
+    /* Lost stream data that was not sent again yet */
+    for (picoquic_stream_head* stream = cnx->first_stream; backlog_empty == 1 && stream != NULL; stream = stream->next_stream) {
+        if (stream->nb_lost_ranges > 0) {
+            backlog_empty = 0;
+        }
+    }
+
     return backlog_empty;
 }
 
@@ -1801,13 +2258,47 @@ uint32_t picoquic_prepare_mtu_probe(picoquic_cnx_t* cnx,
         path_x, header_length, checksum_length, bytes);
 }
 
-protoop_plugin_t *get_next_plugin(picoquic_cnx_t *cnx, protoop_plugin_t *t)
+/*
+ * Plugins having pending reservations are kept in a circular list starting
+ * at cnx->first_drr, so that the frame scheduler only visits plugins that
+ * have something to send. New plugins are inserted at the end of the round.
+ */
+void picoquic_plugin_drr_activate(picoquic_cnx_t* cnx, protoop_plugin_t* p)
 {
-    if (t->hh.next != NULL) {
-        return t->hh.next;
+    if (p->drr_next != NULL) {
+        return;
+    }
+    if (cnx->first_drr == NULL) {
+        p->drr_next = p;
+        p->drr_prev = p;
+        cnx->first_drr = p;
+    } else {
+        p->drr_next = cnx->first_drr;
+        p->drr_prev = cnx->first_drr->drr_prev;
+        p->drr_prev->drr_next = p;
+        cnx->first_drr->drr_prev = p;
     }
-    /* Otherwise, it is the first one */
-    return cnx->plugins;
+    cnx->nb_drr_plugins++;
+}
+
+void picoquic_plugin_drr_deactivate(picoquic_cnx_t* cnx, protoop_plugin_t* p)
+{
+    if (p->drr_next == NULL) {
+        return;
+    }
+    if (p->drr_next == p) {
+        cnx->first_drr = NULL;
+    } else {
+        p->drr_prev->drr_next = p->drr_next;
+        p->drr_next->drr_prev = p->drr_prev;
+        if (cnx->first_drr == p) {
+            cnx->first_drr = p->drr_next;
+        }
+    }
+    p->drr_next = NULL;
+    p->drr_prev = NULL;
+    p->drr_deficit = 0;
+    cnx->nb_drr_plugins--;
 }
 
 /* Special wake up decision logic in initial state */
@@ -1941,13 +2432,11 @@ protoop_arg_t has_congestion_controlled_plugin_frames_to_send(picoquic_cnx_t *cn
     protoop_arg_t ret = 0;
     protoop_plugin_t *p = cnx->first_drr;
 
-    if(p) {
-        do {
-            if (queue_peek(p->block_queue_cc)) {
-                ret = 1;
-                break;
-            }
-        } while (!ret && (p = get_next_plugin(cnx, p)) != cnx->first_drr);
+    for (int i = 0; !ret && i < cnx->nb_drr_plugins; i++) {
+        if (queue_peek(p->block_queue_cc)) {
+            ret = 1;
+        }
+        p = p->drr_next;
     }
     return ret;
 }
@@ -1956,6 +2445,33 @@ bool picoquic_has_congestion_controlled_plugin_frames_to_send(picoquic_cnx_t *cn
     return (bool) protoop_prepare_and_run_noparam(cnx, &PROTOOP_NOPARAM_HAS_CONGESTION_CONTROLLED_PLUGIN_FRAMEMS_TO_SEND, NULL, NULL);
 }
 
+/*
+ * Time at which the oldest packet of the context becomes lost or has to be
+ * probed. The value only changes when acknowledgements arrive or when the
+ * oldest packet leaves the queue, so it is cached until one of these events.
+ * Returns UINT64_MAX if nothing is in flight.
+ */
+static uint64_t picoquic_get_loss_detection_time(picoquic_cnx_t* cnx, picoquic_path_t* path_x,
+    picoquic_packet_context_enum pc, uint64_t current_time)
+{
+    picoquic_packet_context_t* pkt_ctx = &path_x->pkt_ctx[pc];
+    picoquic_packet_t* p = pkt_ctx->retransmit_oldest;
+    uint64_t loss_time = UINT64_MAX;
+    int timer_based = 0;
+
+    if (p == NULL) {
+        pkt_ctx->loss_detection_time = 0;
+    } else if (pkt_ctx->loss_detection_time != 0) {
+        loss_time = pkt_ctx->loss_detection_time;
+    } else {
+        picoquic_retransmit_needed_by_packet(cnx, p, current_time, &timer_based, NULL, &loss_time);
+        /* 0-RTT packets depend on the connection state, do not cache them */
+        pkt_ctx->loss_detection_time = (p->ptype == picoquic_packet_0rtt_protected) ? 0 : loss_time;
+    }
+
+    return loss_time;
+}
+
 /**
  * See PROTOOP_NOPARAM_SET_NEXT_WAKE_TIME
  */
@@ -1964,7 +2480,6 @@ protoop_arg_t set_next_wake_time(picoquic_cnx_t *cnx)
     uint64_t current_time = (uint64_t) cnx->protoop_inputv[0];
     uint64_t next_time = cnx->latest_progress_time + PICOQUIC_MICROSEC_SILENCE_MAX * (2 - cnx->client_mode);
     picoquic_stream_head* stream = NULL;
-    int timer_based = 0;
     int blocked = 1;
     int pacing = 0;
     int ret = 0;
@@ -1985,9 +2500,7 @@ protoop_arg_t set_next_wake_time(picoquic_cnx_t *cnx)
         for (int i = 0; blocked != 0 && pacing == 0 && i < cnx->nb_paths; i++) {
             path_x = cnx->path[i];
             for (picoquic_packet_context_enum pc = 0; pc < picoquic_nb_packet_context; pc++) {
-                picoquic_packet_t* p = path_x->pkt_ctx[pc].retransmit_oldest;
-
-                if (p != NULL && ret == 0 && picoquic_retransmit_needed_by_packet(cnx, p, current_time, /* &ph,*/ &timer_based, NULL, NULL)) {
+                if (ret == 0 && picoquic_get_loss_detection_time(cnx, path_x, pc, current_time) <= current_time) {
                     blocked = 0;
                 }
                 else if (picoquic_is_ack_needed(cnx, current_time, pc, path_x)) {
@@ -2033,8 +2546,9 @@ protoop_arg_t set_next_wake_time(picoquic_cnx_t *cnx)
     } else if (pacing == 0) {
         for (picoquic_packet_context_enum pc = 0; pc < picoquic_nb_packet_context; pc++) {
             for (int i = 0; i < cnx->nb_paths; i++) {
+                uint64_t loss_time;
+
                 path_x = cnx->path[i];
-                picoquic_packet_t* p = path_x->pkt_ctx[pc].retransmit_oldest;
                 /* Consider delayed ACK */
                 if (path_x->pkt_ctx[pc].ack_needed) {
                     uint64_t ack_time = path_x->pkt_ctx[pc].highest_ack_time + path_x->pkt_ctx[pc].ack_delay_local;
@@ -2044,13 +2558,10 @@ protoop_arg_t set_next_wake_time(picoquic_cnx_t *cnx)
                     }
                 }
 
-                if (p != NULL) {
-                    uint64_t retransmit_time = UINT64_MAX;
-                    char *retransmit_reason = NULL;
-                    picoquic_retransmit_needed_by_packet(cnx, p, current_time, &timer_based, &retransmit_reason, &retransmit_time);
-                    if (retransmit_time < next_time) {
-                        next_time = retransmit_time;
-                    }
+                /* Consider loss detection and probe timers */
+                loss_time = picoquic_get_loss_detection_time(cnx, path_x, pc, current_time);
+                if (loss_time < next_time) {
+                    next_time = loss_time;
                 }
             }
             if (cnx->handshake_done && (cnx->client_mode || cnx->handshake_done_acked)) {
@@ -2086,6 +2597,10 @@ protoop_arg_t set_next_wake_time(picoquic_cnx_t *cnx)
 /* TODO: tie with per path scheduling */
 void picoquic_cnx_set_next_wake_time(picoquic_cnx_t* cnx, uint64_t current_time)
 {
+    if (cnx->wake_time_deferred) {
+        cnx->wake_time_pending = 1;
+        return;
+    }
     protoop_prepare_and_run_noparam(cnx, &PROTOOP_NOPARAM_SET_NEXT_WAKE_TIME, NULL, current_time);
 }
 
@@ -2234,6 +2749,7 @@ protoop_arg_t prepare_packet_old_context(picoquic_cnx_t* cnx)
                 send_buffer_max - checksum_overhead - length, &data_bytes)
                 == 0) {
                 length += (uint32_t)data_bytes;
+                picoquic_record_ack_frame_sent(cnx, packet, pc, data_bytes);
             }
             while ((rtx_frame = queue_peek(cnx->rtx_frames[pc])) != NULL &&
                    length + rtx_frame->iov_len + checksum_overhead < send_buffer_max) {
@@ -2381,6 +2897,7 @@ int picoquic_prepare_packet_client_init(picoquic_cnx_t* cnx, picoquic_path_t **
                     send_buffer_max - checksum_overhead - length, &data_bytes)
                     == 0) {
                     length += (uint32_t)data_bytes;
+                    picoquic_record_ack_frame_sent(cnx, packet, pc, data_bytes);
                 }
             }
             /* document the send time & overhead */
@@ -2419,6 +2936,7 @@ int picoquic_prepare_packet_client_init(picoquic_cnx_t* cnx, picoquic_path_t **
                             send_buffer_max - checksum_overhead - length, &data_bytes);
                         if (ret == 0) {
                             length += (uint32_t)data_bytes;
+                            picoquic_record_ack_frame_sent(cnx, packet, pc, data_bytes);
                             data_bytes = 0;
                         }
                         else if (ret == PICOQUIC_ERROR_FRAME_BUFFER_TOO_SMALL) {
@@ -2582,6 +3100,7 @@ int picoquic_prepare_packet_server_init(picoquic_cnx_t* cnx, picoquic_path_t **
                 send_buffer_max - checksum_overhead - length, &data_bytes)
                 == 0) {
                 length += (uint32_t)data_bytes;
+                picoquic_record_ack_frame_sent(cnx, packet, pc, data_bytes);
                 data_bytes = 0;
             }
 
@@ -2645,6 +3164,7 @@ int picoquic_prepare_packet_server_init(picoquic_cnx_t* cnx, picoquic_path_t **
                 send_buffer_max - checksum_overhead - length, &data_bytes)
                 == 0) {
                 length += (uint32_t)data_bytes;
+                picoquic_record_ack_frame_sent(cnx, packet, pc, data_bytes);
                 packet->length = length;
             }
             /* document the send time & overhead */
@@ -2660,6 +3180,7 @@ int picoquic_prepare_packet_server_init(picoquic_cnx_t* cnx, picoquic_path_t **
                 send_buffer_max - checksum_overhead - length, &data_bytes)
                 == 0) {
                 length += (uint32_t)data_bytes;
+                picoquic_record_ack_frame_sent(cnx, packet, pc, data_bytes);
                 packet->length = length;
             }
         } else {
@@ -2851,6 +3372,7 @@ int picoquic_prepare_packet_closing(picoquic_cnx_t* cnx, picoquic_path_t ** path
                 send_buffer_max - checksum_overhead - length, &consumed);
             if (ret == 0) {
                 length += (uint32_t)consumed;
+                picoquic_record_ack_frame_sent(cnx, packet, pc, consumed);
             }
 
             consumed = 0;
@@ -2910,104 +3432,131 @@ picoquic_path_t *picoquic_select_sending_path(picoquic_cnx_t *cnx, picoquic_pack
         retransmit_p, from_path, reason);
 }
 
-/* This implements a deficit round robin with bursts */
-size_t picoquic_frame_fair_reserve(picoquic_cnx_t *cnx, picoquic_path_t *path_x, picoquic_stream_head* stream, uint64_t frame_mss)
+/* Moves the frames of a reservation block to the queue of frames to send, and frees the block */
+static size_t picoquic_frame_schedule_block(picoquic_cnx_t *cnx, protoop_plugin_t *p, reserve_frames_block_t *block)
 {
-    /* If there is no plugin, there is no frame to reserve! */
-    if (!cnx->plugins) {
-        return 0;
+    size_t block_bytes = block->total_bytes;
+
+    for (int i = 0; i < block->nb_frames; i++) {
+        /* Not the most efficient way, but will do the trick */
+        block->frames[i].p = p;
+        queue_enqueue(cnx->reserved_frames, &block->frames[i]);
     }
-    /* Handle the first call */
-    if (!cnx->first_drr) {
-        cnx->first_drr = cnx->plugins;
+    LOG {
+        char ftypes_str[250];
+        size_t ftypes_ofs = 0;
+        for (int i = 0; i < block->nb_frames; i++) {
+            ftypes_ofs += snprintf(ftypes_str + ftypes_ofs, sizeof(ftypes_str) - ftypes_ofs, "%" PRIu64 "%s", block->frames[i].frame_type, i < block->nb_frames - 1 ? ", " : "");
+        }
+        LOG_EVENT(cnx, "plugins", "enqueue_frame", "frame_fair_reserve_under_rated", "{\"plugin\": \"%s\", \"nb_frames\": %d, \"total_bytes\": %" PRIu64 ", \"is_cc\": %d, \"frames\": [%s]}", p->name, block->nb_frames, block->total_bytes, block->is_congestion_controlled, ftypes_str);
     }
-    /* Find if reservations were made */
-    protoop_plugin_t *p, *tmp_p;
-    reserve_frames_block_t *block;
+    /* Free the block */
+    free(block);
 
-    uint64_t plugin_use = 0;
-    uint64_t num_plugins = 0;
+    return block_bytes;
+}
 
-    /* FIXME this is not fair... Introduce DRR */
-    HASH_ITER(hh, cnx->plugins, p, tmp_p) {
-        plugin_use += p->bytes_in_flight;
-        num_plugins += 1;
+/*
+ * Quantum of a plugin for one DRR round. When stream data is waiting, plugins
+ * that are not rate unlimited share the part of the packet left by the core
+ * guaranteed rate. Otherwise, the plugin may fill the whole packet.
+ */
+static uint64_t picoquic_frame_drr_quantum(picoquic_cnx_t *cnx, protoop_plugin_t *p, picoquic_stream_head* stream, uint64_t frame_mss)
+{
+    if (stream != NULL && !p->params.rate_unlimited) {
+        return frame_mss * (1000 - cnx->core_rate) / 1000;
     }
+    return frame_mss;
+}
 
-    uint64_t max_plugin_cwin = path_x->cwin * (1000 - cnx->core_rate) / 1000;
-    uint64_t total_plugin_bytes_in_flight = 0;
+/*
+ * Bound on the credit a plugin keeps across rounds. It does not depend on the
+ * room left in the current packet, so that a block larger than the quantum
+ * accumulates enough credit over small packets to go in the next full one.
+ */
+static uint64_t picoquic_frame_drr_max_deficit(picoquic_path_t *path_x, protoop_plugin_t *p)
+{
+    reserve_frames_block_t *block = (reserve_frames_block_t *) queue_peek(p->block_queue_cc);
+    uint64_t max_deficit = path_x->send_mtu;
 
-    /*
-    if (stream != NULL && plugin_use >= max_plugin_cwin) {
-        printf("Fair reserve over rate! Stream %p plugin_use %" PRIu64 " max_plugin_cwin %" PRIu64 "\n", stream, plugin_use, max_plugin_cwin);
-        // Don't go over the guaranteed rate!
-        return;
+    if (block != NULL && block->total_bytes > max_deficit) {
+        max_deficit = block->total_bytes;
     }
-    */
+    return max_deficit;
+}
 
+/*
+ * This implements a deficit round robin over the plugins having pending
+ * reservations. Each round starts at the plugin following the one that
+ * started the previous round. Congestion controlled reservations are limited
+ * by the deficit of their plugin, while non congestion controlled ones are
+ * only limited by the room left in the packet.
+ */
+size_t picoquic_frame_fair_reserve(picoquic_cnx_t *cnx, picoquic_path_t *path_x, picoquic_stream_head* stream, uint64_t frame_mss)
+{
+    protoop_plugin_t *p, *next_p, *round_start;
+    reserve_frames_block_t *block;
+    uint64_t max_plugin_cwin;
+    uint64_t total_plugin_bytes_in_flight = 0;
     size_t queued_bytes = 0;
-    p = cnx->first_drr;
+    int nb_plugins = cnx->nb_drr_plugins;
+
+    /* If no plugin has reservations, there is no frame to reserve! */
+    if (cnx->first_drr == NULL) {
+        return 0;
+    }
+
+    max_plugin_cwin = path_x->cwin * (1000 - cnx->core_rate) / 1000;
+    round_start = cnx->first_drr;
 
     /* First pass: consider only under-rated plugins with CC */
-    do {
-        if (p->params.rate_unlimited || total_plugin_bytes_in_flight < max_plugin_cwin){
+    p = round_start;
+    for (int i = 0; i < nb_plugins; i++, p = p->drr_next) {
+        if (queue_peek(p->block_queue_cc) != NULL &&
+            (p->params.rate_unlimited || total_plugin_bytes_in_flight < max_plugin_cwin)) {
+            uint64_t max_deficit = picoquic_frame_drr_max_deficit(path_x, p);
+            p->drr_deficit += picoquic_frame_drr_quantum(cnx, p, stream, frame_mss);
+            if (p->drr_deficit > max_deficit) {
+                p->drr_deficit = max_deficit;
+            }
             while ((block = queue_peek(p->block_queue_cc)) != NULL &&
+                   block->total_bytes <= p->drr_deficit &&
                    queued_bytes + block->total_bytes < frame_mss &&
-                   !(stream != NULL && (!p->params.rate_unlimited && plugin_use >= max_plugin_cwin)) &&
+                   !(stream != NULL && (!p->params.rate_unlimited && cnx->plugins_bytes_in_flight >= max_plugin_cwin)) &&
                    (!block->is_congestion_controlled || path_x->bytes_in_transit < path_x->cwin))
             {
                 block = (reserve_frames_block_t *) queue_dequeue(p->block_queue_cc);
-                for (int i = 0; i < block->nb_frames; i++) {
-                    /* Not the most efficient way, but will do the trick */
-                    block->frames[i].p = p;
-                    queue_enqueue(cnx->reserved_frames, &block->frames[i]);
-                }
-                /* Update queued bytes counter */
-                queued_bytes += block->total_bytes;
-                LOG {
-                    char ftypes_str[250];
-                    size_t ftypes_ofs = 0;
-                    for (int i = 0; i < block->nb_frames; i++) {
-                        ftypes_ofs += snprintf(ftypes_str + ftypes_ofs, sizeof(ftypes_str) - ftypes_ofs, "%" PRIu64 "%s", block->frames[i].frame_type, i < block->nb_frames - 1 ? ", " : "");
-                    }
-                    LOG_EVENT(cnx, "plugins", "enqueue_frame", "frame_fair_reserve_under_rated", "{\"plugin\": \"%s\", \"nb_frames\": %d, \"total_bytes\": %" PRIu64 ", \"is_cc\": %d, \"frames\": [%s]}", p->name, block->nb_frames, block->total_bytes, block->is_congestion_controlled, ftypes_str);
-                }
-                /* Free the block */
-                free(block);
+                p->drr_deficit -= block->total_bytes;
+                queued_bytes += picoquic_frame_schedule_block(cnx, p, block);
+            }
+            if (queue_peek(p->block_queue_cc) == NULL) {
+                /* No credit is kept when the queue is empty */
+                p->drr_deficit = 0;
             }
         }
         total_plugin_bytes_in_flight += p->bytes_in_flight;
-    } while ((p = get_next_plugin(cnx, p)) != cnx->first_drr);
-    p = cnx->first_drr;
-    /* Second pass: consider all plugins with non CC */
-    do {
+    }
+
+    /* Second pass: consider all plugins with non CC, and retire the ones having nothing left */
+    p = round_start;
+    for (int i = 0; i < nb_plugins; i++, p = next_p) {
+        next_p = p->drr_next;
         while ((block = queue_peek(p->block_queue_non_cc)) != NULL &&
                 queued_bytes + block->total_bytes < frame_mss &&
                 (!block->is_congestion_controlled || path_x->bytes_in_transit < path_x->cwin))
         {
             block = (reserve_frames_block_t *) queue_dequeue(p->block_queue_non_cc);
-            for (int i = 0; i < block->nb_frames; i++) {
-                /* Not the most efficient way, but will do the trick */
-                block->frames[i].p = p;
-                queue_enqueue(cnx->reserved_frames, &block->frames[i]);
-            }
-            /* Update queued bytes counter */
-            queued_bytes += block->total_bytes;
-            LOG {
-                char ftypes_str[250];
-                size_t ftypes_ofs = 0;
-                for (int i = 0; i < block->nb_frames; i++) {
-                    ftypes_ofs += snprintf(ftypes_str + ftypes_ofs, sizeof(ftypes_str) - ftypes_ofs, "%" PRIu64 "%s", block->frames[i].frame_type, i < block->nb_frames - 1 ? ", " : "");
-                }
-                LOG_EVENT(cnx, "plugins", "enqueue_frame", "frame_fair_reserve_under_rated", "{\"plugin\": \"%s\", \"nb_frames\": %d, \"total_bytes\": %" PRIu64 ", \"is_cc\": %d, \"frames\": [%s]}", p->name, block->nb_frames, block->total_bytes, block->is_congestion_controlled, ftypes_str);
-            }
-            /* Free the block */
-            free(block);
+            queued_bytes += picoquic_frame_schedule_block(cnx, p, block);
         }
-        total_plugin_bytes_in_flight += p->bytes_in_flight;
-    } while ((p = get_next_plugin(cnx, p)) != cnx->first_drr);
-    /* Now we put all we could */
-    cnx->first_drr = get_next_plugin(cnx, p);
+        if (queue_peek(p->block_queue_cc) == NULL && queue_peek(p->block_queue_non_cc) == NULL) {
+            picoquic_plugin_drr_deactivate(cnx, p);
+        }
+    }
+
+    /* The next round starts with the following plugin */
+    if (cnx->first_drr == round_start) {
+        cnx->first_drr = round_start->drr_next;
+    }
 
     return queued_bytes;
 }
@@ -3073,6 +3622,7 @@ protoop_arg_t schedule_frames_on_path(picoquic_cnx_t *cnx)
                 send_buffer_min_max - checksum_overhead - length, &data_bytes)
                 == 0) {
                 length += (uint32_t)data_bytes;
+                picoquic_record_ack_frame_sent(cnx, packet, pc, data_bytes);
                 packet->length = length;
             }
         }
@@ -3153,6 +3703,7 @@ protoop_arg_t schedule_frames_on_path(picoquic_cnx_t *cnx)
                     if (path_x == cnx->path[0] && (header_length != length || picoquic_is_ack_needed(cnx, current_time, pc, path_x))) {
                         if (picoquic_prepare_ack_frame(cnx, current_time, pc, &bytes[length], send_buffer_min_max - checksum_overhead - length, &data_bytes) == 0) {
                             length += (uint32_t)data_bytes;
+                            picoquic_record_ack_frame_sent(cnx, packet, pc, data_bytes);
                         }
                     }
 
@@ -3582,6 +4133,65 @@ int picoquic_prepare_segment(picoquic_cnx_t* cnx, picoquic_path_t ** path, picoq
 }
 
 
+/*
+ * Client datagrams carrying an Initial packet must be at least PICOQUIC_ENFORCED_INITIAL_MTU
+ * long, or the server drops them. When the last coalesced packet could not be padded (it is
+ * not a 1-RTT packet), fill the rest of the datagram with a padding only packet protected at
+ * the best encryption level available.
+ */
+static int picoquic_prepare_padding_packet(picoquic_cnx_t* cnx, picoquic_path_t* path_x,
+    uint64_t current_time, uint8_t* send_buffer, size_t send_buffer_max, size_t* send_length)
+{
+    int ret = 0;
+    int epoch = (cnx->crypto_context[2].aead_encrypt != NULL) ? 2 : 0;
+    picoquic_packet_context_enum pc = (epoch == 2) ? picoquic_packet_context_handshake : picoquic_packet_context_initial;
+    picoquic_packet_type_enum packet_type = picoquic_packet_type_from_epoch(epoch);
+    uint32_t checksum_overhead = picoquic_get_checksum_length(cnx, 1);
+    uint32_t header_length;
+    uint32_t length;
+    size_t padded_length = 0;
+    picoquic_packet_t* packet;
+
+    if (cnx->crypto_context[epoch].aead_encrypt == NULL || *send_length >= send_buffer_max) {
+        return 0;
+    }
+
+    header_length = picoquic_predict_packet_header_length(cnx, packet_type, path_x);
+    if (*send_length + header_length + checksum_overhead + PICOQUIC_MIN_PADDING_PAYLOAD > send_buffer_max) {
+        return 0;
+    }
+
+    packet = picoquic_create_packet(cnx);
+    if (packet == NULL) {
+        return PICOQUIC_ERROR_MEMORY;
+    }
+
+    packet->ptype = packet_type;
+    packet->pc = pc;
+    packet->offset = header_length;
+    packet->sequence_number = path_x->pkt_ctx[pc].send_sequence;
+    packet->send_time = current_time;
+    packet->send_path = path_x;
+
+    length = header_length;
+    while (*send_length + length + checksum_overhead < send_buffer_max) {
+        packet->bytes[length++] = picoquic_frame_type_padding;
+    }
+
+    picoquic_finalize_and_protect_packet(cnx, packet,
+        ret, length, header_length, checksum_overhead,
+        &padded_length, send_buffer + *send_length, (uint32_t)(send_buffer_max - *send_length), path_x, current_time);
+
+    if (packet->length != 0) {
+        *send_length += padded_length;
+        picoquic_segment_prepared(cnx, packet);
+    } else {
+        picoquic_destroy_packet(packet);
+    }
+
+    return ret;
+}
+
 /* Prepare next packet to send, or nothing.. */
 int picoquic_prepare_packet(picoquic_cnx_t* cnx,
     uint64_t current_time, uint8_t* send_buffer, size_t send_buffer_max, size_t* send_length, picoquic_path_t **path)
@@ -3589,9 +4199,16 @@ int picoquic_prepare_packet(picoquic_cnx_t* cnx,
     int ret = 0;
     picoquic_packet_t * packet = NULL;
     int contains_initial = 0;
+    int last_is_1rtt = 0;
+    size_t datagram_max = send_buffer_max;
 
     *send_length = 0;
 
+    /* The departure time is only reported for the datagram carrying a paced packet */
+    for (int i = 0; i < cnx->nb_paths; i++) {
+        cnx->path[i]->pacing_departure_nanosec = 0;
+    }
+
     while (ret == 0)
     {
         size_t available = send_buffer_max;
@@ -3627,6 +4244,8 @@ int picoquic_prepare_packet(picoquic_cnx_t* cnx,
                     if (packet->ptype == picoquic_packet_initial) {
                         contains_initial = 1;
                     }
+                    last_is_1rtt = (packet->ptype == picoquic_packet_1rtt_protected_phi0 ||
+                        packet->ptype == picoquic_packet_1rtt_protected_phi1);
                 }
                 if (packet->length == 0 ||
                     packet->ptype == picoquic_packet_1rtt_protected_phi0 ||
@@ -3651,11 +4270,89 @@ int picoquic_prepare_packet(picoquic_cnx_t* cnx,
         }
     }
 
-    if (cnx->client_mode && contains_initial
-        && packet->ptype != picoquic_packet_1rtt_protected_phi0
-        && packet->ptype != picoquic_packet_1rtt_protected_phi1) {
-        // TODO: Add another QUIC packet full of padding using the best encryption level available
+    if (ret == 0 && cnx->client_mode && contains_initial && !last_is_1rtt) {
+        if (datagram_max > PICOQUIC_ENFORCED_INITIAL_MTU) {
+            datagram_max = PICOQUIC_ENFORCED_INITIAL_MTU;
+        }
+        ret = picoquic_prepare_padding_packet(cnx, cnx->path[0], current_time, send_buffer, datagram_max, send_length);
+    }
+
+    picoquic_free_retired_packets(cnx);
+
+    return ret;
+}
+
+/*
+ * Largest datagram that picoquic_prepare_packet can write in the buffer. The
+ * path is only selected while preparing the datagram, so this is bounded by
+ * the largest MTU of the paths it may be sent on.
+ */
+static size_t picoquic_prepare_packets_max_length(picoquic_cnx_t* cnx, picoquic_prepared_datagram_t* d)
+{
+    size_t path_mtu_max = 0;
+
+    for (int i = 0; i < cnx->nb_paths; i++) {
+        if (cnx->path[i]->send_mtu > path_mtu_max) {
+            path_mtu_max = cnx->path[i]->send_mtu;
+        }
+    }
+
+    return (d->send_buffer_max < path_mtu_max) ? d->send_buffer_max : path_mtu_max;
+}
+
+/* Prepare a burst of datagrams, see picoquic.h */
+int picoquic_prepare_packets(picoquic_cnx_t* cnx, uint64_t current_time,
+    picoquic_prepared_datagram_t* datagrams, size_t nb_datagrams_max, size_t bytes_max, size_t* nb_datagrams)
+{
+    int ret = 0;
+    size_t bytes_prepared = 0;
+    size_t last_length = 0;
+
+    *nb_datagrams = 0;
+    cnx->wake_time_deferred = 1;
+    cnx->wake_time_pending = 0;
+
+    while (ret == 0 && *nb_datagrams < nb_datagrams_max) {
+        picoquic_prepared_datagram_t* d = &datagrams[*nb_datagrams];
+
+        if (bytes_max != 0 && bytes_prepared + picoquic_prepare_packets_max_length(cnx, d) > bytes_max) {
+            /* Not enough budget left for a full datagram */
+            break;
+        }
+        d->send_length = 0;
+        d->path = NULL;
+        d->departure_time = 0;
+        ret = picoquic_prepare_packet(cnx, current_time, d->send_buffer, d->send_buffer_max, &d->send_length, &d->path);
+        last_length = d->send_length;
+        if (ret != 0 || d->send_length == 0) {
+            break;
+        }
+        if (d->path != NULL) {
+            d->departure_time = picoquic_get_departure_time(d->path);
+        }
+        bytes_prepared += d->send_length;
+        (*nb_datagrams)++;
+        if (d->path != NULL && d->path->pacing_edt_horizon != 0) {
+            /* With EDT, the burst ends when the path of the datagram reaches the pacing horizon */
+            uint64_t next_time = UINT64_MAX;
+            if (!picoquic_is_sending_authorized_by_pacing(d->path, current_time, &next_time)) {
+                last_length = 0;
+                break;
+            }
+        }
+    }
+
+    cnx->wake_time_deferred = 0;
+    if (ret == 0 && last_length > 0 && cnx->cnx_state != picoquic_state_handshake_failure &&
+        cnx->cnx_state < picoquic_state_disconnecting) {
+        /* The burst was cut by the caller's limits, there may be more to send */
+        picoquic_reinsert_by_wake_time(cnx->quic, cnx, current_time);
+    } else if (cnx->wake_time_pending) {
+        /* Also after an error. The closing states set their wake time themselves
+         * and are left alone, as in picoquic_incoming_packets. */
+        picoquic_cnx_set_next_wake_time(cnx, current_time);
     }
+    cnx->wake_time_pending = 0;
 
     return ret;
 }
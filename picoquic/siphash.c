@@ -0,0 +1,102 @@
+#include "siphash.h"
+
+#define SIPHASH_ROTL(x, b) (uint64_t)(((x) << (b)) | ((x) >> (64 - (b))))
+
+#define SIPHASH_ROUND(v0, v1, v2, v3) \
+    do {                              \
+        v0 += v1;                     \
+        v1 = SIPHASH_ROTL(v1, 13);    \
+        v1 ^= v0;                     \
+        v0 = SIPHASH_ROTL(v0, 32);    \
+        v2 += v3;                     \
+        v3 = SIPHASH_ROTL(v3, 16);    \
+        v3 ^= v2;                     \
+        v0 += v3;                     \
+        v3 = SIPHASH_ROTL(v3, 21);    \
+        v3 ^= v0;                     \
+        v2 += v1;                     \
+        v1 = SIPHASH_ROTL(v1, 17);    \
+        v1 ^= v2;                     \
+        v2 = SIPHASH_ROTL(v2, 32);    \
+    } while (0)
+
+static uint64_t siphash_load_le64(const uint8_t* bytes)
+{
+    uint64_t x = 0;
+
+    for (int i = 7; i >= 0; i--) {
+        x = (x << 8) | bytes[i];
+    }
+
+    return x;
+}
+
+static void siphash_store_le64(uint8_t* bytes, uint64_t x)
+{
+    for (int i = 0; i < 8; i++) {
+        bytes[i] = (uint8_t)(x >> (8 * i));
+    }
+}
+
+static void siphash_core(const uint8_t key[SIPHASH_KEY_SIZE], const uint8_t* bytes, size_t length,
+    uint8_t* out, size_t out_length)
+{
+    uint64_t k0 = siphash_load_le64(key);
+    uint64_t k1 = siphash_load_le64(key + 8);
+    uint64_t v0 = 0x736f6d6570736575ull ^ k0;
+    uint64_t v1 = 0x646f72616e646f6dull ^ k1;
+    uint64_t v2 = 0x6c7967656e657261ull ^ k0;
+    uint64_t v3 = 0x7465646279746573ull ^ k1;
+    uint64_t b = ((uint64_t)length) << 56;
+    size_t left = length & 7;
+    const uint8_t* end = bytes + length - left;
+
+    if (out_length == 16) {
+        v1 ^= 0xee;
+    }
+
+    for (; bytes != end; bytes += 8) {
+        uint64_t m = siphash_load_le64(bytes);
+        v3 ^= m;
+        SIPHASH_ROUND(v0, v1, v2, v3);
+        SIPHASH_ROUND(v0, v1, v2, v3);
+        v0 ^= m;
+    }
+
+    for (size_t i = 0; i < left; i++) {
+        b |= ((uint64_t)bytes[i]) << (8 * i);
+    }
+
+    v3 ^= b;
+    SIPHASH_ROUND(v0, v1, v2, v3);
+    SIPHASH_ROUND(v0, v1, v2, v3);
+    v0 ^= b;
+
+    v2 ^= (out_length == 16) ? 0xee : 0xff;
+    for (int i = 0; i < 4; i++) {
+        SIPHASH_ROUND(v0, v1, v2, v3);
+    }
+    siphash_store_le64(out, v0 ^ v1 ^ v2 ^ v3);
+
+    if (out_length == 16) {
+        v1 ^= 0xdd;
+        for (int i = 0; i < 4; i++) {
+            SIPHASH_ROUND(v0, v1, v2, v3);
+        }
+        siphash_store_le64(out + 8, v0 ^ v1 ^ v2 ^ v3);
+    }
+}
+
+uint64_t siphash_64(const uint8_t key[SIPHASH_KEY_SIZE], const uint8_t* bytes, size_t length)
+{
+    uint8_t out[8];
+
+    siphash_core(key, bytes, length, out, sizeof(out));
+
+    return siphash_load_le64(out);
+}
+
+void siphash_128(const uint8_t key[SIPHASH_KEY_SIZE], const uint8_t* bytes, size_t length, uint8_t out[16])
+{
+    siphash_core(key, bytes, length, out, 16);
+}
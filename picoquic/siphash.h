@@ -0,0 +1,17 @@
+#ifndef SIPHASH_H
+#define SIPHASH_H
+
+/*
+ * SipHash-2-4, a keyed pseudo random function designed for short inputs,
+ * see https://131002.net/siphash/. The 128 bit output variant is used to
+ * derive the stateless reset secrets of connection IDs from a per context key.
+ */
+#include <stddef.h>
+#include <stdint.h>
+
+#define SIPHASH_KEY_SIZE 16
+
+uint64_t siphash_64(const uint8_t key[SIPHASH_KEY_SIZE], const uint8_t* bytes, size_t length);
+void siphash_128(const uint8_t key[SIPHASH_KEY_SIZE], const uint8_t* bytes, size_t length, uint8_t out[16]);
+
+#endif
@@ -24,6 +24,58 @@
 #include <stdlib.h>
 #include <string.h>
 #include <errno.h>
+#ifndef _WINDOWS
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+/*
+ * The tickets are indexed by SNI and ALPN in a hash table, with at most one
+ * ticket per pair, and chained in order of expiry so that expired tickets
+ * can be dropped from the head of the list.
+ *
+ * The ticket file is an append-only log of serialized tickets, each preceded
+ * by its 4 bytes length. A ticket supersedes the previous records for the same
+ * SNI and ALPN, so new tickets are simply appended. The file is rewritten
+ * once the superseded records make up most of it.
+ *
+ * The file is only a cache. When loading, a truncated last record is dropped
+ * and a file that cannot be parsed, e.g. one written in an older format, is
+ * treated as empty. In both cases the file is rewritten, so that the next
+ * records are not appended after garbage.
+ */
+
+#define PICOQUIC_TICKET_RECORD_MAX 2048
+#define PICOQUIC_TICKET_LOG_COMPACT_MIN 0x10000
+
+static uint64_t picoquic_ticket_hash(void* key)
+{
+    picoquic_stored_ticket_t* stored = (picoquic_stored_ticket_t*)key;
+
+    return picohash_mix64(picohash_bytes((uint8_t*)stored->sni, stored->sni_length) ^
+        (picohash_bytes((uint8_t*)stored->alpn, stored->alpn_length) << 1));
+}
+
+static int picoquic_ticket_compare(void* key1, void* key2)
+{
+    picoquic_stored_ticket_t* t1 = (picoquic_stored_ticket_t*)key1;
+    picoquic_stored_ticket_t* t2 = (picoquic_stored_ticket_t*)key2;
+    int ret = -1;
+
+    if (t1->sni_length == t2->sni_length && t1->alpn_length == t2->alpn_length &&
+        memcmp(t1->sni, t2->sni, t1->sni_length) == 0 && memcmp(t1->alpn, t2->alpn, t1->alpn_length) == 0) {
+        ret = 0;
+    }
+
+    return ret;
+}
+
+static size_t picoquic_ticket_record_size(const picoquic_stored_ticket_t* ticket)
+{
+    return 4 + 8 + 2 + 2 + 2 + (size_t)ticket->sni_length + ticket->alpn_length + ticket->ticket_length;
+}
 
 picoquic_stored_ticket_t* picoquic_format_ticket(uint64_t time_valid_until,
     char const* sni, uint16_t sni_length, char const* alpn, uint16_t alpn_length,
@@ -152,7 +204,149 @@ int picoquic_deserialize_ticket(picoquic_stored_ticket_t ** ticket, uint8_t * by
     return ret;
 }
 
-int picoquic_store_ticket(picoquic_stored_ticket_t** pp_first_ticket,
+static void picoquic_unlink_ticket(picoquic_ticket_store_t* store, picoquic_stored_ticket_t* stored)
+{
+    if (stored->previous_ticket == NULL) {
+        store->p_first_ticket = stored->next_ticket;
+    } else {
+        stored->previous_ticket->next_ticket = stored->next_ticket;
+    }
+
+    if (stored->next_ticket == NULL) {
+        store->p_last_ticket = stored->previous_ticket;
+    } else {
+        stored->next_ticket->previous_ticket = stored->previous_ticket;
+    }
+
+    stored->next_ticket = NULL;
+    stored->previous_ticket = NULL;
+    store->nb_tickets--;
+    store->live_length -= picoquic_ticket_record_size(stored);
+}
+
+static void picoquic_link_ticket(picoquic_ticket_store_t* store, picoquic_stored_ticket_t* stored)
+{
+    /* New tickets usually expire last, so search the position from the end of the list */
+    picoquic_stored_ticket_t* previous = store->p_last_ticket;
+
+    while (previous != NULL && previous->time_valid_until > stored->time_valid_until) {
+        previous = previous->previous_ticket;
+    }
+
+    stored->previous_ticket = previous;
+    if (previous == NULL) {
+        stored->next_ticket = store->p_first_ticket;
+        store->p_first_ticket = stored;
+    } else {
+        stored->next_ticket = previous->next_ticket;
+        previous->next_ticket = stored;
+    }
+
+    if (stored->next_ticket == NULL) {
+        store->p_last_ticket = stored;
+    } else {
+        stored->next_ticket->previous_ticket = stored;
+    }
+
+    store->nb_tickets++;
+    store->live_length += picoquic_ticket_record_size(stored);
+}
+
+static void picoquic_delete_ticket(picoquic_ticket_store_t* store, picoquic_stored_ticket_t* stored)
+{
+    picohash_item* item = picohash_retrieve(store->table_by_name, stored);
+
+    if (item != NULL) {
+        picohash_item_delete(store->table_by_name, item, 0);
+    }
+
+    picoquic_unlink_ticket(store, stored);
+    memset(stored->ticket, 0, stored->ticket_length);
+    free(stored);
+}
+
+/* Insert a ticket in the store, replacing the previous ticket for the same SNI and ALPN */
+static int picoquic_insert_ticket(picoquic_ticket_store_t* store, picoquic_stored_ticket_t* stored, uint64_t current_time)
+{
+    int ret = 0;
+
+    if (store->table_by_name == NULL) {
+        store->table_by_name = picohash_create(16, picoquic_ticket_hash, picoquic_ticket_compare);
+    }
+
+    if (store->table_by_name == NULL) {
+        ret = PICOQUIC_ERROR_MEMORY;
+    } else {
+        picohash_item* item = picohash_retrieve(store->table_by_name, stored);
+
+        if (item != NULL) {
+            picoquic_delete_ticket(store, (picoquic_stored_ticket_t*)item->key);
+        }
+
+        if (picohash_insert(store->table_by_name, stored) != 0) {
+            ret = PICOQUIC_ERROR_MEMORY;
+        } else {
+            picoquic_link_ticket(store, stored);
+
+            /* Drop the tickets that already expired */
+            while (current_time != 0 && store->p_first_ticket != NULL &&
+                store->p_first_ticket->time_valid_until < current_time) {
+                picoquic_delete_ticket(store, store->p_first_ticket);
+            }
+        }
+    }
+
+    return ret;
+}
+
+static int picoquic_append_ticket(picoquic_ticket_store_t* store, const picoquic_stored_ticket_t* stored, uint64_t current_time)
+{
+    int ret = 0;
+
+    if (store->file_length > PICOQUIC_TICKET_LOG_COMPACT_MIN && store->file_length > 2 * store->live_length) {
+        /* Mostly superseded records, rewrite the file */
+        ret = picoquic_save_tickets(store, current_time, store->file_name);
+        if (ret == 0) {
+            store->file_length = store->live_length;
+        }
+    } else {
+        FILE* F = NULL;
+        uint8_t buffer[PICOQUIC_TICKET_RECORD_MAX];
+        size_t record_size = 0;
+#ifdef _WINDOWS
+        errno_t err = fopen_s(&F, store->file_name, "ab");
+        if (err != 0 || F == NULL) {
+            ret = -1;
+        }
+#else
+        F = fopen(store->file_name, "ab");
+        if (F == NULL) {
+            ret = -1;
+        }
+#endif
+        if (ret == 0) {
+            ret = picoquic_serialize_ticket(stored, buffer, sizeof(buffer), &record_size);
+        }
+
+        if (ret == 0) {
+            uint32_t storage_size = (uint32_t)record_size;
+
+            if (fwrite(&storage_size, 4, 1, F) != 1 || fwrite(buffer, 1, record_size, F) != record_size) {
+                ret = PICOQUIC_ERROR_INVALID_FILE;
+            } else {
+                store->file_length += 4 + record_size;
+            }
+        }
+
+        if (F != NULL) {
+            fclose(F);
+        }
+    }
+
+    return ret;
+}
+
+int picoquic_store_ticket(picoquic_ticket_store_t* store,
     uint64_t current_time,
     char const* sni, uint16_t sni_length, char const* alpn, uint16_t alpn_length,
     uint8_t* ticket, uint16_t ticket_length)
@@ -182,29 +376,11 @@ int picoquic_store_ticket(picoquic_stored_ticket_t** pp_first_ticket,
                     alpn, alpn_length, ticket, ticket_length);
             if (stored == NULL) {
                 ret = PICOQUIC_ERROR_MEMORY;
-            }
-            else {
-                picoquic_stored_ticket_t* next;
-                picoquic_stored_ticket_t** pprevious;
-
-
-                stored->next_ticket = next = *pp_first_ticket;
-                *pp_first_ticket = stored;
-                pprevious = &stored->next_ticket;
-
-                /* Now remove the old tickets for that SNI & ALPN */
-                while (next != NULL) {
-                    if (next->time_valid_until <= stored->time_valid_until && next->sni_length == sni_length && next->alpn_length == alpn_length && memcmp(next->sni, sni, sni_length) == 0 && memcmp(next->alpn, alpn, alpn_length) == 0) {
-                        picoquic_stored_ticket_t* deleted = next;
-                        next = next->next_ticket;
-                        *pprevious = next;
-                        memset(&deleted->ticket, 0, deleted->ticket_length);
-                        free(deleted);
-                    } else {
-                        pprevious = &next->next_ticket;
-                        next = next->next_ticket;
-                    }
-                }
+            } else if ((ret = picoquic_insert_ticket(store, stored, current_time)) != 0) {
+                free(stored);
+            } else if (store->file_name != NULL && picoquic_append_ticket(store, stored, current_time) != 0) {
+                /* The ticket remains usable from memory */
+                DBG_PRINTF("Cannot append ticket to <%s>\n", store->file_name);
             }
         }
     }
@@ -212,41 +388,48 @@ int picoquic_store_ticket(picoquic_stored_ticket_t** pp_first_ticket,
     return ret;
 }
 
-int picoquic_get_ticket(picoquic_stored_ticket_t* p_first_ticket,
+int picoquic_get_ticket(picoquic_ticket_store_t* store,
     uint64_t current_time,
     char const* sni, uint16_t sni_length, char const* alpn, uint16_t alpn_length,
     uint8_t** ticket, uint16_t* ticket_length)
 {
-    int ret = 0;
-    picoquic_stored_ticket_t* next = p_first_ticket;
+    int ret = -1;
+    picoquic_stored_ticket_t key;
+    picohash_item* item = NULL;
 
-    while (next != NULL) {
-        if (next->time_valid_until > current_time && next->sni_length == sni_length && next->alpn_length == alpn_length && memcmp(next->sni, sni, sni_length) == 0 && memcmp(next->alpn, alpn, alpn_length) == 0) {
-            break;
-        } else {
-            next = next->next_ticket;
-        }
+    memset(&key, 0, sizeof(key));
+    key.sni = (char*)sni;
+    key.sni_length = sni_length;
+    key.alpn = (char*)alpn;
+    key.alpn_length = alpn_length;
+
+    *ticket = NULL;
+    *ticket_length = 0;
+
+    if (store->table_by_name != NULL) {
+        item = picohash_retrieve(store->table_by_name, &key);
     }
 
-    if (next == NULL) {
-        *ticket = NULL;
-        *ticket_length = 0;
-        ret = -1;
-    } else {
-        *ticket = next->ticket;
-        *ticket_length = next->ticket_length;
+    if (item != NULL) {
+        picoquic_stored_ticket_t* stored = (picoquic_stored_ticket_t*)item->key;
+
+        if (stored->time_valid_until > current_time) {
+            *ticket = stored->ticket;
+            *ticket_length = stored->ticket_length;
+            ret = 0;
+        }
     }
 
     return ret;
 }
 
-int picoquic_save_tickets(const picoquic_stored_ticket_t* first_ticket,
+int picoquic_save_tickets(const picoquic_ticket_store_t* store,
     uint64_t current_time,
     char const* ticket_file_name)
 {
     int ret = 0;
     FILE* F = NULL;
-    const picoquic_stored_ticket_t* next = first_ticket;
+    const picoquic_stored_ticket_t* next = (store == NULL) ? NULL : store->p_first_ticket;
 #ifdef _WINDOWS
     errno_t err = fopen_s(&F, ticket_file_name, "wb");
     if (err != 0 || F == NULL) {
@@ -263,13 +446,15 @@ int picoquic_save_tickets(const picoquic_stored_ticket_t* first_ticket,
         /* Only store the tickets that are valid going forward */
         if (next->time_valid_until > current_time) {
             /* Compute the serialized size */
-            uint8_t buffer[2048];
+            uint8_t buffer[PICOQUIC_TICKET_RECORD_MAX];
             size_t record_size;
 
             ret = picoquic_serialize_ticket(next, buffer, sizeof(buffer), &record_size);
 
             if (ret == 0) {
-                if (fwrite(&record_size, 4, 1, F) != 1 || fwrite(buffer, 1, record_size, F) != record_size) {
+                uint32_t storage_size = (uint32_t)record_size;
+
+                if (fwrite(&storage_size, 4, 1, F) != 1 || fwrite(buffer, 1, record_size, F) != record_size) {
                     ret = PICOQUIC_ERROR_INVALID_FILE;
                     break;
                 }
@@ -285,91 +470,164 @@ int picoquic_save_tickets(const picoquic_stored_ticket_t* first_ticket,
     return ret;
 }
 
-int picoquic_load_tickets(picoquic_stored_ticket_t** pp_first_ticket,
-    uint64_t current_time, char const* ticket_file_name)
+/*
+ * Map the ticket file in memory. On Windows, the file is read in an
+ * allocated buffer instead.
+ */
+static int picoquic_map_ticket_file(char const* ticket_file_name, uint8_t** bytes, size_t* length)
 {
     int ret = 0;
-    FILE* F = NULL;
-    picoquic_stored_ticket_t* previous = NULL;
-    picoquic_stored_ticket_t* next;
-    uint32_t record_size;
-    uint32_t storage_size;
 
+    *bytes = NULL;
+    *length = 0;
 #ifdef _WINDOWS
+    FILE* F = NULL;
     errno_t err = fopen_s(&F, ticket_file_name, "rb");
     if (err != 0 || F == NULL) {
-        ret = (err == ENOENT)? PICOQUIC_ERROR_NO_SUCH_FILE:-1;
+        ret = (err == ENOENT) ? PICOQUIC_ERROR_NO_SUCH_FILE : -1;
+    } else {
+        long file_size;
+
+        if (fseek(F, 0, SEEK_END) != 0 || (file_size = ftell(F)) < 0 || fseek(F, 0, SEEK_SET) != 0) {
+            ret = PICOQUIC_ERROR_INVALID_FILE;
+        } else if (file_size > 0) {
+            *bytes = (uint8_t*)malloc((size_t)file_size);
+            if (*bytes == NULL) {
+                ret = PICOQUIC_ERROR_MEMORY;
+            } else if (fread(*bytes, 1, (size_t)file_size, F) != (size_t)file_size) {
+                free(*bytes);
+                *bytes = NULL;
+                ret = PICOQUIC_ERROR_INVALID_FILE;
+            } else {
+                *length = (size_t)file_size;
+            }
+        }
+        fclose(F);
     }
 #else
-    F = fopen(ticket_file_name, "rb");
-    if (F == NULL) {
+    int fd = open(ticket_file_name, O_RDONLY);
+    if (fd < 0) {
         ret = (errno == ENOENT) ? PICOQUIC_ERROR_NO_SUCH_FILE : -1;
+    } else {
+        struct stat st;
+
+        if (fstat(fd, &st) != 0) {
+            ret = PICOQUIC_ERROR_INVALID_FILE;
+        } else if (st.st_size > 0) {
+            void* mapped = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (mapped == MAP_FAILED) {
+                ret = PICOQUIC_ERROR_INVALID_FILE;
+            } else {
+                *bytes = (uint8_t*)mapped;
+                *length = (size_t)st.st_size;
+            }
+        }
+        close(fd);
     }
 #endif
-    while (ret == 0) {
-        if (fread(&storage_size, 4, 1, F) != 1) {
-            /* end of file */
+
+    return ret;
+}
+
+static void picoquic_unmap_ticket_file(uint8_t* bytes, size_t length)
+{
+    if (bytes != NULL) {
+#ifdef _WINDOWS
+        (void)length;
+        free(bytes);
+#else
+        (void)munmap(bytes, length);
+#endif
+    }
+}
+
+int picoquic_load_tickets(picoquic_ticket_store_t* store,
+    uint64_t current_time, char const* ticket_file_name)
+{
+    uint8_t* bytes = NULL;
+    size_t length = 0;
+    size_t byte_index = 0;
+    int rewrite_needed = 0;
+    int ret = picoquic_map_ticket_file(ticket_file_name, &bytes, &length);
+
+    while (ret == 0 && byte_index + 4 <= length) {
+        uint32_t storage_size;
+        picoquic_stored_ticket_t* next = NULL;
+        size_t consumed = 0;
+
+        memcpy(&storage_size, bytes + byte_index, 4);
+        byte_index += 4;
+
+        if (storage_size > PICOQUIC_TICKET_RECORD_MAX) {
+            ret = PICOQUIC_ERROR_INVALID_FILE;
+        } else if (byte_index + storage_size > length) {
+            /* Truncated last record, e.g. interrupted append */
             break;
-        }
-        else {
-            record_size = storage_size + offsetof(struct st_picoquic_stored_ticket_t, time_valid_until);
-           
-            if (record_size > 2048) {
+        } else {
+            ret = picoquic_deserialize_ticket(&next, bytes + byte_index, storage_size, &consumed);
+
+            if (ret == PICOQUIC_ERROR_INVALID_TICKET || (ret == 0 && (consumed != storage_size || next == NULL))) {
                 ret = PICOQUIC_ERROR_INVALID_FILE;
-                break;
             }
-            else {
-                uint8_t buffer[2048];
-                if (fread(buffer, 1, storage_size, F)
-                    != storage_size) {
-                    ret = PICOQUIC_ERROR_INVALID_FILE;
-                }
-                else {
-                    size_t consumed = 0;
-                    ret = picoquic_deserialize_ticket(&next, buffer, storage_size, &consumed);
-
-                    if (ret == 0 && (consumed != storage_size || next == NULL)) {
-                        ret = PICOQUIC_ERROR_INVALID_FILE;
-                    }
-
-                    if (ret == 0) {
-                        if (next->time_valid_until < current_time) {
-                            free(next);
-                        }
-                        else {
-                            next->sni = ((char*)next) + sizeof(picoquic_stored_ticket_t);
-                            next->alpn = next->sni + next->sni_length + 1;
-                            next->ticket = (uint8_t*)(next->alpn + next->alpn_length + 1);
-                            next->next_ticket = NULL;
-                            if (previous == NULL) {
-                                *pp_first_ticket = next;
-                            }
-                            else {
-                                previous->next_ticket = next;
-                            }
-
-                            previous = next;
-                        }
-                    }
+
+            if (ret == 0) {
+                if (next->time_valid_until < current_time) {
+                    free(next);
+                } else if ((ret = picoquic_insert_ticket(store, next, current_time)) != 0) {
+                    free(next);
                 }
+            } else if (next != NULL) {
+                free(next);
             }
+
+            byte_index += storage_size;
         }
     }
 
-    if (F != NULL) {
-        fclose(F);
+    if (ret == 0 && byte_index < length) {
+        /* Truncated record or length field */
+        rewrite_needed = 1;
+    }
+
+    picoquic_unmap_ticket_file(bytes, length);
+
+    if (ret == PICOQUIC_ERROR_INVALID_FILE) {
+        /* Unreadable content, start from an empty cache */
+        picoquic_free_tickets(store);
+        rewrite_needed = 1;
+        ret = 0;
+    }
+
+    if (ret == 0) {
+        if (rewrite_needed) {
+            ret = picoquic_save_tickets(store, current_time, ticket_file_name);
+            store->file_length = store->live_length;
+        } else {
+            store->file_length = length;
+        }
     }
 
     return ret;
 }
 
-void picoquic_free_tickets(picoquic_stored_ticket_t** pp_first_ticket)
+void picoquic_free_tickets(picoquic_ticket_store_t* store)
 {
     picoquic_stored_ticket_t* next;
 
-    while ((next = *pp_first_ticket) != NULL) {
-        *pp_first_ticket = next->next_ticket;
+    while ((next = store->p_first_ticket) != NULL) {
+        store->p_first_ticket = next->next_ticket;
 
+        memset(next->ticket, 0, next->ticket_length);
         free(next);
     }
+
+    if (store->table_by_name != NULL) {
+        picohash_delete(store->table_by_name, 0);
+        store->table_by_name = NULL;
+    }
+
+    store->p_last_ticket = NULL;
+    store->nb_tickets = 0;
+    store->live_length = 0;
+    store->file_length = 0;
 }
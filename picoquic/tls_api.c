@@ -28,6 +28,7 @@
 #include "picotls/openssl.h"
 #include "picotls/minicrypto.h"
 #include "tls_api.h"
+#include "siphash.h"
 #include <openssl/pem.h>
 #include <openssl/err.h>
 #include <openssl/engine.h>
@@ -58,6 +59,7 @@ typedef struct st_picoquic_tls_ctx_t {
     uint8_t ext_received[256];
     size_t ext_received_length;
     int ext_received_return;
+    uint8_t* session_ticket; /* Copy of the stored ticket, which may be replaced during the handshake */
 } picoquic_tls_ctx_t;
 
 int picoquic_receive_transport_extensions(picoquic_cnx_t* cnx, int extension_mode,
@@ -425,45 +427,68 @@ int picoquic_server_encrypt_ticket_call_back(ptls_encrypt_ticket_t* encrypt_tick
 
     /* Assume that the keys are in the quic context 
      * The tickets are composed of a 64 bit "sequence number" 
-     * followed by the result of the clear text encryption.
+     * followed by the encryption of the issue time and of the clear text.
+     * The top byte of the sequence number is the id of the ticket key.
      */
     int ret = 0;
     picoquic_quic_t** ppquic = (picoquic_quic_t**)(((char*)encrypt_ticket_ctx) + sizeof(ptls_encrypt_ticket_t));
     picoquic_quic_t* quic = *ppquic;
+    ptls_context_t* ctx = (ptls_context_t*)quic->tls_master_ctx;
 
     if (is_encrypt != 0) {
         ptls_aead_context_t* aead_enc = (ptls_aead_context_t*)quic->aead_encrypt_ticket_ctx;
         /* Encoding*/
         if (aead_enc == NULL) {
             ret = -1;
-        } else if ((ret = ptls_buffer_reserve(dst, 8 + src.len + aead_enc->algo->tag_size)) == 0) {
+        } else if ((ret = ptls_buffer_reserve(dst, 8 + 8 + src.len + aead_enc->algo->tag_size)) == 0) {
             /* Create and store the ticket sequence number */
-            uint64_t seq_num = picoquic_public_random_64();
+            uint64_t seq_num = (picoquic_public_random_64() & 0x00FFFFFFFFFFFFFFull) |
+                (((uint64_t)quic->ticket_key_id) << 56);
+            uint8_t* clear_text;
+
             picoformat_64(dst->base + dst->off, seq_num);
             dst->off += 8;
-            /* Run AEAD encryption */
-            dst->off += ptls_aead_encrypt(aead_enc, dst->base + dst->off,
-                src.base, src.len, seq_num, NULL, 0);
+            /* Run AEAD encryption in place, over the issue time and the ticket */
+            clear_text = dst->base + dst->off;
+            picoformat_64(clear_text, ctx->get_time->cb(ctx->get_time));
+            memcpy(clear_text + 8, src.base, src.len);
+            dst->off += ptls_aead_encrypt(aead_enc, clear_text,
+                clear_text, 8 + src.len, seq_num, NULL, 0);
         }
     } else {
-        ptls_aead_context_t* aead_dec = (ptls_aead_context_t*)quic->aead_decrypt_ticket_ctx;
-        /* Encoding*/
+        ptls_aead_context_t* aead_dec = NULL;
+        uint64_t seq_num = 0;
+
+        if (src.len >= 8) {
+            /* Decode the ticket sequence number, and find the key */
+            seq_num = PICOPARSE_64(src.base);
+            aead_dec = (ptls_aead_context_t*)quic->aead_decrypt_ticket_ctx[(seq_num >> 56) % PICOQUIC_TICKET_KEY_RING_SIZE];
+        }
+
         if (aead_dec == NULL) {
             ret = -1;
-        } else if (src.len < 8 + aead_dec->algo->tag_size) {
+        } else if (src.len < 8 + 8 + aead_dec->algo->tag_size) {
             ret = -1;
         } else if ((ret = ptls_buffer_reserve(dst, src.len)) == 0) {
-            /* Decode the ticket sequence number */
-            uint64_t seq_num = PICOPARSE_64(src.base);
             /* Decrypt */
-            size_t decrypted = ptls_aead_decrypt(aead_dec, dst->base + dst->off,
+            uint8_t* clear_text = dst->base + dst->off;
+            size_t decrypted = ptls_aead_decrypt(aead_dec, clear_text,
                 src.base + 8, src.len - 8, seq_num, NULL, 0);
 
-            if (decrypted > src.len - 8) {
+            if (decrypted > src.len - 8 || decrypted < 8) {
                 /* decryption error */
                 ret = -1;
             } else {
-                dst->off += decrypted;
+                uint64_t issued_ms = PICOPARSE_64(clear_text);
+
+                memmove(clear_text, clear_text + 8, decrypted - 8);
+                dst->off += decrypted - 8;
+
+                if (quic->anti_replay != NULL && picoquic_anti_replay_check(quic->anti_replay,
+                    src.base, src.len, issued_ms, ctx->get_time->cb(ctx->get_time)) != 0) {
+                    /* Resume the session, but without early data */
+                    ret = PTLS_ERROR_REJECT_EARLY_DATA;
+                }
             }
         }
     }
@@ -489,7 +514,7 @@ int picoquic_client_save_ticket_call_back(ptls_save_ticket_t* save_ticket_ctx,
     }
 
     if (sni != NULL && alpn != NULL) {
-        ret = picoquic_store_ticket(&quic->p_first_ticket, 0, sni, (uint16_t)strlen(sni),
+        ret = picoquic_store_ticket(&quic->ticket_store, 0, sni, (uint16_t)strlen(sni),
             alpn, (uint16_t)strlen(alpn), input.base, (uint16_t)input.len);
     } else {
         DBG_PRINTF("Received incorrect session resume ticket, sni = %s, alpn = %s, length = %d\n",
@@ -508,6 +533,17 @@ uint64_t picoquic_get_simulated_time_cb(ptls_get_time_t* self)
     return ((**pp_simulated_time) / 1000);
 }
 
+/* Without simulation, TLS uses the same clock as the stack, in milliseconds */
+static uint64_t picoquic_get_current_time_cb(ptls_get_time_t* self)
+{
+#ifdef _WINDOWS
+    UNREFERENCED_PARAMETER(self);
+#endif
+    return picoquic_current_time() / 1000;
+}
+
+static ptls_get_time_t picoquic_get_time = { picoquic_get_current_time_cb };
+
 /*
  * Verify certificate
  */
@@ -884,7 +920,7 @@ int picoquic_master_tlscontext(picoquic_quic_t* quic,
         ctx->update_traffic_key = picoquic_set_update_traffic_key_callback();
 
         if (quic->p_simulated_time == NULL) {
-            ctx->get_time = &ptls_get_time;
+            ctx->get_time = &picoquic_get_time;
         } else {
             ptls_get_time_t* time_getter = (ptls_get_time_t*)malloc(sizeof(ptls_get_time_t) + sizeof(uint64_t*));
             if (time_getter == NULL) {
@@ -939,6 +975,20 @@ int picoquic_master_tlscontext(picoquic_quic_t* quic,
             }
         }
 
+        if (ret == 0 && cert_file_name != NULL) {
+            /* Servers filter the replays of early data */
+            uint8_t anti_replay_key[PICOQUIC_ANTI_REPLAY_KEY_SIZE];
+
+            ctx->random_bytes(anti_replay_key, sizeof(anti_replay_key));
+            quic->anti_replay = picoquic_anti_replay_create(PICOQUIC_ANTI_REPLAY_DEFAULT_WINDOW_MS,
+                PICOQUIC_ANTI_REPLAY_DEFAULT_ENTRIES, anti_replay_key);
+            ptls_clear_memory(anti_replay_key, sizeof(anti_replay_key));
+
+            if (quic->anti_replay == NULL) {
+                ret = PICOQUIC_ERROR_MEMORY;
+            }
+        }
+
         verifier = (ptls_openssl_verify_certificate_t*)malloc(sizeof(ptls_openssl_verify_certificate_t));
         if (verifier == NULL) {
             ctx->verify_certificate = NULL;
@@ -1103,11 +1153,12 @@ int picoquic_tlscontext_create(picoquic_quic_t* quic, picoquic_cnx_t* cnx, uint6
                 uint8_t* ticket = NULL;
                 uint16_t ticket_length = 0;
 
-                if (picoquic_get_ticket(cnx->quic->p_first_ticket, current_time,
+                if (picoquic_get_ticket(&cnx->quic->ticket_store, current_time,
                         cnx->sni, (uint16_t)strlen(cnx->sni), cnx->alpn, (uint16_t)strlen(cnx->alpn),
                         &ticket, &ticket_length)
-                    == 0) {
-                    ctx->handshake_properties.client.session_ticket.base = ticket;
+                    == 0 && (ctx->session_ticket = (uint8_t*)malloc(ticket_length)) != NULL) {
+                    memcpy(ctx->session_ticket, ticket, ticket_length);
+                    ctx->handshake_properties.client.session_ticket.base = ctx->session_ticket;
                     ctx->handshake_properties.client.session_ticket.len = ticket_length;
 
                     ctx->handshake_properties.client.max_early_data_size = &cnx->max_early_data_size;
@@ -1224,6 +1275,10 @@ void picoquic_tlscontext_remove_ticket(picoquic_cnx_t* cnx)
 
     ctx->handshake_properties.client.session_ticket.base = NULL;
     ctx->handshake_properties.client.session_ticket.len = 0;
+    if (ctx->session_ticket != NULL) {
+        free(ctx->session_ticket);
+        ctx->session_ticket = NULL;
+    }
 }
 
 void picoquic_tlscontext_free(picoquic_cnx_t *cnx, void* vctx)
@@ -1233,6 +1288,9 @@ void picoquic_tlscontext_free(picoquic_cnx_t *cnx, void* vctx)
         ptls_free((ptls_t*)ctx->tls);
         ctx->tls = NULL;
     }
+    if (ctx->session_ticket != NULL) {
+        free(ctx->session_ticket);
+    }
     free(ctx);
 }
 
@@ -1292,7 +1350,10 @@ static int picoquic_add_to_tls_stream(picoquic_cnx_t* cnx, const uint8_t* data,
                 memcpy(stream_data->bytes, data, length);
                 stream_data->length = length;
                 stream_data->offset = 0;
+                stream_data->stream_offset = 0;
                 stream_data->next_stream_data = NULL;
+                stream_data->release_fn = NULL;
+                stream_data->release_ctx = NULL;
 
                 while (next != NULL) {
                     pprevious = &next->next_stream_data;
@@ -1442,13 +1503,15 @@ void * picoquic_setup_test_aead_context(int is_encrypt, const uint8_t * secret)
     return v_aead;
 }
 
-int picoquic_server_setup_ticket_aead_contexts(picoquic_quic_t* quic,
-    ptls_context_t* tls_ctx,
+static int picoquic_install_ticket_key(picoquic_quic_t* quic, ptls_context_t* tls_ctx, uint8_t key_id,
     const uint8_t* secret, size_t secret_length)
 {
     int ret = 0;
     uint8_t temp_secret[256]; /* secret_max */
     ptls_cipher_suite_t cipher = { 0, &ptls_openssl_aes128gcm, &ptls_openssl_sha256 };
+    void* aead_enc = NULL;
+    void* aead_dec = NULL;
+    int ring_index = key_id % PICOQUIC_TICKET_KEY_RING_SIZE;
 
     if (cipher.hash->digest_size > sizeof(temp_secret)) {
         ret = PICOQUIC_ERROR_UNEXPECTED_ERROR;
@@ -1461,9 +1524,29 @@ int picoquic_server_setup_ticket_aead_contexts(picoquic_quic_t* quic,
         }
 
         /* Create the AEAD contexts */
-        ret = picoquic_set_aead_from_secret(&quic->aead_encrypt_ticket_ctx, &cipher, 1, temp_secret);
+        ret = picoquic_set_aead_from_secret(&aead_enc, &cipher, 1, temp_secret);
         if (ret == 0) {
-            ret = picoquic_set_aead_from_secret(&quic->aead_decrypt_ticket_ctx, &cipher, 0, temp_secret);
+            ret = picoquic_set_aead_from_secret(&aead_dec, &cipher, 0, temp_secret);
+        }
+
+        if (ret == 0) {
+            /* The new key takes the place of the oldest key in the ring */
+            if (quic->aead_encrypt_ticket_ctx != NULL) {
+                picoquic_aead_free(quic->aead_encrypt_ticket_ctx);
+            }
+            if (quic->aead_decrypt_ticket_ctx[ring_index] != NULL) {
+                picoquic_aead_free(quic->aead_decrypt_ticket_ctx[ring_index]);
+            }
+            quic->aead_encrypt_ticket_ctx = aead_enc;
+            quic->aead_decrypt_ticket_ctx[ring_index] = aead_dec;
+            quic->ticket_key_id = key_id;
+        } else {
+            if (aead_enc != NULL) {
+                picoquic_aead_free(aead_enc);
+            }
+            if (aead_dec != NULL) {
+                picoquic_aead_free(aead_dec);
+            }
         }
 
         /* erase the temporary secret */
@@ -1472,6 +1555,51 @@ int picoquic_server_setup_ticket_aead_contexts(picoquic_quic_t* quic,
     return ret;
 }
 
+int picoquic_server_setup_ticket_aead_contexts(picoquic_quic_t* quic,
+    ptls_context_t* tls_ctx,
+    const uint8_t* secret, size_t secret_length)
+{
+    return picoquic_install_ticket_key(quic, tls_ctx, 0, secret, secret_length);
+}
+
+int picoquic_rotate_ticket_key(picoquic_quic_t* quic, const uint8_t* secret, size_t secret_length)
+{
+    int ret = 0;
+
+    if (quic->aead_encrypt_ticket_ctx == NULL) {
+        ret = -1;
+    } else {
+        ret = picoquic_install_ticket_key(quic, (ptls_context_t*)quic->tls_master_ctx,
+            (uint8_t)(quic->ticket_key_id + 1), secret, secret_length);
+    }
+
+    return ret;
+}
+
+int picoquic_set_anti_replay(picoquic_quic_t* quic, uint64_t window_ms, size_t nb_entries)
+{
+    int ret = 0;
+
+    if (quic->anti_replay != NULL) {
+        picoquic_anti_replay_delete(quic->anti_replay);
+        quic->anti_replay = NULL;
+    }
+
+    if (window_ms > 0 && nb_entries > 0) {
+        uint8_t key[PICOQUIC_ANTI_REPLAY_KEY_SIZE];
+
+        picoquic_crypto_random(quic, key, sizeof(key));
+        quic->anti_replay = picoquic_anti_replay_create(window_ms, nb_entries, key);
+        ptls_clear_memory(key, sizeof(key));
+
+        if (quic->anti_replay == NULL) {
+            ret = PICOQUIC_ERROR_MEMORY;
+        }
+    }
+
+    return ret;
+}
+
 /* AEAD encrypt/decrypt routines */
 size_t picoquic_aead_decrypt_generic(uint8_t* output, uint8_t* input, size_t input_length,
     uint64_t seq_num, uint8_t* auth_data, size_t auth_data_length, void* aead_ctx)
@@ -1537,7 +1665,8 @@ int picoquic_tls_stream_process(picoquic_cnx_t* cnx)
 
     for (size_t epoch = 0; epoch < PICOQUIC_NUMBER_OF_EPOCHS && ret == 0; epoch++) {
         picoquic_stream_head* stream = &cnx->tls_stream[epoch];
-        picoquic_stream_data* data = stream->stream_data;
+        uint8_t* data_bytes = NULL;
+        size_t epoch_data = picoquic_stream_reassembly_peek(&stream->reassembly, stream->consumed_offset, &data_bytes);
         size_t processed = 0;
         int data_pushed = 0;
 
@@ -1547,7 +1676,7 @@ int picoquic_tls_stream_process(picoquic_cnx_t* cnx)
             if (epoch > next_epoch) {
                 break;
             } else {
-                if (data != NULL && data->offset > stream->consumed_offset) {
+                if (epoch_data == 0 && stream->reassembly.nb_ranges > 0) {
                     /* Protocol error: data received that could not be read */
 #ifdef _DEBUG
                     DBG_PRINTF("Connection error - TLS data at epoch %d, expected %d.\n",
@@ -1560,17 +1689,14 @@ int picoquic_tls_stream_process(picoquic_cnx_t* cnx)
             }
         }
 
-        while ((ret == 0 || ret == PTLS_ERROR_IN_PROGRESS) &&
-            data != NULL && data->offset <= stream->consumed_offset) {
+        while ((ret == 0 || ret == PTLS_ERROR_IN_PROGRESS) && epoch_data > 0) {
             struct st_ptls_buffer_t sendbuf;
-            size_t start = (size_t)(stream->consumed_offset - data->offset);
-            size_t epoch_data = data->length - start;
             size_t send_offset[PICOQUIC_NUMBER_OF_EPOCH_OFFSETS] = { 0, 0, 0, 0, 0 };
 
             ptls_buffer_init(&sendbuf, "", 0);
 
             ret = ptls_handle_message(ctx->tls, &sendbuf, send_offset, epoch,
-                data->bytes + start, epoch_data, &ctx->handshake_properties);
+                data_bytes, epoch_data, &ctx->handshake_properties);
 
 #ifdef _DEBUG
             if (cnx->cnx_state < picoquic_state_client_ready) {
@@ -1618,14 +1744,9 @@ int picoquic_tls_stream_process(picoquic_cnx_t* cnx)
             stream->consumed_offset += epoch_data;
             processed += epoch_data;
 
-            if (start + epoch_data >= data->length) {
-                free(data->bytes);
-                cnx->tls_stream[epoch].stream_data = data->next_stream_data;
-                free(data);
-                data = cnx->tls_stream[epoch].stream_data;
-            }
-
             ptls_buffer_dispose(&sendbuf);
+
+            epoch_data = picoquic_stream_reassembly_peek(&stream->reassembly, stream->consumed_offset, &data_bytes);
         }
 
         if (processed > 0) {
@@ -1725,33 +1846,27 @@ int picoquic_tls_stream_process(picoquic_cnx_t* cnx)
 
 /*
  * Compute the 16 byte reset secret associated with a connection ID.
- * We implement it as the hash of a secret seed maintained per QUIC context
- * and the 8 bytes connection ID.
- * This is written using PTLS portable hash API, initialized
- * for now with the OpenSSL implementation. Will have to adapt if we
- * decide to use the minicrypto API.
+ * We implement it as the 128 bit SipHash of the connection ID, keyed with
+ * a secret seed maintained per QUIC context. This is much cheaper than
+ * running a hash context per ID, and remains deterministic, so that the
+ * reset can be recomputed for packets received after a restart.
+ * IDs drawn from the context pool come with a precomputed secret.
  */
 
 int picoquic_create_cnxid_reset_secret(picoquic_quic_t* quic, picoquic_connection_id_t *cnx_id,
     uint8_t reset_secret[PICOQUIC_RESET_SECRET_SIZE])
 {
-    /* Using OpenSSL for now: ptls_hash_algorithm_t ptls_openssl_sha256 */
-    int ret = 0;
-    ptls_hash_algorithm_t* algo = &ptls_openssl_sha256;
-    ptls_hash_context_t* hash_ctx = algo->create();
-    uint8_t final_hash[PTLS_MAX_DIGEST_SIZE];
-
-    if (hash_ctx == NULL) {
-        ret = -1;
-        memset(reset_secret, 0, PICOQUIC_RESET_SECRET_SIZE);
-    } else {
-        hash_ctx->update(hash_ctx, quic->reset_seed, sizeof(quic->reset_seed));
-        hash_ctx->update(hash_ctx, cnx_id, sizeof(picoquic_connection_id_t));
-        hash_ctx->final(hash_ctx, final_hash, PTLS_HASH_FINAL_MODE_FREE);
-        memcpy(reset_secret, final_hash, PICOQUIC_RESET_SECRET_SIZE);
+    uint8_t input[PICOQUIC_CONNECTION_ID_MAX_SIZE + 1];
+    uint8_t id_length = (cnx_id->id_len > PICOQUIC_CONNECTION_ID_MAX_SIZE) ?
+        PICOQUIC_CONNECTION_ID_MAX_SIZE : cnx_id->id_len;
+
+    if (picoquic_get_pooled_reset_secret(quic, cnx_id, reset_secret) != 0) {
+        input[0] = id_length;
+        memcpy(input + 1, cnx_id->id, id_length);
+        siphash_128(quic->reset_seed, input, (size_t)id_length + 1, reset_secret);
     }
 
-    return (ret);
+    return 0;
 }
 
 int picoquic_create_cnxid_reset_secret_for_cnx(picoquic_cnx_t* cnx, picoquic_connection_id_t *cnx_id,
@@ -74,6 +74,7 @@ register_functions(struct ubpf_vm *vm) {
     /* specific to picoquic, how to remove this dependency ? */
     ubpf_register(vm, current_idx++, "picoquic_reinsert_cnx_by_wake_time", picoquic_reinsert_cnx_by_wake_time);
     ubpf_register(vm, current_idx++, "picoquic_current_time", picoquic_current_time);
+    ubpf_register(vm, current_idx++, "picoquic_get_quic_time_for_cnx", picoquic_get_quic_time_for_cnx);
     /* for memory */
     ubpf_register(vm, current_idx++, "my_malloc", my_malloc);
     ubpf_register(vm, current_idx++, "my_free", my_free);
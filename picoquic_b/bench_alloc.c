@@ -0,0 +1,61 @@
+/*
+ * Allocation counters for the benchmarks. The benchmark executable is linked
+ * with --wrap=malloc,--wrap=calloc,--wrap=realloc,--wrap=free so that every
+ * allocation made by the stack goes through these functions. Frees are not
+ * counted, but they are used to maintain the number of live heap bytes.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <malloc.h>
+#include "../picoquictest/picoquictest.h"
+
+void* __real_malloc(size_t size);
+void* __real_calloc(size_t nmemb, size_t size);
+void* __real_realloc(void* ptr, size_t size);
+void __real_free(void* ptr);
+
+void* __wrap_malloc(size_t size)
+{
+    picoquic_bench_alloc_bytes += size;
+    picoquic_bench_alloc_count++;
+    void* ptr = __real_malloc(size);
+    if (ptr != NULL) {
+        picoquic_bench_alloc_live += malloc_usable_size(ptr);
+    }
+    return ptr;
+}
+
+void* __wrap_calloc(size_t nmemb, size_t size)
+{
+    picoquic_bench_alloc_bytes += nmemb * size;
+    picoquic_bench_alloc_count++;
+    void* ptr = __real_calloc(nmemb, size);
+    if (ptr != NULL) {
+        picoquic_bench_alloc_live += malloc_usable_size(ptr);
+    }
+    return ptr;
+}
+
+void* __wrap_realloc(void* ptr, size_t size)
+{
+    picoquic_bench_alloc_bytes += size;
+    picoquic_bench_alloc_count++;
+    size_t old_size = (ptr == NULL) ? 0 : malloc_usable_size(ptr);
+    void* new_ptr = __real_realloc(ptr, size);
+    if (new_ptr != NULL) {
+        picoquic_bench_alloc_live += malloc_usable_size(new_ptr) - old_size;
+    } else if (size == 0) {
+        picoquic_bench_alloc_live -= old_size;
+    }
+    return new_ptr;
+}
+
+void __wrap_free(void* ptr)
+{
+    if (ptr != NULL) {
+        picoquic_bench_alloc_live -= malloc_usable_size(ptr);
+    }
+    __real_free(ptr);
+}
@@ -0,0 +1,165 @@
+/*
+ * Benchmark driver. Benchmarks write their results as CSV lines on the
+ * output file, while progress and errors go to stderr, so that the output
+ * can be stored and compared between builds.
+ */
+
+#ifdef _WINDOWS
+#include "../picoquicfirst/getopt.h"
+#endif
+#include "../picoquic/picoquic.h"
+#include "../picoquic/util.h"
+#include "../picoquictest/picoquictest.h"
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+
+typedef struct st_picoquic_bench_def_t {
+    char const* bench_name;
+    int (*bench_fn)(FILE* F);
+} picoquic_bench_def_t;
+
+static const picoquic_bench_def_t bench_table[] = {
+    { "dispatch_core", dispatch_core_bench },
+    { "dispatch_pluglet", dispatch_pluglet_bench },
+    { "dispatch_param", dispatch_param_bench },
+    { "dispatch_pid", dispatch_pid_bench },
+    { "plugin_memory", plugin_memory_bench },
+    { "throughput_bulk", throughput_bulk_bench },
+    { "throughput_small_streams", throughput_small_streams_bench },
+    { "throughput_many_cnx", throughput_many_cnx_bench },
+    { "throughput_lossy", throughput_lossy_bench },
+    { "throughput_cc", throughput_cc_bench },
+    { "frame_scheduler", frame_scheduler_bench }
+};
+
+static size_t const nb_benches = sizeof(bench_table) / sizeof(picoquic_bench_def_t);
+
+static int do_one_bench(size_t i, FILE* F)
+{
+    int ret = 0;
+
+    fprintf(stderr, "Starting benchmark %s\n", bench_table[i].bench_name);
+    ret = bench_table[i].bench_fn(F);
+    if (ret != 0) {
+        fprintf(stderr, "    Fails, error: %d.\n", ret);
+    }
+
+    return ret;
+}
+
+static int usage(char const * argv0)
+{
+    fprintf(stderr, "PicoQUIC benchmarks\n");
+    fprintf(stderr, "Usage: %s [-i iterations] [-o output.csv] [bench1 [bench2 ..[benchN]]]\n\n", argv0);
+    fprintf(stderr, "Valid benchmark names are: \n");
+    for (size_t x = 0; x < nb_benches; x++) {
+        fprintf(stderr, "    %s\n", bench_table[x].bench_name);
+    }
+    fprintf(stderr, "Options: \n");
+    fprintf(stderr, "  -i nnn         Number of calls per benchmark variant.\n");
+    fprintf(stderr, "  -o file        Write the CSV results to file instead of stdout.\n");
+    fprintf(stderr, "  -n             Disable debug prints.\n");
+    fprintf(stderr, "  -h             Print this help message\n");
+
+    return -1;
+}
+
+static int get_bench_number(char const * bench_name)
+{
+    int bench_number = -1;
+
+    for (size_t i = 0; i < nb_benches; i++) {
+        if (strcmp(bench_name, bench_table[i].bench_name) == 0) {
+            bench_number = (int)i;
+        }
+    }
+
+    return bench_number;
+}
+
+int main(int argc, char** argv)
+{
+    int ret = 0;
+    int nb_failed = 0;
+    int opt;
+    int disable_debug = 0;
+    char const* out_file_name = NULL;
+    FILE* F = stdout;
+
+    while (ret == 0 && (opt = getopt(argc, argv, "i:o:nh")) != -1) {
+        switch (opt) {
+        case 'i': {
+            long long iterations = atoll(optarg);
+            if (iterations <= 0) {
+                fprintf(stderr, "Incorrect number of iterations: %s\n", optarg);
+                ret = usage(argv[0]);
+            } else {
+                picoquic_bench_iterations = (uint64_t)iterations;
+            }
+            break;
+        }
+        case 'o':
+            out_file_name = optarg;
+            break;
+        case 'n':
+            disable_debug = 1;
+            break;
+        case 'h':
+            usage(argv[0]);
+            exit(0);
+            break;
+        default:
+            ret = usage(argv[0]);
+            break;
+        }
+    }
+
+    for (int arg_num = optind; ret == 0 && arg_num < argc; arg_num++) {
+        if (get_bench_number(argv[arg_num]) < 0) {
+            fprintf(stderr, "Incorrect benchmark name: %s\n", argv[arg_num]);
+            ret = usage(argv[0]);
+        }
+    }
+
+    if (ret == 0 && out_file_name != NULL) {
+        F = picoquic_file_open(out_file_name, "w");
+        if (F == NULL) {
+            fprintf(stderr, "Cannot open %s\n", out_file_name);
+            ret = -1;
+        }
+    }
+
+    if (ret == 0) {
+        if (disable_debug) {
+            debug_printf_suspend();
+        }
+
+        fprintf(F, "benchmark,variant,metric,value\n");
+
+        if (optind >= argc) {
+            for (size_t i = 0; i < nb_benches; i++) {
+                if (do_one_bench(i, F) != 0) {
+                    nb_failed++;
+                }
+            }
+        } else {
+            for (int arg_num = optind; arg_num < argc; arg_num++) {
+                if (do_one_bench((size_t)get_bench_number(argv[arg_num]), F) != 0) {
+                    nb_failed++;
+                }
+            }
+        }
+
+        if (nb_failed > 0) {
+            fprintf(stderr, "%d benchmark(s) failed.\n", nb_failed);
+            ret = -1;
+        }
+
+        if (F != stdout) {
+            fclose(F);
+        }
+    }
+
+    return ret;
+}
@@ -43,11 +43,15 @@ typedef enum {
 static const picoquic_test_def_t test_table[] = {
     { "picohash", picohash_test },
     { "splay", splay_test },
+    { "queue", queue_test },
+    { "frame_scheduler", frame_scheduler_test },
+    { "windowed_filter", windowed_filter_test },
     { "cnxcreation", cnxcreation_test },
     { "parseheader", parseheadertest },
     { "pn2pn64", pn2pn64test },
     { "intformat", intformattest },
     { "fnv1a", fnv1atest },
+    { "siphash", siphash_test },
     { "float16", float16test },
     { "varint", varint_test },
     { "sack", sacktest },
@@ -56,9 +60,13 @@ static const picoquic_test_def_t test_table[] = {
     { "logger", logger_test },
     { "TlsStreamFrame", TlsStreamFrameTest },
     { "StreamZeroFrame", StreamZeroFrameTest },
+    { "StreamFrameCallback", StreamFrameCallbackTest },
+    { "StreamReassembly", StreamReassemblyTest },
     { "sendack", sendacktest },
     { "ackrange", ackrange_test },
+    { "retransmit_index", retransmit_index_test },
     { "ack_of_ack", ack_of_ack_test },
+    { "ack_of_ack_watermark", ack_of_ack_watermark_test },
     { "sim_link", sim_link_test },
     { "clear_text_aead", cleartext_aead_test },
     { "pn_ctr", pn_ctr_test },
@@ -72,6 +80,7 @@ static const picoquic_test_def_t test_table[] = {
     { "SH_loss", tls_api_server_first_loss_test },
     { "client_losses", tls_api_client_losses_test },
     { "server_losses", tls_api_server_losses_test },
+    { "coalesced_handshake", coalesced_handshake_test },
     { "transport_param_stream_id", transport_param_stream_id_test },
     { "stream_id_to_rank", stream_id_to_rank_test},
     { "transport_param", transport_param_test },
@@ -87,6 +96,11 @@ static const picoquic_test_def_t test_table[] = {
     { "tls_api_very_long_max", tls_api_very_long_max_test },
     { "tls_api_very_long_with_err", tls_api_very_long_with_err_test },
     { "tls_api_very_long_congestion", tls_api_very_long_congestion_test },
+    { "zero_copy_send", zero_copy_send_test },
+    { "zero_copy_send_loss", zero_copy_send_loss_test },
+    { "prepare_packets", prepare_packets_test },
+    { "incoming_packets", incoming_packets_test },
+    { "edt_pacing", edt_pacing_test },
     { "http0dot9", http0dot9_test },
     { "retry", tls_api_retry_test },
     { "two_connections", tls_api_two_connections_test },
@@ -94,7 +108,9 @@ static const picoquic_test_def_t test_table[] = {
     { "keep_alive", keep_alive_test },
     { "sockets", socket_test },
     { "ticket_store", ticket_store_test },
+    { "anti_replay", anti_replay_test },
     { "session_resume", session_resume_test },
+    { "ticket_key_rotation", ticket_key_rotation_test },
     { "zero_rtt", zero_rtt_test },
     { "zero_rtt_loss", zero_rtt_loss_test },
     { "stop_sending", stop_sending_test },
@@ -122,8 +138,10 @@ static const picoquic_test_def_t test_table[] = {
     { "packet_enc_dec", packet_enc_dec_test},
     { "zero_rtt_spurious", zero_rtt_spurious_test },
     { "zero_rtt_retry", zero_rtt_retry_test },
+    { "zero_rtt_replay", zero_rtt_replay_test },
     { "random_tester", random_tester_test},
     { "cubic", cubic_test },
+    { "bbr2", bbr2_test },
     { "stress", stress_test },
     { "fuzz", fuzz_test },
     { "datagram_test", datagram_test },
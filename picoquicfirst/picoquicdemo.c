@@ -133,6 +133,7 @@ void print_address(struct sockaddr* address, char* label, picoquic_connection_id
 }
 
 #define PICOQUIC_DEMO_MAX_PLUGIN_FILES 64
+#define PICOQUIC_DEMO_BURST_MAX 10
 
 static protoop_id_t set_qlog_file = { .id = "set_qlog_file" };
 
@@ -193,7 +194,7 @@ int quic_server(const char* server_name, int server_port,
     void* cnx_id_callback_ctx, uint8_t reset_seed[PICOQUIC_RESET_SECRET_SIZE],
     int mtu_max, const char** local_plugin_fnames, int local_plugins,
     const char** both_plugin_fnames, int both_plugins, FILE *F_log, FILE *F_tls_secrets, char *qlog_filename,
-    char *stats_filename, bool preload_plugins, const char *web_folder)
+    char *stats_filename, bool preload_plugins, const char *web_folder, uint64_t edt_horizon)
 {
     /* Start: start the QUIC process with cert and key files */
     int ret = 0;
@@ -209,13 +210,20 @@ int quic_server(const char* server_name, int server_port,
     socklen_t from_length;
     socklen_t to_length;
     uint8_t buffer[1536];
-    uint8_t send_buffer[1536];
-    size_t send_length = 0;
+    uint8_t send_buffer[PICOQUIC_DEMO_BURST_MAX][1536];
+    picoquic_prepared_datagram_t datagrams[PICOQUIC_DEMO_BURST_MAX];
+    picoquic_sendmsg_desc_t send_desc[PICOQUIC_DEMO_BURST_MAX];
+    size_t nb_datagrams = 0;
     picoquic_stateless_packet_t* sp;
     int64_t delay_max = 10000000;
     int new_context_created = 0;
     int qlog_fd = -1;
 
+    for (int i = 0; i < PICOQUIC_DEMO_BURST_MAX; i++) {
+        datagrams[i].send_buffer = send_buffer[i];
+        datagrams[i].send_buffer_max = sizeof(send_buffer[i]);
+    }
+
     picohttp_server_parameters_t picoquic_file_param;
     memset(&picoquic_file_param, 0, sizeof(picohttp_server_parameters_t));
     picoquic_file_param.web_folder = web_folder;
@@ -238,6 +246,16 @@ int quic_server(const char* server_name, int server_port,
                 picoquic_set_cookie_mode(qserver, 1);
             }
             qserver->mtu_max = mtu_max;
+            if (edt_horizon != 0) {
+                /* Hand paced packets to the kernel, which releases them at their departure time */
+                for (int i = 0; i < PICOQUIC_NB_SERVER_SOCKETS; i++) {
+                    if (picoquic_socket_set_txtime(server_sockets.s_socket[i]) != 0) {
+                        perror("setsockopt SO_TXTIME");
+                        ret = -1;
+                    }
+                }
+                picoquic_set_edt_pacing(qserver, edt_horizon);
+            }
             /* TODO: add log level, to reduce size in "normal" cases */
             PICOQUIC_SET_LOG(qserver, F_log);
             PICOQUIC_SET_TLS_SECRETS_LOG(qserver, F_tls_secrets);
@@ -305,7 +323,10 @@ int quic_server(const char* server_name, int server_port,
         if (bytes_recv < 0) {
             ret = -1;
         } else {
-            if (bytes_recv > 0) {
+            if (bytes_recv == 0) {
+                /* Idle: prepare connection IDs for the next connections and paths */
+                (void)picoquic_refill_cnxid_pool(qserver);
+            } else {
                 /* Submit the packet to the server */
                 ret = picoquic_incoming_packet(qserver, buffer,
                     (size_t)bytes_recv, (struct sockaddr*)&addr_from,
@@ -360,8 +381,58 @@ int quic_server(const char* server_name, int server_port,
                 }
 
                 while (ret == 0 && (cnx_next = picoquic_get_earliest_cnx_to_wake(qserver, loop_time)) != NULL) {
-                    ret = picoquic_prepare_packet(cnx_next, picoquic_current_time(),
-                        send_buffer, sizeof(send_buffer), &send_length, &path);
+                    ret = picoquic_prepare_packets(cnx_next, picoquic_current_time(),
+                        datagrams, PICOQUIC_DEMO_BURST_MAX, 0, &nb_datagrams);
+
+                    if (nb_datagrams > 0) {
+                        /* Send the datagrams prepared before a disconnection or an error, while the paths exist */
+                        int peer_addr_len = 0;
+                        struct sockaddr* peer_addr;
+                        int local_addr_len = 0;
+                        struct sockaddr* local_addr;
+
+                        if (just_once != 0 ||
+                            cnx_next->cnx_state < picoquic_state_client_ready ||
+                            cnx_next->cnx_state >= picoquic_state_disconnecting) {
+                            printf("%" PRIx64 ": ", picoquic_val64_connection_id(picoquic_get_logging_cnxid(cnx_next)));
+                            printf("Connection state = %d\n",
+                                picoquic_get_cnx_state(cnx_next));
+                        }
+
+                        int last_socket_index = -1;
+
+                        for (size_t i = 0; i < nb_datagrams; i++) {
+                            path = datagrams[i].path;
+                            picoquic_get_peer_addr(path, &peer_addr, &peer_addr_len);
+                            picoquic_get_local_addr(path, &local_addr, &local_addr_len);
+
+                            /* QDC: I hate having those lines here... But it is the only place to hook before sending... */
+                            /* Both Linux and Windows use separate sockets for V4 and V6 */
+#ifndef NS3
+                            int socket_index = (peer_addr->sa_family == AF_INET) ? 1 : 0;
+#else
+                            int socket_index = 0;
+#endif
+                            /* The hook sets socket options, once per socket of the burst is enough */
+                            if (socket_index != last_socket_index) {
+                                picoquic_before_sending_packet(cnx_next, server_sockets.s_socket[socket_index]);
+                                last_socket_index = socket_index;
+                            }
+
+                            send_desc[i].addr_dest = peer_addr;
+                            send_desc[i].dest_length = peer_addr_len;
+                            send_desc[i].addr_from = local_addr;
+                            send_desc[i].from_length = local_addr_len;
+                            send_desc[i].dest_if = picoquic_get_local_if_index(path);
+                            send_desc[i].bytes = (const char*)datagrams[i].send_buffer;
+                            send_desc[i].length = (int)datagrams[i].send_length;
+                            send_desc[i].departure_time = datagrams[i].departure_time;
+                        }
+
+                        (void)picoquic_send_batch_through_server_sockets(&server_sockets, send_desc, (int)nb_datagrams);
+
+                        /* TODO: log sending packet. */
+                    }
 
                     if (ret == PICOQUIC_ERROR_DISCONNECTED) {
                         ret = 0;
@@ -384,43 +455,7 @@ int quic_server(const char* server_name, int server_port,
 
                         fflush(stdout);
                         break;
-                    } else if (ret == 0) {
-                        int peer_addr_len = 0;
-                        struct sockaddr* peer_addr;
-                        int local_addr_len = 0;
-                        struct sockaddr* local_addr;
-
-                        if (send_length > 0) {
-                            if (just_once != 0 ||
-                                cnx_next->cnx_state < picoquic_state_client_ready ||
-                                cnx_next->cnx_state >= picoquic_state_disconnecting) {
-                                printf("%" PRIx64 ": ", picoquic_val64_connection_id(picoquic_get_logging_cnxid(cnx_next)));
-                                printf("Connection state = %d\n",
-                                    picoquic_get_cnx_state(cnx_next));
-                            }
-
-                            picoquic_get_peer_addr(path, &peer_addr, &peer_addr_len);
-                            picoquic_get_local_addr(path, &local_addr, &local_addr_len);
-
-                            /* QDC: I hate having those lines here... But it is the only place to hook before sending... */
-                            /* Both Linux and Windows use separate sockets for V4 and V6 */
-#ifndef NS3
-                            int socket_index = (peer_addr->sa_family == AF_INET) ? 1 : 0;
-#else
-                            int socket_index = 0;
-#endif
-                            picoquic_before_sending_packet(cnx_next, server_sockets.s_socket[socket_index]);
-
-                            (void)picoquic_send_through_server_sockets(&server_sockets,
-                                peer_addr, peer_addr_len, local_addr, local_addr_len,
-                                picoquic_get_local_if_index(path),
-                                (const char*)send_buffer, (int)send_length);
-
-                            /* TODO: log sending packet. */
-                        } else {
-                            break;
-                        }
-                    } else {
+                    } else if (ret != 0 || nb_datagrams == 0) {
                         break;
                     }
                 }
@@ -526,6 +561,10 @@ int quic_client(const char* ip_address_text, int server_port, const char * sni,
                 perror("setsockopt IPV6_DONTFRAG");
             }
         }
+
+        if (ret == 0 && picoquic_socket_set_timestamping(fd) != 0) {
+            perror("setsockopt SO_TIMESTAMPNS");
+        }
     }
 
     /* QDC: please fixme please */
@@ -817,12 +856,14 @@ int quic_client(const char* ip_address_text, int server_port, const char * sni,
         uint8_t* ticket;
         uint16_t ticket_length;
 
-        if (sni != NULL && 0 == picoquic_get_ticket(qclient->p_first_ticket, picoquic_current_time(), sni, (uint16_t)strlen(sni), saved_alpn, (uint16_t)strlen(saved_alpn), &ticket, &ticket_length) && F_log) {
+        if (sni != NULL && 0 == picoquic_get_ticket(&qclient->ticket_store, picoquic_current_time(), sni, (uint16_t)strlen(sni), saved_alpn, (uint16_t)strlen(saved_alpn), &ticket, &ticket_length) && F_log) {
             fprintf(F_log, "Received ticket from %s (%s):\n", sni, saved_alpn);
             picoquic_log_picotls_ticket(F_log, picoquic_null_connection_id, ticket, ticket_length);
         }
 
-        if (picoquic_save_tickets(qclient->p_first_ticket, picoquic_current_time(), ticket_store_filename) != 0) {
+        /* Tickets are appended to the ticket file as they arrive, only save them if there is no such file */
+        if (qclient->ticket_store.file_name == NULL && ticket_store_filename != NULL &&
+            picoquic_save_tickets(&qclient->ticket_store, picoquic_current_time(), ticket_store_filename) != 0) {
             fprintf(stderr, "Could not store the saved session tickets.\n");
         }
 
@@ -929,6 +970,9 @@ void usage()
     fprintf(stderr, "                        defaults to current directory.\n");
     fprintf(stderr, "  -w folder             Folder containing web pages served by server\n");
     fprintf(stderr, "  -D                    no disk: do not save received files on disk.\n");
+    fprintf(stderr, "  -E horizon            Server paces packets by earliest departure time, preparing\n");
+    fprintf(stderr, "                        them up to horizon microseconds ahead. Requires SO_TXTIME\n");
+    fprintf(stderr, "                        and the fq qdisc.\n");
     fprintf(stderr, "  -h                    This help message\n");
 
     fprintf(stderr, "\nThe scenario argument specifies the set of files that should be retrieved,\n");
@@ -1001,6 +1045,7 @@ int main(int argc, char** argv)
     uint64_t* reset_seed = NULL;
     uint64_t reset_seed_x[2];
     int mtu_max = 0;
+    uint64_t edt_horizon = 0;
     char *plugin_store_path = NULL;
     bool preload_plugins = false;
 
@@ -1020,7 +1065,7 @@ int main(int argc, char** argv)
 
     /* Get the parameters */
     int opt;
-    while ((opt = getopt(argc, argv, "c:k:P:C:Q:G:p:v:L14rhzRX:S:i:s:l:m:n:t:q:o:w:Da:")) != -1) {
+    while ((opt = getopt(argc, argv, "c:k:P:C:Q:G:p:v:L14rhzRX:S:i:s:l:m:n:t:q:o:w:DE:a:")) != -1) {
         switch (opt) {
         case 'c':
             server_cert_file = optarg;
@@ -1140,6 +1185,13 @@ int main(int argc, char** argv)
         case 'D':
             no_disk = 1;
             break;
+        case 'E':
+            edt_horizon = strtoull(optarg, NULL, 10);
+            if (edt_horizon == 0) {
+                fprintf(stderr, "Invalid EDT horizon: %s\n", optarg);
+                usage();
+            }
+            break;
         case 'a':
             alpn = optarg;
             break;
@@ -1231,7 +1283,7 @@ int main(int argc, char** argv)
             (cnx_id_mask_is_set == 0) ? NULL : cnx_id_callback,
             (cnx_id_mask_is_set == 0) ? NULL : (void*)&cnx_id_cbdata,
             (uint8_t*)reset_seed, mtu_max, local_plugin_fnames, local_plugins,
-            both_plugin_fnames, both_plugins, F_log, F_tls_secrets, qlog_filename, stats_filename, preload_plugins, www_dir);
+            both_plugin_fnames, both_plugins, F_log, F_tls_secrets, qlog_filename, stats_filename, preload_plugins, www_dir, edt_horizon);
         printf("Server exit with code = %d\n", ret);
         if (F_tls_secrets != NULL && F_tls_secrets != stdout) {
             fclose(F_tls_secrets);
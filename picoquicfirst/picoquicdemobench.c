@@ -848,6 +848,10 @@ int quic_client(const char* ip_address_text, int server_port, const char * sni,
                 perror("setsockopt IPV6_DONTFRAG");
             }
         }
+
+        if (ret == 0 && picoquic_socket_set_timestamping(fd) != 0) {
+            perror("setsockopt SO_TIMESTAMPNS");
+        }
     }
     /* QDC: please fixme please */
 #ifdef _WINDOWS
@@ -1135,12 +1139,14 @@ int quic_client(const char* ip_address_text, int server_port, const char * sni,
         uint8_t* ticket;
         uint16_t ticket_length;
 
-        if (sni != NULL && 0 == picoquic_get_ticket(qclient->p_first_ticket, current_time, sni, (uint16_t)strlen(sni), alpn, (uint16_t)strlen(alpn), &ticket, &ticket_length)) {
+        if (sni != NULL && 0 == picoquic_get_ticket(&qclient->ticket_store, current_time, sni, (uint16_t)strlen(sni), alpn, (uint16_t)strlen(alpn), &ticket, &ticket_length)) {
             fprintf(F_log, "Received ticket from %s:\n", sni);
             picoquic_log_picotls_ticket(F_log, picoquic_null_connection_id, ticket, ticket_length);
         }
 
-        if (picoquic_save_tickets(qclient->p_first_ticket, current_time, ticket_store_filename) != 0) {
+        /* Tickets are appended to the ticket file as they arrive, only save them if there is no such file */
+        if (qclient->ticket_store.file_name == NULL && ticket_store_filename != NULL &&
+            picoquic_save_tickets(&qclient->ticket_store, current_time, ticket_store_filename) != 0) {
             fprintf(stderr, "Could not store the saved session tickets.\n");
         }
         picoquic_free(qclient);
@@ -253,4 +253,59 @@ int ack_of_ack_test()
     }
 
     return ret;
-}
\ No newline at end of file
+}
+/*
+ * Pruning with the watermark recorded when the ACK frame was sent.
+ */
+
+typedef struct st_test_ack_watermark_t {
+    char const* test_name;
+    test_ack_range_t const* initial;
+    size_t nb_initial;
+    uint64_t watermark;
+    test_ack_range_t const* result;
+    size_t nb_result;
+} test_ack_watermark_t;
+
+static const test_ack_range_t test_watermark_res_3[] = {
+    { 9, 9 }
+};
+
+static const test_ack_range_t test_watermark_in_4[] = {
+    { 12, 15 }, { 8, 10 }, { 5, 6 }, { 1, 3 }
+};
+
+static const test_ack_range_t test_watermark_res_4[] = {
+    { 12, 15 }, { 8, 10 }
+};
+
+static const test_ack_watermark_t test_ack_watermark_list[] = {
+    { "partial first range", test_range_in_1, sizeof(test_range_in_1) / sizeof(test_ack_range_t), 8,
+        test_range_res_1, sizeof(test_range_res_1) / sizeof(test_ack_range_t) },
+    { "two ranges", test_range_in_2, sizeof(test_range_in_2) / sizeof(test_ack_range_t), 6,
+        test_range_res_2, sizeof(test_range_res_2) / sizeof(test_ack_range_t) },
+    { "whole list", test_range_in_3, sizeof(test_range_in_3) / sizeof(test_ack_range_t), 9,
+        test_watermark_res_3, sizeof(test_watermark_res_3) / sizeof(test_ack_range_t) },
+    { "straddling range", test_watermark_in_4, sizeof(test_watermark_in_4) / sizeof(test_ack_range_t), 9,
+        test_watermark_res_4, sizeof(test_watermark_res_4) / sizeof(test_ack_range_t) }
+};
+
+int ack_of_ack_watermark_test()
+{
+    int ret = 0;
+
+    for (size_t i = 0; ret == 0 && i < sizeof(test_ack_watermark_list) / sizeof(test_ack_watermark_t); i++) {
+        picoquic_sack_item_t sack_head;
+        test_ack_watermark_t const* sample = &test_ack_watermark_list[i];
+
+        fill_test_sack_list(&sack_head, sample->initial, sample->nb_initial);
+        picoquic_process_ack_of_ack_watermark(&sack_head, sample->watermark);
+        ret = cmp_test_sack_list(&sack_head, sample->result, sample->nb_result);
+        if (ret != 0) {
+            DBG_PRINTF("Watermark test %s fails\n", sample->test_name);
+        }
+        free_test_sack_list(&sack_head);
+    }
+
+    return ret;
+}
@@ -0,0 +1,81 @@
+#include "../picoquic/picoquic_internal.h"
+#include <stdlib.h>
+#include <string.h>
+
+static void anti_replay_test_ticket(uint8_t* ticket, size_t length, uint32_t index)
+{
+    memset(ticket, 0x5a, length);
+    picoformat_32(ticket, index);
+}
+
+int anti_replay_test()
+{
+    int ret = 0;
+    uint8_t key[PICOQUIC_ANTI_REPLAY_KEY_SIZE];
+    uint8_t ticket[64];
+    uint64_t window_ms = 1000;
+    uint64_t current_ms = 20000;
+    picoquic_anti_replay_t* anti_replay;
+    int nb_rejected = 0;
+
+    for (size_t i = 0; i < sizeof(key); i++) {
+        key[i] = (uint8_t)(i + 1);
+    }
+
+    anti_replay = picoquic_anti_replay_create(window_ms, 100, key);
+    if (anti_replay == NULL) {
+        ret = -1;
+    }
+
+    /* First use is accepted, the replay is not */
+    if (ret == 0) {
+        anti_replay_test_ticket(ticket, sizeof(ticket), 0);
+        if (picoquic_anti_replay_check(anti_replay, ticket, sizeof(ticket), current_ms - 10, current_ms) != 0 ||
+            picoquic_anti_replay_check(anti_replay, ticket, sizeof(ticket), current_ms - 10, current_ms) == 0) {
+            ret = -1;
+        }
+    }
+
+    /* The use is still remembered two windows later */
+    if (ret == 0 &&
+        picoquic_anti_replay_check(anti_replay, ticket, sizeof(ticket), current_ms - 10, current_ms + 2 * window_ms) == 0) {
+        ret = -1;
+    }
+
+    /* Tickets too old for the filters are refused */
+    if (ret == 0) {
+        current_ms += 2 * window_ms;
+        anti_replay_test_ticket(ticket, sizeof(ticket), 1);
+        if (picoquic_anti_replay_check(anti_replay, ticket, sizeof(ticket),
+            current_ms - (PICOQUIC_ANTI_REPLAY_FILTERS - 1) * window_ms, current_ms) == 0) {
+            ret = -1;
+        }
+    }
+
+    /* Fresh tickets are accepted once, with few false positives */
+    for (uint32_t i = 2; ret == 0 && i < 102; i++) {
+        anti_replay_test_ticket(ticket, sizeof(ticket), i);
+        if (picoquic_anti_replay_check(anti_replay, ticket, sizeof(ticket), current_ms, current_ms) != 0) {
+            nb_rejected++;
+        } else if (picoquic_anti_replay_check(anti_replay, ticket, sizeof(ticket), current_ms, current_ms) == 0) {
+            ret = -1;
+        }
+    }
+
+    if (ret == 0 && nb_rejected > 5) {
+        ret = -1;
+    }
+
+    /* After enough windows, the filters are cleared */
+    if (ret == 0) {
+        current_ms += PICOQUIC_ANTI_REPLAY_FILTERS * window_ms;
+        anti_replay_test_ticket(ticket, sizeof(ticket), 2);
+        if (picoquic_anti_replay_check(anti_replay, ticket, sizeof(ticket), current_ms, current_ms) != 0) {
+            ret = -1;
+        }
+    }
+
+    picoquic_anti_replay_delete(anti_replay);
+
+    return ret;
+}
@@ -0,0 +1,93 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include "picoquic_internal.h"
+#include "cc_common.h"
+#include "picoquictest.h"
+
+/*
+ * Check the windowed max filter: the max holds for the duration of the
+ * window, then decays to the samples picked at 1/4 and 1/2 of the window.
+ */
+static int windowed_max_filter_test()
+{
+    int ret = 0;
+    picoquic_windowed_filter_t filter;
+    uint64_t const window = 10;
+    uint64_t const samples[] = { 5, 100, 50, 60, 40, 30, 20, 10, 10, 10, 10, 10, 10, 10, 10, 10, 10, 10, 10, 10, 10, 10 };
+    uint64_t const expected[] = { 5, 100, 100, 100, 100, 100, 100, 100, 100, 100, 100, 100, 40, 40, 40, 10, 10, 10, 10, 10, 10, 10 };
+
+    memset(&filter, 0, sizeof(filter));
+
+    for (size_t t = 0; ret == 0 && t < sizeof(samples) / sizeof(uint64_t); t++) {
+        uint64_t v = picoquic_windowed_max_update(&filter, window, t, samples[t]);
+
+        if (v != expected[t] || picoquic_windowed_filter_get(&filter) != v) {
+            DBG_PRINTF("Max filter at t=%d returns %d instead of %d\n", (int)t, (int)v, (int)expected[t]);
+            ret = -1;
+        }
+    }
+
+    return ret;
+}
+
+/*
+ * Check the windowed min filter, including a gap longer than the window,
+ * after which the first new sample becomes the min.
+ */
+static int windowed_min_filter_test()
+{
+    int ret = 0;
+    picoquic_windowed_filter_t filter;
+    uint64_t const window = 1000;
+    uint64_t v = picoquic_windowed_filter_reset(&filter, 0, 200);
+
+    if (v != 200) {
+        ret = -1;
+    }
+
+    for (uint64_t t = 100; ret == 0 && t <= 1000; t += 100) {
+        v = picoquic_windowed_min_update(&filter, window, t, 300);
+        if (v != 200) {
+            DBG_PRINTF("Min filter at t=%d returns %d instead of 200\n", (int)t, (int)v);
+            ret = -1;
+        }
+    }
+
+    if (ret == 0) {
+        v = picoquic_windowed_min_update(&filter, window, 1100, 250);
+        if (v != 250) {
+            DBG_PRINTF("Min filter returns %d after expiry instead of 250\n", (int)v);
+            ret = -1;
+        }
+    }
+
+    if (ret == 0) {
+        v = picoquic_windowed_min_update(&filter, window, 1200, 150);
+        if (v != 150) {
+            DBG_PRINTF("Min filter returns %d after a new min instead of 150\n", (int)v);
+            ret = -1;
+        }
+    }
+
+    if (ret == 0) {
+        v = picoquic_windowed_min_update(&filter, window, 5000, 400);
+        if (v != 400) {
+            DBG_PRINTF("Min filter returns %d after a gap instead of 400\n", (int)v);
+            ret = -1;
+        }
+    }
+
+    return ret;
+}
+
+int windowed_filter_test()
+{
+    int ret = windowed_max_filter_test();
+
+    if (ret == 0) {
+        ret = windowed_min_filter_test();
+    }
+
+    return ret;
+}
@@ -0,0 +1,215 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "picoquic_internal.h"
+#include "util.h"
+#include "picoquictest.h"
+
+#define FRAME_SCHEDULER_TEST_NB_PLUGINS 3
+#define FRAME_SCHEDULER_TEST_SMALL_BYTES 100
+#define FRAME_SCHEDULER_TEST_LARGE_BYTES 1100
+#define FRAME_SCHEDULER_TEST_MSS 1400
+#define FRAME_SCHEDULER_TEST_SHORT_MSS 300
+#define FRAME_SCHEDULER_TEST_NB_PACKETS 600
+
+typedef struct st_frame_scheduler_test_ctx_t {
+    picoquic_cnx_t* cnx;
+    picoquic_path_t* path_x;
+    protoop_plugin_t* plugins[FRAME_SCHEDULER_TEST_NB_PLUGINS];
+    reserve_frame_slot_t slots[FRAME_SCHEDULER_TEST_NB_PLUGINS];
+    uint64_t scheduled_bytes[FRAME_SCHEDULER_TEST_NB_PLUGINS];
+} frame_scheduler_test_ctx_t;
+
+static int frame_scheduler_test_init(frame_scheduler_test_ctx_t* ctx)
+{
+    int ret = 0;
+
+    memset(ctx, 0, sizeof(frame_scheduler_test_ctx_t));
+    ctx->cnx = (picoquic_cnx_t*)calloc(1, sizeof(picoquic_cnx_t));
+    ctx->path_x = (picoquic_path_t*)calloc(1, sizeof(picoquic_path_t));
+
+    if (ctx->cnx == NULL || ctx->path_x == NULL) {
+        ret = -1;
+    } else {
+        register_protocol_operations(ctx->cnx);
+        ctx->cnx->reserved_frames = queue_init();
+        ctx->cnx->current_protoop = ctx->cnx->ops;
+        ctx->cnx->core_rate = 500;
+        ctx->path_x->cwin = UINT64_MAX;
+        ctx->path_x->send_mtu = PICOQUIC_INITIAL_MTU_IPV4;
+        if (ctx->cnx->reserved_frames == NULL) {
+            ret = -1;
+        }
+    }
+
+    for (int i = 0; ret == 0 && i < FRAME_SCHEDULER_TEST_NB_PLUGINS; i++) {
+        ctx->plugins[i] = (protoop_plugin_t*)calloc(1, sizeof(protoop_plugin_t));
+        if (ctx->plugins[i] == NULL) {
+            ret = -1;
+        } else {
+            snprintf(ctx->plugins[i]->name, sizeof(ctx->plugins[i]->name), "test.frame_scheduler.%d", i);
+            ctx->plugins[i]->block_queue_cc = queue_init();
+            ctx->plugins[i]->block_queue_non_cc = queue_init();
+            if (ctx->plugins[i]->block_queue_cc == NULL || ctx->plugins[i]->block_queue_non_cc == NULL) {
+                ret = -1;
+            }
+        }
+        ctx->slots[i].nb_bytes = FRAME_SCHEDULER_TEST_SMALL_BYTES;
+        ctx->slots[i].is_congestion_controlled = 1;
+        ctx->slots[i].frame_type = 0x40 + i;
+    }
+
+    return ret;
+}
+
+static void frame_scheduler_test_release(frame_scheduler_test_ctx_t* ctx)
+{
+    for (int i = 0; i < FRAME_SCHEDULER_TEST_NB_PLUGINS; i++) {
+        if (ctx->plugins[i] != NULL) {
+            void* block;
+            if (ctx->cnx != NULL) {
+                picoquic_plugin_drr_deactivate(ctx->cnx, ctx->plugins[i]);
+            }
+            if (ctx->plugins[i]->block_queue_cc != NULL) {
+                while ((block = queue_dequeue(ctx->plugins[i]->block_queue_cc)) != NULL) {
+                    free(block);
+                }
+                queue_free(ctx->plugins[i]->block_queue_cc);
+            }
+            if (ctx->plugins[i]->block_queue_non_cc != NULL) {
+                queue_free(ctx->plugins[i]->block_queue_non_cc);
+            }
+            free(ctx->plugins[i]);
+        }
+    }
+    if (ctx->cnx != NULL) {
+        if (ctx->cnx->reserved_frames != NULL) {
+            queue_free(ctx->cnx->reserved_frames);
+        }
+        ctx->cnx->current_protoop = NULL;
+        picoquic_free_protoops_and_plugins(ctx->cnx);
+        free(ctx->cnx);
+    }
+    if (ctx->path_x != NULL) {
+        free(ctx->path_x);
+    }
+}
+
+/* Reserves a frame for the plugin, as its pluglets would do */
+static int frame_scheduler_test_reserve(frame_scheduler_test_ctx_t* ctx, int i)
+{
+    ctx->cnx->current_plugin = ctx->plugins[i];
+    return (reserve_frames(ctx->cnx, 1, &ctx->slots[i]) == 0) ? -1 : 0;
+}
+
+/* Schedules one packet and accounts the bytes of the frames taken by each plugin */
+static size_t frame_scheduler_test_packet(frame_scheduler_test_ctx_t* ctx, picoquic_stream_head* stream, uint64_t frame_mss)
+{
+    reserve_frame_slot_t* slot;
+    size_t queued_bytes;
+
+    ctx->cnx->current_plugin = NULL;
+    queued_bytes = picoquic_frame_fair_reserve(ctx->cnx, ctx->path_x, stream, frame_mss);
+    while ((slot = (reserve_frame_slot_t*)queue_dequeue(ctx->cnx->reserved_frames)) != NULL) {
+        for (int i = 0; i < FRAME_SCHEDULER_TEST_NB_PLUGINS; i++) {
+            if (slot->p == ctx->plugins[i]) {
+                ctx->scheduled_bytes[i] += slot->nb_bytes;
+            }
+        }
+    }
+
+    return queued_bytes;
+}
+
+/*
+ * Plugins always having small frames to send while stream data waits get the
+ * same share of the packets.
+ */
+static int frame_scheduler_share_test()
+{
+    frame_scheduler_test_ctx_t ctx;
+    picoquic_stream_head stream = { 0 };
+    uint64_t total_bytes = 0;
+    int ret = frame_scheduler_test_init(&ctx);
+
+    for (int n = 0; ret == 0 && n < FRAME_SCHEDULER_TEST_NB_PACKETS; n++) {
+        for (int i = 0; ret == 0 && i < FRAME_SCHEDULER_TEST_NB_PLUGINS; i++) {
+            while (ret == 0 && queue_size(ctx.plugins[i]->block_queue_cc) < 16) {
+                ret = frame_scheduler_test_reserve(&ctx, i);
+            }
+        }
+        if (ret == 0) {
+            total_bytes += frame_scheduler_test_packet(&ctx, &stream, FRAME_SCHEDULER_TEST_MSS);
+        }
+    }
+
+    for (int i = 0; ret == 0 && i < FRAME_SCHEDULER_TEST_NB_PLUGINS; i++) {
+        uint64_t fair_share = total_bytes / FRAME_SCHEDULER_TEST_NB_PLUGINS;
+        if (ctx.scheduled_bytes[i] == 0 ||
+            ctx.scheduled_bytes[i] * 10 < fair_share * 9 || ctx.scheduled_bytes[i] * 10 > fair_share * 11) {
+            DBG_PRINTF("Plugin %d got %d bytes, fair share is %d\n", i, (int)ctx.scheduled_bytes[i], (int)fair_share);
+            ret = -1;
+        }
+    }
+
+    frame_scheduler_test_release(&ctx);
+
+    return ret;
+}
+
+/*
+ * A block larger than the quantum of its plugin is not starved when full
+ * packets alternate with packets having little room left: the credit gained
+ * in the small ones is kept for the next full one.
+ */
+static int frame_scheduler_starvation_test()
+{
+    frame_scheduler_test_ctx_t ctx;
+    picoquic_stream_head stream = { 0 };
+    int large = FRAME_SCHEDULER_TEST_NB_PLUGINS - 1;
+    int ret = frame_scheduler_test_init(&ctx);
+
+    if (ret == 0) {
+        ctx.slots[large].nb_bytes = FRAME_SCHEDULER_TEST_LARGE_BYTES;
+        ret = frame_scheduler_test_reserve(&ctx, large);
+    }
+
+    for (int n = 0; ret == 0 && n < FRAME_SCHEDULER_TEST_NB_PACKETS && ctx.scheduled_bytes[large] == 0; n++) {
+        for (int i = 0; ret == 0 && i < large; i++) {
+            while (ret == 0 && queue_size(ctx.plugins[i]->block_queue_cc) < 16) {
+                ret = frame_scheduler_test_reserve(&ctx, i);
+            }
+        }
+        if (ret == 0) {
+            (void)frame_scheduler_test_packet(&ctx, &stream,
+                ((n & 1) == 0) ? FRAME_SCHEDULER_TEST_MSS : FRAME_SCHEDULER_TEST_SHORT_MSS);
+        }
+    }
+
+    if (ret == 0 && ctx.scheduled_bytes[large] != FRAME_SCHEDULER_TEST_LARGE_BYTES) {
+        DBG_PRINTF("The block of %d bytes was never scheduled\n", FRAME_SCHEDULER_TEST_LARGE_BYTES);
+        ret = -1;
+    }
+
+    for (int i = 0; ret == 0 && i < large; i++) {
+        if (ctx.scheduled_bytes[i] == 0) {
+            DBG_PRINTF("Plugin %d got no bytes\n", i);
+            ret = -1;
+        }
+    }
+
+    frame_scheduler_test_release(&ctx);
+
+    return ret;
+}
+
+int frame_scheduler_test()
+{
+    int ret = frame_scheduler_share_test();
+
+    if (ret == 0) {
+        ret = frame_scheduler_starvation_test();
+    }
+
+    return ret;
+}
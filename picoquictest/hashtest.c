@@ -133,5 +133,52 @@ int picohash_test()
         picohash_delete(t, 1);
     }
 
+    /* Grow a small table well past its initial size, then delete every other item */
+    if (ret == 0) {
+        const uint64_t nb_items = 1000;
+
+        t = picohash_create(4, hashtest_hash, hashtest_compare);
+
+        if (t == NULL) {
+            ret = -1;
+        } else {
+            struct hashtestkey hk;
+
+            for (uint64_t i = 0; ret == 0 && i < nb_items; i++) {
+                ret = picohash_insert(t, hashtest_item(i * 64));
+            }
+
+            if (ret == 0 && (t->count != nb_items || t->nb_bin < nb_items)) {
+                ret = -1;
+            }
+
+            for (uint64_t i = 0; ret == 0 && i < nb_items; i += 2) {
+                hk.x = i * 64;
+                picohash_item* pi = picohash_retrieve(t, &hk);
+
+                if (pi == NULL) {
+                    ret = -1;
+                } else {
+                    picohash_item_delete(t, pi, 1);
+                }
+            }
+
+            for (uint64_t i = 0; ret == 0 && i < nb_items; i++) {
+                hk.x = i * 64;
+                picohash_item* pi = picohash_retrieve(t, &hk);
+
+                if ((pi == NULL) != ((i & 1) == 0)) {
+                    ret = -1;
+                }
+            }
+
+            if (ret == 0 && t->count != nb_items / 2) {
+                ret = -1;
+            }
+
+            picohash_delete(t, 1);
+        }
+    }
+
     return ret;
 }
@@ -4,6 +4,9 @@
 #include "getset.h"
 #include "util.h"
 #include "protoop.h"
+#include "picoquictest.h"
+#include <stdlib.h>
+#include <time.h>
 
 uint64_t simple_for_loop(picoquic_cnx_t *mem) {
     uint64_t sum = 0;
@@ -221,4 +224,418 @@ int microbench_plugin_run_test() {
 
     /* TODO register functions as default ops */
     return ret;
-}
\ No newline at end of file
+}
+
+/*
+ * Protocol operation dispatch benchmarks.
+ *
+ * Each benchmark reports one CSV line per variant on the provided file:
+ *     <benchmark>,<variant>,<calls>,<elapsed_ns>,<ns_per_call>
+ * so that runs can be compared by scripts to catch dispatch overhead regressions.
+ */
+
+uint64_t picoquic_bench_iterations = 1000000;
+/* Only updated when the allocator is wrapped, see picoquic_b/bench_alloc.c */
+uint64_t picoquic_bench_alloc_bytes = 0;
+uint64_t picoquic_bench_alloc_count = 0;
+int64_t picoquic_bench_alloc_live = 0;
+
+uint64_t picoquic_bench_now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ((uint64_t)ts.tv_sec) * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+void picoquic_bench_report_metric(FILE* F, char const* bench, char const* variant, char const* metric, double value)
+{
+    fprintf(F, "%s,%s,%s,%.2f\n", bench, variant, metric, value);
+    fflush(F);
+}
+
+void picoquic_bench_report(FILE* F, char const* bench, char const* variant, uint64_t nb_calls, uint64_t elapsed_ns)
+{
+    picoquic_bench_report_metric(F, bench, variant, "calls", (double)nb_calls);
+    picoquic_bench_report_metric(F, bench, variant, "ns_per_call",
+        (nb_calls > 0) ? ((double)elapsed_ns) / ((double)nb_calls) : 0.0);
+}
+
+#define DISPATCH_BENCH_PLUGIN "plugins/microbench/microbench.plugin"
+#define DISPATCH_BENCH_PLUGIN_NAME "be.qdeconinck.microbench"
+#define DISPATCH_BENCH_OBSERVER "plugins/microbench/dispatch_observer.o"
+#define DISPATCH_BENCH_NB_PARAMS 64
+#define DISPATCH_BENCH_MAX_OBSERVERS 16
+
+static protoop_arg_t dispatch_core_noop(picoquic_cnx_t *cnx)
+{
+    return 0;
+}
+
+static picoquic_cnx_t* dispatch_bench_create_cnx(int with_plugin)
+{
+    picoquic_cnx_t* cnx = (picoquic_cnx_t*)calloc(1, sizeof(picoquic_cnx_t));
+    protoop_id_t pid_core = { .id = "dispatch_core_noop" };
+    protoop_id_t pid_replace = { .id = "dispatch_noop" };
+    protoop_id_t pid_param = { .id = "dispatch_param_noop" };
+    int ret = 0;
+
+    if (cnx == NULL) {
+        return NULL;
+    }
+
+    register_protocol_operations(cnx);
+    register_microbench_protoops(cnx);
+    ret |= register_noparam_protoop(cnx, &pid_core, &dispatch_core_noop);
+    ret |= register_noparam_protoop(cnx, &pid_replace, &dispatch_core_noop);
+    for (param_id_t param = 0; ret == 0 && param < DISPATCH_BENCH_NB_PARAMS; param++) {
+        ret = register_param_protoop(cnx, &pid_param, param, &dispatch_core_noop);
+    }
+
+    if (ret == 0 && with_plugin) {
+        ret = plugin_insert_plugin(cnx, DISPATCH_BENCH_PLUGIN);
+        if (ret) {
+            fprintf(stderr, "Failed to insert microbench plugin!\n");
+        }
+    }
+
+    if (ret != 0) {
+        picoquic_free_protoops_and_plugins(cnx);
+        free(cnx);
+        cnx = NULL;
+    }
+
+    return cnx;
+}
+
+static void dispatch_bench_delete_cnx(picoquic_cnx_t* cnx)
+{
+    picoquic_free_protoops_and_plugins(cnx);
+    free(cnx);
+}
+
+static void dispatch_bench_run_noparam(FILE* F, picoquic_cnx_t* cnx, protoop_id_t* pid, char const* bench, char const* variant)
+{
+    uint64_t nb_calls = picoquic_bench_iterations;
+    uint64_t start = picoquic_bench_now_ns();
+
+    for (uint64_t i = 0; i < nb_calls; i++) {
+        protoop_prepare_and_run_noparam(cnx, pid, NULL, NULL);
+    }
+
+    picoquic_bench_report(F, bench, variant, nb_calls, picoquic_bench_now_ns() - start);
+}
+
+/* Core operation only, then the same operation with N pre and N post observers */
+int dispatch_core_bench(FILE* F)
+{
+    static const int nb_observers[] = { 1, 4, DISPATCH_BENCH_MAX_OBSERVERS };
+    picoquic_cnx_t* cnx = dispatch_bench_create_cnx(1);
+    protoop_id_t pid = { .id = "dispatch_core_noop" };
+    protoop_plugin_t* p = NULL;
+    int nb_plugged = 0;
+    char variant[32];
+    int ret = 0;
+
+    if (cnx == NULL) {
+        return -1;
+    }
+
+    pid.hash = hash_value_str(pid.id);
+    dispatch_bench_run_noparam(F, cnx, &pid, "dispatch", "core");
+
+    HASH_FIND_STR(cnx->plugins, DISPATCH_BENCH_PLUGIN_NAME, p);
+    if (p == NULL) {
+        ret = -1;
+    }
+
+    for (size_t i = 0; ret == 0 && i < sizeof(nb_observers) / sizeof(int); i++) {
+        while (ret == 0 && nb_plugged < nb_observers[i]) {
+            ret = plugin_plug_elf(cnx, p, pid.id, NO_PARAM, pluglet_pre, DISPATCH_BENCH_OBSERVER);
+            if (ret == 0) {
+                ret = plugin_plug_elf(cnx, p, pid.id, NO_PARAM, pluglet_post, DISPATCH_BENCH_OBSERVER);
+                if (ret != 0) {
+                    plugin_unplug(cnx, pid.id, NO_PARAM, pluglet_pre);
+                }
+            }
+            if (ret == 0) {
+                nb_plugged++;
+            }
+        }
+        if (ret == 0) {
+            snprintf(variant, sizeof(variant), "core_%d_pre_%d_post", nb_plugged, nb_plugged);
+            dispatch_bench_run_noparam(F, cnx, &pid, "dispatch", variant);
+        }
+    }
+
+    dispatch_bench_delete_cnx(cnx);
+
+    return ret;
+}
+
+/* Replace pluglet reached through the protoop, and the same pluglet executed directly */
+int dispatch_pluglet_bench(FILE* F)
+{
+    picoquic_cnx_t* cnx = dispatch_bench_create_cnx(1);
+    protoop_id_t pid = { .id = "dispatch_noop" };
+    protocol_operation_struct_t *post = NULL;
+    char* error_msg = NULL;
+    int ret = 0;
+
+    if (cnx == NULL) {
+        return -1;
+    }
+
+    pid.hash = hash_value_str(pid.id);
+    dispatch_bench_run_noparam(F, cnx, &pid, "dispatch", "replace");
+
+    HASH_FIND_PID(cnx->ops, &pid.hash, post);
+    if (post == NULL || post->params->replace == NULL) {
+        ret = -1;
+    } else {
+        pluglet_t* pluglet = post->params->replace;
+        uint64_t nb_calls = picoquic_bench_iterations;
+        uint64_t start;
+
+        cnx->current_plugin = pluglet->p;
+
+        start = picoquic_bench_now_ns();
+        for (uint64_t i = 0; i < nb_calls; i++) {
+            _exec_loaded_code(pluglet, (void *)cnx, (void *)cnx->current_plugin->memory, sizeof(cnx->current_plugin->memory), &error_msg, true);
+        }
+        picoquic_bench_report(F, "pluglet_exec", "jit", nb_calls, picoquic_bench_now_ns() - start);
+
+        start = picoquic_bench_now_ns();
+        for (uint64_t i = 0; i < nb_calls; i++) {
+            _exec_loaded_code(pluglet, (void *)cnx, (void *)cnx->current_plugin->memory, sizeof(cnx->current_plugin->memory), &error_msg, false);
+        }
+        picoquic_bench_report(F, "pluglet_exec", "interpreter", nb_calls, picoquic_bench_now_ns() - start);
+
+        cnx->current_plugin = NULL;
+    }
+
+    dispatch_bench_delete_cnx(cnx);
+
+    return ret;
+}
+
+/* Lookup of the parameter in a parametrable protocol operation */
+int dispatch_param_bench(FILE* F)
+{
+    picoquic_cnx_t* cnx = dispatch_bench_create_cnx(0);
+    protoop_id_t pid = { .id = "dispatch_param_noop" };
+    uint64_t nb_calls = picoquic_bench_iterations;
+    uint64_t start;
+
+    if (cnx == NULL) {
+        return -1;
+    }
+
+    pid.hash = hash_value_str(pid.id);
+
+    start = picoquic_bench_now_ns();
+    for (uint64_t i = 0; i < nb_calls; i++) {
+        protoop_prepare_and_run_param(cnx, &pid, (param_id_t)0, NULL, NULL);
+    }
+    picoquic_bench_report(F, "dispatch_param", "same_param", nb_calls, picoquic_bench_now_ns() - start);
+
+    start = picoquic_bench_now_ns();
+    for (uint64_t i = 0; i < nb_calls; i++) {
+        protoop_prepare_and_run_param(cnx, &pid, (param_id_t)(i % DISPATCH_BENCH_NB_PARAMS), NULL, NULL);
+    }
+    picoquic_bench_report(F, "dispatch_param", "rotating_params", nb_calls, picoquic_bench_now_ns() - start);
+
+    dispatch_bench_delete_cnx(cnx);
+
+    return 0;
+}
+
+/* plugin_run_protoop with the string identifier versus a cached protoop_id_t */
+int dispatch_pid_bench(FILE* F)
+{
+    picoquic_cnx_t* cnx = dispatch_bench_create_cnx(0);
+    protoop_id_t pid = { .id = "dispatch_core_noop" };
+    protoop_arg_t args[1] = { 0 };
+    protoop_params_t pp = { .param = NO_PARAM, .caller_is_intern = true, .inputc = 1, .inputv = args, .outputv = NULL };
+    uint64_t nb_calls = picoquic_bench_iterations;
+    uint64_t start;
+
+    if (cnx == NULL) {
+        return -1;
+    }
+
+    start = picoquic_bench_now_ns();
+    for (uint64_t i = 0; i < nb_calls; i++) {
+        plugin_run_protoop(cnx, &pp, "dispatch_core_noop", NULL);
+    }
+    picoquic_bench_report(F, "plugin_run_protoop", "string_pid", nb_calls, picoquic_bench_now_ns() - start);
+
+    start = picoquic_bench_now_ns();
+    for (uint64_t i = 0; i < nb_calls; i++) {
+        plugin_run_protoop(cnx, &pp, "dispatch_core_noop", &pid);
+    }
+    picoquic_bench_report(F, "plugin_run_protoop", "cached_pid", nb_calls, picoquic_bench_now_ns() - start);
+
+    dispatch_bench_delete_cnx(cnx);
+
+    return 0;
+}
+
+/* Allocation churn in the plugin memory */
+int plugin_memory_bench(FILE* F)
+{
+    static const unsigned int sizes[] = { 16, 64, 256, 1536 };
+    picoquic_cnx_t* cnx = dispatch_bench_create_cnx(1);
+    protoop_plugin_t* p = NULL;
+    void* blocks[16];
+    char variant[32];
+    int ret = 0;
+
+    if (cnx == NULL) {
+        return -1;
+    }
+
+    HASH_FIND_STR(cnx->plugins, DISPATCH_BENCH_PLUGIN_NAME, p);
+    if (p == NULL) {
+        ret = -1;
+    } else {
+        cnx->current_plugin = p;
+        for (size_t s = 0; ret == 0 && s < sizeof(sizes) / sizeof(unsigned int); s++) {
+            uint64_t nb_calls = 0;
+            uint64_t start = picoquic_bench_now_ns();
+
+            for (uint64_t i = 0; ret == 0 && i < picoquic_bench_iterations; i += 16) {
+                for (int j = 0; j < 16; j++) {
+                    blocks[j] = my_malloc(cnx, sizes[s]);
+                    if (blocks[j] == NULL) {
+                        ret = -1;
+                    }
+                }
+                for (int j = 0; j < 16; j++) {
+                    if (blocks[j] != NULL) {
+                        my_free(cnx, blocks[j]);
+                    }
+                }
+                nb_calls += 16;
+            }
+
+            snprintf(variant, sizeof(variant), "malloc_free_%u", sizes[s]);
+            picoquic_bench_report(F, "plugin_memory", variant, nb_calls, picoquic_bench_now_ns() - start);
+        }
+        cnx->current_plugin = NULL;
+    }
+
+    dispatch_bench_delete_cnx(cnx);
+
+    return ret;
+}
+
+#define FRAME_SCHEDULER_BENCH_MAX_PLUGINS 16
+#define FRAME_SCHEDULER_BENCH_FRAME_BYTES 100
+#define FRAME_SCHEDULER_BENCH_MSS 1400
+
+/*
+ * Scheduling of plugin reservations in the frames of a packet. Each plugin
+ * reserves a congestion controlled frame whenever its previous one was
+ * scheduled, and stream data is waiting so that the plugins share the packet.
+ */
+int frame_scheduler_bench(FILE* F)
+{
+    static const int nb_plugins[] = { 1, 4, FRAME_SCHEDULER_BENCH_MAX_PLUGINS };
+    picoquic_cnx_t* cnx = dispatch_bench_create_cnx(0);
+    picoquic_path_t* path_x = (picoquic_path_t*)calloc(1, sizeof(picoquic_path_t));
+    protoop_plugin_t* plugins[FRAME_SCHEDULER_BENCH_MAX_PLUGINS] = { NULL };
+    reserve_frame_slot_t slots[FRAME_SCHEDULER_BENCH_MAX_PLUGINS];
+    picoquic_stream_head stream = { 0 };
+    char variant[32];
+    int ret = 0;
+
+    if (cnx == NULL || path_x == NULL) {
+        ret = -1;
+    } else {
+        cnx->reserved_frames = queue_init();
+        cnx->current_protoop = cnx->ops;
+        cnx->core_rate = 500;
+        path_x->cwin = UINT64_MAX;
+        if (cnx->reserved_frames == NULL) {
+            ret = -1;
+        }
+    }
+
+    for (int i = 0; ret == 0 && i < FRAME_SCHEDULER_BENCH_MAX_PLUGINS; i++) {
+        plugins[i] = (protoop_plugin_t*)calloc(1, sizeof(protoop_plugin_t));
+        if (plugins[i] == NULL) {
+            ret = -1;
+        } else {
+            snprintf(plugins[i]->name, sizeof(plugins[i]->name), "bench.frame_scheduler.%d", i);
+            plugins[i]->block_queue_cc = queue_init();
+            plugins[i]->block_queue_non_cc = queue_init();
+            if (plugins[i]->block_queue_cc == NULL || plugins[i]->block_queue_non_cc == NULL) {
+                ret = -1;
+            }
+        }
+        memset(&slots[i], 0, sizeof(reserve_frame_slot_t));
+        slots[i].nb_bytes = FRAME_SCHEDULER_BENCH_FRAME_BYTES;
+        slots[i].is_congestion_controlled = 1;
+        slots[i].frame_type = 0x40 + i;
+    }
+
+    for (size_t v = 0; ret == 0 && v < sizeof(nb_plugins) / sizeof(int); v++) {
+        uint64_t nb_calls = picoquic_bench_iterations;
+        uint64_t queued_bytes = 0;
+        uint64_t start = picoquic_bench_now_ns();
+
+        for (uint64_t i = 0; ret == 0 && i < nb_calls; i++) {
+            for (int j = 0; j < nb_plugins[v]; j++) {
+                if (queue_peek(plugins[j]->block_queue_cc) == NULL) {
+                    cnx->current_plugin = plugins[j];
+                    if (reserve_frames(cnx, 1, &slots[j]) == 0) {
+                        ret = -1;
+                    }
+                }
+            }
+            cnx->current_plugin = NULL;
+            queued_bytes += picoquic_frame_fair_reserve(cnx, path_x, &stream, FRAME_SCHEDULER_BENCH_MSS);
+            while (queue_dequeue(cnx->reserved_frames) != NULL) {
+                /* The frames are not written */
+            }
+        }
+
+        snprintf(variant, sizeof(variant), "%d_plugins", nb_plugins[v]);
+        picoquic_bench_report(F, "frame_scheduler", variant, nb_calls, picoquic_bench_now_ns() - start);
+        picoquic_bench_report_metric(F, "frame_scheduler", variant, "bytes_per_packet",
+            (nb_calls > 0) ? ((double)queued_bytes) / ((double)nb_calls) : 0.0);
+
+        /* Drop the reservations left before the next variant */
+        for (int j = 0; j < nb_plugins[v]; j++) {
+            void* block;
+            while ((block = queue_dequeue(plugins[j]->block_queue_cc)) != NULL) {
+                free(block);
+            }
+            picoquic_plugin_drr_deactivate(cnx, plugins[j]);
+        }
+    }
+
+    for (int i = 0; i < FRAME_SCHEDULER_BENCH_MAX_PLUGINS; i++) {
+        if (plugins[i] != NULL) {
+            if (plugins[i]->block_queue_cc != NULL) {
+                queue_free(plugins[i]->block_queue_cc);
+            }
+            if (plugins[i]->block_queue_non_cc != NULL) {
+                queue_free(plugins[i]->block_queue_non_cc);
+            }
+            free(plugins[i]);
+        }
+    }
+    if (cnx != NULL) {
+        if (cnx->reserved_frames != NULL) {
+            queue_free(cnx->reserved_frames);
+        }
+        cnx->current_protoop = NULL;
+        dispatch_bench_delete_cnx(cnx);
+    }
+    if (path_x != NULL) {
+        free(path_x);
+    }
+
+    return ret;
+}
@@ -374,6 +374,7 @@ int parseheadertest()
         uint32_t header_length;
         uint32_t pn_offset;
         uint32_t pn_length;
+        picoquic_packet_header ph_prepared;
 
         if (test_entries[i].decode_test_only) {
             continue;
@@ -390,13 +391,20 @@ int parseheadertest()
         }
         header_length = picoquic_create_packet_header(cnx_10, test_entries[i].ph->ptype,
             cnx_10->path[0],
-            test_entries[i].ph->pn, packet, &pn_offset, &pn_length);
+            test_entries[i].ph->pn, packet, &pn_offset, &pn_length, &ph_prepared);
         picoquic_update_payload_length(packet, pn_offset, pn_offset, pn_offset +
             test_entries[i].ph->payload_length);
         
         if ( pn_offset != test_entries[i].ph->pn_offset) {
            ret = -1;
         }
+
+        /* The header returned by the builder must match what parsing would find */
+        if (ph_prepared.pn_offset != pn_offset || ph_prepared.offset != pn_offset ||
+            ph_prepared.ptype != test_entries[i].ph->ptype ||
+            picoquic_compare_connection_id(&ph_prepared.dest_cnx_id, &test_entries[i].ph->dest_cnx_id) != 0) {
+            ret = -1;
+        }
         
         if (memcmp(packet, test_entries[i].packet, header_length) != 0)
         {
@@ -37,9 +37,12 @@ int parseheadertest();
 int pn2pn64test();
 int intformattest();
 int fnv1atest();
+int siphash_test();
 int sacktest();
 int float16test();
 int StreamZeroFrameTest();
+int StreamFrameCallbackTest();
+int StreamReassemblyTest();
 int sendacktest();
 int tls_api_test();
 int tls_api_silence_test();
@@ -63,23 +66,33 @@ int tls_api_very_long_stream_test();
 int tls_api_very_long_max_test();
 int tls_api_very_long_with_err_test();
 int tls_api_very_long_congestion_test();
+int zero_copy_send_test();
+int zero_copy_send_loss_test();
+int prepare_packets_test();
+int incoming_packets_test();
+int edt_pacing_test();
 int http0dot9_test();
 int tls_api_retry_test();
 int ackrange_test();
+int retransmit_index_test();
 int ack_of_ack_test();
+int ack_of_ack_watermark_test();
 int tls_api_two_connections_test();
 int cleartext_aead_test();
 int tls_api_multiple_versions_test();
 int varint_test();
 int tls_api_client_losses_test();
 int tls_api_server_losses_test();
+int coalesced_handshake_test();
 int skip_frame_test();
 int ping_pong_test();
 int keep_alive_test();
 int logger_test();
 int socket_test();
 int ticket_store_test();
+int anti_replay_test();
 int session_resume_test();
+int ticket_key_rotation_test();
 int zero_rtt_test();
 int zero_rtt_loss_test();
 int stop_sending_test();
@@ -112,13 +125,18 @@ int spin_bit_test();
 int packet_enc_dec_test();
 int zero_rtt_spurious_test();
 int zero_rtt_retry_test();
+int zero_rtt_replay_test();
 int parse_frame_test();
 int stress_test();
 int splay_test();
+int queue_test();
+int frame_scheduler_test();
+int windowed_filter_test();
 int TlsStreamFrameTest();
 int fuzz_test();
 int random_tester_test();
 int cubic_test();
+int bbr2_test();
 int datagram_test();
 int microbench_plugin_run_test();
 int split_stream_frame_test();
@@ -144,6 +162,30 @@ int short_initial_cid_test();
 int stream_id_max_test();
 int stream_id_to_rank_test();
 
+/* Control variables and reporting for the benchmarks */
+
+extern uint64_t picoquic_bench_iterations; /* Calls per benchmark variant; defaults to 1 million */
+extern uint64_t picoquic_bench_alloc_bytes; /* Bytes requested from malloc, calloc and realloc */
+extern uint64_t picoquic_bench_alloc_count; /* Number of allocation calls */
+extern int64_t picoquic_bench_alloc_live; /* Heap bytes currently allocated */
+
+uint64_t picoquic_bench_now_ns();
+void picoquic_bench_report(FILE* F, char const* bench, char const* variant, uint64_t nb_calls, uint64_t elapsed_ns);
+void picoquic_bench_report_metric(FILE* F, char const* bench, char const* variant, char const* metric, double value);
+
+/* List of benchmark functions */
+int dispatch_core_bench(FILE* F);
+int dispatch_pluglet_bench(FILE* F);
+int dispatch_param_bench(FILE* F);
+int dispatch_pid_bench(FILE* F);
+int plugin_memory_bench(FILE* F);
+int throughput_bulk_bench(FILE* F);
+int throughput_small_streams_bench(FILE* F);
+int throughput_many_cnx_bench(FILE* F);
+int throughput_lossy_bench(FILE* F);
+int throughput_cc_bench(FILE* F);
+int frame_scheduler_bench(FILE* F);
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,76 @@
+#include <stdint.h>
+#include <stdio.h>
+#include "util.h"
+#include "picoquictest.h"
+
+/*
+ * Check the FIFO order of the queue across growths and wrap arounds of its
+ * circular array, and the access to elements by position.
+ */
+int queue_test()
+{
+    int ret = 0;
+    uintptr_t next_in = 1;
+    uintptr_t next_out = 1;
+    queue_t *q = queue_init();
+
+    if (q == NULL) {
+        DBG_PRINTF("%s", "Cannot allocate the queue\n");
+        return -1;
+    }
+
+    if (queue_peek(q) != NULL || queue_dequeue(q) != NULL || queue_size(q) != 0) {
+        DBG_PRINTF("%s", "Empty queue returns an element\n");
+        ret = -1;
+    }
+
+    /* Enqueue more elements than dequeued at each round, so that the queue
+     * wraps around before growing */
+    for (int round = 0; ret == 0 && round < 16; round++) {
+        for (int i = 0; ret == 0 && i < 5; i++) {
+            if (queue_enqueue(q, (void *)next_in) != 0) {
+                DBG_PRINTF("Cannot enqueue element %d\n", (int)next_in);
+                ret = -1;
+            }
+            next_in++;
+        }
+        for (size_t i = 0; ret == 0 && i < queue_size(q); i++) {
+            if ((uintptr_t)queue_get(q, i) != next_out + i) {
+                DBG_PRINTF("Element at position %d is %d instead of %d\n", (int)i, (int)(uintptr_t)queue_get(q, i), (int)(next_out + i));
+                ret = -1;
+            }
+        }
+        if (ret == 0 && queue_get(q, queue_size(q)) != NULL) {
+            DBG_PRINTF("%s", "Element found beyond the end of the queue\n");
+            ret = -1;
+        }
+        for (int i = 0; ret == 0 && i < 3; i++) {
+            if ((uintptr_t)queue_peek(q) != next_out || (uintptr_t)queue_dequeue(q) != next_out) {
+                DBG_PRINTF("Expected element %d at the head\n", (int)next_out);
+                ret = -1;
+            }
+            next_out++;
+        }
+        if (ret == 0 && queue_size(q) != next_in - next_out) {
+            DBG_PRINTF("Queue size is %d instead of %d\n", (int)queue_size(q), (int)(next_in - next_out));
+            ret = -1;
+        }
+    }
+
+    while (ret == 0 && next_out < next_in) {
+        if ((uintptr_t)queue_dequeue(q) != next_out) {
+            DBG_PRINTF("Expected element %d when draining\n", (int)next_out);
+            ret = -1;
+        }
+        next_out++;
+    }
+
+    if (ret == 0 && (queue_peek(q) != NULL || queue_size(q) != 0)) {
+        DBG_PRINTF("%s", "Drained queue is not empty\n");
+        ret = -1;
+    }
+
+    queue_free(q);
+
+    return ret;
+}
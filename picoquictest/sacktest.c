@@ -384,3 +384,152 @@ int ackrange_test()
 
     return ret;
 }
+
+/*
+ * Test of the index of packets waiting for acknowledgement.
+ * Queue packets with holes in the number space, remove some of them
+ * as if acknowledged, and verify that the lookups by number agree with
+ * the content of the queue. An old packet stays in the queue while
+ * new ones are sent, so the index has to grow. Once it is acknowledged,
+ * the index shrinks back.
+ */
+
+#define RETRANSMIT_INDEX_TEST_NB 4096
+
+static int retransmit_index_check(picoquic_packet_context_t* pkt_ctx, picoquic_packet_t** queued, uint64_t nb_numbers)
+{
+    int ret = 0;
+    picoquic_packet_t* below = NULL;
+
+    for (uint64_t i = 0; ret == 0 && i < nb_numbers; i++) {
+        if (queued[i] != NULL) {
+            below = queued[i];
+        }
+
+        if (picoquic_retransmit_packet_by_number(pkt_ctx, i) != queued[i]) {
+            DBG_PRINTF("Lookup of packet %d fails\n", (int)i);
+            ret = -1;
+        } else if (picoquic_retransmit_packet_at_or_below(pkt_ctx, i) != below) {
+            DBG_PRINTF("Lookup at or below %d fails\n", (int)i);
+            ret = -1;
+        }
+    }
+
+    return ret;
+}
+
+static int retransmit_index_queue(picoquic_cnx_t* cnx, picoquic_packet_t** queued, uint64_t first, uint64_t last)
+{
+    int ret = 0;
+    picoquic_path_t* path_x = cnx->path[0];
+
+    for (uint64_t i = first; ret == 0 && i < last; i++) {
+        if (i % 7 != 3) {
+            picoquic_packet_t* packet = picoquic_create_packet(cnx);
+
+            if (packet == NULL) {
+                ret = -1;
+            } else {
+                packet->sequence_number = i;
+                packet->pc = picoquic_packet_context_application;
+                packet->send_path = path_x;
+                packet->length = 100;
+                picoquic_queue_for_retransmit(cnx, path_x, packet, packet->length, 0);
+                queued[i] = packet;
+            }
+        }
+    }
+
+    return ret;
+}
+
+int retransmit_index_test()
+{
+    int ret = 0;
+    picoquic_quic_t* quic = NULL;
+    picoquic_cnx_t* cnx = NULL;
+    picoquic_packet_context_t* pkt_ctx = NULL;
+    picoquic_packet_t** queued = (picoquic_packet_t**)calloc(RETRANSMIT_INDEX_TEST_NB, sizeof(picoquic_packet_t*));
+    struct sockaddr_in addr;
+
+    memset(&addr, 0, sizeof(struct sockaddr_in));
+    addr.sin_family = AF_INET;
+    addr.sin_port = 4433;
+
+    quic = picoquic_create(8, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, 0, NULL, NULL, NULL, 0, NULL);
+    if (quic == NULL || queued == NULL) {
+        ret = -1;
+    } else {
+        cnx = picoquic_create_cnx(quic, picoquic_null_connection_id, picoquic_null_connection_id,
+            (struct sockaddr*)&addr, 0, 0, NULL, NULL, 1);
+        if (cnx == NULL) {
+            ret = -1;
+        } else {
+            pkt_ctx = &cnx->path[0]->pkt_ctx[picoquic_packet_context_application];
+        }
+    }
+
+    if (ret == 0) {
+        ret = retransmit_index_queue(cnx, queued, 0, 1000);
+    }
+
+    if (ret == 0) {
+        ret = retransmit_index_check(pkt_ctx, queued, RETRANSMIT_INDEX_TEST_NB);
+    }
+
+    if (ret == 0) {
+        /* Remove one packet in three, but keep packet 1 in the queue */
+        for (uint64_t i = 0; i < 1000; i++) {
+            if (queued[i] != NULL && i % 3 == 0) {
+                picoquic_dequeue_retransmit_packet(cnx, queued[i], 1);
+                queued[i] = NULL;
+            }
+        }
+        ret = retransmit_index_check(pkt_ctx, queued, RETRANSMIT_INDEX_TEST_NB);
+    }
+
+    if (ret == 0) {
+        size_t old_size = pkt_ctx->retransmit_index_size;
+
+        ret = retransmit_index_queue(cnx, queued, 1000, RETRANSMIT_INDEX_TEST_NB);
+
+        if (ret == 0 && pkt_ctx->retransmit_index_size <= old_size) {
+            DBG_PRINTF("Index size did not grow, %d\n", (int)pkt_ctx->retransmit_index_size);
+            ret = -1;
+        }
+    }
+
+    if (ret == 0) {
+        ret = retransmit_index_check(pkt_ctx, queued, RETRANSMIT_INDEX_TEST_NB);
+    }
+
+    if (ret == 0) {
+        /* Acknowledge everything but the last packet */
+        for (uint64_t i = 0; i < RETRANSMIT_INDEX_TEST_NB - 1; i++) {
+            if (queued[i] != NULL) {
+                picoquic_dequeue_retransmit_packet(cnx, queued[i], 1);
+                queued[i] = NULL;
+            }
+        }
+        ret = retransmit_index_check(pkt_ctx, queued, RETRANSMIT_INDEX_TEST_NB);
+    }
+
+    if (ret == 0 && pkt_ctx->retransmit_index_size != PICOQUIC_RETRANSMIT_INDEX_MIN_SIZE) {
+        DBG_PRINTF("Index size did not shrink, %d\n", (int)pkt_ctx->retransmit_index_size);
+        ret = -1;
+    }
+
+    if (cnx != NULL) {
+        picoquic_delete_cnx(cnx);
+    }
+
+    if (quic != NULL) {
+        picoquic_free(quic);
+    }
+
+    if (queued != NULL) {
+        free(queued);
+    }
+
+    return ret;
+}
@@ -0,0 +1,72 @@
+#include "../picoquic/siphash.h"
+#include <stdint.h>
+#include <string.h>
+
+/*
+ * Test vectors from the SipHash reference implementation: the key is
+ * 00 01 .. 0f and the message of length N is 00 01 .. N-1.
+ */
+typedef struct st_siphash_test_vector_t {
+    size_t length;
+    uint64_t expected_64;
+    uint8_t expected_128[16];
+} siphash_test_vector_t;
+
+static const siphash_test_vector_t siphash_test_vectors[] = {
+    { 0, 0x726fdb47dd0e0e31ull,
+        { 0xa3, 0x81, 0x7f, 0x04, 0xba, 0x25, 0xa8, 0xe6, 0x6d, 0xf6, 0x72, 0x14, 0xc7, 0x55, 0x02, 0x93 } },
+    { 15, 0xa129ca6149be45e5ull,
+        { 0x54, 0x93, 0xe9, 0x99, 0x33, 0xb0, 0xa8, 0x11, 0x7e, 0x08, 0xec, 0x0f, 0x97, 0xcf, 0xc3, 0xd9 } }
+};
+
+static const size_t nb_siphash_test_vectors = sizeof(siphash_test_vectors) / sizeof(siphash_test_vector_t);
+
+int siphash_test()
+{
+    int ret = 0;
+    uint8_t key[SIPHASH_KEY_SIZE];
+    uint8_t message[64];
+    uint8_t out[16];
+    uint8_t out2[16];
+
+    for (size_t i = 0; i < sizeof(key); i++) {
+        key[i] = (uint8_t)i;
+    }
+
+    for (size_t i = 0; i < sizeof(message); i++) {
+        message[i] = (uint8_t)i;
+    }
+
+    for (size_t i = 0; ret == 0 && i < nb_siphash_test_vectors; i++) {
+        if (siphash_64(key, message, siphash_test_vectors[i].length) != siphash_test_vectors[i].expected_64) {
+            ret = -1;
+        } else {
+            siphash_128(key, message, siphash_test_vectors[i].length, out);
+            if (memcmp(out, siphash_test_vectors[i].expected_128, sizeof(out)) != 0) {
+                ret = -1;
+            }
+        }
+    }
+
+    /* Changing one bit of the key or of the message must change the output */
+    if (ret == 0) {
+        siphash_128(key, message, 20, out);
+        key[7] ^= 1;
+        siphash_128(key, message, 20, out2);
+        key[7] ^= 1;
+
+        if (memcmp(out, out2, sizeof(out)) == 0) {
+            ret = -1;
+        } else {
+            message[19] ^= 1;
+            siphash_128(key, message, 20, out2);
+            message[19] ^= 1;
+
+            if (memcmp(out, out2, sizeof(out)) == 0) {
+                ret = -1;
+            }
+        }
+    }
+
+    return ret;
+}
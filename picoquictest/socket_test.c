@@ -107,6 +107,72 @@ static int socket_ping_pong(SOCKET_TYPE fd, struct sockaddr* server_addr, int se
     return ret;
 }
 
+/*
+ * Check that the server sockets return the kernel arrival time of packets,
+ * expressed in the same clock as picoquic_current_time().
+ */
+static int socket_timestamp_check(SOCKET_TYPE fd, struct sockaddr* server_addr, int server_address_length,
+    picoquic_server_sockets_t* server_sockets)
+{
+    int ret = 0;
+    uint8_t buffer[1536];
+    uint64_t send_time = picoquic_current_time();
+    uint64_t arrival_time = 0;
+    int bytes_recv = 0;
+    int tos = 0;
+    fd_set readfds;
+    struct timeval tv;
+    int sockmax = 0;
+    struct sockaddr_storage addr_from;
+    socklen_t from_length = (socklen_t)sizeof(addr_from);
+
+    memset(buffer, 0x5A, sizeof(buffer));
+    if (sendto(fd, (const char*)buffer, 256, 0, server_addr, server_address_length) != 256) {
+        ret = -1;
+    }
+
+    if (ret == 0) {
+        FD_ZERO(&readfds);
+        for (int i = 0; i < PICOQUIC_NB_SERVER_SOCKETS; i++) {
+            if (sockmax < (int)server_sockets->s_socket[i]) {
+                sockmax = (int)server_sockets->s_socket[i];
+            }
+            FD_SET(server_sockets->s_socket[i], &readfds);
+        }
+        tv.tv_sec = 1;
+        tv.tv_usec = 0;
+
+        if (select(sockmax + 1, &readfds, NULL, NULL, &tv) <= 0) {
+            ret = -1;
+        }
+    }
+
+    for (int i = 0; ret == 0 && i < PICOQUIC_NB_SERVER_SOCKETS; i++) {
+        if (FD_ISSET(server_sockets->s_socket[i], &readfds)) {
+            bytes_recv = picoquic_recvmsg(server_sockets->s_socket[i], &addr_from, &from_length,
+                NULL, NULL, NULL, buffer, sizeof(buffer), &tos, &arrival_time);
+            break;
+        }
+    }
+
+    if (ret == 0 && bytes_recv != 256) {
+        ret = -1;
+    }
+
+#if !defined(_WINDOWS) && defined(SO_TIMESTAMPNS)
+    if (ret == 0 && (arrival_time == 0 || arrival_time > picoquic_current_time() ||
+        arrival_time + PICOQUIC_MAX_RCV_QUEUE_DELAY < send_time)) {
+        DBG_PRINTF("Unexpected arrival time, %llu, sent at %llu\n",
+            (unsigned long long)arrival_time, (unsigned long long)send_time);
+        ret = -1;
+    }
+#else
+    (void)send_time;
+#endif
+
+    return ret;
+}
+
 static int socket_test_one(char const* addr_text, int server_port, int should_be_name,
     picoquic_server_sockets_t* server_sockets)
 {
@@ -128,6 +194,9 @@ static int socket_test_one(char const* addr_text, int server_port, int should_be
                 ret = -1;
             } else {
                 ret = socket_ping_pong(fd, (struct sockaddr*)&server_address, server_address_length, server_sockets);
+                if (ret == 0) {
+                    ret = socket_timestamp_check(fd, (struct sockaddr*)&server_address, server_address_length, server_sockets);
+                }
             }
 
             SOCKET_CLOSE(fd);
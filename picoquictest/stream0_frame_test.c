@@ -22,6 +22,9 @@
 #include "../picoquic/picoquic_internal.h"
 #include "../picoquic/plugin.h"
 #include "../picoquic/memory.h"
+#include "picoquictest_internal.h"
+#include <stdlib.h>
+#include <string.h>
 
 /*
  * Testing Arrival of Frame for Stream Zero
@@ -129,9 +132,54 @@ static size_t const nb_test_cases = sizeof(test_case) / sizeof(struct test_case_
 
 #define FAIL(test, fmt, ...) DBG_PRINTF("Test %s failed: " fmt, (test)->name, __VA_ARGS__)
 
-static int StreamZeroFrameOneTest(struct test_case_st* test)
+/* All the data should be available in one contiguous run from offset 0 */
+static int stream_frame_check_reassembly(struct test_case_st* test, picoquic_stream_reassembly_t* reassembly)
 {
     int ret = 0;
+    uint8_t* bytes = NULL;
+    size_t length = picoquic_stream_reassembly_peek(reassembly, 0, &bytes);
+
+    for (size_t i = 0; ret == 0 && i < length; i++) {
+        if (bytes[i] != i + 1) {
+            FAIL(test, "byte %" PRIst " is %u instead of %" PRIst, i, bytes[i], i + 1);
+            ret = -1;
+        }
+    }
+
+    if (ret == 0 && length != test->expected_length) {
+        FAIL(test, "total byte %" PRIst " bytes instead of %" PRIst, length, test->expected_length);
+        ret = -1;
+    }
+
+    return ret;
+}
+
+/* When a callback is set, the data is delivered in order, from the packet when possible */
+typedef struct st_stream_frame_callback_ctx_t {
+    size_t nb_delivered;
+    int error_detected;
+} stream_frame_callback_ctx_t;
+
+static int stream_frame_test_callback(picoquic_cnx_t* cnx,
+    uint64_t stream_id, uint8_t* bytes, size_t length,
+    picoquic_call_back_event_t fin_or_event, void* callback_ctx, void* stream_ctx)
+{
+    stream_frame_callback_ctx_t* ctx = (stream_frame_callback_ctx_t*)callback_ctx;
+
+    for (size_t i = 0; i < length; i++) {
+        ctx->nb_delivered++;
+        if (bytes[i] != ctx->nb_delivered) {
+            ctx->error_detected = 1;
+        }
+    }
+
+    return 0;
+}
+
+static int StreamZeroFrameOneTest(struct test_case_st* test, int use_callback)
+{
+    int ret = 0;
+    stream_frame_callback_ctx_t callback_ctx = { 0 };
 
     struct sockaddr_in test_addr;
     picoquic_quic_t* quic = picoquic_create(8, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, 0, NULL, NULL, NULL, 0, NULL);
@@ -159,6 +207,10 @@ static int StreamZeroFrameOneTest(struct test_case_st* test)
     cnx->remote_parameters.initial_max_stream_data_bidi_remote = 0x10000;
     cnx->maxdata_local = 0x10000;
 
+    if (ret == 0 && use_callback) {
+        picoquic_set_callback(cnx, stream_frame_test_callback, &callback_ctx);
+    }
+
     for (size_t i = 0; ret == 0 && i < test->list_size; i++) {
         if (PICOQUIC_ERROR_DETECTED == picoquic_decode_frames(cnx, test->list[i].packet, test->list[i].packet_length, 3, current_time, &path)) {
             FAIL(test, "packet %" PRIst, i);
@@ -176,43 +228,39 @@ static int StreamZeroFrameOneTest(struct test_case_st* test)
         ret = -1;
     }
 
-    if (ret == 0) {
+    if (ret == 0 && use_callback) {
+        if (callback_ctx.error_detected || callback_ctx.nb_delivered != test->expected_length) {
+            FAIL(test, "delivered %" PRIst " bytes instead of %" PRIst, callback_ctx.nb_delivered, test->expected_length);
+            ret = -1;
+        } else if (cnx->first_stream->reassembly.nb_ranges != 0) {
+            FAIL(test, "%s", "Data left in the receive queue");
+            ret = -1;
+        }
+    } else if (ret == 0) {
         /* Check the content of all the data in the context */
-        picoquic_stream_data* data = cnx->first_stream->stream_data;
-        size_t data_rank = 0;
-
-        while (data != NULL) {
-            if (data->bytes == NULL) {
-                FAIL(test, "%s", "No data bytes");
-                ret = -1;
-            }
+        ret = stream_frame_check_reassembly(test, &cnx->first_stream->reassembly);
+    }
 
-            for (size_t i = 0; ret == 0 && i < data->length; i++) {
-                data_rank++;
-                if (data->bytes[i] != data_rank) {
-                    FAIL(test, "byte %" PRIst " is %u instead of %" PRIst, i, data->bytes[i], data_rank);
-                    ret = -1;
-                }
-            }
+    return ret;
+}
 
-            data = data->next_stream_data;
-        }
+int StreamZeroFrameTest()
+{
+    int ret = 0;
 
-        if (ret == 0 && data_rank != test->expected_length) {
-            FAIL(test, "total byte %" PRIst " bytes instead of %" PRIst, data_rank, test->expected_length);
-            ret = -1;
-        }
+    for (size_t i = 0; ret == 0 && i < nb_test_cases; i++) {
+        ret = StreamZeroFrameOneTest(&test_case[i], 0);
     }
 
     return ret;
 }
 
-int StreamZeroFrameTest()
+int StreamFrameCallbackTest()
 {
     int ret = 0;
 
     for (size_t i = 0; ret == 0 && i < nb_test_cases; i++) {
-        ret = StreamZeroFrameOneTest(&test_case[i]);
+        ret = StreamZeroFrameOneTest(&test_case[i], 1);
     }
 
     return ret;
@@ -344,30 +392,7 @@ static int TlsStreamFrameOneTest(struct test_case_st* test)
 
     if (ret == 0) {
         /* Check the content of all the data in the context */
-        picoquic_stream_data* data = cnx.tls_stream[test_epoch].stream_data;
-        size_t data_rank = 0;
-
-        while (data != NULL) {
-            if (data->bytes == NULL) {
-                FAIL(test, "%s", "No data bytes");
-                ret = -1;
-            }
-
-            for (size_t i = 0; ret == 0 && i < data->length; i++) {
-                data_rank++;
-                if (data->bytes[i] != data_rank) {
-                    FAIL(test, "byte %" PRIst " is %u instead of %" PRIst, i, data->bytes[i], data_rank);
-                    ret = -1;
-                }
-            }
-
-            data = data->next_stream_data;
-        }
-
-        if (ret == 0 && data_rank != test->expected_length) {
-            FAIL(test, "total byte %" PRIst " bytes instead of %" PRIst, data_rank, test->expected_length);
-            ret = -1;
-        }
+        ret = stream_frame_check_reassembly(test, &cnx.tls_stream[test_epoch].reassembly);
     }
 
     return ret;
@@ -383,3 +408,89 @@ int TlsStreamFrameTest()
 
     return ret;
 }
+
+/*
+ * Heavy reordering: segments of varying sizes arrive in a shuffled order,
+ * with duplicates and overlaps, while the reader consumes whatever becomes
+ * contiguous. The data must be delivered once, in order, and unchanged.
+ */
+#define REASSEMBLY_TEST_LENGTH 200000
+
+int StreamReassemblyTest()
+{
+    int ret = 0;
+    picoquic_stream_reassembly_t reassembly = { 0 };
+    uint8_t* source = (uint8_t*)malloc(REASSEMBLY_TEST_LENGTH);
+    uint64_t* segment_offset = (uint64_t*)malloc(REASSEMBLY_TEST_LENGTH * sizeof(uint64_t));
+    size_t nb_segments = 0;
+    uint64_t consumed_offset = 0;
+    uint64_t random_ctx = 0xdeadbeefcafebabeull;
+
+    if (source == NULL || segment_offset == NULL) {
+        ret = -1;
+    } else {
+        for (size_t i = 0; i < REASSEMBLY_TEST_LENGTH; i++) {
+            source[i] = (uint8_t)(i * 7 + (i >> 8));
+        }
+
+        /* Segments start every 100 to 1300 bytes */
+        for (uint64_t offset = 0; offset < REASSEMBLY_TEST_LENGTH; nb_segments++) {
+            segment_offset[nb_segments] = offset;
+            offset += 100 + picoquic_test_uniform_random(&random_ctx, 1200);
+        }
+
+        /* Shuffle */
+        for (size_t i = nb_segments - 1; i > 0; i--) {
+            size_t j = (size_t)picoquic_test_uniform_random(&random_ctx, i + 1);
+            uint64_t x = segment_offset[i];
+            segment_offset[i] = segment_offset[j];
+            segment_offset[j] = x;
+        }
+    }
+
+    for (size_t i = 0; ret == 0 && i < nb_segments; i++) {
+        /* Segments are 1500 bytes long so they overlap the next one, and one in 8 is sent twice */
+        int nb_copies = (picoquic_test_uniform_random(&random_ctx, 8) == 0) ? 2 : 1;
+        uint64_t offset = segment_offset[i];
+        size_t length = 1500;
+        int new_data_available = 0;
+        uint8_t* bytes = NULL;
+        size_t available;
+
+        if (offset + length > REASSEMBLY_TEST_LENGTH) {
+            length = (size_t)(REASSEMBLY_TEST_LENGTH - offset);
+        }
+
+        for (int c = 0; ret == 0 && c < nb_copies; c++) {
+            if (picoquic_stream_reassembly_insert(&reassembly, consumed_offset, offset, source + offset, length, &new_data_available) != 0) {
+                DBG_PRINTF("Cannot insert segment %d at offset %" PRIu64 "\n", (int)i, offset);
+                ret = -1;
+            }
+        }
+
+        while (ret == 0 && (available = picoquic_stream_reassembly_peek(&reassembly, consumed_offset, &bytes)) > 0) {
+            if (memcmp(bytes, source + consumed_offset, available) != 0) {
+                DBG_PRINTF("Data mismatch at offset %" PRIu64 "\n", consumed_offset);
+                ret = -1;
+            }
+            consumed_offset += available;
+        }
+    }
+
+    if (ret == 0 && (consumed_offset != REASSEMBLY_TEST_LENGTH || reassembly.nb_ranges != 0)) {
+        DBG_PRINTF("Consumed %" PRIu64 " bytes, %d ranges left\n", consumed_offset, (int)reassembly.nb_ranges);
+        ret = -1;
+    }
+
+    picoquic_stream_reassembly_clear(&reassembly);
+
+    if (source != NULL) {
+        free(source);
+    }
+
+    if (segment_offset != NULL) {
+        free(segment_offset);
+    }
+
+    return ret;
+}
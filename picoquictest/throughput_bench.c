@@ -0,0 +1,552 @@
+/*
+ * End-to-end throughput benchmarks.
+ *
+ * A client and a server exchange data over a pair of simulated links in
+ * virtual time, as in the stress test, so that no network is involved and
+ * runs are reproducible. Only the time spent in picoquic_prepare_packet and
+ * picoquic_incoming_packet is accounted to the stack, which gives the
+ * hot-path cost per packet independently of the simulator overhead.
+ *
+ * Each scenario is run without plugins, then once per plugin listed in
+ * throughput_bench_plugins.
+ *
+ * When the allocator is wrapped, the heap bytes retained by the stack between
+ * calls are tracked as well, giving the memory held per connection, e.g. by
+ * loss recovery state in the lossy scenario.
+ *
+ * The congestion control comparison runs a bulk transfer over links with a
+ * shallow buffer once per congestion algorithm, and reports the goodput and
+ * the number of packets dropped by the links.
+ */
+
+#include "../picoquic/picoquic_internal.h"
+#include "picoquictest_internal.h"
+#include "picoquictest.h"
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define THROUGHPUT_BENCH_MAX_CNX 64
+#define THROUGHPUT_BENCH_MAX_OPEN_STREAMS 16
+#define THROUGHPUT_BENCH_REQUEST_SIZE 8
+#define THROUGHPUT_BENCH_CHUNK_SIZE 0x10000
+#define THROUGHPUT_BENCH_TIME_LIMIT 120000000ull /* 2 minutes of simulated time */
+
+typedef struct st_throughput_bench_scenario_t {
+    char const* name;
+    int nb_cnx;
+    int nb_streams;
+    uint64_t response_size;
+    uint64_t loss_mask; /* Rotating mask applied on both links, 0 for no loss */
+    uint64_t queue_delay_max; /* Buffer size of the links in microseconds, 0 for unlimited */
+} throughput_bench_scenario_t;
+
+typedef struct st_throughput_bench_client_ctx_t {
+    uint64_t response_size;
+    int nb_streams;
+    int nb_started;
+    int nb_open;
+    int nb_done;
+    uint64_t bytes_received;
+} throughput_bench_client_ctx_t;
+
+typedef struct st_throughput_bench_ctx_t {
+    picoquic_quic_t* qclient;
+    picoquic_quic_t* qserver;
+    picoquictest_sim_link_t* c_to_s_link;
+    picoquictest_sim_link_t* s_to_c_link;
+    struct sockaddr_in client_addr;
+    struct sockaddr_in server_addr;
+    uint64_t simulated_time;
+    uint64_t c_to_s_loss_mask;
+    uint64_t s_to_c_loss_mask;
+    int nb_clients_active;
+    throughput_bench_client_ctx_t client_ctx[THROUGHPUT_BENCH_MAX_CNX];
+    /* Measurements */
+    uint64_t nb_packets;
+    uint64_t nb_bytes;
+    uint64_t prepare_ns;
+    uint64_t incoming_ns;
+    uint64_t alloc_bytes;
+    uint64_t alloc_count;
+    int64_t live_bytes; /* Heap bytes retained by the stack */
+    int64_t peak_live_bytes;
+} throughput_bench_ctx_t;
+
+static const char* throughput_bench_plugins[] = {
+    "plugins/basic/basic.plugin",
+    "plugins/monitoring/monitoring.plugin",
+    "plugins/ecn/ecn.plugin",
+    "plugins/tlp/tlp.plugin",
+    "plugins/no_pacing/no_pacing.plugin",
+    "plugins/stream_scheduling_rr/stream_scheduling_rr.plugin"
+};
+
+static const size_t nb_throughput_bench_plugins = sizeof(throughput_bench_plugins) / sizeof(char const*);
+
+typedef struct st_throughput_bench_cc_t {
+    char const* name;
+    picoquic_congestion_algorithm_t** alg;
+} throughput_bench_cc_t;
+
+static const throughput_bench_cc_t throughput_bench_cc_algs[] = {
+    { "newreno", &picoquic_newreno_algorithm },
+    { "cubic", &picoquic_cubic_algorithm },
+    { "bbr", &picoquic_bbr_algorithm },
+    { "bbr2", &picoquic_bbr2_algorithm }
+};
+
+static const size_t nb_throughput_bench_cc_algs = sizeof(throughput_bench_cc_algs) / sizeof(throughput_bench_cc_t);
+
+static const uint8_t throughput_bench_ticket_key[32] = {
+    1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15, 16,
+    17, 18, 19, 20, 21, 22, 23, 24, 25, 26, 27, 28, 29, 30, 31, 32
+};
+
+static uint8_t throughput_bench_data[THROUGHPUT_BENCH_CHUNK_SIZE];
+
+static uint64_t throughput_bench_cpu_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+    return ((uint64_t)ts.tv_sec) * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+static void throughput_bench_start_streams(picoquic_cnx_t* cnx, throughput_bench_client_ctx_t* ctx)
+{
+    uint8_t request[THROUGHPUT_BENCH_REQUEST_SIZE];
+
+    picoformat_64(request, ctx->response_size);
+
+    while (ctx->nb_open < THROUGHPUT_BENCH_MAX_OPEN_STREAMS && ctx->nb_started < ctx->nb_streams) {
+        uint64_t stream_id = 4 * (uint64_t)ctx->nb_started;
+
+        if (picoquic_add_to_stream(cnx, stream_id, request, sizeof(request), 1) != 0) {
+            break;
+        }
+        ctx->nb_started++;
+        ctx->nb_open++;
+    }
+}
+
+static int throughput_bench_client_callback(picoquic_cnx_t* cnx,
+    uint64_t stream_id, uint8_t* bytes, size_t length,
+    picoquic_call_back_event_t fin_or_event, void* callback_ctx, void* stream_ctx)
+{
+    throughput_bench_client_ctx_t* ctx = (throughput_bench_client_ctx_t*)callback_ctx;
+
+    if (ctx == NULL) {
+        return 0;
+    }
+
+    switch (fin_or_event) {
+    case picoquic_callback_no_event:
+        ctx->bytes_received += length;
+        break;
+    case picoquic_callback_stream_fin:
+        ctx->bytes_received += length;
+        ctx->nb_open--;
+        ctx->nb_done++;
+        if (ctx->nb_done >= ctx->nb_streams) {
+            picoquic_close(cnx, 0);
+        } else {
+            throughput_bench_start_streams(cnx, ctx);
+        }
+        break;
+    case picoquic_callback_close:
+    case picoquic_callback_application_close:
+    case picoquic_callback_stateless_reset:
+        picoquic_set_callback(cnx, NULL, NULL);
+        break;
+    default:
+        break;
+    }
+
+    return 0;
+}
+
+static int throughput_bench_server_callback(picoquic_cnx_t* cnx,
+    uint64_t stream_id, uint8_t* bytes, size_t length,
+    picoquic_call_back_event_t fin_or_event, void* callback_ctx, void* stream_ctx)
+{
+    int ret = 0;
+
+    if (fin_or_event == picoquic_callback_stream_fin && length >= THROUGHPUT_BENCH_REQUEST_SIZE) {
+        uint64_t response_size = PICOPARSE_64(bytes);
+
+        while (ret == 0 && response_size > THROUGHPUT_BENCH_CHUNK_SIZE) {
+            ret = picoquic_add_to_stream(cnx, stream_id, throughput_bench_data, THROUGHPUT_BENCH_CHUNK_SIZE, 0);
+            response_size -= THROUGHPUT_BENCH_CHUNK_SIZE;
+        }
+        if (ret == 0) {
+            ret = picoquic_add_to_stream(cnx, stream_id, throughput_bench_data, (size_t)response_size, 1);
+        }
+    }
+
+    return ret;
+}
+
+static void throughput_bench_delete_ctx(throughput_bench_ctx_t* ctx)
+{
+    if (ctx->qclient != NULL) {
+        picoquic_free(ctx->qclient);
+    }
+    if (ctx->qserver != NULL) {
+        picoquic_free(ctx->qserver);
+    }
+    if (ctx->c_to_s_link != NULL) {
+        picoquictest_sim_link_delete(ctx->c_to_s_link);
+    }
+    if (ctx->s_to_c_link != NULL) {
+        picoquictest_sim_link_delete(ctx->s_to_c_link);
+    }
+    free(ctx);
+}
+
+static throughput_bench_ctx_t* throughput_bench_create_ctx(throughput_bench_scenario_t const* scenario, char const* plugin_fname,
+    picoquic_congestion_algorithm_t* cc_alg)
+{
+    int ret = 0;
+    throughput_bench_ctx_t* ctx = (throughput_bench_ctx_t*)calloc(1, sizeof(throughput_bench_ctx_t));
+
+    if (ctx == NULL) {
+        return NULL;
+    }
+
+    ctx->client_addr.sin_family = AF_INET;
+    ctx->client_addr.sin_addr.s_addr = 0x0A000002;
+    ctx->client_addr.sin_port = 1234;
+    ctx->server_addr.sin_family = AF_INET;
+    ctx->server_addr.sin_addr.s_addr = 0x0A000001;
+    ctx->server_addr.sin_port = 4321;
+
+    ctx->qclient = picoquic_create(THROUGHPUT_BENCH_MAX_CNX, NULL, NULL, PICOQUIC_TEST_CERT_STORE, NULL, NULL,
+        NULL, NULL, NULL, NULL, ctx->simulated_time, &ctx->simulated_time, NULL, NULL, 0, NULL);
+    ctx->qserver = picoquic_create(THROUGHPUT_BENCH_MAX_CNX,
+        PICOQUIC_TEST_SERVER_CERT, PICOQUIC_TEST_SERVER_KEY, PICOQUIC_TEST_CERT_STORE,
+        PICOQUIC_TEST_ALPN, throughput_bench_server_callback, NULL, NULL, NULL, NULL,
+        ctx->simulated_time, &ctx->simulated_time, NULL,
+        throughput_bench_ticket_key, sizeof(throughput_bench_ticket_key), NULL);
+    ctx->c_to_s_loss_mask = scenario->loss_mask;
+    ctx->s_to_c_loss_mask = scenario->loss_mask;
+    ctx->c_to_s_link = picoquictest_sim_link_create(0.1, 10000,
+        (scenario->loss_mask != 0) ? &ctx->c_to_s_loss_mask : NULL, scenario->queue_delay_max, ctx->simulated_time);
+    ctx->s_to_c_link = picoquictest_sim_link_create(0.1, 10000,
+        (scenario->loss_mask != 0) ? &ctx->s_to_c_loss_mask : NULL, scenario->queue_delay_max, ctx->simulated_time);
+
+    if (ctx->qclient == NULL || ctx->qserver == NULL || ctx->c_to_s_link == NULL || ctx->s_to_c_link == NULL) {
+        ret = -1;
+    }
+
+    if (ret == 0 && plugin_fname != NULL) {
+        ret = picoquic_set_local_plugins(ctx->qclient, &plugin_fname, 1);
+        if (ret == 0) {
+            ret = picoquic_set_local_plugins(ctx->qserver, &plugin_fname, 1);
+        }
+    }
+
+    if (ret == 0 && cc_alg != NULL) {
+        picoquic_set_default_congestion_algorithm(ctx->qclient, cc_alg);
+        picoquic_set_default_congestion_algorithm(ctx->qserver, cc_alg);
+    }
+
+    for (int i = 0; ret == 0 && i < scenario->nb_cnx; i++) {
+        throughput_bench_client_ctx_t* c_ctx = &ctx->client_ctx[i];
+        picoquic_cnx_t* cnx = picoquic_create_cnx(ctx->qclient,
+            picoquic_null_connection_id, picoquic_null_connection_id,
+            (struct sockaddr*)&ctx->server_addr, ctx->simulated_time,
+            0, PICOQUIC_TEST_SNI, PICOQUIC_TEST_ALPN, 1);
+
+        if (cnx == NULL) {
+            ret = -1;
+        } else {
+            c_ctx->response_size = scenario->response_size;
+            c_ctx->nb_streams = scenario->nb_streams;
+            picoquic_set_callback(cnx, throughput_bench_client_callback, c_ctx);
+            throughput_bench_start_streams(cnx, c_ctx);
+            ret = picoquic_start_client_cnx(cnx);
+            ctx->nb_clients_active++;
+        }
+    }
+
+    if (ret != 0) {
+        throughput_bench_delete_ctx(ctx);
+        ctx = NULL;
+    }
+
+    return ctx;
+}
+
+static void throughput_bench_account_live(throughput_bench_ctx_t* ctx, int64_t live_before)
+{
+    ctx->live_bytes += picoquic_bench_alloc_live - live_before;
+    if (ctx->live_bytes > ctx->peak_live_bytes) {
+        ctx->peak_live_bytes = ctx->live_bytes;
+    }
+}
+
+static int throughput_bench_prepare(throughput_bench_ctx_t* ctx, picoquic_cnx_t* cnx, int is_client)
+{
+    int ret = 0;
+    picoquic_path_t* path = NULL;
+    picoquictest_sim_packet_t* packet = picoquictest_sim_link_create_packet();
+    uint64_t alloc_bytes = picoquic_bench_alloc_bytes;
+    uint64_t alloc_count = picoquic_bench_alloc_count;
+    int64_t live_before = picoquic_bench_alloc_live;
+    uint64_t start;
+
+    if (packet == NULL) {
+        return -1;
+    }
+
+    start = picoquic_bench_now_ns();
+    ret = picoquic_prepare_packet(cnx, ctx->simulated_time, packet->bytes, PICOQUIC_MAX_PACKET_SIZE, &packet->length, &path);
+    ctx->prepare_ns += picoquic_bench_now_ns() - start;
+    ctx->alloc_bytes += picoquic_bench_alloc_bytes - alloc_bytes;
+    ctx->alloc_count += picoquic_bench_alloc_count - alloc_count;
+    throughput_bench_account_live(ctx, live_before);
+
+    if (ret == 0 && packet->length > 0) {
+        ctx->nb_packets++;
+        ctx->nb_bytes += packet->length;
+        memcpy(&packet->addr_from, is_client ? &ctx->client_addr : &ctx->server_addr, sizeof(struct sockaddr_in));
+        memcpy(&packet->addr_to, is_client ? &ctx->server_addr : &ctx->client_addr, sizeof(struct sockaddr_in));
+        picoquictest_sim_link_submit(is_client ? ctx->c_to_s_link : ctx->s_to_c_link, packet, ctx->simulated_time);
+    } else {
+        free(packet);
+        if (ret == PICOQUIC_ERROR_DISCONNECTED) {
+            ret = 0;
+            if (is_client) {
+                ctx->nb_clients_active--;
+            }
+            picoquic_delete_cnx(cnx);
+        }
+    }
+
+    return ret;
+}
+
+static int throughput_bench_arrival(throughput_bench_ctx_t* ctx, picoquic_quic_t* quic, picoquictest_sim_link_t* link)
+{
+    int ret = 0;
+    int new_context_created = 0;
+    picoquictest_sim_packet_t* packet = picoquictest_sim_link_dequeue(link, ctx->simulated_time);
+    picoquic_stateless_packet_t* sp;
+
+    if (packet != NULL) {
+        uint64_t alloc_bytes = picoquic_bench_alloc_bytes;
+        uint64_t alloc_count = picoquic_bench_alloc_count;
+        int64_t live_before = picoquic_bench_alloc_live;
+        uint64_t start = picoquic_bench_now_ns();
+
+        ret = picoquic_incoming_packet(quic, packet->bytes, (uint32_t)packet->length,
+            (struct sockaddr*)&packet->addr_from, (struct sockaddr*)&packet->addr_to, 0,
+            ctx->simulated_time, &new_context_created);
+        ctx->incoming_ns += picoquic_bench_now_ns() - start;
+        ctx->alloc_bytes += picoquic_bench_alloc_bytes - alloc_bytes;
+        ctx->alloc_count += picoquic_bench_alloc_count - alloc_count;
+        throughput_bench_account_live(ctx, live_before);
+        free(packet);
+    }
+
+    /* Retry or version negotiation packets produced by the server */
+    while ((sp = picoquic_dequeue_stateless_packet(ctx->qserver)) != NULL) {
+        if (sp->length > 0 && (packet = picoquictest_sim_link_create_packet()) != NULL) {
+            memcpy(&packet->addr_from, &ctx->server_addr, sizeof(struct sockaddr_in));
+            memcpy(&packet->addr_to, &ctx->client_addr, sizeof(struct sockaddr_in));
+            memcpy(packet->bytes, sp->bytes, sp->length);
+            packet->length = sp->length;
+            picoquictest_sim_link_submit(ctx->s_to_c_link, packet, ctx->simulated_time);
+        }
+        picoquic_delete_stateless_packet(sp);
+    }
+
+    return ret;
+}
+
+static int throughput_bench_one_round(throughput_bench_ctx_t* ctx)
+{
+    int ret = 0;
+    uint64_t best_time = UINT64_MAX;
+    int action = -1;
+    picoquic_cnx_t* c_cnx = picoquic_get_earliest_cnx_to_wake(ctx->qclient, 0);
+    picoquic_cnx_t* s_cnx = picoquic_get_earliest_cnx_to_wake(ctx->qserver, 0);
+
+    if (ctx->s_to_c_link->first_packet != NULL && ctx->s_to_c_link->first_packet->arrival_time < best_time) {
+        best_time = ctx->s_to_c_link->first_packet->arrival_time;
+        action = 0;
+    }
+    if (ctx->c_to_s_link->first_packet != NULL && ctx->c_to_s_link->first_packet->arrival_time < best_time) {
+        best_time = ctx->c_to_s_link->first_packet->arrival_time;
+        action = 1;
+    }
+    if (c_cnx != NULL && c_cnx->next_wake_time < best_time) {
+        best_time = c_cnx->next_wake_time;
+        action = 2;
+    }
+    if (s_cnx != NULL && s_cnx->next_wake_time < best_time) {
+        best_time = s_cnx->next_wake_time;
+        action = 3;
+    }
+
+    if (best_time > ctx->simulated_time) {
+        ctx->simulated_time = best_time;
+    }
+
+    switch (action) {
+    case 0:
+        ret = throughput_bench_arrival(ctx, ctx->qclient, ctx->s_to_c_link);
+        break;
+    case 1:
+        ret = throughput_bench_arrival(ctx, ctx->qserver, ctx->c_to_s_link);
+        break;
+    case 2:
+        ret = throughput_bench_prepare(ctx, c_cnx, 1);
+        break;
+    case 3:
+        ret = throughput_bench_prepare(ctx, s_cnx, 0);
+        break;
+    default:
+        /* Nothing left to do while some clients are still active */
+        ret = -1;
+        break;
+    }
+
+    return ret;
+}
+
+static int throughput_bench_one_run(FILE* F, throughput_bench_scenario_t const* scenario, char const* plugin_fname,
+    throughput_bench_cc_t const* cc)
+{
+    int ret = 0;
+    char const* variant = "none";
+    throughput_bench_ctx_t* ctx = throughput_bench_create_ctx(scenario, plugin_fname, (cc == NULL) ? NULL : *cc->alg);
+    uint64_t cpu_start;
+    uint64_t cpu_loop = 0;
+
+    if (cc != NULL) {
+        variant = cc->name;
+    } else if (plugin_fname != NULL) {
+        char const* last_sep = strrchr(plugin_fname, '/');
+        variant = (last_sep == NULL) ? plugin_fname : last_sep + 1;
+    }
+
+    if (ctx == NULL) {
+        if (plugin_fname != NULL) {
+            /* Plugins may not be compiled in this tree; this is not a stack failure */
+            fprintf(stderr, "Skipping %s with %s, cannot create the connections.\n", scenario->name, variant);
+            return 0;
+        }
+        return -1;
+    }
+
+    cpu_start = throughput_bench_cpu_ns();
+    while (ret == 0 && ctx->nb_clients_active > 0 && ctx->simulated_time < THROUGHPUT_BENCH_TIME_LIMIT) {
+        ret = throughput_bench_one_round(ctx);
+    }
+    cpu_loop = throughput_bench_cpu_ns() - cpu_start;
+
+    if (ret == 0 && ctx->nb_clients_active > 0) {
+        ret = -1;
+    }
+
+    for (int i = 0; ret == 0 && i < scenario->nb_cnx; i++) {
+        if (ctx->client_ctx[i].nb_done != scenario->nb_streams ||
+            ctx->client_ctx[i].bytes_received != scenario->response_size * (uint64_t)scenario->nb_streams) {
+            ret = -1;
+        }
+    }
+
+    if (ret != 0) {
+        fprintf(stderr, "Scenario %s with %s did not complete, simulated time %" PRIu64 "\n",
+            scenario->name, variant, ctx->simulated_time);
+    } else if (ctx->nb_packets > 0) {
+        double stack_ns = (double)(ctx->prepare_ns + ctx->incoming_ns);
+        double nb_packets = (double)ctx->nb_packets;
+
+        picoquic_bench_report_metric(F, scenario->name, variant, "packets", nb_packets);
+        picoquic_bench_report_metric(F, scenario->name, variant, "bytes", (double)ctx->nb_bytes);
+        picoquic_bench_report_metric(F, scenario->name, variant, "simulated_us", (double)ctx->simulated_time);
+        picoquic_bench_report_metric(F, scenario->name, variant, "prepare_ns_per_packet", ctx->prepare_ns / nb_packets);
+        picoquic_bench_report_metric(F, scenario->name, variant, "incoming_ns_per_packet", ctx->incoming_ns / nb_packets);
+        picoquic_bench_report_metric(F, scenario->name, variant, "cpu_ns_per_packet", stack_ns / nb_packets);
+        picoquic_bench_report_metric(F, scenario->name, variant, "packets_per_sec_per_core", (stack_ns > 0) ? nb_packets * 1e9 / stack_ns : 0);
+        picoquic_bench_report_metric(F, scenario->name, variant, "loop_cpu_ns_per_packet", cpu_loop / nb_packets);
+        if (picoquic_bench_alloc_count > 0) {
+            /* Allocations are only tracked when the benchmark is linked with the allocation wrappers */
+            picoquic_bench_report_metric(F, scenario->name, variant, "alloc_bytes_per_packet", ctx->alloc_bytes / nb_packets);
+            picoquic_bench_report_metric(F, scenario->name, variant, "allocs_per_packet", ctx->alloc_count / nb_packets);
+            picoquic_bench_report_metric(F, scenario->name, variant, "peak_live_bytes_per_cnx",
+                (double)ctx->peak_live_bytes / scenario->nb_cnx);
+        }
+        if (cc != NULL) {
+            uint64_t goodput_bytes = scenario->response_size * (uint64_t)scenario->nb_streams * (uint64_t)scenario->nb_cnx;
+
+            picoquic_bench_report_metric(F, scenario->name, variant, "goodput_mbps",
+                (ctx->simulated_time > 0) ? (double)goodput_bytes * 8.0 / (double)ctx->simulated_time : 0);
+            picoquic_bench_report_metric(F, scenario->name, variant, "packets_dropped",
+                (double)(ctx->c_to_s_link->packets_dropped + ctx->s_to_c_link->packets_dropped));
+        }
+    }
+
+    throughput_bench_delete_ctx(ctx);
+
+    return ret;
+}
+
+static int throughput_bench_scenario(FILE* F, throughput_bench_scenario_t const* scenario)
+{
+    int ret = throughput_bench_one_run(F, scenario, NULL, NULL);
+
+    for (size_t i = 0; i < nb_throughput_bench_plugins; i++) {
+        if (throughput_bench_one_run(F, scenario, throughput_bench_plugins[i], NULL) != 0) {
+            ret = -1;
+        }
+    }
+
+    return ret;
+}
+
+int throughput_bulk_bench(FILE* F)
+{
+    throughput_bench_scenario_t scenario = { "bulk", 1, 1, 16000000, 0, 0 };
+
+    return throughput_bench_scenario(F, &scenario);
+}
+
+int throughput_small_streams_bench(FILE* F)
+{
+    throughput_bench_scenario_t scenario = { "small_streams", 1, 1000, 1000, 0, 0 };
+
+    return throughput_bench_scenario(F, &scenario);
+}
+
+int throughput_many_cnx_bench(FILE* F)
+{
+    throughput_bench_scenario_t scenario = { "many_cnx", THROUGHPUT_BENCH_MAX_CNX, 4, 64000, 0, 0 };
+
+    return throughput_bench_scenario(F, &scenario);
+}
+
+int throughput_lossy_bench(FILE* F)
+{
+    /* 3 packets out of 64 lost on each link, i.e. about 5% loss */
+    throughput_bench_scenario_t scenario = { "lossy", 1, 1, 4000000, 0x4000020000100000ull, 0 };
+
+    return throughput_bench_scenario(F, &scenario);
+}
+
+int throughput_cc_bench(FILE* F)
+{
+    /* 100 Mbps and 20 ms RTT, with a buffer of 2 ms, i.e. a tenth of the BDP */
+    throughput_bench_scenario_t scenario = { "cc_shallow_buffer", 1, 1, 16000000, 0, 2000 };
+    int ret = 0;
+
+    for (size_t i = 0; i < nb_throughput_bench_cc_algs; i++) {
+        if (throughput_bench_one_run(F, &scenario, NULL, &throughput_bench_cc_algs[i]) != 0) {
+            ret = -1;
+        }
+    }
+
+    return ret;
+}
@@ -51,11 +51,43 @@ static int create_test_ticket(uint64_t current_time, uint32_t ttl, uint8_t* buf,
     return ret;
 }
 
-static int ticket_store_compare(picoquic_stored_ticket_t* s1, picoquic_stored_ticket_t* s2)
+static int ticket_file_append(char const* file_name, const uint8_t* bytes, size_t length)
 {
     int ret = 0;
-    picoquic_stored_ticket_t* c1 = s1;
-    picoquic_stored_ticket_t* c2 = s2;
+    FILE* F = picoquic_file_open(file_name, "ab");
+
+    if (F == NULL) {
+        ret = -1;
+    } else {
+        if (fwrite(bytes, 1, length, F) != length) {
+            ret = -1;
+        }
+        fclose(F);
+    }
+
+    return ret;
+}
+
+static long ticket_file_size(char const* file_name)
+{
+    long file_size = -1;
+    FILE* F = picoquic_file_open(file_name, "rb");
+
+    if (F != NULL) {
+        if (fseek(F, 0, SEEK_END) == 0) {
+            file_size = ftell(F);
+        }
+        fclose(F);
+    }
+
+    return file_size;
+}
+
+static int ticket_store_compare(picoquic_ticket_store_t* s1, picoquic_ticket_store_t* s2)
+{
+    int ret = 0;
+    picoquic_stored_ticket_t* c1 = s1->p_first_ticket;
+    picoquic_stored_ticket_t* c2 = s2->p_first_ticket;
 
     while (ret == 0 && c1 != 0) {
         if (c2 == 0) {
@@ -80,10 +112,14 @@ static int ticket_store_compare(picoquic_stored_ticket_t* s1, picoquic_stored_ti
 int ticket_store_test()
 {
     int ret = 0;
-    picoquic_stored_ticket_t* p_first_ticket = NULL;
-    picoquic_stored_ticket_t* p_first_ticket_bis = NULL;
-    picoquic_stored_ticket_t* p_first_ticket_ter = NULL;
-    picoquic_stored_ticket_t* p_first_ticket_empty = NULL;
+    picoquic_ticket_store_t store;
+    picoquic_ticket_store_t store_bis;
+    picoquic_ticket_store_t store_ter;
+    picoquic_ticket_store_t store_empty;
+    picoquic_ticket_store_t store_log;
+    picoquic_ticket_store_t store_log_bis;
+    picoquic_ticket_store_t store_cut;
+    picoquic_ticket_store_t store_bad;
 
     uint64_t ticket_time = 40000000000ull;
     uint64_t current_time = 50000000000ull;
@@ -92,20 +128,29 @@ int ticket_store_test()
     uint32_t ttl = 100000;
     uint8_t ticket[128];
 
+    memset(&store, 0, sizeof(picoquic_ticket_store_t));
+    memset(&store_bis, 0, sizeof(picoquic_ticket_store_t));
+    memset(&store_ter, 0, sizeof(picoquic_ticket_store_t));
+    memset(&store_empty, 0, sizeof(picoquic_ticket_store_t));
+    memset(&store_log, 0, sizeof(picoquic_ticket_store_t));
+    memset(&store_log_bis, 0, sizeof(picoquic_ticket_store_t));
+    memset(&store_cut, 0, sizeof(picoquic_ticket_store_t));
+    memset(&store_bad, 0, sizeof(picoquic_ticket_store_t));
+
     /* Test reading and writing an empty file */
     if (ret == 0) {
-        ret = picoquic_save_tickets(p_first_ticket, current_time, test_file_name);
+        ret = picoquic_save_tickets(&store, current_time, test_file_name);
     }
     /* Load the empty file again */
     if (ret == 0) {
-        ret = picoquic_load_tickets(&p_first_ticket_empty, retrieve_time, test_file_name);
+        ret = picoquic_load_tickets(&store_empty, retrieve_time, test_file_name);
 
         /* Verify that the two contents are empty */
-        if (p_first_ticket_empty != NULL) {
+        if (store_empty.p_first_ticket != NULL) {
             if (ret == 0) {
                 ret = -1;
             }
-            picoquic_free_tickets(&p_first_ticket_empty);
+            picoquic_free_tickets(&store_empty);
         }
     }
 
@@ -117,7 +162,7 @@ int ticket_store_test()
             if (ret != 0) {
                 break;
             }
-            ret = picoquic_store_ticket(&p_first_ticket, current_time,
+            ret = picoquic_store_ticket(&store, current_time,
                 test_sni[i], (uint16_t)strlen(test_sni[i]),
                 test_alpn[j], (uint16_t)strlen(test_alpn[j]),
                 ticket, ticket_length);
@@ -133,7 +178,7 @@ int ticket_store_test()
             uint16_t ticket_length = 0;
             uint16_t expected_length = (uint16_t)(64 + j * nb_test_sni + i);
             uint8_t* ticket = NULL;
-            ret = picoquic_get_ticket(p_first_ticket, current_time,
+            ret = picoquic_get_ticket(&store, current_time,
                 test_sni[i], (uint16_t)strlen(test_sni[i]),
                 test_alpn[j], (uint16_t)strlen(test_alpn[j]),
                 &ticket, &ticket_length);
@@ -148,30 +193,135 @@ int ticket_store_test()
     }
     /* Store them on a file */
     if (ret == 0) {
-        ret = picoquic_save_tickets(p_first_ticket, current_time, test_file_name);
+        ret = picoquic_save_tickets(&store, current_time, test_file_name);
     }
     /* Load the file again */
     if (ret == 0) {
-        ret = picoquic_load_tickets(&p_first_ticket_bis, retrieve_time, test_file_name);
+        ret = picoquic_load_tickets(&store_bis, retrieve_time, test_file_name);
     }
 
     /* Verify that the two contents match */
     if (ret == 0) {
-        ret = ticket_store_compare(p_first_ticket, p_first_ticket_bis);
+        ret = ticket_store_compare(&store, &store_bis);
     }
 
     /* Reload after a long time */
     if (ret == 0) {
-        ret = picoquic_load_tickets(&p_first_ticket_ter, too_late_time, test_file_name);
+        ret = picoquic_load_tickets(&store_ter, too_late_time, test_file_name);
+
+        if (ret == 0 && store_ter.p_first_ticket != NULL) {
+            ret = -1;
+        }
+    }
 
-        if (ret == 0 && p_first_ticket_ter != NULL) {
+    /* Replacing the ticket of an SNI and ALPN keeps one ticket per pair */
+    if (ret == 0) {
+        uint16_t ticket_length = 0;
+        uint8_t* ticket_found = NULL;
+
+        ret = create_test_ticket((ticket_time / 1000) + 100000, ttl, ticket, 100);
+        if (ret == 0) {
+            ret = picoquic_store_ticket(&store, current_time,
+                test_sni[0], (uint16_t)strlen(test_sni[0]), test_alpn[1], (uint16_t)strlen(test_alpn[1]),
+                ticket, 100);
+        }
+        if (ret == 0 && store.nb_tickets != nb_test_sni * nb_test_alpn) {
+            ret = -1;
+        }
+        if (ret == 0) {
+            ret = picoquic_get_ticket(&store, current_time,
+                test_sni[0], (uint16_t)strlen(test_sni[0]), test_alpn[1], (uint16_t)strlen(test_alpn[1]),
+                &ticket_found, &ticket_length);
+        }
+        if (ret == 0 && (ticket_length != 100 || store.p_last_ticket->ticket_length != 100)) {
+            ret = -1;
+        }
+        if (ret == 0 && picoquic_get_ticket(&store, current_time,
+            test_sni[0], (uint16_t)strlen(test_sni[0]) - 1, test_alpn[1], (uint16_t)strlen(test_alpn[1]),
+            &ticket_found, &ticket_length) == 0) {
             ret = -1;
         }
     }
+
+    /* Tickets stored with a file name are appended to the file, superseded records are ignored when loading */
+    if (ret == 0) {
+        ret = picoquic_save_tickets(NULL, current_time, test_file_name);
+        store_log.file_name = test_file_name;
+    }
+
+    for (size_t k = 0; ret == 0 && k < 2; k++) {
+        for (size_t i = 0; ret == 0 && i < nb_test_sni; i++) {
+            uint16_t ticket_length = (uint16_t)(64 + i);
+            ret = create_test_ticket((ticket_time / 1000) + 1000 * ((k * nb_test_sni) + i), ttl, ticket, ticket_length);
+            if (ret == 0) {
+                ret = picoquic_store_ticket(&store_log, current_time,
+                    test_sni[i], (uint16_t)strlen(test_sni[i]), test_alpn[0], (uint16_t)strlen(test_alpn[0]),
+                    ticket, ticket_length);
+            }
+        }
+    }
+
+    if (ret == 0) {
+        ret = picoquic_load_tickets(&store_log_bis, retrieve_time, test_file_name);
+    }
+
+    if (ret == 0 && (store_log_bis.nb_tickets != nb_test_sni ||
+        store_log_bis.file_length != 2 * store_log_bis.live_length)) {
+        ret = -1;
+    }
+
+    if (ret == 0) {
+        ret = ticket_store_compare(&store_log, &store_log_bis);
+    }
+
+    /* A truncated last record, e.g. from an interrupted append, is dropped and the file rewritten */
+    if (ret == 0) {
+        uint8_t partial[16];
+        uint32_t partial_length = 100;
+
+        memset(partial, 0xcc, sizeof(partial));
+        memcpy(partial, &partial_length, 4);
+        ret = ticket_file_append(test_file_name, partial, sizeof(partial));
+    }
+
+    if (ret == 0) {
+        ret = picoquic_load_tickets(&store_cut, retrieve_time, test_file_name);
+    }
+
+    if (ret == 0) {
+        ret = ticket_store_compare(&store_log, &store_cut);
+    }
+
+    if (ret == 0 && (store_cut.file_length != store_cut.live_length ||
+        ticket_file_size(test_file_name) != (long)store_cut.live_length)) {
+        ret = -1;
+    }
+
+    /* A file that cannot be parsed is treated as an empty cache, and rewritten as such */
+    if (ret == 0) {
+        uint32_t bad_length = 0xFFFF;
+
+        ret = ticket_file_append(test_file_name, (uint8_t*)&bad_length, 4);
+    }
+
+    if (ret == 0) {
+        ret = picoquic_load_tickets(&store_bad, retrieve_time, test_file_name);
+    }
+
+    if (ret == 0 && (store_bad.p_first_ticket != NULL || store_bad.nb_tickets != 0 ||
+        ticket_file_size(test_file_name) != 0)) {
+        ret = -1;
+    }
+
     /* Free what needs be */
-    picoquic_free_tickets(&p_first_ticket);
-    picoquic_free_tickets(&p_first_ticket_bis);
-    picoquic_free_tickets(&p_first_ticket_ter);
+    picoquic_free_tickets(&store);
+    picoquic_free_tickets(&store_bis);
+    picoquic_free_tickets(&store_ter);
+    picoquic_free_tickets(&store_empty);
+    picoquic_free_tickets(&store_log);
+    picoquic_free_tickets(&store_log_bis);
+    picoquic_free_tickets(&store_cut);
+    picoquic_free_tickets(&store_bad);
 
     return ret;
 }
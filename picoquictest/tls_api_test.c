@@ -108,6 +108,19 @@ typedef struct st_picoquic_test_tls_api_ctx_t {
     int sum_data_received_at_client;
     int test_finished;
     int reset_received;
+    int use_buffer_api;
+    int nb_buffers_released;
+    size_t nb_bytes_released;
+    int prepare_burst;
+    size_t max_burst_size;
+    int nb_coalesced_datagrams;
+    int nb_short_initial_datagrams;
+    int receive_batch;
+    size_t max_receive_batch_size;
+    uint64_t edt_horizon;
+    int nb_edt_errors;
+    int nb_edt_paced;
+    int nb_edt_unpaced;
 } picoquic_test_tls_api_ctx_t;
 
 static test_api_stream_desc_t test_scenario_oneway[] = {
@@ -268,6 +281,24 @@ static void test_api_receive_stream_data(
     }
 }
 
+static void test_api_release_buffer(void* release_ctx, const uint8_t* data, size_t length)
+{
+    picoquic_test_tls_api_ctx_t* test_ctx = (picoquic_test_tls_api_ctx_t*)release_ctx;
+
+    test_ctx->nb_buffers_released++;
+    test_ctx->nb_bytes_released += length;
+}
+
+static int test_api_add_to_stream(picoquic_test_tls_api_ctx_t* test_ctx, picoquic_cnx_t* cnx,
+    uint64_t stream_id, const uint8_t* data, size_t length)
+{
+    if (test_ctx->use_buffer_api) {
+        return picoquic_add_buffer_to_stream(cnx, stream_id, data, length, 1, NULL, test_api_release_buffer, test_ctx);
+    } else {
+        return picoquic_add_to_stream(cnx, stream_id, data, length, 1);
+    }
+}
+
 static int test_api_queue_initial_queries(picoquic_test_tls_api_ctx_t* test_ctx, uint64_t stream_id)
 {
     int ret = 0;
@@ -279,9 +310,9 @@ static int test_api_queue_initial_queries(picoquic_test_tls_api_ctx_t* test_ctx,
 
             cnx = IS_CLIENT_STREAM_ID(test_ctx->test_stream[i].stream_id) ? test_ctx->cnx_client : test_ctx->cnx_server;
 
-            ret = picoquic_add_to_stream(cnx, test_ctx->test_stream[i].stream_id,
+            ret = test_api_add_to_stream(test_ctx, cnx, test_ctx->test_stream[i].stream_id,
                 test_ctx->test_stream[i].q_src,
-                test_ctx->test_stream[i].q_len, 1);
+                test_ctx->test_stream[i].q_len);
 
             if (ret == 0) {
                 test_ctx->test_stream[i].q_sent = 1;
@@ -378,9 +409,9 @@ static int test_api_callback(picoquic_cnx_t* cnx,
                         stream_finished = fin_or_event;
                     } else if (cb_ctx->error_detected == 0) {
                         /* send a response */
-                        if (picoquic_add_to_stream(ctx->cnx_server, stream_id,
+                        if (test_api_add_to_stream(ctx, ctx->cnx_server, stream_id,
                                 ctx->test_stream[stream_index].r_src,
-                                ctx->test_stream[stream_index].r_len, 1)
+                                ctx->test_stream[stream_index].r_len)
                             != 0) {
                             cb_ctx->error_detected |= test_api_fail_cannot_send_response;
                         }
@@ -404,9 +435,9 @@ static int test_api_callback(picoquic_cnx_t* cnx,
                         stream_finished = fin_or_event;
                     } else if (cb_ctx->error_detected == 0) {
                         /* send a response */
-                        if (picoquic_add_to_stream(ctx->cnx_client, stream_id,
+                        if (test_api_add_to_stream(ctx, ctx->cnx_client, stream_id,
                                 ctx->test_stream[stream_index].r_src,
-                                ctx->test_stream[stream_index].r_len, 1)
+                                ctx->test_stream[stream_index].r_len)
                             != 0) {
                             cb_ctx->error_detected |= test_api_fail_cannot_send_response;
                         }
@@ -697,6 +728,148 @@ static int tls_api_init_ctx(picoquic_test_tls_api_ctx_t** pctx, uint32_t propose
     return ret;
 }
 
+#define PICOQUIC_TEST_BURST_MAX 8
+
+/* Prepare a burst of datagrams with picoquic_prepare_packets and submit them to the link */
+static int tls_api_prepare_burst(picoquic_test_tls_api_ctx_t* test_ctx, picoquic_cnx_t* cnx, uint64_t simulated_time,
+    picoquictest_sim_link_t* target_link, struct sockaddr_in* addr_from, struct sockaddr_in* addr_to, size_t* nb_sent)
+{
+    int ret = 0;
+    picoquictest_sim_packet_t* packets[PICOQUIC_TEST_BURST_MAX];
+    picoquic_prepared_datagram_t datagrams[PICOQUIC_TEST_BURST_MAX];
+    uint64_t last_departure_time = 0;
+
+    *nb_sent = 0;
+
+    for (int i = 0; i < PICOQUIC_TEST_BURST_MAX; i++) {
+        packets[i] = picoquictest_sim_link_create_packet();
+        if (packets[i] == NULL) {
+            ret = -1;
+        } else {
+            datagrams[i].send_buffer = packets[i]->bytes;
+            datagrams[i].send_buffer_max = PICOQUIC_MAX_PACKET_SIZE;
+        }
+    }
+
+    if (ret == 0 && picoquic_prepare_packets(cnx, simulated_time, datagrams, PICOQUIC_TEST_BURST_MAX, 0, nb_sent) != 0) {
+        ret = -1;
+    }
+
+    for (size_t i = 0; i < PICOQUIC_TEST_BURST_MAX; i++) {
+        if (ret == 0 && i < *nb_sent) {
+            uint64_t submit_time = simulated_time;
+
+            if (test_ctx->edt_horizon != 0) {
+                /* Hold the packet until its departure time, as the fq qdisc would.
+                 * Datagrams without paced packets, e.g. pure ACKs, leave now. */
+                if (datagrams[i].departure_time == 0) {
+                    test_ctx->nb_edt_unpaced++;
+                } else {
+                    test_ctx->nb_edt_paced++;
+                    if (datagrams[i].departure_time < last_departure_time) {
+                        test_ctx->nb_edt_errors++;
+                    }
+                    last_departure_time = datagrams[i].departure_time;
+                }
+                if (datagrams[i].departure_time / 1000 > submit_time) {
+                    submit_time = datagrams[i].departure_time / 1000;
+                }
+            }
+            packets[i]->length = datagrams[i].send_length;
+            memcpy(&packets[i]->addr_from, addr_from, sizeof(struct sockaddr_in));
+            memcpy(&packets[i]->addr_to, addr_to, sizeof(struct sockaddr_in));
+            picoquictest_sim_link_submit(target_link, packets[i], submit_time);
+        } else if (packets[i] != NULL) {
+            free(packets[i]);
+        }
+    }
+
+    if (*nb_sent > test_ctx->max_burst_size) {
+        test_ctx->max_burst_size = *nb_sent;
+    }
+
+    return ret;
+}
+
+/* Walk the segments of a datagram before it is delivered, counting coalesced datagrams
+ * and client datagrams carrying an Initial packet below the enforced minimum size */
+static void tls_api_inspect_datagram(picoquic_test_tls_api_ctx_t* test_ctx, picoquic_quic_t* quic,
+    picoquictest_sim_packet_t* packet)
+{
+    size_t byte_index = 0;
+    int nb_segments = 0;
+    int contains_initial = 0;
+
+    while (byte_index < packet->length) {
+        picoquic_packet_header ph;
+        picoquic_cnx_t* pcnx = NULL;
+
+        nb_segments++;
+
+        if (picoquic_parse_packet_header(quic, packet->bytes + byte_index, (uint32_t)(packet->length - byte_index),
+                (struct sockaddr*)&packet->addr_from, &ph, &pcnx, 1) != 0 ||
+            ph.ptype == picoquic_packet_1rtt_protected_phi0 || ph.ptype == picoquic_packet_1rtt_protected_phi1) {
+            break;
+        }
+
+        if (ph.ptype == picoquic_packet_initial) {
+            contains_initial = 1;
+        }
+
+        byte_index += ph.offset + ph.payload_length;
+    }
+
+    if (nb_segments > 1) {
+        test_ctx->nb_coalesced_datagrams++;
+    }
+
+    if (quic == test_ctx->qserver && contains_initial && packet->length < PICOQUIC_ENFORCED_INITIAL_MTU) {
+        test_ctx->nb_short_initial_datagrams++;
+    }
+}
+
+/* Receive the first packet and those that arrive on the same link before the deadline
+ * as a single batch, as a receiver using recvmmsg would */
+static int tls_api_incoming_batch(picoquic_test_tls_api_ctx_t* test_ctx, picoquic_quic_t* quic,
+    picoquictest_sim_link_t* link, picoquictest_sim_packet_t* first_packet, uint64_t deadline, uint64_t* simulated_time)
+{
+    int ret = 0;
+    int new_context_created = 0;
+    picoquictest_sim_packet_t* packets[PICOQUIC_TEST_BURST_MAX];
+    picoquic_received_datagram_t datagrams[PICOQUIC_TEST_BURST_MAX];
+    size_t nb_packets = 1;
+
+    packets[0] = first_packet;
+    while (nb_packets < PICOQUIC_TEST_BURST_MAX &&
+        (packets[nb_packets] = picoquictest_sim_link_dequeue(link, deadline)) != NULL) {
+        *simulated_time = packets[nb_packets]->arrival_time;
+        nb_packets++;
+    }
+
+    for (size_t i = 0; i < nb_packets; i++) {
+        tls_api_inspect_datagram(test_ctx, quic, packets[i]);
+        datagrams[i].bytes = packets[i]->bytes;
+        datagrams[i].length = (uint32_t)packets[i]->length;
+        datagrams[i].addr_from = (struct sockaddr*)&packets[i]->addr_from;
+        datagrams[i].addr_to = (struct sockaddr*)&packets[i]->addr_to;
+        datagrams[i].if_index_to = 0;
+        datagrams[i].arrival_time = 0;
+    }
+
+    ret = picoquic_incoming_packets(quic, datagrams, nb_packets, *simulated_time, &new_context_created);
+
+    /* The first packet is released by the caller */
+    for (size_t i = 1; i < nb_packets; i++) {
+        free(packets[i]);
+    }
+
+    if (nb_packets > test_ctx->max_receive_batch_size) {
+        test_ctx->max_receive_batch_size = nb_packets;
+    }
+
+    return ret;
+}
+
 static int tls_api_one_sim_round(picoquic_test_tls_api_ctx_t* test_ctx,
     uint64_t* simulated_time, int* was_active)
 {
@@ -704,6 +877,7 @@ static int tls_api_one_sim_round(picoquic_test_tls_api_ctx_t* test_ctx,
     int new_context_created = 0;
     picoquictest_sim_link_t* target_link = NULL;
     picoquic_path_t *path;
+    size_t nb_burst = 0;
 
     /* If one of the sources can send a packet, send it, keep time as it */
 
@@ -731,7 +905,16 @@ static int tls_api_one_sim_round(picoquic_test_tls_api_ctx_t* test_ctx,
             picoquic_delete_stateless_packet(sp);
         }
 
-        if (packet->length == 0) {
+        if (packet->length == 0 && test_ctx->prepare_burst) {
+            if (test_ctx->cnx_client->cnx_state != picoquic_state_disconnected) {
+                ret = tls_api_prepare_burst(test_ctx, test_ctx->cnx_client, *simulated_time, test_ctx->c_to_s_link,
+                    &test_ctx->client_addr, &test_ctx->server_addr, &nb_burst);
+            }
+            if (ret == 0 && nb_burst == 0 && test_ctx->cnx_server != NULL && test_ctx->cnx_server->cnx_state != picoquic_state_disconnected) {
+                ret = tls_api_prepare_burst(test_ctx, test_ctx->cnx_server, *simulated_time, test_ctx->s_to_c_link,
+                    &test_ctx->server_addr, &test_ctx->client_addr, &nb_burst);
+            }
+        } else if (packet->length == 0) {
             /* check whether the client has something to send */
             if (test_ctx->cnx_client->cnx_state != picoquic_state_disconnected) {
                 ret = picoquic_prepare_packet(test_ctx->cnx_client, *simulated_time,
@@ -771,7 +954,10 @@ static int tls_api_one_sim_round(picoquic_test_tls_api_ctx_t* test_ctx,
             }
         }
 
-        if (packet->length > 0 && ret == 0) {
+        if (nb_burst > 0) {
+            free(packet);
+            *was_active |= 1;
+        } else if (packet->length > 0 && ret == 0) {
             picoquictest_sim_link_submit(target_link, packet, *simulated_time);
             *was_active |= 1;
         } else {
@@ -798,13 +984,20 @@ static int tls_api_one_sim_round(picoquic_test_tls_api_ctx_t* test_ctx,
             server_arrival = picoquictest_sim_link_next_arrival(test_ctx->c_to_s_link, next_time);
 
             if (client_arrival < server_arrival && client_arrival < next_time && (packet = picoquictest_sim_link_dequeue(test_ctx->s_to_c_link, client_arrival)) != NULL) {
+                uint64_t batch_deadline = (server_arrival < next_time) ? server_arrival : next_time;
+
                 next_time = client_arrival;
                 *simulated_time = next_time;
 
                 /* Check the destination address  before submitting the packet */
                 /* TODO: better test when testing more than NAT rebinding. */
-                if (picoquic_compare_addr((struct sockaddr *)&test_ctx->client_addr,
+                if (test_ctx->receive_batch) {
+                    ret = tls_api_incoming_batch(test_ctx, test_ctx->qclient, test_ctx->s_to_c_link, packet,
+                        batch_deadline, simulated_time);
+                    *was_active |= 1;
+                } else if (picoquic_compare_addr((struct sockaddr *)&test_ctx->client_addr,
                     (struct sockaddr *)&packet->addr_to) == 0) {
+                    tls_api_inspect_datagram(test_ctx, test_ctx->qclient, packet);
                     ret = picoquic_incoming_packet(test_ctx->qclient, packet->bytes, (uint32_t)packet->length,
                         (struct sockaddr*)&packet->addr_from,
                         (struct sockaddr*)&packet->addr_to, 0,
@@ -820,14 +1013,19 @@ static int tls_api_one_sim_round(picoquic_test_tls_api_ctx_t* test_ctx,
 
                 free(packet);
             } else if (server_arrival < next_time && (packet = picoquictest_sim_link_dequeue(test_ctx->c_to_s_link, server_arrival)) != NULL) {
+                uint64_t batch_deadline = (client_arrival < next_time) ? client_arrival : next_time;
 
                 next_time = server_arrival;
                 *simulated_time = next_time;
 
                 /* Check the destination address  before submitting the packet */
                 /* TODO: better test when testing more than NAT rebinding. */
-                if (picoquic_compare_addr((struct sockaddr *)&test_ctx->server_addr,
+                if (test_ctx->receive_batch) {
+                    ret = tls_api_incoming_batch(test_ctx, test_ctx->qserver, test_ctx->c_to_s_link, packet,
+                        batch_deadline, simulated_time);
+                } else if (picoquic_compare_addr((struct sockaddr *)&test_ctx->server_addr,
                     (struct sockaddr *)&packet->addr_to) == 0) {
+                    tls_api_inspect_datagram(test_ctx, test_ctx->qserver, packet);
                     ret = picoquic_incoming_packet(test_ctx->qserver, packet->bytes, (uint32_t)packet->length,
                         (struct sockaddr*)&packet->addr_from,
                         (struct sockaddr*)&packet->addr_to, 0,
@@ -1349,6 +1547,219 @@ int tls_api_very_long_congestion_test()
     return tls_api_one_scenario_test(test_scenario_very_long, sizeof(test_scenario_very_long), 0, 128000, 20000, 0, 7000000, NULL, NULL);
 }
 
+/*
+ * Same as the sustained scenario, but the queries and responses are queued
+ * as application buffers, without copy. Verify that each buffer is handed
+ * back exactly once, after the data was acknowledged. With losses, the lost
+ * data is sent again from the application buffers.
+ */
+static int zero_copy_send_one_test(uint64_t data_loss_mask)
+{
+    uint64_t simulated_time = 0;
+    uint64_t loss_mask = 0;
+    size_t nb_buffers = 0;
+    size_t nb_bytes = 0;
+    picoquic_test_tls_api_ctx_t* test_ctx = NULL;
+    int ret = tls_api_init_ctx(&test_ctx, PICOQUIC_INTERNAL_TEST_VERSION_1,
+        PICOQUIC_TEST_SNI, PICOQUIC_TEST_ALPN, &simulated_time, NULL, 0, 1, 0);
+
+    if (ret == 0) {
+        test_ctx->use_buffer_api = 1;
+        ret = picoquic_start_client_cnx(test_ctx->cnx_client);
+    }
+
+    if (ret == 0) {
+        ret = tls_api_connection_loop(test_ctx, &loss_mask, 0, &simulated_time);
+    }
+
+    if (ret == 0) {
+        ret = test_api_init_send_recv_scenario(test_ctx, test_scenario_sustained, sizeof(test_scenario_sustained));
+    }
+
+    if (ret == 0) {
+        /* An empty buffer is not queued, it is handed back at once */
+        ret = picoquic_add_buffer_to_stream(test_ctx->cnx_client, test_ctx->test_stream[0].stream_id,
+            test_ctx->test_stream[0].q_src, 0, 0, NULL, test_api_release_buffer, test_ctx);
+        if (ret == 0 && test_ctx->nb_buffers_released != 1) {
+            DBG_PRINTF("%s\n", "The empty buffer was not released");
+            ret = -1;
+        }
+        nb_buffers++;
+    }
+
+    if (ret == 0) {
+        loss_mask = data_loss_mask;
+        ret = tls_api_data_sending_loop(test_ctx, &loss_mask, &simulated_time, 0);
+    }
+
+    if (ret == 0 && data_loss_mask != 0 &&
+        test_ctx->cnx_client->nb_retransmission_total + test_ctx->cnx_server->nb_retransmission_total == 0) {
+        DBG_PRINTF("%s\n", "No retransmission, the losses were not exercised");
+        ret = -1;
+    }
+
+    if (ret == 0 && data_loss_mask != 0 &&
+        test_ctx->cnx_client->nb_stream_bytes_repeated + test_ctx->cnx_server->nb_stream_bytes_repeated == 0) {
+        DBG_PRINTF("%s\n", "The lost stream data was not sent again from the sent queues");
+        ret = -1;
+    }
+
+    /* Everything was acknowledged, nothing is left to repeat */
+    for (int c = 0; ret == 0 && c < 2; c++) {
+        picoquic_stream_head* stream = (c == 0) ? test_ctx->cnx_client->first_stream : test_ctx->cnx_server->first_stream;
+
+        while (ret == 0 && stream != NULL) {
+            if (stream->sent_queue != NULL || stream->nb_lost_ranges != 0) {
+                DBG_PRINTF("Stream %d of the %s still has sent data\n", (int)stream->stream_id, (c == 0) ? "client" : "server");
+                ret = -1;
+            }
+            stream = stream->next_stream;
+        }
+    }
+
+    if (ret == 0) {
+        if (test_ctx->server_callback.error_detected || test_ctx->client_callback.error_detected) {
+            ret = -1;
+        }
+
+        for (size_t i = 0; ret == 0 && i < test_ctx->nb_test_streams; i++) {
+            if (test_ctx->test_stream[i].q_recv_nb != test_ctx->test_stream[i].q_len ||
+                test_ctx->test_stream[i].r_recv_nb != test_ctx->test_stream[i].r_len) {
+                ret = -1;
+            } else if (memcmp(test_ctx->test_stream[i].q_rcv, test_ctx->test_stream[i].q_src, test_ctx->test_stream[i].q_len) != 0 ||
+                memcmp(test_ctx->test_stream[i].r_rcv, test_ctx->test_stream[i].r_src, test_ctx->test_stream[i].r_len) != 0) {
+                DBG_PRINTF("Data received on stream %d differs from the data sent\n", (int)test_ctx->test_stream[i].stream_id);
+                ret = -1;
+            } else {
+                nb_buffers += 2;
+                nb_bytes += test_ctx->test_stream[i].q_len + test_ctx->test_stream[i].r_len;
+            }
+        }
+    }
+
+    if (ret == 0 && (test_ctx->nb_buffers_released != (int)nb_buffers || test_ctx->nb_bytes_released != nb_bytes)) {
+        DBG_PRINTF("Released %d buffers, %d bytes, expected %d, %d\n", test_ctx->nb_buffers_released,
+            (int)test_ctx->nb_bytes_released, (int)nb_buffers, (int)nb_bytes);
+        ret = -1;
+    }
+
+    if (test_ctx != NULL) {
+        tls_api_delete_ctx(test_ctx);
+        test_ctx = NULL;
+    }
+
+    return ret;
+}
+
+int zero_copy_send_test()
+{
+    return zero_copy_send_one_test(0);
+}
+
+int zero_copy_send_loss_test()
+{
+    return zero_copy_send_one_test(0x0000400800100040ull);
+}
+
+/*
+ * Transfer data with both ends preparing bursts of datagrams, or receiving
+ * batches of datagrams, and verify that bursts or batches of more than one
+ * datagram were actually produced. With EDT pacing, also verify that each
+ * datagram carries a departure time.
+ */
+static int tls_api_batch_test_one(int prepare_burst, int receive_batch, uint64_t edt_horizon)
+{
+    uint64_t simulated_time = 0;
+    uint64_t loss_mask = 0;
+    picoquic_test_tls_api_ctx_t* test_ctx = NULL;
+    int ret = tls_api_init_ctx(&test_ctx, PICOQUIC_INTERNAL_TEST_VERSION_1,
+        PICOQUIC_TEST_SNI, PICOQUIC_TEST_ALPN, &simulated_time, NULL, 0, 1, 0);
+
+    if (ret == 0) {
+        test_ctx->prepare_burst = prepare_burst;
+        test_ctx->receive_batch = receive_batch;
+        test_ctx->edt_horizon = edt_horizon;
+        if (edt_horizon != 0) {
+            /* The client path was created with the context, set its horizon too */
+            picoquic_set_edt_pacing(test_ctx->qclient, edt_horizon);
+            picoquic_set_edt_pacing(test_ctx->qserver, edt_horizon);
+            test_ctx->cnx_client->path[0]->pacing_edt_horizon = edt_horizon;
+        }
+        ret = picoquic_start_client_cnx(test_ctx->cnx_client);
+    }
+
+    if (ret == 0) {
+        ret = tls_api_connection_loop(test_ctx, &loss_mask, 0, &simulated_time);
+    }
+
+    if (ret == 0) {
+        ret = test_api_init_send_recv_scenario(test_ctx, test_scenario_sustained, sizeof(test_scenario_sustained));
+    }
+
+    if (ret == 0) {
+        ret = tls_api_data_sending_loop(test_ctx, &loss_mask, &simulated_time, 0);
+    }
+
+    if (ret == 0) {
+        if (test_ctx->server_callback.error_detected || test_ctx->client_callback.error_detected) {
+            ret = -1;
+        }
+
+        for (size_t i = 0; ret == 0 && i < test_ctx->nb_test_streams; i++) {
+            if (test_ctx->test_stream[i].q_recv_nb != test_ctx->test_stream[i].q_len ||
+                test_ctx->test_stream[i].r_recv_nb != test_ctx->test_stream[i].r_len) {
+                ret = -1;
+            }
+        }
+    }
+
+    if (ret == 0 && prepare_burst && test_ctx->max_burst_size <= 1) {
+        DBG_PRINTF("Largest burst has %d datagrams\n", (int)test_ctx->max_burst_size);
+        ret = -1;
+    }
+
+    if (ret == 0 && receive_batch && test_ctx->max_receive_batch_size <= 1) {
+        DBG_PRINTF("Largest received batch has %d datagrams\n", (int)test_ctx->max_receive_batch_size);
+        ret = -1;
+    }
+
+    if (ret == 0 && test_ctx->nb_edt_errors != 0) {
+        DBG_PRINTF("%d datagrams with decreasing departure times\n", test_ctx->nb_edt_errors);
+        ret = -1;
+    }
+
+    if (ret == 0 && edt_horizon != 0 && (test_ctx->nb_edt_paced == 0 || test_ctx->nb_edt_unpaced == 0)) {
+        DBG_PRINTF("%d paced and %d unpaced datagrams, expected both\n", test_ctx->nb_edt_paced, test_ctx->nb_edt_unpaced);
+        ret = -1;
+    }
+
+    if (ret == 0) {
+        ret = tls_api_attempt_to_close(test_ctx, &simulated_time);
+    }
+
+    if (test_ctx != NULL) {
+        tls_api_delete_ctx(test_ctx);
+        test_ctx = NULL;
+    }
+
+    return ret;
+}
+
+int prepare_packets_test()
+{
+    return tls_api_batch_test_one(1, 0, 0);
+}
+
+int incoming_packets_test()
+{
+    return tls_api_batch_test_one(1, 1, 0);
+}
+
+int edt_pacing_test()
+{
+    return tls_api_batch_test_one(1, 0, 1000);
+}
+
 int unidir_test()
 {
     return tls_api_one_scenario_test(test_scenario_unidir, sizeof(test_scenario_unidir), 0, 128000, 10000, 0, 100000, NULL, NULL);
@@ -1615,6 +2026,65 @@ int tls_api_server_losses_test()
     return tls_api_loss_test(6ull);
 }
 
+/*
+ * Run the handshake over a long delay link, with and without losses, and verify that
+ * the handshake flights are coalesced and that every client datagram carrying an
+ * Initial packet is padded to the enforced minimum size.
+ */
+static int coalesced_handshake_test_one(uint64_t init_loss_mask)
+{
+    uint64_t simulated_time = 0;
+    uint64_t loss_mask = init_loss_mask;
+    picoquic_test_tls_api_ctx_t* test_ctx = NULL;
+    int ret = tls_api_init_ctx(&test_ctx, 0, PICOQUIC_TEST_SNI, PICOQUIC_TEST_ALPN, &simulated_time, NULL, 0, 0, 0);
+
+    if (ret == 0) {
+        test_ctx->c_to_s_link->microsec_latency = 100000ull;
+        test_ctx->s_to_c_link->microsec_latency = 100000ull;
+
+        ret = tls_api_connection_loop(test_ctx, &loss_mask, 0, &simulated_time);
+    }
+
+    if (ret == 0 && (test_ctx->cnx_client->cnx_state != picoquic_state_client_ready ||
+        test_ctx->cnx_server == NULL || test_ctx->cnx_server->cnx_state != picoquic_state_server_ready)) {
+        DBG_PRINTF("Handshake did not complete, loss mask 0x%llx\n", (unsigned long long)init_loss_mask);
+        ret = -1;
+    }
+
+    if (ret == 0 && test_ctx->nb_coalesced_datagrams == 0) {
+        DBG_PRINTF("%s", "No coalesced datagram received during the handshake\n");
+        ret = -1;
+    }
+
+    if (ret == 0 && test_ctx->nb_short_initial_datagrams != 0) {
+        DBG_PRINTF("%d client datagrams with Initial packets shorter than %d\n",
+            test_ctx->nb_short_initial_datagrams, PICOQUIC_ENFORCED_INITIAL_MTU);
+        ret = -1;
+    }
+
+    if (ret == 0) {
+        ret = tls_api_attempt_to_close(test_ctx, &simulated_time);
+    }
+
+    if (test_ctx != NULL) {
+        tls_api_delete_ctx(test_ctx);
+    }
+
+    return ret;
+}
+
+int coalesced_handshake_test()
+{
+    uint64_t loss_masks[] = { 0, 2ull, 5ull, 12ull };
+    int ret = 0;
+
+    for (size_t i = 0; ret == 0 && i < sizeof(loss_masks) / sizeof(uint64_t); i++) {
+        ret = coalesced_handshake_test_one(loss_masks[i]);
+    }
+
+    return ret;
+}
+
 /*
  * Do a simple test for all supported versions
  */
@@ -1731,7 +2201,7 @@ int session_resume_wait_for_ticket(picoquic_test_tls_api_ctx_t* test_ctx,
     while (*simulated_time <time_out &&
         test_ctx->cnx_client->cnx_state == picoquic_state_client_ready &&
         test_ctx->cnx_server->cnx_state == picoquic_state_server_ready &&
-        test_ctx->qclient->p_first_ticket == NULL &&
+        test_ctx->qclient->ticket_store.p_first_ticket == NULL &&
         nb_trials < 1024 &&
         nb_inactive < 64 &&
         ret == 0){
@@ -1751,13 +2221,14 @@ int session_resume_wait_for_ticket(picoquic_test_tls_api_ctx_t* test_ctx,
     return ret;
 }
 
-int session_resume_test()
+static int session_resume_test_one(int nb_key_rotations)
 {
     uint64_t simulated_time = 0;
     picoquic_test_tls_api_ctx_t* test_ctx = NULL;
     char const* sni = PICOQUIC_TEST_SNI;
     char const* alpn = PICOQUIC_TEST_ALPN;
     uint64_t loss_mask = 0;
+    int expect_psk = nb_key_rotations < PICOQUIC_TICKET_KEY_RING_SIZE;
     int ret = 0;
 
     /* Initialize an empty ticket store */
@@ -1773,13 +2244,18 @@ int session_resume_test()
             test_ctx->cnx_client->max_early_data_size = 0;
         }
 
+        for (int k = 0; ret == 0 && i == 1 && k < nb_key_rotations; k++) {
+            ret = picoquic_rotate_ticket_key(test_ctx->qserver, NULL, 0);
+        }
+
         if (ret == 0) {
             ret = tls_api_connection_loop(test_ctx, &loss_mask, 0, &simulated_time);
         }
 
         if (ret == 0 && i == 1) {
             /* If resume succeeded, the second connection will have a type "PSK" */
-            if (picoquic_tls_is_psk_handshake(test_ctx->cnx_server) == 0 || picoquic_tls_is_psk_handshake(test_ctx->cnx_client) == 0) {
+            if ((picoquic_tls_is_psk_handshake(test_ctx->cnx_server) != 0) != expect_psk ||
+                (picoquic_tls_is_psk_handshake(test_ctx->cnx_client) != 0) != expect_psk) {
                 ret = -1;
             }
         }
@@ -1795,10 +2271,10 @@ int session_resume_test()
 
         /* Verify that the session ticket has been received correctly */
         if (ret == 0) {
-            if (test_ctx->qclient->p_first_ticket == NULL) {
+            if (test_ctx->qclient->ticket_store.p_first_ticket == NULL) {
                 ret = -1;
             } else {
-                ret = picoquic_save_tickets(test_ctx->qclient->p_first_ticket, simulated_time, ticket_file_name);
+                ret = picoquic_save_tickets(&test_ctx->qclient->ticket_store, simulated_time, ticket_file_name);
             }
         }
         /* Tear down and free everything */
@@ -1812,6 +2288,27 @@ int session_resume_test()
     return ret;
 }
 
+int session_resume_test()
+{
+    return session_resume_test_one(0);
+}
+
+/*
+ * Ticket key rotation test. Tickets encrypted with a previous key are accepted
+ * until the key leaves the ring of decryption keys.
+ */
+
+int ticket_key_rotation_test()
+{
+    int ret = session_resume_test_one(1);
+
+    if (ret == 0) {
+        ret = session_resume_test_one(PICOQUIC_TICKET_KEY_RING_SIZE);
+    }
+
+    return ret;
+}
+
 /*
  * Zero RTT test. Like the session resume test, but with a twist...
  */
@@ -1948,12 +2445,12 @@ int zero_rtt_test_one(int use_badcrypt, int hardreset, unsigned int early_loss)
 
         /* Verify that the session ticket has been received correctly */
         if (ret == 0) {
-            if (test_ctx->qclient->p_first_ticket == NULL) {
+            if (test_ctx->qclient->ticket_store.p_first_ticket == NULL) {
                 DBG_PRINTF("Zero RTT test (badcrypt: %d, hard: %d), cnx %d, no ticket received.\n",
                     use_badcrypt, hardreset, i);
                 ret = -1;
             } else {
-                ret = picoquic_save_tickets(test_ctx->qclient->p_first_ticket, simulated_time, ticket_file_name);
+                ret = picoquic_save_tickets(&test_ctx->qclient->ticket_store, simulated_time, ticket_file_name);
                 if (ret != 0)
                     DBG_PRINTF("Zero RTT test (badcrypt: %d, hard: %d), cnx %d, ticket save error (0x%x).\n",
                                use_badcrypt, hardreset, i, ret);
@@ -2027,6 +2524,115 @@ int zero_rtt_retry_test()
     return zero_rtt_test_one(0, 1, 0);
 }
 
+/*
+ * Zero RTT replay test. The client resumes twice with the same ticket and early
+ * data against the same server. The early data is accepted the first time. The
+ * server's anti-replay filter rejects it the second time, but the session is
+ * still resumed.
+ */
+int zero_rtt_replay_test()
+{
+    uint64_t simulated_time = 0;
+    uint64_t loss_mask = 0;
+    picoquic_test_tls_api_ctx_t* test_ctx = NULL;
+    uint8_t* ticket = NULL;
+    uint16_t ticket_length = 0;
+    int ret = tls_api_init_ctx(&test_ctx, 0, PICOQUIC_TEST_SNI, PICOQUIC_TEST_ALPN, &simulated_time, NULL, 0, 0, 0);
+
+    if (ret == 0) {
+        ret = tls_api_connection_loop(test_ctx, &loss_mask, 0, &simulated_time);
+    }
+
+    if (ret == 0) {
+        ret = session_resume_wait_for_ticket(test_ctx, &simulated_time);
+    }
+
+    if (ret == 0) {
+        picoquic_stored_ticket_t* stored = test_ctx->qclient->ticket_store.p_first_ticket;
+
+        if (stored == NULL || (ticket = (uint8_t*)malloc(stored->ticket_length)) == NULL) {
+            DBG_PRINTF("%s", "No ticket received\n");
+            ret = -1;
+        } else {
+            memcpy(ticket, stored->ticket, stored->ticket_length);
+            ticket_length = stored->ticket_length;
+        }
+    }
+
+    if (ret == 0) {
+        ret = tls_api_attempt_to_close(test_ctx, &simulated_time);
+    }
+
+    for (int i = 0; ret == 0 && i < 2; i++) {
+        uint8_t test_data[8] = { 't', 'e', 's', 't', '0', 'r', 't', 't' };
+        int data_received_before = test_ctx->sum_data_received_at_server;
+
+        /* Replace the tickets received since by the first one */
+        ret = picoquic_store_ticket(&test_ctx->qclient->ticket_store, simulated_time,
+            PICOQUIC_TEST_SNI, (uint16_t)strlen(PICOQUIC_TEST_SNI),
+            PICOQUIC_TEST_ALPN, (uint16_t)strlen(PICOQUIC_TEST_ALPN), ticket, ticket_length);
+
+        if (ret == 0) {
+            while (test_ctx->qclient->cnx_list != NULL) {
+                picoquic_delete_cnx(test_ctx->qclient->cnx_list);
+            }
+            test_ctx->cnx_server = NULL;
+
+            test_ctx->cnx_client = picoquic_create_cnx(test_ctx->qclient,
+                picoquic_null_connection_id, picoquic_null_connection_id,
+                (struct sockaddr*)&test_ctx->server_addr, simulated_time, 0, PICOQUIC_TEST_SNI, PICOQUIC_TEST_ALPN, 1);
+
+            if (test_ctx->cnx_client == NULL) {
+                ret = -1;
+            } else {
+                (void)picoquic_add_to_stream(test_ctx->cnx_client, 0, test_data, sizeof(test_data), 1);
+                ret = picoquic_start_client_cnx(test_ctx->cnx_client);
+            }
+        }
+
+        if (ret == 0) {
+            ret = tls_api_connection_loop(test_ctx, &loss_mask, 0, &simulated_time);
+        }
+
+        if (ret == 0 && (picoquic_tls_is_psk_handshake(test_ctx->cnx_server) == 0 ||
+            picoquic_tls_is_psk_handshake(test_ctx->cnx_client) == 0)) {
+            DBG_PRINTF("Zero RTT replay test, attempt %d not PSK.\n", i);
+            ret = -1;
+        }
+
+        if (ret == 0) {
+            ret = tls_api_attempt_to_close(test_ctx, &simulated_time);
+        }
+
+        if (ret == 0) {
+            if (test_ctx->cnx_client->nb_zero_rtt_sent == 0) {
+                DBG_PRINTF("Zero RTT replay test, attempt %d, no zero RTT sent.\n", i);
+                ret = -1;
+            } else if (i == 0 && test_ctx->cnx_client->nb_zero_rtt_acked != test_ctx->cnx_client->nb_zero_rtt_sent) {
+                DBG_PRINTF("%s", "Zero RTT replay test, early data of the first use not accepted.\n");
+                ret = -1;
+            } else if (i == 1 && test_ctx->cnx_client->nb_zero_rtt_acked != 0) {
+                DBG_PRINTF("%s", "Zero RTT replay test, early data of the replay accepted.\n");
+                ret = -1;
+            } else if (test_ctx->sum_data_received_at_server == data_received_before) {
+                DBG_PRINTF("Zero RTT replay test, attempt %d, no data received.\n", i);
+                ret = -1;
+            }
+        }
+    }
+
+    if (ticket != NULL) {
+        free(ticket);
+    }
+
+    if (test_ctx != NULL) {
+        tls_api_delete_ctx(test_ctx);
+        test_ctx = NULL;
+    }
+
+    return ret;
+}
+
 /*
  * Stop sending test. Start a long transmission, but after receiving some bytes,
  * send a stop sending request. Then ask for another transmission. The
@@ -2811,6 +3417,25 @@ int virtual_time_test()
                 }
             }
         }
+        /* Check that the stamped time is used until the next stamp */
+        if (ret == 0) {
+            uint64_t stamped_time = picoquic_stamp_time(qdirect);
+#ifdef _WINDOWS
+            Sleep(1);
+#else
+            usleep(1000);
+#endif
+            test_time = picoquic_get_quic_time(qdirect);
+            if (test_time != stamped_time) {
+                DBG_PRINTF("Test time: %" PRIu64 " != stamped time: %" PRIu64,
+                    test_time,
+                    stamped_time);
+                ret = -1;
+            } else if (picoquic_stamp_time(qdirect) <= stamped_time) {
+                DBG_PRINTF("Stamped time did not progress after: %" PRIu64, stamped_time);
+                ret = -1;
+            }
+        }
     }
 
     if (qsimul != NULL)
@@ -3336,3 +3961,87 @@ int cubic_test()
 
     return ret;
 }
+
+/*
+ * Run the long scenario over a link with a shallow buffer, using the BBRv2
+ * congestion control on both sides. The buffer overflows when the sender
+ * probes for bandwidth, which must set the loss based inflight_hi bound.
+ */
+int bbr2_test()
+{
+    uint64_t simulated_time = 0;
+    uint64_t loss_mask = 0;
+    picoquic_test_tls_api_ctx_t* test_ctx = NULL;
+    int ret = tls_api_init_ctx(&test_ctx, PICOQUIC_INTERNAL_TEST_VERSION_1, PICOQUIC_TEST_SNI, PICOQUIC_TEST_ALPN, &simulated_time, NULL, 0, 1, 0);
+
+    if (ret == 0 && test_ctx == NULL) {
+        ret = -1;
+    }
+
+    if (ret == 0) {
+        picoquic_set_default_congestion_algorithm(test_ctx->qserver, picoquic_bbr2_algorithm);
+        picoquic_set_congestion_algorithm(test_ctx->cnx_client, picoquic_bbr2_algorithm);
+
+        ret = picoquic_start_client_cnx(test_ctx->cnx_client);
+    }
+
+    if (ret == 0) {
+        ret = tls_api_connection_loop(test_ctx, &loss_mask, 5000, &simulated_time);
+    }
+
+    if (ret == 0 && (test_ctx->cnx_server == NULL ||
+        test_ctx->cnx_server->congestion_alg != picoquic_bbr2_algorithm ||
+        test_ctx->cnx_client->congestion_alg != picoquic_bbr2_algorithm)) {
+        DBG_PRINTF("%s", "BBRv2 is not selected on both connections\n");
+        ret = -1;
+    }
+
+    if (ret == 0) {
+        ret = test_api_init_send_recv_scenario(test_ctx, test_scenario_very_long, sizeof(test_scenario_very_long));
+    }
+
+    if (ret == 0) {
+        ret = tls_api_data_sending_loop(test_ctx, &loss_mask, &simulated_time, 0);
+    }
+
+    if (ret == 0) {
+        if (test_ctx->server_callback.error_detected || test_ctx->client_callback.error_detected) {
+            ret = -1;
+        }
+
+        for (size_t i = 0; ret == 0 && i < test_ctx->nb_test_streams; i++) {
+            if (test_ctx->test_stream[i].q_recv_nb != test_ctx->test_stream[i].q_len ||
+                test_ctx->test_stream[i].r_recv_nb != test_ctx->test_stream[i].r_len) {
+                ret = -1;
+            }
+        }
+    }
+
+    if (ret == 0 && simulated_time > 2000000) {
+        DBG_PRINTF("Scenario completes in %" PRIu64 " microsec, more than %" PRIu64 "\n", simulated_time, (uint64_t)2000000);
+        ret = -1;
+    }
+
+    /* The server sends the bulk of the data, its link must have dropped packets
+     * and its sender must have set the long term bound from these losses */
+    if (ret == 0 && test_ctx->s_to_c_link->packets_dropped == 0) {
+        DBG_PRINTF("%s", "No packet dropped by the shallow buffer\n");
+        ret = -1;
+    }
+
+    if (ret == 0 && picoquic_bbr2_get_inflight_hi(test_ctx->cnx_server, test_ctx->cnx_server->path[0]) == UINT64_MAX) {
+        DBG_PRINTF("%s", "BBRv2 did not set inflight_hi after losses\n");
+        ret = -1;
+    }
+
+    if (ret == 0) {
+        ret = tls_api_attempt_to_close(test_ctx, &simulated_time);
+    }
+
+    if (test_ctx != NULL) {
+        tls_api_delete_ctx(test_ctx);
+        test_ctx = NULL;
+    }
+
+    return ret;
+}
@@ -124,7 +124,7 @@ static __attribute__((always_inline)) protoop_arg_t send_datagram_to_application
 
 static __attribute__((always_inline)) void dump_buffer(datagram_memory_t *m, picoquic_cnx_t *cnx) {
     received_datagram_t *r = m->datagram_buffer;
-    uint64_t now = picoquic_current_time();
+    uint64_t now = picoquic_get_quic_time_for_cnx(cnx);
     while (r != NULL) {
         PROTOOP_PRINTF(cnx, "{%d, d=%" PRIu64 ", n=%p} ", r->datagram->datagram_id, r->delivery_deadline < now ? 0 : r->delivery_deadline - now, (protoop_arg_t) r->next);
         r = r->next;
@@ -151,7 +151,7 @@ static __attribute__((always_inline)) void insert_into_datagram_buffer(datagram_
 
 static __attribute__((always_inline)) void process_datagram_buffer(datagram_memory_t *m, picoquic_cnx_t *cnx) {
     received_datagram_t *r = m->datagram_buffer;
-    uint64_t now = picoquic_current_time();
+    uint64_t now = picoquic_get_quic_time_for_cnx(cnx);
 
     while (r != NULL) {
         if (r->delivery_deadline < now || m->expected_datagram_id >= r->datagram->datagram_id) {
@@ -17,7 +17,7 @@ protoop_arg_t process_ecn_block(picoquic_cnx_t *cnx) {
         cnts->ecn_ect0_remote_pkts = block->ect0;
         cnts->ecn_ect1_remote_pkts = block->ect1;
         if (block->ectce > cnts->ecn_ect_ce_remote_pkts) {
-            helper_congestion_algorithm_notify(cnx, path, picoquic_congestion_notification_congestion_experienced, 0, 0, 0, picoquic_current_time());
+            helper_congestion_algorithm_notify(cnx, path, picoquic_congestion_notification_congestion_experienced, 0, 0, 0, picoquic_get_quic_time_for_cnx(cnx));
         }
         cnts->ecn_ect_ce_remote_pkts = block->ectce;
     }
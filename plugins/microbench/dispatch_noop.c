@@ -0,0 +1,6 @@
+#include "../helpers.h"
+
+/* Empty replace pluglet, used to measure the cost of dispatching to eBPF code */
+protoop_arg_t dispatch_noop(picoquic_cnx_t *cnx) {
+    return 0;
+}
@@ -0,0 +1,6 @@
+#include "../helpers.h"
+
+/* Empty pre/post pluglet, plugged a variable number of times by the dispatch benchmark */
+protoop_arg_t dispatch_observer(picoquic_cnx_t *cnx) {
+    return 0;
+}
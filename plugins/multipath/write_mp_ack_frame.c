@@ -11,7 +11,7 @@ protoop_arg_t write_mp_ack_frame(picoquic_cnx_t *cnx)
     
     size_t consumed = 0;
     
-    uint64_t current_time = picoquic_current_time();
+    uint64_t current_time = picoquic_get_quic_time_for_cnx(cnx);
     picoquic_path_t *path_x = mac->path_x;
     picoquic_packet_context_enum pc = mac->pc;
 
@@ -83,7 +83,7 @@ protoop_arg_t write_mp_new_connection_id_frame(picoquic_cnx_t* cnx)
 
         if (u->state < uniflow_active) {
             /* Now that we sent the MP NEW CONNECTION ID frame, we should be active to receive packets */
-            mp_receiving_uniflow_active(cnx, u, picoquic_current_time());
+            mp_receiving_uniflow_active(cnx, u, picoquic_get_quic_time_for_cnx(cnx));
         }
     }
 
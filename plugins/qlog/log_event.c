@@ -7,7 +7,7 @@
  */
 protoop_arg_t log_event(picoquic_cnx_t *cnx) {
     qlog_t *qlog = get_qlog_t(cnx);
-    uint64_t now = picoquic_current_time();
+    uint64_t now = picoquic_get_quic_time_for_cnx(cnx);
     char *fields[QLOG_N_EVENT_FIELDS - 1];
     for (int i = 0; i < QLOG_N_EVENT_FIELDS - 1; i++) {
         fields[i] = (char *) get_cnx(cnx, AK_CNX_INPUT, i);
@@ -21,6 +21,15 @@ protoop_arg_t schedule_next_stream(picoquic_cnx_t *cnx) {
 
     PROTOOP_PRINTF(cnx, "first_stream: %p, last_stream_id: %" PRIu64 "\n", (protoop_arg_t) stream, *last_stream_id);
 
+    /* Lost data is repeated first, it is not subject to flow control */
+    picoquic_stream_head *lost_stream = stream;
+    while (lost_stream) {
+        if (get_stream_head(lost_stream, AK_STREAMHEAD_NB_LOST_RANGES) > 0) {
+            return (protoop_arg_t) lost_stream;
+        }
+        lost_stream = (picoquic_stream_head *) get_stream_head(lost_stream, AK_STREAMHEAD_NEXT_STREAM);
+    }
+
     if (cnx_maxdata_remote > cnx_data_sent) {
         while (stream && (stream = (picoquic_stream_head *) get_stream_head(stream, AK_STREAMHEAD_NEXT_STREAM))) {
             if (get_stream_head(stream, AK_STREAMHEAD_STREAM_ID) >= *last_stream_id) {